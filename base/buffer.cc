@@ -60,6 +60,12 @@ Buffer& Buffer::Append(const char* data, size_t size) {
   return *this;
 }
 
+void Buffer::Clear() { data_.clear(); }
+
+void Buffer::Reserve(size_t size) { data_.reserve(size); }
+
+size_t Buffer::Capacity() const { return data_.capacity(); }
+
 void Buffer::swap(Buffer& other) {
   using std::swap;
   swap(this->data_, other.data_);
@@ -0,0 +1,63 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include <stdint.h>
+#include <string>
+#include "enquery/benchmark.h"
+#include "enquery/buffer.h"
+
+using ::enquery::Buffer;
+using ::enquery::BenchmarkState;
+using ::enquery::DoNotOptimize;
+
+namespace {
+
+// Appends go to a fresh buffer every kAppendsPerBuffer calls, so that
+// growth (reallocation and copying) is included at a realistic rate.
+const uint64_t kAppendsPerBuffer = 1024;
+
+void AppendPieces(BenchmarkState* state, size_t piece_size) {
+  static const char kData[4096] = {0};
+  Buffer buffer;
+  for (uint64_t i = 0; i < state->iterations(); ++i) {
+    if (i % kAppendsPerBuffer == 0) {
+      Buffer().swap(buffer);
+    }
+    buffer.Append(kData, piece_size);
+  }
+  DoNotOptimize(buffer);
+}
+
+void BM_BufferAppend16(BenchmarkState* state) { AppendPieces(state, 16); }
+ENQUERY_BENCHMARK(BM_BufferAppend16);
+
+void BM_BufferAppend512(BenchmarkState* state) { AppendPieces(state, 512); }
+ENQUERY_BENCHMARK(BM_BufferAppend512);
+
+void BM_BufferAppend4096(BenchmarkState* state) { AppendPieces(state, 4096); }
+ENQUERY_BENCHMARK(BM_BufferAppend4096);
+
+void BM_BufferCopy4096(BenchmarkState* state) {
+  Buffer source(std::string(4096, 'x'));
+  for (uint64_t i = 0; i < state->iterations(); ++i) {
+    Buffer copy(source);
+    DoNotOptimize(copy);
+  }
+}
+ENQUERY_BENCHMARK(BM_BufferCopy4096);
+
+}  // namespace
+
+ENQUERY_BENCHMARK_MAIN()
@@ -43,5 +43,14 @@ int main(int argc, char* argv[]) {
   // Test Data accessor
   ASSERT_EQUALS(b3.Data()[0], 't');
 
+  // Test that clearing keeps the memory for reuse.
+  Buffer b4;
+  b4.Reserve(100);
+  ASSERT_TRUE(b4.Capacity() >= 100);
+  b4.Append("abc", 3);
+  b4.Clear();
+  ASSERT_EQUALS(b4.Size(), 0);
+  ASSERT_TRUE(b4.Capacity() >= 100);
+
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,401 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifdef OS_LINUX
+
+#include "base/epoll_reactor.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "enquery/scope_pointer.h"
+#include "enquery/status.h"
+#include "enquery/utility.h"
+
+namespace {
+
+const char* const kModule = "EpollReactor";
+
+// Translate reactor interest into epoll flags.
+uint32_t ToEpollEvents(int events) {
+  uint32_t result = 0;
+  if (events & enquery::Reactor::READABLE) {
+    result |= EPOLLIN;
+  }
+  if (events & enquery::Reactor::WRITABLE) {
+    result |= EPOLLOUT;
+  }
+  return result;
+}
+
+// Translate epoll flags into reactor events, limited to 'interest'. Errors
+// and hang-ups are reported as every event of interest so that the handler
+// attempts I/O and discovers the condition itself.
+int FromEpollEvents(uint32_t flags, int interest) {
+  int result = 0;
+  if (flags & EPOLLIN) {
+    result |= enquery::Reactor::READABLE;
+  }
+  if (flags & EPOLLOUT) {
+    result |= enquery::Reactor::WRITABLE;
+  }
+  if (flags & (EPOLLERR | EPOLLHUP)) {
+    result = interest;
+  }
+  return result & interest;
+}
+
+}  // namespace
+
+namespace enquery {
+
+EpollReactor::EpollReactor(int max_events)
+    : epoll_fd_(-1), wakeup_fd_(-1), events_(max_events) {}
+
+EpollReactor::~EpollReactor() {
+  if (wakeup_fd_ >= 0) {
+    close(wakeup_fd_);
+  }
+  if (epoll_fd_ >= 0) {
+    close(epoll_fd_);
+  }
+}
+
+Reactor* EpollReactor::Create(const Settings& settings, Status* status_out) {
+  if (settings.queue_depth() < 1) {
+    MaybeAssign(status_out,
+                Status::MakeError(kModule, "queue depth must be positive"));
+    return NULL;
+  }
+  ScopePointer<EpollReactor> reactor(
+      new EpollReactor(settings.queue_depth()));
+  Status status = reactor->InitBuffers(settings);
+  if (status.IsSuccess()) {
+    status = reactor->Init();
+  }
+  if (status.IsFailure()) {
+    MaybeAssign(status_out, status);
+    return NULL;
+  }
+  return reactor.ReleaseOwnership();
+}
+
+Status EpollReactor::Init() {
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ < 0) {
+    return Status::MakeFromSystemError(errno);
+  }
+
+  wakeup_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (wakeup_fd_ < 0) {
+    return Status::MakeFromSystemError(errno);
+  }
+
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.fd = wakeup_fd_;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wakeup_fd_, &ev) != 0) {
+    return Status::MakeFromSystemError(errno);
+  }
+
+  return Status::OK();
+}
+
+Status EpollReactor::Add(int fd, int events, Handler* handler) {
+  assert(handler != NULL);
+  if (fd < 0 || handler == NULL) {
+    return Status::MakeError(kModule, "invalid descriptor or handler");
+  }
+  Entry* entry = GetEntry(fd);
+  if (entry->handler != NULL) {
+    return Status::MakeError(kModule, "descriptor already registered");
+  }
+  const bool registered = entry->registered;
+  entry->handler = handler;
+  entry->events = events;
+  entry->registered = true;
+  Status status = Update(fd, entry);
+  if (status.IsFailure()) {
+    entry->handler = NULL;
+    entry->events = 0;
+    entry->registered = registered;
+  }
+  return status;
+}
+
+Status EpollReactor::Modify(int fd, int events) {
+  if (fd < 0 || static_cast<size_t>(fd) >= entries_.size() ||
+      entries_[fd].handler == NULL) {
+    return Status::MakeError(kModule, "descriptor not registered");
+  }
+  Entry* entry = &entries_[fd];
+  if (entry->events == events) {
+    return Status::OK();
+  }
+  entry->events = events;
+  return Update(fd, entry);
+}
+
+Status EpollReactor::Remove(int fd) {
+  if (fd < 0 || static_cast<size_t>(fd) >= entries_.size() ||
+      !entries_[fd].registered) {
+    return Status::MakeError(kModule, "descriptor not registered");
+  }
+  Entry* entry = &entries_[fd];
+  Reclaim(entry->send);
+  Reclaim(entry->receive);
+  entry->send = Transfer();
+  entry->receive = Transfer();
+  entry->events = 0;
+  Status status = Update(fd, entry);
+  *entry = Entry();
+
+  for (std::deque<Transfer>::iterator it = finished_.begin();
+       it != finished_.end();) {
+    if (it->fd == fd) {
+      Reclaim(*it);
+      it = finished_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  return status;
+}
+
+Status EpollReactor::Send(int fd, char* data, size_t size,
+                          Completion* completion) {
+  if (fd < 0 || completion == NULL) {
+    return Status::MakeError(kModule, "invalid descriptor or completion");
+  }
+  Transfer transfer;
+  transfer.fd = fd;
+  transfer.completion = completion;
+  transfer.data = data;
+  transfer.size = size;
+  return Start(GetEntry(fd), true, transfer);
+}
+
+Status EpollReactor::Receive(int fd, char* data, size_t size,
+                             Completion* completion) {
+  if (fd < 0 || completion == NULL) {
+    return Status::MakeError(kModule, "invalid descriptor or completion");
+  }
+  Transfer transfer;
+  transfer.fd = fd;
+  transfer.completion = completion;
+  transfer.data = data;
+  transfer.size = size;
+  return Start(GetEntry(fd), false, transfer);
+}
+
+// Files are always ready as far as epoll is concerned (and can't be added
+// to its set), so a read is made at once.
+Status EpollReactor::Read(int fd, char* data, size_t size, int64_t offset,
+                          Completion* completion) {
+  if (fd < 0 || completion == NULL) {
+    return Status::MakeError(kModule, "invalid descriptor or completion");
+  }
+  Entry* entry = GetEntry(fd);
+  if (entry->receive.completion != NULL) {
+    return Status::MakeError(kModule, "receive already in progress");
+  }
+  entry->registered = true;
+  Transfer transfer;
+  transfer.fd = fd;
+  transfer.completion = completion;
+  transfer.data = data;
+  ssize_t n = 0;
+  do {
+    n = pread(fd, data, size, offset);
+  } while (n < 0 && errno == EINTR);
+  transfer.result = n < 0 ? -errno : static_cast<int>(n);
+  finished_.push_back(transfer);
+  return Status::OK();
+}
+
+EpollReactor::Entry* EpollReactor::GetEntry(int fd) {
+  if (static_cast<size_t>(fd) >= entries_.size()) {
+    entries_.resize(fd + 1);
+  }
+  return &entries_[fd];
+}
+
+// Descriptors with no interest are taken out of the epoll set entirely;
+// epoll always reports errors and hang-ups, which would otherwise cause a
+// suspended, level-triggered descriptor to spin the loop.
+Status EpollReactor::Update(int fd, Entry* entry) {
+  int interest = entry->events;
+  if (entry->receive.completion != NULL) {
+    interest |= READABLE;
+  }
+  if (entry->send.completion != NULL) {
+    interest |= WRITABLE;
+  }
+  if (interest == entry->interest) {
+    return Status::OK();
+  }
+
+  int op = 0;
+  if (interest == 0) {
+    op = EPOLL_CTL_DEL;
+  } else {
+    op = entry->in_epoll ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+  }
+
+  struct epoll_event ev;
+  ev.events = ToEpollEvents(interest);
+  ev.data.fd = fd;
+  if (epoll_ctl(epoll_fd_, op, fd, &ev) != 0) {
+    return Status::MakeFromSystemError(errno);
+  }
+  entry->interest = interest;
+  entry->in_epoll = (op != EPOLL_CTL_DEL);
+  return Status::OK();
+}
+
+// A send is tried at once, since a socket can usually take it; a receive
+// waits to be told there is something to receive.
+Status EpollReactor::Start(Entry* entry, bool sending,
+                           const Transfer& transfer) {
+  Transfer* slot = sending ? &entry->send : &entry->receive;
+  if (slot->completion != NULL) {
+    return Status::MakeError(kModule, sending ? "send already in progress"
+                                              : "receive already in progress");
+  }
+  entry->registered = true;
+  *slot = transfer;
+  if (sending && Perform(true, slot)) {
+    finished_.push_back(*slot);
+    *slot = Transfer();
+    return Status::OK();
+  }
+  Status status = Update(transfer.fd, entry);
+  if (status.IsFailure()) {
+    *slot = Transfer();
+  }
+  return status;
+}
+
+bool EpollReactor::Perform(bool sending, Transfer* transfer) {
+  for (;;) {
+    const ssize_t n =
+        sending ? send(transfer->fd, transfer->data, transfer->size,
+                       MSG_NOSIGNAL)
+                : read(transfer->fd, transfer->data, transfer->size);
+    if (n >= 0) {
+      transfer->result = static_cast<int>(n);
+      return true;
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return false;
+    }
+    transfer->result = -errno;
+    return true;
+  }
+}
+
+Status EpollReactor::Attempt(int fd, bool sending, uint32_t flags) {
+  Entry* entry = &entries_[fd];
+  Transfer* slot = sending ? &entry->send : &entry->receive;
+  const uint32_t ready = (sending ? EPOLLOUT : EPOLLIN) | EPOLLERR | EPOLLHUP;
+  if (slot->completion == NULL || !(flags & ready) ||
+      !Perform(sending, slot)) {
+    return Status::OK();
+  }
+  const Transfer done = *slot;
+  *slot = Transfer();
+  Status status = Update(fd, entry);
+  done.completion->OnComplete(fd, done.result, done.data);
+  return status;
+}
+
+void EpollReactor::Reclaim(const Transfer& transfer) {
+  if (transfer.completion != NULL && BufferIndex(transfer.data) >= 0) {
+    ReleaseBuffer(transfer.data);
+  }
+}
+
+Status EpollReactor::Poll(int timeout_ms) {
+  // Transfers made at once are delivered without waiting. Only those
+  // made before now are, so that a completion that starts another
+  // doesn't keep the loop here.
+  size_t finished = finished_.size();
+  const int count =
+      epoll_wait(epoll_fd_, &events_[0], static_cast<int>(events_.size()),
+                 finished > 0 ? 0 : timeout_ms);
+  if (count < 0 && errno != EINTR) {
+    return Status::MakeFromSystemError(errno);
+  }
+
+  Status status;
+  for (int i = 0; i < count; ++i) {
+    const int fd = events_[i].data.fd;
+    if (fd == wakeup_fd_) {
+      uint64_t value = 0;
+      ssize_t ignored = read(wakeup_fd_, &value, sizeof(value));
+      (void)ignored;
+      continue;
+    }
+
+    // A handler earlier in the batch may have removed this descriptor.
+    if (static_cast<size_t>(fd) >= entries_.size()) {
+      continue;
+    }
+    // Each step looks the entry up afresh, since a completion may have
+    // grown the table or removed 'fd'.
+    const uint32_t flags = events_[i].events;
+    Status attempted = Attempt(fd, false, flags);
+    if (attempted.IsSuccess()) {
+      attempted = Attempt(fd, true, flags);
+    }
+    if (attempted.IsFailure()) {
+      status = attempted;
+    }
+    Entry* entry = &entries_[fd];
+    if (entry->handler == NULL) {
+      continue;
+    }
+    const int ready = FromEpollEvents(flags, entry->events);
+    if (ready) {
+      entry->handler->OnReady(fd, ready);
+    }
+  }
+
+  // A completion may remove a descriptor whose transfers are still to be
+  // delivered, which takes them out of the queue.
+  while (finished > 0 && !finished_.empty()) {
+    const Transfer done = finished_.front();
+    finished_.pop_front();
+    --finished;
+    done.completion->OnComplete(done.fd, done.result, done.data);
+  }
+  return status;
+}
+
+void EpollReactor::Wakeup() {
+  const uint64_t one = 1;
+  ssize_t ignored = write(wakeup_fd_, &one, sizeof(one));
+  (void)ignored;
+}
+
+}  // namespace enquery
+
+#endif  // OS_LINUX
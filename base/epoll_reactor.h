@@ -0,0 +1,116 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef BASE_EPOLL_REACTOR_H_
+#define BASE_EPOLL_REACTOR_H_
+
+#ifdef OS_LINUX
+
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <deque>
+#include <vector>
+#include "enquery/reactor.h"
+#include "enquery/status.h"
+
+namespace enquery {
+
+class EpollReactor : public Reactor {
+ public:
+  virtual ~EpollReactor();
+
+  // Create an epoll-based reactor.
+  static Reactor* Create(const Settings& settings, Status* status);
+
+  virtual Backend backend() const { return EPOLL; }
+  virtual Status Add(int fd, int events, Handler* handler);
+  virtual Status Modify(int fd, int events);
+  virtual Status Remove(int fd);
+  virtual Status Send(int fd, char* data, size_t size,
+                      Completion* completion);
+  virtual Status Receive(int fd, char* data, size_t size,
+                         Completion* completion);
+  virtual Status Read(int fd, char* data, size_t size, int64_t offset,
+                      Completion* completion);
+  virtual Status Poll(int timeout_ms);
+  virtual void Wakeup();
+
+ private:
+  // A transfer waiting for its descriptor to be ready, or made and
+  // waiting to be delivered.
+  struct Transfer {
+    Transfer() : fd(-1), completion(NULL), data(NULL), size(0), result(0) {}
+    int fd;
+    Completion* completion;  // NULL if there is no transfer.
+    char* data;
+    size_t size;
+    int result;
+  };
+
+  // Registration for a single descriptor, indexed by descriptor number.
+  struct Entry {
+    Entry()
+        : handler(NULL),
+          events(0),
+          registered(false),
+          interest(0),
+          in_epoll(false) {}
+    Handler* handler;
+    int events;       // Wanted by the handler.
+    bool registered;  // Added, or given a transfer.
+    int interest;     // Given to epoll: 'events', and what transfers need.
+    bool in_epoll;
+    Transfer send;
+    Transfer receive;
+  };
+
+  explicit EpollReactor(int max_events);
+  EpollReactor(const EpollReactor& no_copy);
+  EpollReactor& operator=(const EpollReactor& no_assign);
+
+  // Perform (possibly failing) initialization.
+  Status Init();
+
+  // Return the entry for 'fd', growing the table if need be.
+  Entry* GetEntry(int fd);
+
+  // Bring the kernel's interest set in line with 'entry'.
+  Status Update(int fd, Entry* entry);
+
+  // Start a send or receive of 'transfer' on 'entry'.
+  Status Start(Entry* entry, bool sending, const Transfer& transfer);
+
+  // Make the transfer now. Return false if its descriptor isn't ready.
+  static bool Perform(bool sending, Transfer* transfer);
+
+  // Make the send or receive waiting on 'fd', which epoll reported ready
+  // with 'flags', and deliver it if it is done.
+  Status Attempt(int fd, bool sending, uint32_t flags);
+
+  // Give a buffer from AcquireBuffer() that 'transfer' holds back.
+  void Reclaim(const Transfer& transfer);
+
+  int epoll_fd_;
+  int wakeup_fd_;
+  std::vector<Entry> entries_;
+  std::vector<struct epoll_event> events_;
+  std::deque<Transfer> finished_;  // Made at once, and not yet delivered.
+};
+
+}  // namespace enquery
+
+#endif  // OS_LINUX
+
+#endif  // BASE_EPOLL_REACTOR_H_
@@ -0,0 +1,97 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include <stdint.h>
+#include "enquery/benchmark.h"
+#include "enquery/execution.h"
+#include "enquery/executive.h"
+#include "enquery/futures.h"
+#include "enquery/status.h"
+#include "enquery/thread_pool_execution.h"
+
+using ::enquery::BenchmarkState;
+using ::enquery::DoNotOptimize;
+using ::enquery::Execution;
+using ::enquery::Executive;
+using ::enquery::Future;
+using ::enquery::Status;
+using ::enquery::ThreadPoolExecution;
+
+namespace {
+
+int Increment(int value) { return value + 1; }
+
+// Submit() and GetValue() with execution on the calling thread.
+void BM_SubmitCurrentThread(BenchmarkState* state) {
+  Executive* executive = Executive::Create(Executive::DefaultSettings());
+  int sum = 0;
+  for (uint64_t i = 0; i < state->iterations(); ++i) {
+    Future<int> future;
+    executive->Submit(Increment, sum, &future);
+    sum = future.GetValue();
+  }
+  DoNotOptimize(sum);
+  delete executive;
+}
+ENQUERY_BENCHMARK(BM_SubmitCurrentThread);
+
+// A full round trip through a thread pool: each Submit() waits for the
+// result before the next, so this measures hand-off latency.
+void BM_SubmitThreadPoolRoundTrip(BenchmarkState* state) {
+  state->StopTiming();
+  Status status;
+  Execution* pool = ThreadPoolExecution::Create(
+      ThreadPoolExecution::Settings().set_thread_count(1), &status);
+  Executive* executive = Executive::Create(
+      Executive::DefaultSettings().set_execution(pool).set_take_ownership(
+          true));
+  state->StartTiming();
+
+  int sum = 0;
+  for (uint64_t i = 0; i < state->iterations(); ++i) {
+    Future<int> future;
+    executive->Submit(Increment, sum, &future);
+    sum = future.GetValue();
+  }
+  DoNotOptimize(sum);
+
+  state->StopTiming();
+  delete executive;
+}
+ENQUERY_BENCHMARK(BM_SubmitThreadPoolRoundTrip);
+
+// Submit() throughput to a thread pool. Deleting the pool drains its
+// queue, so that is timed too.
+void BM_SubmitThreadPoolThroughput(BenchmarkState* state) {
+  state->StopTiming();
+  Status status;
+  Execution* pool = ThreadPoolExecution::Create(
+      ThreadPoolExecution::Settings().set_thread_count(4), &status);
+  Executive* executive = Executive::Create(
+      Executive::DefaultSettings().set_execution(pool).set_take_ownership(
+          true));
+  state->StartTiming();
+
+  for (uint64_t i = 0; i < state->iterations(); ++i) {
+    Future<int> future;
+    executive->Submit(Increment, 0, &future);
+  }
+  delete executive;
+}
+ENQUERY_BENCHMARK(BM_SubmitThreadPoolThroughput);
+
+}  // namespace
+
+ENQUERY_BENCHMARK_MAIN()
@@ -0,0 +1,69 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include <stdint.h>
+#include "enquery/benchmark.h"
+#include "enquery/futures.h"
+
+using ::enquery::BenchmarkState;
+using ::enquery::DoNotOptimize;
+using ::enquery::Future;
+using ::enquery::Promise;
+
+namespace {
+
+int g_notified = 0;
+
+void OnReady() { ++g_notified; }
+
+// Create a promise, set its value and read it back through the future.
+void BM_PromiseSetGet(BenchmarkState* state) {
+  int sum = 0;
+  for (uint64_t i = 0; i < state->iterations(); ++i) {
+    Promise<int> promise;
+    Future<int> future = promise.GetFuture();
+    promise.SetValue(static_cast<int>(i));
+    sum += future.GetValue();
+  }
+  DoNotOptimize(sum);
+}
+ENQUERY_BENCHMARK(BM_PromiseSetGet);
+
+// As above, but delivering the value to a callback registered beforehand.
+void BM_PromiseNotify(BenchmarkState* state) {
+  for (uint64_t i = 0; i < state->iterations(); ++i) {
+    Promise<int> promise;
+    Future<int> future = promise.GetFuture();
+    future.Notify(OnReady);
+    promise.SetValue(static_cast<int>(i));
+  }
+  DoNotOptimize(g_notified);
+}
+ENQUERY_BENCHMARK(BM_PromiseNotify);
+
+// Copying a future only touches its shared state's reference count.
+void BM_FutureCopy(BenchmarkState* state) {
+  Promise<int> promise;
+  Future<int> future = promise.GetFuture();
+  for (uint64_t i = 0; i < state->iterations(); ++i) {
+    Future<int> copy(future);
+    DoNotOptimize(copy);
+  }
+}
+ENQUERY_BENCHMARK(BM_FutureCopy);
+
+}  // namespace
+
+ENQUERY_BENCHMARK_MAIN()
@@ -0,0 +1,153 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "enquery/histogram.h"
+#include <stdint.h>
+#include <string.h>
+
+namespace {
+
+const uint64_t kNoMinimum = ~static_cast<uint64_t>(0);
+
+// Fields have a single writer, so a relaxed load and store is enough to
+// update them; unlike a locked read-modify-write, it costs no more than
+// a plain increment. The atomic accesses only keep concurrent readers
+// from seeing torn values.
+inline uint64_t Load(const uint64_t* field) {
+  return __atomic_load_n(field, __ATOMIC_RELAXED);
+}
+
+inline void Store(uint64_t* field, uint64_t value) {
+  __atomic_store_n(field, value, __ATOMIC_RELAXED);
+}
+
+inline void Add(uint64_t* field, uint64_t delta) {
+  Store(field, Load(field) + delta);
+}
+
+}  // namespace
+
+namespace enquery {
+
+Histogram::Histogram() { Clear(); }
+
+void Histogram::Record(uint64_t value) {
+  Add(&buckets_[BucketIndex(value)], 1);
+  Add(&count_, 1);
+  Add(&sum_, value);
+  if (value < Load(&min_)) {
+    Store(&min_, value);
+  }
+  if (value > Load(&max_)) {
+    Store(&max_, value);
+  }
+}
+
+void Histogram::Merge(const Histogram& other) {
+  for (int i = 0; i < kBucketCount; ++i) {
+    const uint64_t n = Load(&other.buckets_[i]);
+    if (n) {
+      Add(&buckets_[i], n);
+    }
+  }
+  Add(&count_, Load(&other.count_));
+  Add(&sum_, Load(&other.sum_));
+  const uint64_t other_min = Load(&other.min_);
+  if (other_min < Load(&min_)) {
+    Store(&min_, other_min);
+  }
+  const uint64_t other_max = Load(&other.max_);
+  if (other_max > Load(&max_)) {
+    Store(&max_, other_max);
+  }
+}
+
+void Histogram::Clear() {
+  memset(buckets_, 0, sizeof(buckets_));
+  count_ = 0;
+  sum_ = 0;
+  min_ = kNoMinimum;
+  max_ = 0;
+}
+
+uint64_t Histogram::Count() const { return Load(&count_); }
+
+uint64_t Histogram::Min() const {
+  const uint64_t min = Load(&min_);
+  return (min == kNoMinimum) ? 0 : min;
+}
+
+uint64_t Histogram::Max() const { return Load(&max_); }
+
+double Histogram::Mean() const {
+  const uint64_t count = Load(&count_);
+  if (count == 0) {
+    return 0.0;
+  }
+  return static_cast<double>(Load(&sum_)) / count;
+}
+
+uint64_t Histogram::Percentile(double percentile) const {
+  const uint64_t count = Load(&count_);
+  if (count == 0) {
+    return 0;
+  }
+  if (percentile < 0.0) {
+    percentile = 0.0;
+  } else if (percentile > 100.0) {
+    percentile = 100.0;
+  }
+
+  // Rank of the value sought, counting from one.
+  uint64_t rank = static_cast<uint64_t>(percentile / 100.0 * count + 0.5);
+  if (rank < 1) {
+    rank = 1;
+  }
+
+  uint64_t seen = 0;
+  for (int i = 0; i < kBucketCount; ++i) {
+    seen += Load(&buckets_[i]);
+    if (seen >= rank) {
+      const uint64_t value = BucketHighestValue(i);
+      const uint64_t max = Load(&max_);
+      return (value < max) ? value : max;
+    }
+  }
+  return Load(&max_);
+}
+
+// Values below kSubBucketCount map to their own bucket. Above that, the
+// position of the highest set bit selects a group of kSubBucketCount
+// buckets and the next kSubBucketBits bits select a bucket in the group.
+int Histogram::BucketIndex(uint64_t value) {
+  if (value < static_cast<uint64_t>(kSubBucketCount)) {
+    return static_cast<int>(value);
+  }
+  const int msb = 63 - __builtin_clzll(value);
+  const int shift = msb - kSubBucketBits;
+  const int sub_bucket = static_cast<int>(value >> shift) - kSubBucketCount;
+  return (shift + 1) * kSubBucketCount + sub_bucket;
+}
+
+uint64_t Histogram::BucketHighestValue(int index) {
+  if (index < kSubBucketCount) {
+    return static_cast<uint64_t>(index);
+  }
+  const int shift = index / kSubBucketCount - 1;
+  const uint64_t sub_bucket = index % kSubBucketCount + kSubBucketCount;
+  return ((sub_bucket + 1) << shift) - 1;
+}
+
+}  // namespace enquery
@@ -0,0 +1,78 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "enquery/histogram.h"
+#include "enquery/testing.h"
+
+using ::enquery::Histogram;
+
+int main(int argc, char* argv[]) {
+  // An empty histogram reports zeros.
+  Histogram empty;
+  ASSERT_EQUALS(empty.Count(), 0u);
+  ASSERT_EQUALS(empty.Min(), 0u);
+  ASSERT_EQUALS(empty.Max(), 0u);
+  ASSERT_EQUALS(empty.Percentile(50.0), 0u);
+  ASSERT_TRUE(empty.Mean() == 0.0);
+
+  // Small values are recorded exactly.
+  Histogram small;
+  for (uint64_t i = 1; i <= 10; ++i) {
+    small.Record(i);
+  }
+  ASSERT_EQUALS(small.Count(), 10u);
+  ASSERT_EQUALS(small.Min(), 1u);
+  ASSERT_EQUALS(small.Max(), 10u);
+  ASSERT_EQUALS(small.Percentile(50.0), 5u);
+  ASSERT_EQUALS(small.Percentile(100.0), 10u);
+  ASSERT_TRUE(small.Mean() == 5.5);
+
+  // Large values are reported to within the bucket precision (~3%.)
+  Histogram large;
+  for (uint64_t i = 1; i <= 100000; ++i) {
+    large.Record(i * 1000);
+  }
+  const uint64_t p50 = large.Percentile(50.0);
+  const uint64_t p99 = large.Percentile(99.0);
+  ASSERT_GREATER_THAN(p50, 50000000ULL * 97 / 100);
+  ASSERT_LESS_THAN(p50, 50000000ULL * 103 / 100);
+  ASSERT_GREATER_THAN(p99, 99000000ULL * 97 / 100);
+  ASSERT_LESS_THAN(p99, 99000000ULL * 103 / 100);
+  ASSERT_EQUALS(large.Percentile(100.0), 100000000u);
+
+  // The extremes of the range do not overflow.
+  Histogram extremes;
+  extremes.Record(0);
+  extremes.Record(~static_cast<uint64_t>(0));
+  ASSERT_EQUALS(extremes.Percentile(0.0), 0u);
+  ASSERT_EQUALS(extremes.Percentile(100.0), ~static_cast<uint64_t>(0));
+
+  // Merging combines counts and extremes.
+  Histogram merged;
+  merged.Merge(small);
+  merged.Merge(large);
+  ASSERT_EQUALS(merged.Count(), 100010u);
+  ASSERT_EQUALS(merged.Min(), 1u);
+  ASSERT_EQUALS(merged.Max(), 100000000u);
+
+  // Clearing resets everything.
+  merged.Clear();
+  ASSERT_EQUALS(merged.Count(), 0u);
+  ASSERT_EQUALS(merged.Max(), 0u);
+
+  return EXIT_SUCCESS;
+}
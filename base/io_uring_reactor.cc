@@ -0,0 +1,650 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#if defined(OS_LINUX) && defined(HAVE_IO_URING)
+
+#include "base/io_uring_reactor.h"
+#include <assert.h>
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include "enquery/scope_pointer.h"
+#include "enquery/status.h"
+#include "enquery/utility.h"
+
+// Older C libraries do not define the io_uring system call numbers; they
+// are the same on every architecture.
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+#ifndef __NR_io_uring_register
+#define __NR_io_uring_register 427
+#endif
+
+namespace {
+
+const char* const kModule = "IoUringReactor";
+
+// The low bits of a request's user_data say which of its watch's
+// requests it is.
+const uintptr_t kPollTag = 0;
+const uintptr_t kSendTag = 1;
+const uintptr_t kReceiveTag = 2;
+const uintptr_t kTagMask = 3;
+
+int io_uring_setup(unsigned entries, struct io_uring_params* params) {
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                   unsigned flags, const void* arg, size_t arg_size) {
+  return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit,
+                                  min_complete, flags, arg, arg_size));
+}
+
+int io_uring_register(int fd, unsigned opcode, const void* arg,
+                      unsigned count) {
+  return static_cast<int>(
+      syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+// Translate reactor interest into poll(2) flags.
+unsigned ToPollEvents(int events) {
+  unsigned result = 0;
+  if (events & enquery::Reactor::READABLE) {
+    result |= POLLIN;
+  }
+  if (events & enquery::Reactor::WRITABLE) {
+    result |= POLLOUT;
+  }
+  return result;
+}
+
+// Translate poll(2) flags into reactor events, limited to 'interest'.
+int FromPollEvents(unsigned flags, int interest) {
+  int result = 0;
+  if (flags & POLLIN) {
+    result |= enquery::Reactor::READABLE;
+  }
+  if (flags & POLLOUT) {
+    result |= enquery::Reactor::WRITABLE;
+  }
+  if (flags & (POLLERR | POLLHUP)) {
+    result = interest;
+  }
+  return result & interest;
+}
+
+}  // namespace
+
+namespace enquery {
+
+IoUringReactor::IoUringReactor()
+    : ring_fd_(-1),
+      wakeup_fd_(-1),
+      ring_(MAP_FAILED),
+      ring_size_(0),
+      sqes_(static_cast<struct io_uring_sqe*>(MAP_FAILED)),
+      sqes_size_(0),
+      sq_head_(NULL),
+      sq_tail_(NULL),
+      sq_array_(NULL),
+      sq_mask_(0),
+      sq_entries_(0),
+      sq_local_tail_(0),
+      pending_(0),
+      cq_head_(NULL),
+      cq_tail_(NULL),
+      cq_mask_(0),
+      cqes_(NULL),
+      registered_(false) {}
+
+IoUringReactor::~IoUringReactor() {
+  // Closing the ring cancels everything in flight; after that no Watch
+  // can be referenced by the kernel and all of them may be freed.
+  if (sqes_ != MAP_FAILED) {
+    munmap(sqes_, sqes_size_);
+  }
+  if (ring_ != MAP_FAILED) {
+    munmap(ring_, ring_size_);
+  }
+  if (ring_fd_ >= 0) {
+    close(ring_fd_);
+  }
+  if (wakeup_fd_ >= 0) {
+    close(wakeup_fd_);
+  }
+  for (size_t i = 0; i < watches_.size(); ++i) {
+    delete watches_[i];
+  }
+  for (size_t i = 0; i < zombies_.size(); ++i) {
+    delete zombies_[i];
+  }
+}
+
+Reactor* IoUringReactor::Create(const Settings& settings, Status* status_out) {
+  if (settings.queue_depth() < 1) {
+    MaybeAssign(status_out,
+                Status::MakeError(kModule, "queue depth must be positive"));
+    return NULL;
+  }
+  ScopePointer<IoUringReactor> reactor(new IoUringReactor());
+  Status status = reactor->InitBuffers(settings);
+  if (status.IsSuccess()) {
+    status = reactor->Init(settings.queue_depth());
+  }
+  if (status.IsFailure()) {
+    MaybeAssign(status_out, status);
+    return NULL;
+  }
+  return reactor.ReleaseOwnership();
+}
+
+Status IoUringReactor::Init(unsigned entries) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring_fd_ = io_uring_setup(entries, &params);
+  if (ring_fd_ < 0) {
+    return Status::MakeFromSystemError(errno);
+  }
+
+  // A single mapping for both rings and timeouts passed to io_uring_enter
+  // came together in 5.11; anything older is left to the epoll backend.
+  const unsigned kRequired = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_EXT_ARG;
+  if ((params.features & kRequired) != kRequired) {
+    return Status::MakeError(kModule, "io_uring lacks required features");
+  }
+
+  const size_t sq_size =
+      params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  const size_t cq_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  ring_size_ = std::max(sq_size, cq_size);
+  ring_ = mmap(NULL, ring_size_, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+  if (ring_ == MAP_FAILED) {
+    return Status::MakeFromSystemError(errno);
+  }
+
+  sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+  sqes_ = static_cast<struct io_uring_sqe*>(
+      mmap(NULL, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+           ring_fd_, IORING_OFF_SQES));
+  if (sqes_ == MAP_FAILED) {
+    return Status::MakeFromSystemError(errno);
+  }
+
+  char* base = static_cast<char*>(ring_);
+  sq_head_ = reinterpret_cast<unsigned*>(base + params.sq_off.head);
+  sq_tail_ = reinterpret_cast<unsigned*>(base + params.sq_off.tail);
+  sq_array_ = reinterpret_cast<unsigned*>(base + params.sq_off.array);
+  sq_mask_ = *reinterpret_cast<unsigned*>(base + params.sq_off.ring_mask);
+  sq_entries_ = params.sq_entries;
+  sq_local_tail_ = *sq_tail_;
+
+  cq_head_ = reinterpret_cast<unsigned*>(base + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned*>(base + params.cq_off.tail);
+  cq_mask_ = *reinterpret_cast<unsigned*>(base + params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<struct io_uring_cqe*>(base + params.cq_off.cqes);
+
+  // Registration pins the buffers' pages, which counts against the
+  // locked memory limit; without it transfers still work.
+  if (buffer_count() > 0) {
+    std::vector<struct iovec> iovecs(buffer_count());
+    for (int i = 0; i < buffer_count(); ++i) {
+      iovecs[i].iov_base = buffer(i);
+      iovecs[i].iov_len = buffer_size();
+    }
+    registered_ = io_uring_register(ring_fd_, IORING_REGISTER_BUFFERS,
+                                    &iovecs[0], buffer_count()) == 0;
+  }
+
+  wakeup_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (wakeup_fd_ < 0) {
+    return Status::MakeFromSystemError(errno);
+  }
+  wakeup_watch_.fd = wakeup_fd_;
+  wakeup_watch_.events = READABLE;
+  return Arm(&wakeup_watch_);
+}
+
+Status IoUringReactor::Add(int fd, int events, Handler* handler) {
+  assert(handler != NULL);
+  if (fd < 0 || handler == NULL) {
+    return Status::MakeError(kModule, "invalid descriptor or handler");
+  }
+  if (static_cast<size_t>(fd) < watches_.size() && watches_[fd] != NULL &&
+      watches_[fd]->handler != NULL) {
+    return Status::MakeError(kModule, "descriptor already registered");
+  }
+
+  Watch* watch = GetWatch(fd);
+  watch->events = events;
+  watch->handler = handler;
+  if (events) {
+    Status status = Arm(watch);
+    if (status.IsFailure()) {
+      watch->events = 0;
+      watch->handler = NULL;
+      return status;
+    }
+  }
+  return Status::OK();
+}
+
+Status IoUringReactor::Modify(int fd, int events) {
+  if (fd < 0 || static_cast<size_t>(fd) >= watches_.size() ||
+      watches_[fd] == NULL || watches_[fd]->handler == NULL) {
+    return Status::MakeError(kModule, "descriptor not registered");
+  }
+  Watch* watch = watches_[fd];
+  if (watch->events == events) {
+    return Status::OK();
+  }
+  watch->events = events;
+
+  // An outstanding poll is cancelled rather than updated in place; its
+  // completion re-arms the watch with the new interest (see Reap.)
+  if (watch->armed) {
+    return Cancel(watch);
+  }
+  return events ? Arm(watch) : Status::OK();
+}
+
+// The buffers of cancelled transfers are reclaimed as their requests
+// complete (see Finish.)
+Status IoUringReactor::Remove(int fd) {
+  if (fd < 0 || static_cast<size_t>(fd) >= watches_.size() ||
+      watches_[fd] == NULL) {
+    return Status::MakeError(kModule, "descriptor not registered");
+  }
+  Watch* watch = watches_[fd];
+  watches_[fd] = NULL;
+  watch->removed = true;
+  zombies_.push_back(watch);
+  Status status;
+  if (watch->armed) {
+    status = Cancel(watch);
+  }
+  if (status.IsSuccess() && watch->send.in_flight) {
+    status = CancelTransfer(watch, true);
+  }
+  if (status.IsSuccess() && watch->receive.in_flight) {
+    status = CancelTransfer(watch, false);
+  }
+  return status;
+}
+
+Status IoUringReactor::Send(int fd, char* data, size_t size,
+                            Completion* completion) {
+  if (fd < 0 || completion == NULL) {
+    return Status::MakeError(kModule, "invalid descriptor or completion");
+  }
+  Transfer transfer;
+  transfer.completion = completion;
+  transfer.data = data;
+  transfer.size = size;
+  transfer.opcode = IORING_OP_SEND;
+  return Start(GetWatch(fd), true, transfer);
+}
+
+// A receive is never made as a fixed read, though a registered buffer
+// would allow it: a read of a non-blocking socket fails with EAGAIN
+// rather than waiting, which costs a poll and another trip through the
+// ring, where IORING_OP_RECV waits within the kernel.
+Status IoUringReactor::Receive(int fd, char* data, size_t size,
+                               Completion* completion) {
+  if (fd < 0 || completion == NULL) {
+    return Status::MakeError(kModule, "invalid descriptor or completion");
+  }
+  Transfer transfer;
+  transfer.completion = completion;
+  transfer.data = data;
+  transfer.size = size;
+  transfer.opcode = IORING_OP_RECV;
+  return Start(GetWatch(fd), false, transfer);
+}
+
+Status IoUringReactor::Read(int fd, char* data, size_t size, int64_t offset,
+                            Completion* completion) {
+  if (fd < 0 || completion == NULL) {
+    return Status::MakeError(kModule, "invalid descriptor or completion");
+  }
+  Transfer transfer;
+  transfer.completion = completion;
+  transfer.data = data;
+  transfer.size = size;
+  transfer.offset = offset;
+  transfer.opcode = IORING_OP_READ;
+  return Start(GetWatch(fd), false, transfer);
+}
+
+Status IoUringReactor::Poll(int timeout_ms) {
+  // Only block when nothing is waiting in the completion queue already.
+  const bool wait = (timeout_ms != 0) &&
+                    (*cq_head_ == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE));
+  Status status = Enter(wait, timeout_ms);
+  if (status.IsFailure()) {
+    return status;
+  }
+  status = Reap();
+  CollectGarbage();
+  return status;
+}
+
+void IoUringReactor::Wakeup() {
+  const uint64_t one = 1;
+  ssize_t ignored = write(wakeup_fd_, &one, sizeof(one));
+  (void)ignored;
+}
+
+struct io_uring_sqe* IoUringReactor::GetSqe(Status* status) {
+  const unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  if (sq_local_tail_ - head >= sq_entries_) {
+    Status flushed = Enter(false, 0);
+    if (flushed.IsFailure()) {
+      *status = flushed;
+      return NULL;
+    }
+  }
+  const unsigned index = sq_local_tail_ & sq_mask_;
+  struct io_uring_sqe* sqe = &sqes_[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sq_array_[index] = index;
+  ++sq_local_tail_;
+  ++pending_;
+  return sqe;
+}
+
+IoUringReactor::Watch* IoUringReactor::GetWatch(int fd) {
+  if (static_cast<size_t>(fd) >= watches_.size()) {
+    watches_.resize(fd + 1, NULL);
+  }
+  if (watches_[fd] == NULL) {
+    Watch* watch = new Watch();
+    assert((reinterpret_cast<uintptr_t>(watch) & kTagMask) == 0);
+    watch->fd = fd;
+    watches_[fd] = watch;
+  }
+  return watches_[fd];
+}
+
+Status IoUringReactor::Arm(Watch* watch) {
+  Status status;
+  struct io_uring_sqe* sqe = GetSqe(&status);
+  if (sqe == NULL) {
+    return status;
+  }
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = watch->fd;
+  sqe->poll32_events = ToPollEvents(watch->events);
+  sqe->user_data = reinterpret_cast<uintptr_t>(watch);
+  watch->armed = true;
+  return Status::OK();
+}
+
+Status IoUringReactor::Cancel(Watch* watch) {
+  if (watch->cancelling) {
+    return Status::OK();
+  }
+  Status status;
+  struct io_uring_sqe* sqe = GetSqe(&status);
+  if (sqe == NULL) {
+    return status;
+  }
+  sqe->opcode = IORING_OP_POLL_REMOVE;
+  sqe->fd = -1;
+  sqe->addr = reinterpret_cast<uintptr_t>(watch);
+  sqe->user_data = 0;
+  watch->cancelling = true;
+  return Status::OK();
+}
+
+Status IoUringReactor::Start(Watch* watch, bool sending,
+                             const Transfer& transfer) {
+  Transfer* slot = sending ? &watch->send : &watch->receive;
+  if (slot->completion != NULL) {
+    return Status::MakeError(kModule, sending ? "send already in progress"
+                                              : "receive already in progress");
+  }
+  *slot = transfer;
+  const int index = BufferIndex(transfer.data);
+  if (registered_ && transfer.opcode == IORING_OP_READ && index >= 0 &&
+      transfer.data + transfer.size <= buffer(index) + buffer_size()) {
+    slot->opcode = IORING_OP_READ_FIXED;
+    slot->buffer_index = index;
+  }
+  Status status = Submit(watch, sending);
+  if (status.IsFailure()) {
+    *slot = Transfer();
+  }
+  return status;
+}
+
+Status IoUringReactor::Submit(Watch* watch, bool sending) {
+  Status status;
+  struct io_uring_sqe* sqe = GetSqe(&status);
+  if (sqe == NULL) {
+    return status;
+  }
+  Transfer* transfer = sending ? &watch->send : &watch->receive;
+  sqe->fd = watch->fd;
+  if (transfer->polling) {
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->poll32_events = sending ? POLLOUT : POLLIN;
+  } else {
+    sqe->opcode = static_cast<uint8_t>(transfer->opcode);
+    sqe->addr = reinterpret_cast<uintptr_t>(transfer->data);
+    sqe->len = static_cast<unsigned>(transfer->size);
+    sqe->off = static_cast<uint64_t>(transfer->offset);
+    if (transfer->opcode == IORING_OP_SEND) {
+      sqe->msg_flags = MSG_NOSIGNAL;
+    } else if (transfer->opcode == IORING_OP_READ_FIXED) {
+      sqe->buf_index = static_cast<uint16_t>(transfer->buffer_index);
+    }
+  }
+  sqe->user_data =
+      reinterpret_cast<uintptr_t>(watch) | (sending ? kSendTag : kReceiveTag);
+  transfer->in_flight = true;
+  return Status::OK();
+}
+
+Status IoUringReactor::CancelTransfer(Watch* watch, bool sending) {
+  Status status;
+  struct io_uring_sqe* sqe = GetSqe(&status);
+  if (sqe == NULL) {
+    return status;
+  }
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr =
+      reinterpret_cast<uintptr_t>(watch) | (sending ? kSendTag : kReceiveTag);
+  sqe->user_data = 0;
+  return Status::OK();
+}
+
+// A descriptor that is non-blocking may have its request fail with
+// EAGAIN rather than wait; it is then made again once a poll says the
+// descriptor is ready.
+Status IoUringReactor::Finish(Watch* watch, bool sending, int result) {
+  Transfer* transfer = sending ? &watch->send : &watch->receive;
+  transfer->in_flight = false;
+  if (watch->removed) {
+    if (BufferIndex(transfer->data) >= 0) {
+      ReleaseBuffer(transfer->data);
+    }
+    *transfer = Transfer();
+    return Status::OK();
+  }
+  if (transfer->polling || result == -EINTR) {
+    transfer->polling = false;
+    return Submit(watch, sending);
+  }
+  if (result == -EAGAIN) {
+    transfer->polling = true;
+    return Submit(watch, sending);
+  }
+  const Transfer done = *transfer;
+  *transfer = Transfer();
+  done.completion->OnComplete(watch->fd, result, done.data);
+  return Status::OK();
+}
+
+Status IoUringReactor::Enter(bool wait, int timeout_ms) {
+  // Publish queued entries to the kernel.
+  __atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+  if (pending_ == 0 && !wait) {
+    return Status::OK();
+  }
+
+  unsigned flags = 0;
+  unsigned min_complete = 0;
+  struct io_uring_getevents_arg arg;
+  struct __kernel_timespec ts;
+  const void* arg_ptr = NULL;
+  size_t arg_size = 0;
+  if (wait) {
+    flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+    min_complete = 1;
+    memset(&arg, 0, sizeof(arg));
+    if (timeout_ms > 0) {
+      ts.tv_sec = timeout_ms / 1000;
+      ts.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+      arg.ts = reinterpret_cast<uintptr_t>(&ts);
+    }
+    arg_ptr = &arg;
+    arg_size = sizeof(arg);
+  }
+
+  for (;;) {
+    const int result = io_uring_enter(ring_fd_, pending_, min_complete, flags,
+                                      arg_ptr, arg_size);
+    if (result >= 0) {
+      pending_ -= std::min(pending_, static_cast<unsigned>(result));
+      return Status::OK();
+    }
+    if (errno == ETIME || errno == EINTR) {
+      // The kernel consumes submissions before it starts to wait, so
+      // anything pending has been submitted.
+      pending_ = 0;
+      return Status::OK();
+    }
+    if (errno != EAGAIN && errno != EBUSY) {
+      return Status::MakeFromSystemError(errno);
+    }
+    // The kernel is short of resources or completions must be reaped
+    // first; do so and try again without waiting.
+    Status status = Reap();
+    if (status.IsFailure()) {
+      return status;
+    }
+    flags = 0;
+    min_complete = 0;
+    arg_ptr = NULL;
+    arg_size = 0;
+  }
+}
+
+Status IoUringReactor::Reap() {
+  Status status;
+  unsigned head = *cq_head_;
+  for (;;) {
+    if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+      break;
+    }
+    const struct io_uring_cqe* cqe = &cqes_[head & cq_mask_];
+    const uint64_t user_data = cqe->user_data;
+    const int result = cqe->res;
+    ++head;
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+
+    // Completions of cancellation requests carry no watch.
+    if (user_data == 0) {
+      continue;
+    }
+
+    Watch* watch = reinterpret_cast<Watch*>(
+        static_cast<uintptr_t>(user_data) & ~kTagMask);
+    const uintptr_t tag = static_cast<uintptr_t>(user_data) & kTagMask;
+    if (tag != kPollTag) {
+      Status finished = Finish(watch, tag == kSendTag, result);
+      if (finished.IsFailure()) {
+        status = finished;
+      }
+      continue;
+    }
+    watch->armed = false;
+    watch->cancelling = false;
+
+    if (watch == &wakeup_watch_) {
+      uint64_t value = 0;
+      ssize_t ignored = read(wakeup_fd_, &value, sizeof(value));
+      (void)ignored;
+    } else if (!watch->removed) {
+      int ready = 0;
+      if (result > 0) {
+        ready = FromPollEvents(static_cast<unsigned>(result), watch->events);
+      } else if (result < 0 && result != -ECANCELED) {
+        // Let the handler discover the error through its own I/O.
+        ready = watch->events;
+      }
+      if (ready) {
+        watch->handler->OnReady(watch->fd, ready);
+      }
+      if (result == -EBADF) {
+        continue;
+      }
+    }
+
+    // The handler may have removed or modified the watch, or armed it
+    // again via Modify(); only re-arm if none of that happened.
+    if (!watch->removed && !watch->armed && watch->events) {
+      Status armed = Arm(watch);
+      if (armed.IsFailure()) {
+        status = armed;
+      }
+    }
+  }
+  return status;
+}
+
+void IoUringReactor::CollectGarbage() {
+  size_t kept = 0;
+  for (size_t i = 0; i < zombies_.size(); ++i) {
+    Watch* watch = zombies_[i];
+    if (watch->armed || watch->send.in_flight || watch->receive.in_flight) {
+      zombies_[kept++] = watch;
+    } else {
+      delete watch;
+    }
+  }
+  zombies_.resize(kept);
+}
+
+}  // namespace enquery
+
+#endif  // defined(OS_LINUX) && defined(HAVE_IO_URING)
@@ -0,0 +1,180 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef BASE_IO_URING_REACTOR_H_
+#define BASE_IO_URING_REACTOR_H_
+
+#if defined(OS_LINUX) && defined(HAVE_IO_URING)
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+#include "enquery/reactor.h"
+#include "enquery/status.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace enquery {
+
+// Reactor implemented on io_uring. Readiness is requested with one-shot
+// IORING_OP_POLL_ADD operations that are re-armed after each completion.
+// Interest changes are queued in the submission ring and handed to the
+// kernel in the same io_uring_enter() call that waits for completions,
+// so a loop iteration costs a single system call no matter how many
+// descriptors were (re)armed. Requires IORING_FEAT_EXT_ARG (Linux 5.11.)
+//
+// Transfers go through the ring the same way, as IORING_OP_SEND,
+// IORING_OP_RECV and IORING_OP_READ. The buffers lent out by the reactor
+// are registered with IORING_REGISTER_BUFFERS, and a read into one is
+// made as IORING_OP_READ_FIXED. If registering them fails (e.g. for want
+// of locked memory) they are used unregistered.
+class IoUringReactor : public Reactor {
+ public:
+  virtual ~IoUringReactor();
+
+  // Create an io_uring-based reactor. Fails if the kernel does not
+  // support io_uring or lacks a required feature.
+  static Reactor* Create(const Settings& settings, Status* status);
+
+  virtual Backend backend() const { return IO_URING; }
+  virtual Status Add(int fd, int events, Handler* handler);
+  virtual Status Modify(int fd, int events);
+  virtual Status Remove(int fd);
+  virtual Status Send(int fd, char* data, size_t size,
+                      Completion* completion);
+  virtual Status Receive(int fd, char* data, size_t size,
+                         Completion* completion);
+  virtual Status Read(int fd, char* data, size_t size, int64_t offset,
+                      Completion* completion);
+  virtual Status Poll(int timeout_ms);
+  virtual void Wakeup();
+
+ private:
+  // A send, receive or read given to the kernel.
+  struct Transfer {
+    Transfer()
+        : completion(NULL),
+          data(NULL),
+          size(0),
+          offset(0),
+          opcode(0),
+          buffer_index(-1),
+          in_flight(false),
+          polling(false) {}
+    Completion* completion;  // NULL if there is no transfer.
+    char* data;
+    size_t size;
+    int64_t offset;
+    int opcode;
+    int buffer_index;  // Of the registered buffer 'data' is in, if any.
+    bool in_flight;    // The kernel has a request for it.
+    bool polling;      // The request waits for readiness, after EAGAIN.
+  };
+
+  // Registration for a single descriptor. The address of a Watch, tagged
+  // in its low bits with which of its requests it is for, is the
+  // user_data of its requests, so a removed Watch must outlive any still
+  // in flight in the kernel.
+  struct Watch {
+    Watch()
+        : fd(-1),
+          events(0),
+          handler(NULL),
+          armed(false),
+          cancelling(false),
+          removed(false) {}
+    int fd;
+    int events;
+    Handler* handler;  // NULL if only given transfers.
+    bool armed;
+    bool cancelling;
+    bool removed;
+    Transfer send;
+    Transfer receive;
+  };
+
+  IoUringReactor();
+  IoUringReactor(const IoUringReactor& no_copy);
+  IoUringReactor& operator=(const IoUringReactor& no_assign);
+
+  // Perform (possibly failing) initialization.
+  Status Init(unsigned entries);
+
+  // Return the watch for 'fd', creating it if need be.
+  Watch* GetWatch(int fd);
+
+  // Obtain a zeroed submission entry, flushing the queue if it is full.
+  struct io_uring_sqe* GetSqe(Status* status);
+
+  // Queue a poll request for the watch's current interest.
+  Status Arm(Watch* watch);
+
+  // Queue cancellation of the watch's outstanding poll request.
+  Status Cancel(Watch* watch);
+
+  // Start 'transfer' as the watch's send or receive.
+  Status Start(Watch* watch, bool sending, const Transfer& transfer);
+
+  // Queue the request for the watch's send or receive.
+  Status Submit(Watch* watch, bool sending);
+
+  // Queue cancellation of the watch's send or receive.
+  Status CancelTransfer(Watch* watch, bool sending);
+
+  // Handle the completion of a request for the watch's send or receive.
+  Status Finish(Watch* watch, bool sending, int result);
+
+  // Submit queued entries and optionally wait for a completion.
+  Status Enter(bool wait, int timeout_ms);
+
+  // Drain the completion queue, dispatching handlers.
+  Status Reap();
+
+  // Free removed watches that no longer have requests in flight.
+  void CollectGarbage();
+
+  int ring_fd_;
+  int wakeup_fd_;
+
+  void* ring_;
+  size_t ring_size_;
+  struct io_uring_sqe* sqes_;
+  size_t sqes_size_;
+
+  unsigned* sq_head_;
+  unsigned* sq_tail_;
+  unsigned* sq_array_;
+  unsigned sq_mask_;
+  unsigned sq_entries_;
+  unsigned sq_local_tail_;
+  unsigned pending_;
+
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned cq_mask_;
+  struct io_uring_cqe* cqes_;
+
+  bool registered_;  // The buffers are registered with the kernel.
+  Watch wakeup_watch_;
+  std::vector<Watch*> watches_;
+  std::vector<Watch*> zombies_;
+};
+
+}  // namespace enquery
+
+#endif  // defined(OS_LINUX) && defined(HAVE_IO_URING)
+
+#endif  // BASE_IO_URING_REACTOR_H_
@@ -0,0 +1,207 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "enquery/mutex.h"
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <vector>
+#include "enquery/portability.h"
+
+namespace enquery {
+
+// Contention counters for all mutexes that share a site name. Counters
+// are updated with atomic adds, since many threads may wait at once.
+struct LockSite {
+  const char* name;
+  uint64_t contentions;
+  uint64_t wait_nanos;
+  uint64_t max_wait_nanos;
+};
+
+}  // namespace enquery
+
+namespace {
+
+using ::enquery::LockProfiler;
+using ::enquery::LockSite;
+
+// The registry of sites is guarded by a raw pthread mutex, as a Mutex
+// can't profile the lock that guards its own profile. Sites are never
+// freed, so a Mutex may keep a pointer to its site.
+pthread_mutex_t g_sites_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+std::vector<LockSite*>* Sites() {
+  static std::vector<LockSite*> sites;
+  return &sites;
+}
+
+LockSite* FindOrAddSite(const char* name) {
+  pthread_mutex_lock(&g_sites_mutex);
+  std::vector<LockSite*>* sites = Sites();
+  LockSite* site = NULL;
+  for (size_t i = 0; i < sites->size(); ++i) {
+    if (strcmp((*sites)[i]->name, name) == 0) {
+      site = (*sites)[i];
+      break;
+    }
+  }
+  if (site == NULL) {
+    site = new LockSite();
+    site->name = name;
+    site->contentions = 0;
+    site->wait_nanos = 0;
+    site->max_wait_nanos = 0;
+    sites->push_back(site);
+  }
+  pthread_mutex_unlock(&g_sites_mutex);
+  return site;
+}
+
+bool HotterThan(const LockProfiler::Entry& lhs,
+                const LockProfiler::Entry& rhs) {
+  return lhs.wait_nanos > rhs.wait_nanos;
+}
+
+}  // namespace
+
+namespace enquery {
+
+Mutex::Mutex(const char* site) : site_(site), profile_(NULL) {
+  const int result = pthread_mutex_init(&mutex_, NULL);
+  assert(result == 0);
+  (void)result;
+}
+
+Mutex::~Mutex() { pthread_mutex_destroy(&mutex_); }
+
+void Mutex::LockSlow() {
+  const uint64_t started_at = MonotonicNanos();
+  pthread_mutex_lock(&mutex_);
+  const uint64_t waited = MonotonicNanos() - started_at;
+
+  // The profile is looked up while holding the mutex, so only one thread
+  // at a time writes 'profile_'.
+  if (profile_ == NULL) {
+    profile_ = FindOrAddSite(site_);
+  }
+  __sync_fetch_and_add(&profile_->contentions, 1);
+  __sync_fetch_and_add(&profile_->wait_nanos, waited);
+  uint64_t max = __atomic_load_n(&profile_->max_wait_nanos, __ATOMIC_RELAXED);
+  while (waited > max &&
+         !__atomic_compare_exchange_n(&profile_->max_wait_nanos, &max, waited,
+                                      true, __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED)) {
+  }
+}
+
+// Deadlines are on the monotonic clock, which the condition variable is
+// told to use where that is possible; elsewhere, WaitUntil() waits for a
+// relative time.
+CondVar::CondVar() {
+#ifdef OS_MACOSX
+  const int result = pthread_cond_init(&cond_, NULL);
+#else
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  const int result = pthread_cond_init(&cond_, &attr);
+  pthread_condattr_destroy(&attr);
+#endif
+  assert(result == 0);
+  (void)result;
+}
+
+CondVar::~CondVar() { pthread_cond_destroy(&cond_); }
+
+bool CondVar::WaitUntil(Mutex* mutex, uint64_t deadline) {
+#ifdef OS_MACOSX
+  const uint64_t now = MonotonicNanos();
+  const uint64_t wait = deadline > now ? deadline - now : 0;
+  struct timespec ts;
+  ts.tv_sec = wait / 1000000000ULL;
+  ts.tv_nsec = wait % 1000000000ULL;
+  return pthread_cond_timedwait_relative_np(&cond_, &mutex->mutex_, &ts) !=
+         ETIMEDOUT;
+#else
+  struct timespec ts;
+  ts.tv_sec = deadline / 1000000000ULL;
+  ts.tv_nsec = deadline % 1000000000ULL;
+  return pthread_cond_timedwait(&cond_, &mutex->mutex_, &ts) != ETIMEDOUT;
+#endif
+}
+
+bool LockProfiler::IsEnabled() {
+#ifdef ENQUERY_LOCK_PROFILING
+  return true;
+#else
+  return false;
+#endif
+}
+
+void LockProfiler::GetReport(std::vector<Entry>* entries) {
+  entries->clear();
+  pthread_mutex_lock(&g_sites_mutex);
+  const std::vector<LockSite*>& sites = *Sites();
+  for (size_t i = 0; i < sites.size(); ++i) {
+    Entry entry;
+    entry.site = sites[i]->name;
+    entry.contentions =
+        __atomic_load_n(&sites[i]->contentions, __ATOMIC_RELAXED);
+    entry.wait_nanos = __atomic_load_n(&sites[i]->wait_nanos, __ATOMIC_RELAXED);
+    entry.max_wait_nanos =
+        __atomic_load_n(&sites[i]->max_wait_nanos, __ATOMIC_RELAXED);
+    if (entry.contentions > 0) {
+      entries->push_back(entry);
+    }
+  }
+  pthread_mutex_unlock(&g_sites_mutex);
+  std::stable_sort(entries->begin(), entries->end(), HotterThan);
+}
+
+void LockProfiler::PrintReport(size_t max_entries) {
+  std::vector<Entry> entries;
+  GetReport(&entries);
+  if (!IsEnabled()) {
+    fprintf(stderr, "lock profiling is not compiled in\n");
+    return;
+  }
+  fprintf(stderr, "%-40s %12s %14s %14s\n", "lock site", "contentions",
+          "total wait us", "max wait us");
+  for (size_t i = 0; i < entries.size() && i < max_entries; ++i) {
+    const Entry& e = entries[i];
+    fprintf(stderr, "%-40s %12llu %14.1f %14.1f\n", e.site,
+            static_cast<unsigned long long>(e.contentions),  // NOLINT
+            e.wait_nanos / 1e3, e.max_wait_nanos / 1e3);
+  }
+}
+
+void LockProfiler::Reset() {
+  pthread_mutex_lock(&g_sites_mutex);
+  const std::vector<LockSite*>& sites = *Sites();
+  for (size_t i = 0; i < sites.size(); ++i) {
+    __atomic_store_n(&sites[i]->contentions, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&sites[i]->wait_nanos, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&sites[i]->max_wait_nanos, 0, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&g_sites_mutex);
+}
+
+}  // namespace enquery
@@ -0,0 +1,139 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include "enquery/mutex.h"
+#include "enquery/portability.h"
+#include "enquery/scope_lock.h"
+#include "enquery/testing.h"
+
+using ::enquery::CondVar;
+using ::enquery::LockProfiler;
+using ::enquery::MonotonicNanos;
+using ::enquery::Mutex;
+using ::enquery::ScopeLock;
+
+namespace {
+
+const int kThreads = 4;
+const int kIncrements = 100000;
+
+Mutex g_counter_mutex("mutex_test.counter");
+int g_counter = 0;
+
+Mutex g_held_mutex("mutex_test.held");
+
+Mutex g_ready_mutex("mutex_test.ready");
+CondVar g_ready_cond;
+bool g_ready = false;
+
+void* IncrementCounter(void*) {
+  for (int i = 0; i < kIncrements; ++i) {
+    ScopeLock lock(&g_counter_mutex);
+    ++g_counter;
+  }
+  return NULL;
+}
+
+void* LockHeldMutex(void*) {
+  g_held_mutex.Lock();
+  g_held_mutex.Unlock();
+  return NULL;
+}
+
+void* SetReady(void*) {
+  ScopeLock lock(&g_ready_mutex);
+  g_ready = true;
+  g_ready_cond.Signal();
+  return NULL;
+}
+
+const LockProfiler::Entry* FindSite(
+    const std::vector<LockProfiler::Entry>& entries, const char* site) {
+  for (size_t i = 0; i < entries.size(); ++i) {
+    if (strcmp(entries[i].site, site) == 0) {
+      return &entries[i];
+    }
+  }
+  return NULL;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  // Mutual exclusion holds under contention.
+  pthread_t threads[kThreads];
+  for (int i = 0; i < kThreads; ++i) {
+    ASSERT_EQUALS(pthread_create(&threads[i], NULL, IncrementCounter, NULL), 0);
+  }
+  for (int i = 0; i < kThreads; ++i) {
+    ASSERT_EQUALS(pthread_join(threads[i], NULL), 0);
+  }
+  ASSERT_EQUALS(g_counter, kThreads * kIncrements);
+
+  // A condition variable wakes a waiter.
+  pthread_t setter;
+  g_ready_mutex.Lock();
+  ASSERT_EQUALS(pthread_create(&setter, NULL, SetReady, NULL), 0);
+  while (!g_ready) {
+    g_ready_cond.Wait(&g_ready_mutex);
+  }
+  g_ready_mutex.Unlock();
+  ASSERT_EQUALS(pthread_join(setter, NULL), 0);
+
+  // A timed wait gives up at its deadline, but not before.
+  {
+    Mutex mutex("mutex_test.timed");
+    CondVar cond;
+    const uint64_t started_at = MonotonicNanos();
+    ScopeLock lock(&mutex);
+    while (cond.WaitUntil(&mutex, started_at + 10000000)) {
+    }
+    ASSERT_TRUE(MonotonicNanos() >= started_at + 10000000);
+  }
+
+  // Force a wait of at least 20ms on a named site.
+  pthread_t waiter;
+  g_held_mutex.Lock();
+  ASSERT_EQUALS(pthread_create(&waiter, NULL, LockHeldMutex, NULL), 0);
+  usleep(20000);
+  g_held_mutex.Unlock();
+  ASSERT_EQUALS(pthread_join(waiter, NULL), 0);
+
+  std::vector<LockProfiler::Entry> entries;
+  LockProfiler::GetReport(&entries);
+  if (LockProfiler::IsEnabled()) {
+    const LockProfiler::Entry* held = FindSite(entries, "mutex_test.held");
+    ASSERT_VALID_POINTER(held);
+    ASSERT_EQUALS(held->contentions, 1u);
+    ASSERT_GREATER_THAN(held->wait_nanos, 10000000u);
+    ASSERT_EQUALS(held->max_wait_nanos, held->wait_nanos);
+
+    // The report is sorted by total wait, hottest first.
+    for (size_t i = 1; i < entries.size(); ++i) {
+      ASSERT_TRUE(entries[i - 1].wait_nanos >= entries[i].wait_nanos);
+    }
+
+    LockProfiler::Reset();
+    LockProfiler::GetReport(&entries);
+  }
+  ASSERT_TRUE(entries.empty());
+
+  return EXIT_SUCCESS;
+}
@@ -14,7 +14,9 @@
 // contributors.
 
 #include "enquery/portability.h"
+#include <stdint.h>
 #include <string.h>
+#include <time.h>
 
 namespace enquery {
 
@@ -39,4 +41,20 @@ std::string SystemErrorToString(errno_t error_number) {
 #endif  // #ifdef _WIN32
 }
 
+uint64_t MonotonicNanos() {
+#ifdef _WIN32
+  LARGE_INTEGER frequency;
+  LARGE_INTEGER counter;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+  const uint64_t ticks = counter.QuadPart;
+  const uint64_t hz = frequency.QuadPart;
+  return ticks / hz * 1000000000ULL + ticks % hz * 1000000000ULL / hz;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+#endif  // #ifdef _WIN32
+}
+
 }  // namespace enquery
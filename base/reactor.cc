@@ -0,0 +1,128 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "enquery/reactor.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "base/epoll_reactor.h"
+#include "base/io_uring_reactor.h"
+#include "enquery/status.h"
+#include "enquery/utility.h"
+
+namespace enquery {
+
+Reactor* Reactor::Create(const Settings& settings, Status* status) {
+#ifdef OS_LINUX
+#ifdef HAVE_IO_URING
+  if (settings.backend() == IO_URING) {
+    Reactor* reactor = IoUringReactor::Create(settings, NULL);
+    if (reactor) {
+      MaybeAssign(status, Status::OK());
+      return reactor;
+    }
+    // Fall through to epoll: io_uring may be missing, too old, or
+    // disabled by a seccomp policy.
+  }
+#endif  // HAVE_IO_URING
+  Reactor* reactor = EpollReactor::Create(settings, status);
+  if (reactor) {
+    MaybeAssign(status, Status::OK());
+  }
+  return reactor;
+#else
+  (void)settings;
+  MaybeAssign(status, Status::MakeError("Reactor", "unsupported platform"));
+  return NULL;
+#endif  // OS_LINUX
+}
+
+Reactor::Settings Reactor::DefaultSettings() { return Settings(); }
+
+Reactor::Reactor()
+    : buffers_(NULL),
+      buffer_size_(0),
+      buffer_count_(0),
+      free_buffers_(NULL),
+      free_count_(0) {}
+
+Reactor::~Reactor() {
+  free(buffers_);
+  delete[] free_buffers_;
+}
+
+Status Reactor::InitBuffers(const Settings& settings) {
+  if (settings.buffer_count() < 0 ||
+      (settings.buffer_count() > 0 && settings.buffer_size() == 0)) {
+    return Status::MakeError("Reactor", "invalid buffer settings");
+  }
+  if (settings.buffer_count() == 0) {
+    return Status::OK();
+  }
+
+  // Page alignment keeps each buffer's pages its own when registered.
+  const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  const size_t size = (settings.buffer_size() + page - 1) / page * page;
+  void* memory = NULL;
+  if (posix_memalign(&memory, page, size * settings.buffer_count()) != 0) {
+    return Status::MakeError("Reactor", "out of memory", ENOMEM);
+  }
+  buffers_ = static_cast<char*>(memory);
+  buffer_size_ = size;
+  buffer_count_ = settings.buffer_count();
+  free_buffers_ = new int[buffer_count_];
+  for (int i = 0; i < buffer_count_; ++i) {
+    free_buffers_[i] = buffer_count_ - 1 - i;
+  }
+  free_count_ = buffer_count_;
+  return Status::OK();
+}
+
+char* Reactor::AcquireBuffer() {
+  if (free_count_ == 0) {
+    return NULL;
+  }
+  return buffer(free_buffers_[--free_count_]);
+}
+
+void Reactor::ReleaseBuffer(char* data) {
+  const int index = BufferIndex(data);
+  assert(index >= 0 && free_count_ < buffer_count_);
+  if (index >= 0 && free_count_ < buffer_count_) {
+    free_buffers_[free_count_++] = index;
+  }
+}
+
+int Reactor::BufferIndex(const char* data) const {
+  if (buffers_ == NULL || data < buffers_ ||
+      data >= buffers_ + buffer_count_ * buffer_size_) {
+    return -1;
+  }
+  return static_cast<int>((data - buffers_) / buffer_size_);
+}
+
+const char* Reactor::BackendName(Backend backend) {
+  switch (backend) {
+    case DEFAULT:
+    case EPOLL:
+      return "epoll";
+    case IO_URING:
+      return "io_uring";
+  }
+  return "unknown";
+}
+
+}  // namespace enquery
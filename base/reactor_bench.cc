@@ -0,0 +1,237 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+// Compares reactor backends on loopback TCP traffic. A single reactor
+// drives both ends of a number of connections; every client repeatedly
+// sends a small message that the server side echoes back. One operation
+// is one round trip. Each backend is measured with handlers that read
+// and write when told a socket is ready, and with transfers made by the
+// reactor into and out of its own buffers.
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+#include "enquery/benchmark.h"
+#include "enquery/reactor.h"
+#include "enquery/status.h"
+
+using ::enquery::BenchmarkState;
+using ::enquery::Reactor;
+using ::enquery::Status;
+
+namespace {
+
+const int kConnections = 64;
+const size_t kMessageSize = 64;
+
+void SetSocketOptions(int fd) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+// Echoes whatever it reads (server side), or counts a round trip and
+// sends the next message (client side.)
+class EchoHandler : public Reactor::Handler {
+ public:
+  explicit EchoHandler(bool client) : client_(client), round_trips_(0) {}
+
+  virtual void OnReady(int fd, int events) {
+    char buf[kMessageSize];
+    for (;;) {
+      ssize_t n = read(fd, buf, sizeof(buf));
+      if (n <= 0) {
+        return;
+      }
+      if (client_) {
+        ++round_trips_;
+      }
+      ssize_t ignored = write(fd, buf, n);
+      (void)ignored;
+    }
+  }
+
+  long round_trips() const { return round_trips_; }
+
+ private:
+  bool client_;
+  long round_trips_;
+};
+
+// Does as EchoHandler does, with the reactor making the transfers: each
+// connection has a buffer that it receives into and sends from in turn.
+class EchoCompletion : public Reactor::Completion {
+ public:
+  EchoCompletion(Reactor* reactor, bool client)
+      : reactor_(reactor), client_(client), round_trips_(0) {}
+
+  // Start receiving on 'fd'.
+  void Start(int fd) {
+    if (sending_.size() <= static_cast<size_t>(fd)) {
+      sending_.resize(fd + 1, false);
+    }
+    reactor_->Receive(fd, reactor_->AcquireBuffer(), kMessageSize, this);
+  }
+
+  virtual void OnComplete(int fd, int result, char* buffer) {
+    if (result <= 0) {
+      return;
+    }
+    if (sending_[fd]) {
+      sending_[fd] = false;
+      reactor_->Receive(fd, buffer, kMessageSize, this);
+      return;
+    }
+    if (client_) {
+      ++round_trips_;
+    }
+    sending_[fd] = true;
+    reactor_->Send(fd, buffer, result, this);
+  }
+
+  long round_trips() const { return round_trips_; }
+
+ private:
+  Reactor* reactor_;
+  bool client_;
+  long round_trips_;
+  std::vector<bool> sending_;  // By descriptor: a send is in progress.
+};
+
+bool MakeConnections(std::vector<int>* clients, std::vector<int>* servers) {
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(addr);
+  if (bind(listener, reinterpret_cast<sockaddr*>(&addr), len) != 0 ||
+      listen(listener, kConnections) != 0 ||
+      getsockname(listener, reinterpret_cast<sockaddr*>(&addr), &len) != 0) {
+    close(listener);
+    return false;
+  }
+  for (int i = 0; i < kConnections; ++i) {
+    int client = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(client, reinterpret_cast<sockaddr*>(&addr), len) != 0) {
+      close(client);
+      close(listener);
+      return false;
+    }
+    int server = accept(listener, NULL, NULL);
+    SetSocketOptions(client);
+    SetSocketOptions(server);
+    clients->push_back(client);
+    servers->push_back(server);
+  }
+  close(listener);
+  return true;
+}
+
+void RunBackend(BenchmarkState* state, Reactor::Backend backend,
+                bool transfers) {
+  state->StopTiming();
+  Status status;
+  Reactor* reactor = Reactor::Create(
+      Reactor::DefaultSettings().set_backend(backend).set_buffers(
+          2 * kConnections, kMessageSize),
+      &status);
+  if (!reactor) {
+    fprintf(stderr, "failed to create reactor: %s\n", status.GetMessage());
+    exit(EXIT_FAILURE);
+  }
+  if (reactor->backend() != backend) {
+    static bool warned = false;
+    if (!warned) {
+      fprintf(stderr, "%s unavailable; measuring %s instead\n",
+              Reactor::BackendName(backend),
+              Reactor::BackendName(reactor->backend()));
+      warned = true;
+    }
+  }
+
+  std::vector<int> clients;
+  std::vector<int> servers;
+  if (!MakeConnections(&clients, &servers)) {
+    fprintf(stderr, "failed to set up loopback connections\n");
+    exit(EXIT_FAILURE);
+  }
+
+  EchoHandler client_handler(true);
+  EchoHandler server_handler(false);
+  EchoCompletion client_completion(reactor, true);
+  EchoCompletion server_completion(reactor, false);
+  const char message[kMessageSize] = {0};
+  for (int i = 0; i < kConnections; ++i) {
+    if (transfers) {
+      client_completion.Start(clients[i]);
+      server_completion.Start(servers[i]);
+    } else {
+      reactor->Add(clients[i], Reactor::READABLE, &client_handler);
+      reactor->Add(servers[i], Reactor::READABLE, &server_handler);
+    }
+  }
+
+  state->StartTiming();
+  for (int i = 0; i < kConnections; ++i) {
+    ssize_t ignored = write(clients[i], message, sizeof(message));
+    (void)ignored;
+  }
+  const long iterations = static_cast<long>(state->iterations());
+  while (client_handler.round_trips() + client_completion.round_trips() <
+         iterations) {
+    reactor->Poll(100);
+  }
+  state->StopTiming();
+
+  for (int i = 0; i < kConnections; ++i) {
+    reactor->Remove(clients[i]);
+    reactor->Remove(servers[i]);
+    close(clients[i]);
+    close(servers[i]);
+  }
+  delete reactor;
+}
+
+void BM_ReactorEchoEpoll(BenchmarkState* state) {
+  RunBackend(state, Reactor::EPOLL, false);
+}
+ENQUERY_BENCHMARK(BM_ReactorEchoEpoll);
+
+void BM_ReactorEchoIoUring(BenchmarkState* state) {
+  RunBackend(state, Reactor::IO_URING, false);
+}
+ENQUERY_BENCHMARK(BM_ReactorEchoIoUring);
+
+void BM_ReactorTransferEchoEpoll(BenchmarkState* state) {
+  RunBackend(state, Reactor::EPOLL, true);
+}
+ENQUERY_BENCHMARK(BM_ReactorTransferEchoEpoll);
+
+void BM_ReactorTransferEchoIoUring(BenchmarkState* state) {
+  RunBackend(state, Reactor::IO_URING, true);
+}
+ENQUERY_BENCHMARK(BM_ReactorTransferEchoIoUring);
+
+}  // namespace
+
+ENQUERY_BENCHMARK_MAIN()
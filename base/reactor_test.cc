@@ -0,0 +1,325 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <string>
+#include "enquery/reactor.h"
+#include "enquery/status.h"
+#include "enquery/testing.h"
+
+using ::enquery::Reactor;
+using ::enquery::Status;
+
+namespace {
+
+// Handler that records the events it receives; optionally removes its
+// descriptor from the reactor the first time it is called.
+class RecordingHandler : public Reactor::Handler {
+ public:
+  explicit RecordingHandler(Reactor* reactor)
+      : reactor_(reactor), calls_(0), events_(0), remove_on_call_(false) {}
+
+  virtual void OnReady(int fd, int events) {
+    ++calls_;
+    events_ |= events;
+    if (remove_on_call_) {
+      Status status = reactor_->Remove(fd);
+      ASSERT_TRUE(status.IsSuccess());
+    }
+  }
+
+  void Reset() {
+    calls_ = 0;
+    events_ = 0;
+  }
+
+  void set_remove_on_call(bool remove) { remove_on_call_ = remove; }
+  int calls() const { return calls_; }
+  int events() const { return events_; }
+
+ private:
+  Reactor* reactor_;
+  int calls_;
+  int events_;
+  bool remove_on_call_;
+};
+
+// Completion that records the last transfer it was told of.
+class RecordingCompletion : public Reactor::Completion {
+ public:
+  RecordingCompletion() : calls_(0), result_(0), buffer_(NULL) {}
+
+  virtual void OnComplete(int fd, int result, char* buffer) {
+    ++calls_;
+    result_ = result;
+    buffer_ = buffer;
+  }
+
+  int calls() const { return calls_; }
+  int result() const { return result_; }
+  char* buffer() const { return buffer_; }
+
+ private:
+  int calls_;
+  int result_;
+  char* buffer_;
+};
+
+// Poll until 'completion' has been called 'calls' times, or give up.
+void PollFor(Reactor* reactor, const RecordingCompletion& completion,
+             int calls) {
+  for (int i = 0; i < 100 && completion.calls() < calls; ++i) {
+    ASSERT_TRUE(reactor->Poll(100).IsSuccess());
+  }
+  ASSERT_EQUALS(completion.calls(), calls);
+}
+
+void* wakeup_thread(void* arg) {
+  Reactor* reactor = reinterpret_cast<Reactor*>(arg);
+  usleep(10000);
+  reactor->Wakeup();
+  return NULL;
+}
+
+void test_backend(Reactor::Backend backend) {
+  Status status;
+  Reactor* reactor = Reactor::Create(
+      Reactor::DefaultSettings().set_backend(backend), &status);
+  ASSERT_TRUE(status.IsSuccess());
+  ASSERT_VALID_POINTER(reactor);
+  printf("  backend: %s\n", Reactor::BackendName(reactor->backend()));
+
+  int fds[2] = {-1, -1};
+  ASSERT_EQUALS(pipe(fds), 0);
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+  fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+  RecordingHandler reader(reactor);
+  RecordingHandler writer(reactor);
+
+  // Registering the same descriptor twice is an error.
+  status = reactor->Add(fds[0], Reactor::READABLE, &reader);
+  ASSERT_TRUE(status.IsSuccess());
+  status = reactor->Add(fds[0], Reactor::READABLE, &reader);
+  ASSERT_TRUE(status.IsFailure());
+
+  // Nothing to read yet.
+  status = reactor->Poll(0);
+  ASSERT_TRUE(status.IsSuccess());
+  ASSERT_EQUALS(reader.calls(), 0);
+
+  // Data makes the read end readable, and it stays readable (level
+  // triggered) until drained.
+  ASSERT_EQUALS(write(fds[1], "x", 1), 1);
+  for (int i = 0; i < 3; ++i) {
+    reader.Reset();
+    status = reactor->Poll(1000);
+    ASSERT_TRUE(status.IsSuccess());
+    ASSERT_EQUALS(reader.calls(), 1);
+    ASSERT_EQUALS(reader.events(), Reactor::READABLE);
+  }
+
+  // Suspending interest stops delivery even though data is present.
+  status = reactor->Modify(fds[0], 0);
+  ASSERT_TRUE(status.IsSuccess());
+  reader.Reset();
+  status = reactor->Poll(10);
+  ASSERT_TRUE(status.IsSuccess());
+  ASSERT_EQUALS(reader.calls(), 0);
+
+  // Restoring interest resumes it.
+  status = reactor->Modify(fds[0], Reactor::READABLE);
+  ASSERT_TRUE(status.IsSuccess());
+  status = reactor->Poll(1000);
+  ASSERT_TRUE(status.IsSuccess());
+  ASSERT_EQUALS(reader.calls(), 1);
+
+  // The write end of an empty pipe is writable.
+  status = reactor->Add(fds[1], Reactor::WRITABLE, &writer);
+  ASSERT_TRUE(status.IsSuccess());
+  reader.Reset();
+  status = reactor->Poll(1000);
+  ASSERT_TRUE(status.IsSuccess());
+  ASSERT_EQUALS(writer.calls(), 1);
+  ASSERT_EQUALS(writer.events(), Reactor::WRITABLE);
+  status = reactor->Remove(fds[1]);
+  ASSERT_TRUE(status.IsSuccess());
+
+  // A handler may remove its own descriptor during dispatch, after which
+  // it receives no further events.
+  reader.set_remove_on_call(true);
+  reader.Reset();
+  status = reactor->Poll(1000);
+  ASSERT_TRUE(status.IsSuccess());
+  ASSERT_EQUALS(reader.calls(), 1);
+  status = reactor->Poll(10);
+  ASSERT_TRUE(status.IsSuccess());
+  ASSERT_EQUALS(reader.calls(), 1);
+  status = reactor->Remove(fds[0]);
+  ASSERT_TRUE(status.IsFailure());
+
+  // Wakeup() from another thread interrupts an indefinite wait.
+  pthread_t thread;
+  pthread_create(&thread, NULL, wakeup_thread, reactor);
+  status = reactor->Poll(-1);
+  ASSERT_TRUE(status.IsSuccess());
+  pthread_join(thread, NULL);
+
+  close(fds[0]);
+  close(fds[1]);
+  delete reactor;
+}
+
+void test_transfers(Reactor::Backend backend) {
+  Status status;
+  Reactor* reactor = Reactor::Create(
+      Reactor::DefaultSettings().set_backend(backend).set_buffers(2, 1000),
+      &status);
+  ASSERT_TRUE(status.IsSuccess());
+  ASSERT_VALID_POINTER(reactor);
+  const size_t size = reactor->buffer_size();
+  ASSERT_TRUE(size >= 1000);
+
+  // Buffers are lent out until there are none left.
+  char* first = reactor->AcquireBuffer();
+  char* second = reactor->AcquireBuffer();
+  ASSERT_VALID_POINTER(first);
+  ASSERT_VALID_POINTER(second);
+  ASSERT_TRUE(first != second);
+  ASSERT_TRUE(reactor->AcquireBuffer() == NULL);
+
+  int fds[2] = {-1, -1};
+  ASSERT_EQUALS(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+  fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+  // A receive waits for something to receive, and only one at a time may
+  // be in progress.
+  RecordingCompletion received;
+  status = reactor->Receive(fds[0], first, size, &received);
+  ASSERT_TRUE(status.IsSuccess());
+  status = reactor->Receive(fds[0], second, size, &received);
+  ASSERT_TRUE(status.IsFailure());
+  ASSERT_TRUE(reactor->Poll(10).IsSuccess());
+  ASSERT_EQUALS(received.calls(), 0);
+  ASSERT_EQUALS(write(fds[1], "hello", 5), 5);
+  PollFor(reactor, received, 1);
+  ASSERT_EQUALS(received.result(), 5);
+  ASSERT_TRUE(received.buffer() == first);
+  ASSERT_TRUE(std::string(first, 5) == "hello");
+
+  // A send completes once the socket has taken the data.
+  RecordingCompletion sent;
+  memcpy(second, "world", 5);
+  status = reactor->Send(fds[1], second, 5, &sent);
+  ASSERT_TRUE(status.IsSuccess());
+  PollFor(reactor, sent, 1);
+  ASSERT_EQUALS(sent.result(), 5);
+  ASSERT_TRUE(sent.buffer() == second);
+  char data[8];
+  ASSERT_EQUALS(read(fds[0], data, sizeof(data)), 5);
+  ASSERT_TRUE(std::string(data, 5) == "world");
+
+  // A file is read at an offset.
+  FILE* file = tmpfile();
+  ASSERT_VALID_POINTER(file);
+  fputs("0123456789", file);
+  fflush(file);
+  RecordingCompletion read_file;
+  status = reactor->Read(fileno(file), first, 4, 3, &read_file);
+  ASSERT_TRUE(status.IsSuccess());
+  PollFor(reactor, read_file, 1);
+  ASSERT_EQUALS(read_file.result(), 4);
+  ASSERT_TRUE(std::string(first, 4) == "3456");
+  ASSERT_TRUE(reactor->Remove(fileno(file)).IsSuccess());
+  fclose(file);
+
+  // A descriptor may be watched while it receives.
+  RecordingHandler writer(reactor);
+  status = reactor->Add(fds[1], Reactor::WRITABLE, &writer);
+  ASSERT_TRUE(status.IsSuccess());
+  status = reactor->Receive(fds[1], first, size, &received);
+  ASSERT_TRUE(status.IsSuccess());
+  ASSERT_EQUALS(write(fds[0], "x", 1), 1);
+  PollFor(reactor, received, 2);
+  ASSERT_EQUALS(received.result(), 1);
+  ASSERT_TRUE(writer.calls() > 0);
+  ASSERT_TRUE(reactor->Modify(fds[1], 0).IsSuccess());
+
+  // Removing a descriptor cancels its receive, which is never delivered,
+  // and takes back its buffer.
+  status = reactor->Receive(fds[0], first, size, &received);
+  ASSERT_TRUE(status.IsSuccess());
+  ASSERT_TRUE(reactor->Remove(fds[0]).IsSuccess());
+  ASSERT_TRUE(reactor->Remove(fds[0]).IsFailure());
+  reactor->ReleaseBuffer(second);
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_TRUE(reactor->Poll(10).IsSuccess());
+  }
+  ASSERT_EQUALS(received.calls(), 2);
+  first = reactor->AcquireBuffer();
+  second = reactor->AcquireBuffer();
+  ASSERT_VALID_POINTER(first);
+  ASSERT_VALID_POINTER(second);
+
+  // The end of the stream is an empty receive, and sending to a closed
+  // peer fails without raising SIGPIPE.
+  close(fds[0]);
+  status = reactor->Receive(fds[1], first, size, &received);
+  ASSERT_TRUE(status.IsSuccess());
+  PollFor(reactor, received, 3);
+  ASSERT_EQUALS(received.result(), 0);
+  status = reactor->Send(fds[1], second, size, &sent);
+  ASSERT_TRUE(status.IsSuccess());
+  PollFor(reactor, sent, 2);
+  ASSERT_EQUALS(sent.result(), -EPIPE);
+
+  ASSERT_TRUE(reactor->Remove(fds[1]).IsSuccess());
+  close(fds[1]);
+  reactor->ReleaseBuffer(first);
+  reactor->ReleaseBuffer(second);
+  delete reactor;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  // Invalid settings are rejected.
+  Status status;
+  Reactor* reactor =
+      Reactor::Create(Reactor::DefaultSettings().set_queue_depth(0), &status);
+  ASSERT_TRUE(reactor == NULL);
+  ASSERT_TRUE(status.IsFailure());
+  reactor = Reactor::Create(Reactor::DefaultSettings().set_buffers(1, 0),
+                            &status);
+  ASSERT_TRUE(reactor == NULL);
+  ASSERT_TRUE(status.IsFailure());
+
+  // IO_URING falls back to epoll where it is unavailable, so both runs
+  // are expected to succeed everywhere.
+  test_backend(Reactor::EPOLL);
+  test_backend(Reactor::IO_URING);
+  test_transfers(Reactor::EPOLL);
+  test_transfers(Reactor::IO_URING);
+
+  return EXIT_SUCCESS;
+}
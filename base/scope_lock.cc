@@ -14,13 +14,26 @@
 // contributors.
 
 #include "enquery/scope_lock.h"
+#include <stdlib.h>
+#include "enquery/mutex.h"
 
 namespace enquery {
 
-ScopeLock::ScopeLock(pthread_mutex_t* mutex) : mutex_(mutex) {
-  pthread_mutex_lock(mutex_);
+ScopeLock::ScopeLock(pthread_mutex_t* mutex)
+    : raw_mutex_(mutex), mutex_(NULL) {
+  pthread_mutex_lock(raw_mutex_);
 }
 
-ScopeLock::~ScopeLock() { pthread_mutex_unlock(mutex_); }
+ScopeLock::ScopeLock(Mutex* mutex) : raw_mutex_(NULL), mutex_(mutex) {
+  mutex_->Lock();
+}
+
+ScopeLock::~ScopeLock() {
+  if (mutex_) {
+    mutex_->Unlock();
+  } else {
+    pthread_mutex_unlock(raw_mutex_);
+  }
+}
 
 }  // namespace enquery
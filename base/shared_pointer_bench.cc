@@ -0,0 +1,80 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include <pthread.h>
+#include <stdint.h>
+#include "enquery/benchmark.h"
+#include "enquery/shared_pointer.h"
+
+using ::enquery::BenchmarkState;
+using ::enquery::DoNotOptimize;
+using ::enquery::SharedPointer;
+
+namespace {
+
+const int kContendingThreads = 4;
+
+struct CopyArgs {
+  SharedPointer<int>* ptr;
+  uint64_t iterations;
+};
+
+void* CopyLoop(void* arg) {
+  CopyArgs* args = static_cast<CopyArgs*>(arg);
+  for (uint64_t i = 0; i < args->iterations; ++i) {
+    SharedPointer<int> copy(*args->ptr);
+    DoNotOptimize(copy);
+  }
+  return NULL;
+}
+
+void BM_SharedPointerCopy(BenchmarkState* state) {
+  SharedPointer<int> ptr(new int(0));
+  for (uint64_t i = 0; i < state->iterations(); ++i) {
+    SharedPointer<int> copy(ptr);
+    DoNotOptimize(copy);
+  }
+}
+ENQUERY_BENCHMARK(BM_SharedPointerCopy);
+
+void BM_SharedPointerAssign(BenchmarkState* state) {
+  SharedPointer<int> a(new int(0));
+  SharedPointer<int> b(new int(1));
+  SharedPointer<int> target;
+  for (uint64_t i = 0; i < state->iterations(); ++i) {
+    target = (i & 1) ? a : b;
+    DoNotOptimize(target);
+  }
+}
+ENQUERY_BENCHMARK(BM_SharedPointerAssign);
+
+// Several threads copy the same pointer, contending on its count. The
+// time reported is per copy, over all threads.
+void BM_SharedPointerCopyContended(BenchmarkState* state) {
+  SharedPointer<int> ptr(new int(0));
+  CopyArgs args = {&ptr, state->iterations() / kContendingThreads + 1};
+  pthread_t threads[kContendingThreads];
+  for (int i = 0; i < kContendingThreads; ++i) {
+    pthread_create(&threads[i], NULL, CopyLoop, &args);
+  }
+  for (int i = 0; i < kContendingThreads; ++i) {
+    pthread_join(threads[i], NULL);
+  }
+}
+ENQUERY_BENCHMARK(BM_SharedPointerCopyContended);
+
+}  // namespace
+
+ENQUERY_BENCHMARK_MAIN()
@@ -0,0 +1,62 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include <errno.h>
+#include <stdint.h>
+#include "enquery/benchmark.h"
+#include "enquery/status.h"
+
+using ::enquery::BenchmarkState;
+using ::enquery::DoNotOptimize;
+using ::enquery::Status;
+
+namespace {
+
+void BM_StatusOK(BenchmarkState* state) {
+  for (uint64_t i = 0; i < state->iterations(); ++i) {
+    Status status = Status::OK();
+    DoNotOptimize(status);
+  }
+}
+ENQUERY_BENCHMARK(BM_StatusOK);
+
+void BM_StatusMakeError(BenchmarkState* state) {
+  for (uint64_t i = 0; i < state->iterations(); ++i) {
+    Status status = Status::MakeError("bench", "something went wrong");
+    DoNotOptimize(status);
+  }
+}
+ENQUERY_BENCHMARK(BM_StatusMakeError);
+
+void BM_StatusMakeFromSystemError(BenchmarkState* state) {
+  for (uint64_t i = 0; i < state->iterations(); ++i) {
+    Status status = Status::MakeFromSystemError(ENOENT);
+    DoNotOptimize(status);
+  }
+}
+ENQUERY_BENCHMARK(BM_StatusMakeFromSystemError);
+
+void BM_StatusCopyError(BenchmarkState* state) {
+  const Status error = Status::MakeError("bench", "something went wrong");
+  for (uint64_t i = 0; i < state->iterations(); ++i) {
+    Status copy(error);
+    DoNotOptimize(copy);
+  }
+}
+ENQUERY_BENCHMARK(BM_StatusCopyError);
+
+}  // namespace
+
+ENQUERY_BENCHMARK_MAIN()
@@ -15,30 +15,36 @@
 
 #include "enquery/thread_pool_execution.h"
 #include <assert.h>
-#include <pthread.h>
-#include <string.h>
+#include <stdint.h>
 #include <deque>
 #include <vector>
+#include "enquery/histogram.h"
+#include "enquery/mutex.h"
+#include "enquery/portability.h"
 #include "enquery/scope_lock.h"
 #include "enquery/scope_pointer.h"
 #include "enquery/status.h"
 #include "enquery/thread.h"
+#include "enquery/trace.h"
 #include "enquery/utility.h"
 
 namespace enquery {
 
 class ThreadPoolExecution::Rep : public Execution {
  public:
-  Rep() : created_sync_(false), shutting_down_(false) {
-    memset(&mutex_, 0, sizeof(mutex_));
-    memset(&cond_, 0, sizeof(cond_));
-  }
+  Rep()
+      : mutex_("ThreadPoolExecution"),
+        submitted_(0),
+        rejected_(0),
+        initialized_(false),
+        shutting_down_(false) {}
 
   virtual ~Rep() {
-    if (created_sync_) {
+    if (initialized_) {
       Shutdown();
-      pthread_cond_destroy(&cond_);
-      pthread_mutex_destroy(&mutex_);
+    }
+    for (size_t i = 0; i < workers_.size(); ++i) {
+      delete workers_[i];
     }
   }
 
@@ -52,26 +58,17 @@ class ThreadPoolExecution::Rep : public Execution {
                                "thread count must be positive");
     }
 
-    int status = pthread_mutex_init(&mutex_, NULL);
-    if (status != 0) {
-      return Status::MakeFromSystemError(status);
-    }
-
-    status = pthread_cond_init(&cond_, NULL);
-    if (status != 0) {
-      pthread_mutex_destroy(&mutex_);
-      return Status::MakeFromSystemError(status);
-    }
-
-    // Record that we've created the core synchronization primitives used
-    // in the instance. This tells the destructor that it's OK to delete
-    // them. This solves a conundrum created by the fact that we're doing
-    // "two phase" construction.
-    created_sync_ = true;
+    // Record that the settings were accepted. This tells the destructor
+    // that it must shut down any threads started below. This solves a
+    // conundrum created by the fact that we're doing "two phase"
+    // construction.
+    initialized_ = true;
 
     for (int i = 0; i < thread_count; ++i) {
+      Worker* worker = new Worker(this);
+      workers_.push_back(worker);
       Status status;
-      Thread* thread = Thread::Create(ThreadFunction, this, &status);
+      Thread* thread = Thread::Create(ThreadFunction, worker, &status);
       if (!thread) {
         return status;
       }
@@ -82,26 +79,40 @@ class ThreadPoolExecution::Rep : public Execution {
   }
 
   Status Execute(Task* task) {
+    TraceScope trace("task", "ThreadPoolExecution::Execute");
+
     // Ensure the task is valid and report error otherwise.
     assert(task != NULL);
     if (task == NULL) {
       return Status::MakeError("ThreadPoolExecution::Rep", "task was null");
     }
 
+    // Read the clock before taking the lock to keep the critical section
+    // short; the difference is not significant for queueing time.
+    const uint64_t now = MonotonicNanos();
+
     // We must lock the mutex to safely determine whether we are still
     // accepting task submissions. If we're being shut down, we will
     // not accept any more tasks.
-    pthread_mutex_lock(&mutex_);
+    mutex_.Lock();
 
     if (shutting_down_) {
-      pthread_mutex_unlock(&mutex_);
+      ++rejected_;
+      mutex_.Unlock();
       return Status::MakeError("ThreadPoolExecution::Rep", "shutting down");
     }
 
+    // Link this submission to the task's eventual run in the timeline.
+    // This is recorded before the task is queued, so that a worker can't
+    // end the flow before it starts.
+    ENQUERY_TRACE(Tracer::FLOW_START, "task", "task",
+                  reinterpret_cast<uintptr_t>(task));
+
     // Enqueue the task, signal a waiting thread
-    tasks_.push_front(task);
-    pthread_cond_signal(&cond_);  // TODO(tdial): pthread_cond_broadcast() ?
-    pthread_mutex_unlock(&mutex_);
+    tasks_.push_front(QueuedTask(task, now));
+    ++submitted_;
+    cond_.Signal();  // TODO(tdial): Broadcast() ?
+    mutex_.Unlock();
 
     return Status::OK();
   }
@@ -110,9 +121,9 @@ class ThreadPoolExecution::Rep : public Execution {
     // First, check to see if we are already shutting down. This must
     // be checked within the mutex. If we *are* in that process, then
     // simply release the mutex and return.
-    pthread_mutex_lock(&mutex_);
+    mutex_.Lock();
     if (shutting_down_) {
-      pthread_mutex_unlock(&mutex_);
+      mutex_.Unlock();
       return;
     }
 
@@ -120,15 +131,15 @@ class ThreadPoolExecution::Rep : public Execution {
     shutting_down_ = true;
 
     // Unlock the mutex
-    pthread_mutex_unlock(&mutex_);
+    mutex_.Unlock();
 
     // Queue up NULL tasks for all threads.
     const size_t thread_count = threads_.size();
     for (size_t i = 0; i < thread_count; ++i) {
-      pthread_mutex_lock(&mutex_);
-      tasks_.push_front(NULL);
-      pthread_cond_signal(&cond_);
-      pthread_mutex_unlock(&mutex_);
+      mutex_.Lock();
+      tasks_.push_front(QueuedTask(NULL, 0));
+      cond_.Signal();
+      mutex_.Unlock();
     }
 
     // Loop through threads and delete them. This is safe because the
@@ -145,18 +156,57 @@ class ThreadPoolExecution::Rep : public Execution {
     assert(tasks_.size() == 0);
   }
 
+  void GetStatistics(ThreadPoolExecution::Statistics* stats) {
+    assert(stats != NULL);
+    ThreadPoolExecution::Statistics result;
+
+    mutex_.Lock();
+    result.set_submitted(submitted_);
+    result.set_rejected(rejected_);
+    result.set_queued(tasks_.size());
+    mutex_.Unlock();
+
+    uint64_t completed = 0;
+    for (size_t i = 0; i < workers_.size(); ++i) {
+      const Worker* worker = workers_[i];
+      completed += __atomic_load_n(&worker->completed, __ATOMIC_RELAXED);
+      result.queue_wait().Merge(worker->queue_wait);
+      result.run_time().Merge(worker->run_time);
+    }
+    result.set_completed(completed);
+
+    *stats = result;
+  }
+
  private:
+  // A task waiting in the queue, with the time at which it was enqueued.
+  struct QueuedTask {
+    QueuedTask(Task* t, uint64_t at) : task(t), enqueued_at(at) {}
+    Task* task;
+    uint64_t enqueued_at;
+  };
+
+  // State owned by a single worker thread. Only that thread writes to
+  // the counters, so recording needs no synchronization; readers use
+  // relaxed atomic loads (see Histogram.)
+  struct Worker {
+    explicit Worker(Rep* r) : rep(r), completed(0) {}
+    Rep* rep;
+    uint64_t completed;
+    Histogram queue_wait;
+    Histogram run_time;
+  };
+
   // Retrieve a task from the shared task queue.
-  Task* GetNextTask() {
-    Task* task = NULL;
-    pthread_mutex_lock(&mutex_);
+  QueuedTask GetNextTask() {
+    mutex_.Lock();
     while (tasks_.size() == 0) {
-      pthread_cond_wait(&cond_, &mutex_);
+      cond_.Wait(&mutex_);
     }
-    task = tasks_.back();
+    QueuedTask queued = tasks_.back();
     tasks_.pop_back();
-    pthread_mutex_unlock(&mutex_);
-    return task;
+    mutex_.Unlock();
+    return queued;
   }
 
   // Run in every thread; retrieve tasks forever, quitting only when a
@@ -164,34 +214,49 @@ class ThreadPoolExecution::Rep : public Execution {
   // by clients, but are used internally as a shutdown signal. Because
   // tasks are entered in FIFO fashion, this ensures that all tasks in
   // the queue are processed prior to shutdown.
-  void* WorkerLoop() {
+  void* WorkerLoop(Worker* worker) {
     for (;;) {
-      Task* task = GetNextTask();
-      if (!task) {
+      QueuedTask queued = GetNextTask();
+      if (!queued.task) {
         break;
       }
-      task->Run();
-      delete task;
+      const uint64_t started_at = MonotonicNanos();
+      {
+        TraceScope trace("task", "task.run");
+        ENQUERY_TRACE(Tracer::FLOW_END, "task", "task",
+                      reinterpret_cast<uintptr_t>(queued.task));
+        queued.task->Run();
+        delete queued.task;
+      }
+      const uint64_t finished_at = MonotonicNanos();
+
+      worker->queue_wait.Record(started_at - queued.enqueued_at);
+      worker->run_time.Record(finished_at - started_at);
+      __atomic_store_n(&worker->completed, worker->completed + 1,
+                       __ATOMIC_RELAXED);
     }
     return NULL;
   }
 
-  // Worker threads run this function. At the time of thread creation, the
-  // 'this' pointer of the controlling Rep instance is passed as the thread
-  // argument. Here, we cast it back so that we may run the WorkerLoop()
-  // member function.
+  // Worker threads run this function. At the time of thread creation, a
+  // pointer to the thread's Worker record, which refers back to the
+  // controlling Rep instance, is passed as the thread argument. Here, we
+  // cast it back so that we may run the WorkerLoop() member function.
   static void* ThreadFunction(void* arg) {
-    Rep* execution = reinterpret_cast<Rep*>(arg);
-    return execution->WorkerLoop();
+    Worker* worker = reinterpret_cast<Worker*>(arg);
+    return worker->rep->WorkerLoop(worker);
   }
 
   Rep(const Rep& no_copy);
   Rep& operator=(const Rep& no_assign);
-  pthread_mutex_t mutex_;
-  pthread_cond_t cond_;
+  Mutex mutex_;
+  CondVar cond_;
   std::vector<Thread*> threads_;
-  std::deque<Task*> tasks_;
-  bool created_sync_;
+  std::vector<Worker*> workers_;
+  std::deque<QueuedTask> tasks_;
+  uint64_t submitted_;
+  uint64_t rejected_;
+  bool initialized_;
   bool shutting_down_;
 };
 
@@ -224,4 +289,8 @@ Status ThreadPoolExecution::Execute(Task* task) { return rep_->Execute(task); }
 
 void ThreadPoolExecution::Shutdown() { rep_->Shutdown(); }
 
+void ThreadPoolExecution::GetStatistics(Statistics* stats) const {
+  rep_->GetStatistics(stats);
+}
+
 }  // namespace enquery
@@ -63,6 +63,43 @@ Status create_pool_test(int num_thread, int num_tasks) {
   return status;
 }
 
+// Ensure that statistics account for every accepted and refused task.
+void statistics_test(int num_thread, int num_tasks) {
+  Status status;
+  ThreadPoolExecution::Settings settings;
+  settings.set_thread_count(num_thread);
+  ThreadPoolExecution* tpe = static_cast<ThreadPoolExecution*>(
+      ThreadPoolExecution::Create(settings, &status));
+  ASSERT_TRUE(status.IsSuccess());
+  int counter = 0;
+  for (int i = 0; i < num_tasks; ++i) {
+    Status s2(tpe->Execute(new IncrementingTask(&counter)));
+    ASSERT_TRUE(s2.IsSuccess());
+  }
+
+  // Snapshots may be taken while the pool is busy.
+  ThreadPoolExecution::Statistics stats;
+  tpe->GetStatistics(&stats);
+  ASSERT_EQUALS(stats.submitted(), static_cast<uint64_t>(num_tasks));
+  ASSERT_TRUE(stats.completed() <= stats.submitted());
+
+  // Once shut down, tasks are refused.
+  tpe->Shutdown();
+  IncrementingTask* late = new IncrementingTask(&counter);
+  Status s3(tpe->Execute(late));
+  ASSERT_TRUE(s3.IsFailure());
+  delete late;
+
+  tpe->GetStatistics(&stats);
+  ASSERT_EQUALS(stats.submitted(), static_cast<uint64_t>(num_tasks));
+  ASSERT_EQUALS(stats.completed(), static_cast<uint64_t>(num_tasks));
+  ASSERT_EQUALS(stats.rejected(), 1u);
+  ASSERT_EQUALS(stats.queued(), 0u);
+  ASSERT_EQUALS(stats.queue_wait().Count(), static_cast<uint64_t>(num_tasks));
+  ASSERT_EQUALS(stats.run_time().Count(), static_cast<uint64_t>(num_tasks));
+  delete tpe;
+}
+
 int main(int argc, char* argv[]) {
   Status status;
 
@@ -103,5 +140,9 @@ int main(int argc, char* argv[]) {
     }
   }
 
+  // Check the statistics for a few pool sizes
+  statistics_test(1, 1000);
+  statistics_test(4, 10000);
+
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,162 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "enquery/timer_queue.h"
+#include <assert.h>
+#include <stdint.h>
+#include <map>
+#include <utility>
+#include "enquery/futures.h"
+#include "enquery/mutex.h"
+#include "enquery/portability.h"
+#include "enquery/scope_lock.h"
+#include "enquery/scope_pointer.h"
+#include "enquery/status.h"
+#include "enquery/thread.h"
+#include "enquery/utility.h"
+
+namespace enquery {
+
+class TimerQueue::Rep {
+ public:
+  Rep()
+      : mutex_("TimerQueue"), next_id_(1), stopping_(false), thread_(NULL) {}
+
+  ~Rep() {
+    if (thread_) {
+      {
+        ScopeLock lock(&mutex_);
+        stopping_ = true;
+        cond_.Signal();
+      }
+      delete thread_;  // Joins.
+    }
+    for (Timers::iterator it = timers_.begin(); it != timers_.end(); ++it) {
+      delete it->second;
+    }
+  }
+
+  Status Init() {
+    Status status;
+    thread_ = Thread::Create(ThreadMain, this, &status);
+    return status;
+  }
+
+  TimerId Schedule(uint64_t delay_nanos, Callback* callback) {
+    assert(callback != NULL);
+    const uint64_t deadline = MonotonicNanos() + delay_nanos;
+    ScopeLock lock(&mutex_);
+    const TimerId id = next_id_++;
+    timers_[Key(deadline, id)] = callback;
+    deadlines_[id] = deadline;
+    // The thread only needs waking if this is now the first timer.
+    if (timers_.begin()->first.second == id) {
+      cond_.Signal();
+    }
+    return id;
+  }
+
+  bool Cancel(TimerId id) {
+    Callback* callback = NULL;
+    {
+      ScopeLock lock(&mutex_);
+      Deadlines::iterator it = deadlines_.find(id);
+      if (it == deadlines_.end()) {
+        return false;
+      }
+      Timers::iterator timer = timers_.find(Key(it->second, id));
+      callback = timer->second;
+      timers_.erase(timer);
+      deadlines_.erase(it);
+    }
+    // The callback may hold references that take locks to release, so
+    // it is deleted outside the mutex.
+    delete callback;
+    return true;
+  }
+
+ private:
+  // Timers are ordered by deadline, then by id, which keeps timers that
+  // share a deadline in the order they were scheduled.
+  typedef std::pair<uint64_t, TimerId> Key;
+  typedef std::map<Key, Callback*> Timers;
+  typedef std::map<TimerId, uint64_t> Deadlines;
+
+  static void* ThreadMain(void* arg) {
+    static_cast<Rep*>(arg)->Run();
+    return NULL;
+  }
+
+  void Run() {
+    mutex_.Lock();
+    while (!stopping_) {
+      if (timers_.empty()) {
+        cond_.Wait(&mutex_);
+        continue;
+      }
+      Timers::iterator first = timers_.begin();
+      if (MonotonicNanos() < first->first.first) {
+        cond_.WaitUntil(&mutex_, first->first.first);
+        continue;
+      }
+      Callback* callback = first->second;
+      deadlines_.erase(first->first.second);
+      timers_.erase(first);
+      mutex_.Unlock();
+      callback->Execute();
+      delete callback;
+      mutex_.Lock();
+    }
+    mutex_.Unlock();
+  }
+
+  Rep(const Rep& no_copy);
+  Rep& operator=(const Rep& no_assign);
+
+  Mutex mutex_;
+  CondVar cond_;
+  Timers timers_;
+  Deadlines deadlines_;
+  TimerId next_id_;
+  bool stopping_;
+  Thread* thread_;
+};
+
+TimerQueue::TimerQueue(Rep* rep) : rep_(rep) { assert(rep != NULL); }
+
+TimerQueue::~TimerQueue() { delete rep_; }
+
+TimerQueue* TimerQueue::Create(Status* status_out) {
+  ScopePointer<Rep> rep(new Rep());
+  Status status = rep->Init();
+  if (status.IsFailure()) {
+    MaybeAssign(status_out, status);
+    return NULL;
+  }
+
+  TimerQueue* queue = new TimerQueue(rep.Get());
+  rep.ReleaseOwnership();
+
+  return queue;
+}
+
+TimerQueue::TimerId TimerQueue::Schedule(uint64_t delay_nanos,
+                                         Callback* callback) {
+  return rep_->Schedule(delay_nanos, callback);
+}
+
+bool TimerQueue::Cancel(TimerId id) { return rep_->Cancel(id); }
+
+}  // namespace enquery
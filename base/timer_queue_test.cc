@@ -0,0 +1,116 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+#include "enquery/futures.h"
+#include "enquery/mutex.h"
+#include "enquery/portability.h"
+#include "enquery/scope_lock.h"
+#include "enquery/status.h"
+#include "enquery/testing.h"
+#include "enquery/timer_queue.h"
+
+using ::enquery::Callback;
+using ::enquery::MonotonicNanos;
+using ::enquery::Mutex;
+using ::enquery::ScopeLock;
+using ::enquery::Status;
+using ::enquery::TimerQueue;
+
+namespace {
+
+const uint64_t kNanosPerMilli = 1000000;
+
+Mutex g_mutex("timer_queue_test");
+std::vector<int> g_ran;  // Tags of the callbacks that have run, in order.
+int g_deleted = 0;       // Callbacks deleted, whether or not they ran.
+
+// Records its tag, and the time it ran, when run.
+class Recorder : public Callback {
+ public:
+  explicit Recorder(int tag, uint64_t* ran_at = NULL)
+      : tag_(tag), ran_at_(ran_at) {}
+  virtual ~Recorder() {
+    ScopeLock lock(&g_mutex);
+    ++g_deleted;
+  }
+  virtual void Execute() {
+    if (ran_at_) {
+      *ran_at_ = MonotonicNanos();
+    }
+    ScopeLock lock(&g_mutex);
+    g_ran.push_back(tag_);
+  }
+
+ private:
+  const int tag_;
+  uint64_t* const ran_at_;
+};
+
+size_t RanCount() {
+  ScopeLock lock(&g_mutex);
+  return g_ran.size();
+}
+
+void WaitForRuns(size_t count) {
+  while (RanCount() < count) {
+    usleep(1000);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  Status status;
+  TimerQueue* queue = TimerQueue::Create(&status);
+  ASSERT_TRUE(status.IsSuccess());
+
+  // Callbacks run in deadline order, not in the order scheduled, and not
+  // before their time.
+  uint64_t ran_at = 0;
+  const uint64_t scheduled_at = MonotonicNanos();
+  queue->Schedule(30 * kNanosPerMilli, new Recorder(3, &ran_at));
+  queue->Schedule(10 * kNanosPerMilli, new Recorder(1));
+  queue->Schedule(20 * kNanosPerMilli, new Recorder(2));
+  WaitForRuns(3);
+  ASSERT_EQUALS(g_ran[0], 1);
+  ASSERT_EQUALS(g_ran[1], 2);
+  ASSERT_EQUALS(g_ran[2], 3);
+  ASSERT_TRUE(ran_at >= scheduled_at + 30 * kNanosPerMilli);
+
+  // A cancelled callback is deleted without running; one that has run
+  // can't be cancelled.
+  const TimerQueue::TimerId cancelled =
+      queue->Schedule(10 * kNanosPerMilli, new Recorder(4));
+  const TimerQueue::TimerId kept = queue->Schedule(0, new Recorder(5));
+  ASSERT_TRUE(queue->Cancel(cancelled));
+  ASSERT_FALSE(queue->Cancel(cancelled));
+  WaitForRuns(4);
+  usleep(20000);
+  ASSERT_EQUALS(RanCount(), 4u);
+  ASSERT_EQUALS(g_ran[3], 5);
+  ASSERT_FALSE(queue->Cancel(kept));
+  ASSERT_EQUALS(g_deleted, 5);
+
+  // Callbacks still waiting when the queue is destroyed are deleted.
+  queue->Schedule(60000 * kNanosPerMilli, new Recorder(6));
+  delete queue;
+  ASSERT_EQUALS(RanCount(), 4u);
+  ASSERT_EQUALS(g_deleted, 6);
+
+  return EXIT_SUCCESS;
+}
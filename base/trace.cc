@@ -0,0 +1,256 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "enquery/trace.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "enquery/mutex.h"
+#include "enquery/portability.h"
+#include "enquery/scope_lock.h"
+#include "enquery/status.h"
+
+namespace {
+
+// Ring size used if recording starts without a call to Enable().
+const size_t kDefaultEventsPerThread = 1 << 16;
+
+// Phase used internally for events recorded with RecordComplete().
+const char kPhaseComplete = 'X';
+
+struct Event {
+  uint64_t timestamp;
+  uint64_t value;  // Flow id, or duration for complete events.
+  const char* category;
+  const char* name;
+  char phase;
+};
+
+// A single-writer ring of events. The owning thread fills a slot and then
+// publishes it by advancing 'head' with release semantics; a reader that
+// loads 'head' with acquire semantics sees every slot before it. Slots
+// the writer may have overwritten while a reader copied them are detected
+// by re-reading 'head' afterwards and are discarded.
+struct ThreadBuffer {
+  ThreadBuffer(size_t capacity, int thread_id)
+      : events(capacity),
+        mask(capacity - 1),
+        head(0),
+        floor(0),
+        tid(thread_id) {}
+  std::vector<Event> events;
+  const uint64_t mask;
+  uint64_t head;   // Written only by the owning thread.
+  uint64_t floor;  // Events before this index were cleared.
+  const int tid;
+};
+
+enquery::Mutex g_registry_mutex("Tracer::registry");
+
+// All buffers ever created. Buffers are never freed, because the thread
+// that owns a buffer holds a pointer to it for its whole life; their
+// number is bounded by the number of threads that recorded events.
+std::vector<ThreadBuffer*> g_buffers;
+
+size_t g_events_per_thread = kDefaultEventsPerThread;
+
+__thread ThreadBuffer* t_buffer = NULL;
+
+size_t RoundUpToPowerOfTwo(size_t n) {
+  size_t result = 1;
+  while (result < n) {
+    result <<= 1;
+  }
+  return result;
+}
+
+ThreadBuffer* GetThreadBuffer() {
+  if (t_buffer == NULL) {
+    enquery::ScopeLock lock(&g_registry_mutex);
+    t_buffer = new ThreadBuffer(g_events_per_thread,
+                                static_cast<int>(g_buffers.size()) + 1);
+    g_buffers.push_back(t_buffer);
+  }
+  return t_buffer;
+}
+
+void Append(char phase, const char* category, const char* name,
+            uint64_t timestamp, uint64_t value) {
+  ThreadBuffer* buffer = GetThreadBuffer();
+  const uint64_t head = buffer->head;
+  Event& event = buffer->events[head & buffer->mask];
+  event.timestamp = timestamp;
+  event.value = value;
+  event.category = category;
+  event.name = name;
+  event.phase = phase;
+  __atomic_store_n(&buffer->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// Append 'str' to 'out' as a JSON string literal.
+void AppendJsonString(const char* str, std::string* out) {
+  out->push_back('"');
+  for (const char* p = str ? str : ""; *p; ++p) {
+    const char c = *p;
+    if (c == '"' || c == '\\') {
+      out->push_back('\\');
+      out->push_back(c);
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      out->append(escaped);
+    } else {
+      out->push_back(c);
+    }
+  }
+  out->push_back('"');
+}
+
+void AppendEventJson(const Event& event, int pid, int tid, std::string* out) {
+  char buf[160];
+  out->append("{\"name\":");
+  AppendJsonString(event.name, out);
+  out->append(",\"cat\":");
+  AppendJsonString(event.category, out);
+  snprintf(buf, sizeof(buf),
+           ",\"ph\":\"%c\",\"ts\":%" PRIu64 ".%03u,\"pid\":%d,\"tid\":%d",
+           event.phase, event.timestamp / 1000,
+           static_cast<unsigned>(event.timestamp % 1000), pid, tid);
+  out->append(buf);
+
+  switch (event.phase) {
+    case kPhaseComplete:
+      snprintf(buf, sizeof(buf), ",\"dur\":%" PRIu64 ".%03u",
+               event.value / 1000, static_cast<unsigned>(event.value % 1000));
+      out->append(buf);
+      break;
+    case enquery::Tracer::INSTANT:
+      out->append(",\"s\":\"t\"");
+      break;
+    case enquery::Tracer::FLOW_START:
+    case enquery::Tracer::FLOW_END:
+      // Flow ids are typically addresses; emit them as strings so that
+      // 64-bit values survive JSON number parsing. Binding the end to the
+      // enclosing slice ("bp":"e") attaches it to the task that starts.
+      snprintf(buf, sizeof(buf), ",\"id\":\"0x%" PRIx64 "\"%s", event.value,
+               event.phase == enquery::Tracer::FLOW_END ? ",\"bp\":\"e\"" : "");
+      out->append(buf);
+      break;
+    default:
+      break;
+  }
+  out->push_back('}');
+}
+
+}  // namespace
+
+namespace enquery {
+
+bool Tracer::enabled_ = false;
+
+void Tracer::Enable(size_t events_per_thread) {
+  {
+    ScopeLock lock(&g_registry_mutex);
+    g_events_per_thread =
+        RoundUpToPowerOfTwo(events_per_thread ? events_per_thread : 1);
+  }
+  __atomic_store_n(&enabled_, true, __ATOMIC_RELAXED);
+}
+
+void Tracer::Disable() {
+  __atomic_store_n(&enabled_, false, __ATOMIC_RELAXED);
+}
+
+void Tracer::Record(Phase phase, const char* category, const char* name,
+                    uint64_t id) {
+  Append(static_cast<char>(phase), category, name, MonotonicNanos(), id);
+}
+
+void Tracer::RecordComplete(const char* category, const char* name,
+                            uint64_t start_nanos, uint64_t duration_nanos) {
+  Append(kPhaseComplete, category, name, start_nanos, duration_nanos);
+}
+
+void Tracer::Clear() {
+  ScopeLock lock(&g_registry_mutex);
+  for (size_t i = 0; i < g_buffers.size(); ++i) {
+    ThreadBuffer* buffer = g_buffers[i];
+    buffer->floor = __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE);
+  }
+}
+
+void Tracer::WriteJson(std::string* out) {
+  const int pid = static_cast<int>(getpid());
+  std::vector<Event> events;
+  bool first = true;
+
+  out->clear();
+  out->append("{\"traceEvents\":[");
+
+  ScopeLock lock(&g_registry_mutex);
+  for (size_t i = 0; i < g_buffers.size(); ++i) {
+    ThreadBuffer* buffer = g_buffers[i];
+    const uint64_t capacity = buffer->mask + 1;
+    const uint64_t head = __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE);
+    uint64_t start = head > capacity ? head - capacity : 0;
+    if (start < buffer->floor) {
+      start = buffer->floor;
+    }
+
+    events.clear();
+    for (uint64_t n = start; n < head; ++n) {
+      events.push_back(buffer->events[n & buffer->mask]);
+    }
+
+    // Anything the writer lapped while we copied is unreliable, as is the
+    // slot it may be writing now (for index 'after'.)
+    const uint64_t after = __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE);
+    const uint64_t valid = after + 1 > capacity ? after + 1 - capacity : 0;
+    const size_t skip = valid > start ? static_cast<size_t>(valid - start) : 0;
+
+    for (size_t e = skip; e < events.size(); ++e) {
+      if (!first) {
+        out->push_back(',');
+      }
+      first = false;
+      AppendEventJson(events[e], pid, buffer->tid, out);
+    }
+  }
+
+  out->append("],\"displayTimeUnit\":\"ns\"}\n");
+}
+
+Status Tracer::WriteJsonFile(const char* path) {
+  std::string json;
+  WriteJson(&json);
+  FILE* file = fopen(path, "w");
+  if (file == NULL) {
+    return Status::MakeFromSystemError(errno);
+  }
+  const size_t written = fwrite(json.data(), 1, json.size(), file);
+  const int error = ferror(file) ? errno : 0;
+  fclose(file);
+  if (written != json.size()) {
+    return Status::MakeFromSystemError(error ? error : EIO);
+  }
+  return Status::OK();
+}
+
+}  // namespace enquery
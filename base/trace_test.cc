@@ -0,0 +1,131 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string>
+#include "enquery/atomic.h"
+#include "enquery/thread_pool_execution.h"
+#include "enquery/testing.h"
+#include "enquery/trace.h"
+
+using ::enquery::AtomicIncrement;
+using ::enquery::Execution;
+using ::enquery::Status;
+using ::enquery::Task;
+using ::enquery::ThreadPoolExecution;
+using ::enquery::TraceScope;
+using ::enquery::Tracer;
+
+namespace {
+
+const char* const kNames[] = {"e0", "e1", "e2", "e3", "e4",
+                              "e5", "e6", "e7", "e8", "e9"};
+
+class IncrementingTask : public Task {
+ public:
+  explicit IncrementingTask(int* counter) : counter_(counter) {}
+  virtual ~IncrementingTask() {}
+  virtual void Run() { AtomicIncrement(counter_); }
+
+ private:
+  int* counter_;
+};
+
+bool Contains(const std::string& json, const char* text) {
+  return json.find(text) != std::string::npos;
+}
+
+// Records all of kNames, in order, on a fresh thread.
+void* RecordNames(void*) {
+  for (size_t i = 0; i < sizeof(kNames) / sizeof(kNames[0]); ++i) {
+    ENQUERY_TRACE(Tracer::INSTANT, "test", kNames[i], 0);
+  }
+  return NULL;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::string json;
+
+  // Nothing is recorded while tracing is disabled.
+  ASSERT_FALSE(Tracer::IsEnabled());
+  ENQUERY_TRACE(Tracer::INSTANT, "test", "disabled", 0);
+  { TraceScope scope("test", "disabled.scope"); }
+  Tracer::WriteJson(&json);
+  ASSERT_FALSE(Contains(json, "disabled"));
+  ASSERT_TRUE(Contains(json, "\"traceEvents\":[]"));
+
+  // Scopes, instants and complete events are written once enabled.
+  Tracer::Enable(1024);
+  ASSERT_TRUE(Tracer::IsEnabled());
+  { TraceScope scope("test", "scope"); }
+  ENQUERY_TRACE(Tracer::INSTANT, "test", "instant", 0);
+  Tracer::RecordComplete("test", "complete", 2000, 1500);
+  Tracer::WriteJson(&json);
+  ASSERT_TRUE(Contains(json, "\"name\":\"scope\",\"cat\":\"test\","
+                             "\"ph\":\"B\""));
+  ASSERT_TRUE(Contains(json, "\"name\":\"scope\",\"cat\":\"test\","
+                             "\"ph\":\"E\""));
+  ASSERT_TRUE(Contains(json, "\"name\":\"instant\""));
+  ASSERT_TRUE(Contains(json, "\"ph\":\"X\",\"ts\":2.000"));
+  ASSERT_TRUE(Contains(json, "\"dur\":1.500"));
+
+  // Clearing discards everything recorded so far.
+  Tracer::Clear();
+  Tracer::WriteJson(&json);
+  ASSERT_TRUE(Contains(json, "\"traceEvents\":[]"));
+
+  // Thread pool tasks are traced, with flows from submission to run.
+  Status status;
+  ThreadPoolExecution::Settings settings;
+  settings.set_thread_count(2);
+  Execution* pool = ThreadPoolExecution::Create(settings, &status);
+  ASSERT_TRUE(status.IsSuccess());
+  int counter = 0;
+  for (int i = 0; i < 10; ++i) {
+    ASSERT_TRUE(pool->Execute(new IncrementingTask(&counter)).IsSuccess());
+  }
+  delete pool;
+  ASSERT_EQUALS(counter, 10);
+  Tracer::WriteJson(&json);
+  ASSERT_TRUE(Contains(json, "\"name\":\"task.run\""));
+  ASSERT_TRUE(Contains(json, "\"ph\":\"s\""));
+  ASSERT_TRUE(Contains(json, "\"ph\":\"f\""));
+  ASSERT_TRUE(Contains(json, "\"bp\":\"e\""));
+
+  // When a thread's ring is full, the oldest events are overwritten. The
+  // oldest slot left is the next the writer would fill, and so isn't
+  // trusted either.
+  Tracer::Clear();
+  Tracer::Enable(4);
+  pthread_t thread;
+  ASSERT_EQUALS(pthread_create(&thread, NULL, RecordNames, NULL), 0);
+  ASSERT_EQUALS(pthread_join(thread, NULL), 0);
+  Tracer::WriteJson(&json);
+  ASSERT_FALSE(Contains(json, "\"e6\""));
+  for (int i = 7; i < 10; ++i) {
+    ASSERT_TRUE(Contains(json, kNames[i]));
+  }
+
+  // Events recorded earlier are kept when tracing is disabled.
+  Tracer::Disable();
+  ASSERT_FALSE(Tracer::IsEnabled());
+  Tracer::WriteJson(&json);
+  ASSERT_TRUE(Contains(json, "\"e9\""));
+
+  return EXIT_SUCCESS;
+}
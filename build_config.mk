@@ -0,0 +1,9 @@
+BASE_FILES=base/buffer.cc base/epoll_reactor.cc base/histogram.cc base/io_uring_reactor.cc base/mutex.cc base/portability.cc base/reactor.cc base/scope_lock.cc base/status.cc base/thread.cc base/thread_pool_execution.cc base/timer_queue.cc base/trace.cc 
+CPPLINT_SOURCES=include/enquery/async_http_client.h include/enquery/atomic.h include/enquery/balancing_http_client.h include/enquery/batching_http_client.h include/enquery/benchmark.h include/enquery/buffer.h include/enquery/caching_http_client.h include/enquery/coalescing_http_client.h include/enquery/execution.h include/enquery/executive.h include/enquery/futures.h include/enquery/hedging_http_client.h include/enquery/histogram.h include/enquery/http.h include/enquery/http_client.h include/enquery/http_request.h include/enquery/http_request_template.h include/enquery/http_response.h include/enquery/limiting_http_client.h include/enquery/mutex.h include/enquery/portability.h include/enquery/reactor.h include/enquery/retrying_http_client.h include/enquery/scope_lock.h include/enquery/scope_pointer.h include/enquery/shared.h include/enquery/shared_pointer.h include/enquery/slice.h include/enquery/status.h include/enquery/task.h include/enquery/testing.h include/enquery/thread.h include/enquery/thread_pool_execution.h include/enquery/timer_queue.h include/enquery/trace.h include/enquery/utility.h  base/atomic_test.cc base/buffer.cc base/buffer_bench.cc base/buffer_test.cc base/epoll_reactor.cc base/executive_bench.cc base/executive_test.cc base/futures_bench.cc base/futures_test.cc base/histogram.cc base/histogram_test.cc base/io_uring_reactor.cc base/mutex.cc base/mutex_test.cc base/portability.cc base/reactor.cc base/reactor_bench.cc base/reactor_test.cc base/scope_lock.cc base/shared_pointer_bench.cc base/shared_pointer_test.cc base/shared_test.cc base/status.cc base/status_bench.cc base/status_test.cc base/thread.cc base/thread_pool_execution.cc base/thread_pool_execution_test.cc base/timer_queue.cc base/timer_queue_test.cc base/trace.cc base/trace_test.cc  base/epoll_reactor.h base/io_uring_reactor.h  http/balancing_http_client.cc http/balancing_http_client_test.cc http/batching_http_client.cc http/batching_http_client_test.cc http/caching_http_client.cc http/caching_http_client_test.cc http/coalescing_http_client.cc http/coalescing_http_client_test.cc http/curl_async_http_client.cc http/curl_async_http_client_test.cc http/curl_http.cc http/curl_http_client.cc http/curl_http_client_bench.cc http/curl_http_client_test.cc http/curl_http_response.cc http/curl_http_test.cc http/curl_request.cc http/curl_share.cc http/hedging_http_client.cc http/hedging_http_client_test.cc http/http.cc http/http1_codec.cc http/http1_codec_test.cc http/http2_test_session.cc http/http_client_test.cc http/http_request.cc http/http_request_template.cc http/http_request_template_test.cc http/http_request_test.cc http/http_response.cc http/http_test.cc http/http_test_client.cc http/http_test_server.cc http/http_test_server_test.cc http/http_util.cc http/limiting_http_client.cc http/limiting_http_client_test.cc http/native_async_http_client.cc http/native_http.cc http/native_http_client.cc http/native_http_client_test.cc http/retrying_http_client.cc http/retrying_http_client_test.cc http/shared_http_response.cc  http/curl_async_http_client.h http/curl_http.h http/curl_http_client.h http/curl_http_response.h http/curl_request.h http/curl_share.h http/http1_codec.h http/http2_test_session.h http/http_test_client.h http/http_test_server.h http/http_util.h http/native_async_http_client.h http/native_http.h http/native_http_client.h http/shared_http_response.h  dev/load_generator.cc  
+CXX=g++
+FEATURES= -DHAVE_IO_URING -DHAVE_ZLIB
+HTTP_FILES=http/balancing_http_client.cc http/batching_http_client.cc http/caching_http_client.cc http/coalescing_http_client.cc http/curl_async_http_client.cc http/curl_http.cc http/curl_http_client.cc http/curl_http_response.cc http/curl_request.cc http/curl_share.cc http/hedging_http_client.cc http/http.cc http/http1_codec.cc http/http_request.cc http/http_request_template.cc http/http_response.cc http/http_util.cc http/limiting_http_client.cc http/native_async_http_client.cc http/native_http.cc http/native_http_client.cc http/retrying_http_client.cc http/shared_http_response.cc 
+LIBRARIES=-lpthread -L/root/miniconda/lib -lcurl -Wl,-rpath,/root/miniconda/lib -lz
+LINT_TOOL=./scripts/fakelint.sh
+PLATFORM=OS_LINUX
+PLATFORM_CXXFLAGS=-DOS_LINUX
@@ -0,0 +1,525 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+// load_generator drives an HTTP server with the library's own clients, in
+// the manner of wrk, and reports throughput and latency percentiles.
+//
+//   load_generator --url=http://127.0.0.1:8080/4096 --threads=2
+//       --connections=64 --duration=10 [--rate=20000]
+//
+// Each of the --threads workers runs as a task on an Executive backed by
+// a thread pool, and owns an AsyncHttpClient with its share of the
+// --connections. Without --rate the load is a closed loop: every
+// connection sends its next request as soon as the last is answered.
+// With --rate, requests are sent on a fixed schedule whatever the server
+// does (an open loop), and each latency is measured from when its request
+// was due to be sent rather than from when it was, so that a server that
+// stalls is charged for the requests it held up ("coordinated omission.")
+// A closed loop can only measure service time, and says so.
+//
+// --sync drives a synchronous HttpClient from each worker instead, so the
+// number of connections is the number of threads.
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "enquery/async_http_client.h"
+#include "enquery/executive.h"
+#include "enquery/futures.h"
+#include "enquery/histogram.h"
+#include "enquery/http.h"
+#include "enquery/http_client.h"
+#include "enquery/http_request.h"
+#include "enquery/http_response.h"
+#include "enquery/mutex.h"
+#include "enquery/portability.h"
+#include "enquery/scope_lock.h"
+#include "enquery/shared.h"
+#include "enquery/status.h"
+#include "enquery/thread_pool_execution.h"
+
+using ::enquery::AsyncHttpClient;
+using ::enquery::CondVar;
+using ::enquery::Execution;
+using ::enquery::Executive;
+using ::enquery::Future;
+using ::enquery::Histogram;
+using ::enquery::Http;
+using ::enquery::HttpClient;
+using ::enquery::HttpRequest;
+using ::enquery::HttpResponse;
+using ::enquery::HttpResult;
+using ::enquery::MonotonicNanos;
+using ::enquery::Mutex;
+using ::enquery::ScopeLock;
+using ::enquery::Shared;
+using ::enquery::Status;
+using ::enquery::ThreadPoolExecution;
+
+namespace {
+
+const uint64_t kNanosPerSecond = 1000000000ULL;
+
+// Requests an open loop may have waiting for each connection before it
+// falls behind its schedule. Time spent behind still counts as latency.
+const int kQueuedPerConnection = 16;
+
+struct Options {
+  Options()
+      : threads(2),
+        connections(16),
+        duration_seconds(10),
+        rate(0),
+        pipeline(1),
+        timeout_ms(0),
+        native(false),
+        sync(false) {}
+  std::string url;
+  int threads;
+  int connections;
+  double duration_seconds;
+  double rate;  // Requests per second in all, or zero for a closed loop.
+  int pipeline;
+  int timeout_ms;
+  bool native;
+  bool sync;
+};
+
+// What a worker measured. Latencies are in nanoseconds.
+struct Results {
+  Results() : completed(0), errors(0), non_2xx(0), unsent(0), body_bytes(0) {}
+
+  void Merge(const Results& other) {
+    latency.Merge(other.latency);
+    service_time.Merge(other.service_time);
+    completed += other.completed;
+    errors += other.errors;
+    non_2xx += other.non_2xx;
+    unsent += other.unsent;
+    body_bytes += other.body_bytes;
+  }
+
+  Histogram latency;       // From when each request was due to be sent.
+  Histogram service_time;  // From when each request was sent.
+  uint64_t completed;
+  uint64_t errors;
+  uint64_t non_2xx;
+  uint64_t unsent;  // Due before the end, but never sent.
+  uint64_t body_bytes;
+};
+
+class Worker;
+
+// A request in flight on an AsyncHttpClient.
+struct Pending {
+  Worker* worker;
+  uint64_t due;
+  uint64_t sent;
+  Future<HttpResult> future;
+};
+
+// Sends one worker's share of the load until its end time.
+class Worker {
+ public:
+  Worker(const Options& options, Http* http, int index)
+      : options_(options),
+        http_(http),
+        index_(index),
+        mutex_("load_generator::Worker"),
+        in_flight_(0),
+        start_(0),
+        end_(0) {
+    // Connections (and the rate) are shared out as evenly as they go.
+    connections_ = options.connections / options.threads +
+                   (index < options.connections % options.threads ? 1 : 0);
+    if (connections_ < 1 || options.sync) {
+      connections_ = 1;
+    }
+  }
+
+  // Send requests from 'start' until 'end', then wait for the answers.
+  void Prepare(uint64_t start, uint64_t end) {
+    start_ = start;
+    end_ = end;
+  }
+
+  const Results& results() const { return results_; }
+
+  // Run 'worker', on a thread of the Executive.
+  static Status Run(Worker* worker) {
+    return worker->options_.sync ? worker->RunSync() : worker->RunAsync();
+  }
+
+ private:
+  Worker(const Worker& no_copy);
+  Worker& operator=(const Worker& no_assign);
+
+  // Return the time between this worker's requests in an open loop, or
+  // zero in a closed one.
+  uint64_t Interval() const {
+    if (options_.rate <= 0) {
+      return 0;
+    }
+    const double share =
+        options_.rate * connections_ /
+        (options_.sync ? options_.threads : options_.connections);
+    return static_cast<uint64_t>(kNanosPerSecond / share);
+  }
+
+  // Return the time this worker's first request is due. Open loop workers
+  // are staggered across one interval so that they don't send together.
+  uint64_t FirstDue(uint64_t interval) const {
+    return start_ + interval * index_ / options_.threads;
+  }
+
+  // Sleep until 'deadline'.
+  static void SleepUntil(uint64_t deadline) {
+    const uint64_t now = MonotonicNanos();
+    if (deadline <= now) {
+      return;
+    }
+    struct timespec ts;
+    ts.tv_sec = (deadline - now) / kNanosPerSecond;
+    ts.tv_nsec = (deadline - now) % kNanosPerSecond;
+    nanosleep(&ts, NULL);
+  }
+
+  // Record the outcome of a request due at 'due' and sent at 'sent'.
+  // Called with mutex_ held.
+  void Record(const Status& status, const HttpResponse* response,
+              uint64_t due, uint64_t sent, uint64_t done) {
+    if (status.IsFailure() || response == NULL) {
+      ++results_.errors;
+      return;
+    }
+    ++results_.completed;
+    if (response->StatusCode() < 200 || response->StatusCode() > 299) {
+      ++results_.non_2xx;
+    }
+    results_.body_bytes += response->BodySize();
+    results_.latency.Record(done - due);
+    results_.service_time.Record(done - sent);
+  }
+
+  // In an open loop, record the requests due from 'due' until the end
+  // that were never sent, each as having waited at least until the end:
+  // a server that stalls as the run ends still held them up.
+  void RecordUnsent(uint64_t due, uint64_t interval) {
+    if (interval == 0) {
+      return;
+    }
+    ScopeLock lock(&mutex_);
+    for (; due < end_; due += interval) {
+      ++results_.unsent;
+      results_.latency.Record(end_ - due);
+    }
+  }
+
+  Status RunSync() {
+    Status status;
+    Shared<HttpClient>::Ptr client(http_->CreateClient(
+        HttpClient::Settings().set_timeout_ms(options_.timeout_ms), &status));
+    if (status.IsFailure()) {
+      return status;
+    }
+    HttpRequest request;
+    request.set_uri(options_.url.c_str());
+    const uint64_t interval = Interval();
+    uint64_t due = FirstDue(interval);
+    for (;;) {
+      SleepUntil(due);
+      const uint64_t sent = MonotonicNanos();
+      if (sent >= end_) {
+        RecordUnsent(due, interval);
+        break;
+      }
+      Shared<HttpResponse>::Ptr response(
+          client->SendRequest(request, &status));
+      const uint64_t done = MonotonicNanos();
+      {
+        ScopeLock lock(&mutex_);
+        Record(status, response.get(), interval ? due : sent, sent, done);
+      }
+      due = interval ? due + interval : done;
+    }
+    return Status::OK();
+  }
+
+  Status RunAsync() {
+    Status status;
+    Shared<AsyncHttpClient>::Ptr client(http_->CreateAsyncClient(
+        AsyncHttpClient::Settings()
+            .set_io_thread_count(1)
+            .set_max_connections_per_host(connections_)
+            .set_max_pipelined_requests(options_.pipeline)
+            .set_timeout_ms(options_.timeout_ms),
+        &status));
+    if (status.IsFailure()) {
+      return status;
+    }
+    HttpRequest request;
+    request.set_uri(options_.url.c_str());
+    const uint64_t interval = Interval();
+
+    // A closed loop keeps one request per connection (or per pipeline
+    // slot) in flight; an open loop lets more wait.
+    const int window = connections_ * std::max(1, options_.pipeline) *
+                       (interval ? kQueuedPerConnection : 1);
+    uint64_t due = FirstDue(interval);
+    for (;;) {
+      SleepUntil(due);
+      {
+        ScopeLock lock(&mutex_);
+        while (in_flight_ >= window && MonotonicNanos() < end_) {
+          cond_.WaitUntil(&mutex_, end_);
+        }
+      }
+      const uint64_t sent = MonotonicNanos();
+      if (sent >= end_) {
+        RecordUnsent(due, interval);
+        break;
+      }
+      Pending* pending = new Pending();
+      pending->worker = this;
+      pending->due = interval ? due : sent;
+      pending->sent = sent;
+      status = client->SendRequest(request, &pending->future);
+      if (status.IsFailure()) {
+        delete pending;
+        return status;
+      }
+      {
+        ScopeLock lock(&mutex_);
+        ++in_flight_;
+      }
+      pending->future.Notify(OnComplete, pending);
+      due = interval ? due + interval : sent;
+    }
+
+    // Wait for the answers to the requests already sent.
+    ScopeLock lock(&mutex_);
+    while (in_flight_ > 0) {
+      cond_.Wait(&mutex_);
+    }
+    return Status::OK();
+  }
+
+  static void OnComplete(Pending* pending) {
+    const uint64_t done = MonotonicNanos();
+    HttpResult result = pending->future.GetValue();
+    Worker* worker = pending->worker;
+    {
+      ScopeLock lock(&worker->mutex_);
+      worker->Record(result.status(), result.response(), pending->due,
+                     pending->sent, done);
+      --worker->in_flight_;
+      worker->cond_.Signal();
+    }
+    delete pending;
+  }
+
+  const Options options_;
+  Http* const http_;
+  const int index_;
+  int connections_;
+
+  // Guards the members below, which the client's I/O thread updates.
+  Mutex mutex_;
+  CondVar cond_;
+  int in_flight_;
+  Results results_;
+
+  uint64_t start_;
+  uint64_t end_;
+};
+
+void PrintUsage(const char* program) {
+  fprintf(stderr,
+          "usage: %s --url=URL [--threads=N] [--connections=N] "
+          "[--duration=SECONDS]\n"
+          "       [--rate=REQUESTS_PER_SECOND] [--engine=curl|native] "
+          "[--pipeline=N]\n"
+          "       [--timeout_ms=N] [--sync]\n",
+          program);
+}
+
+bool ParseOptions(int argc, char* argv[], Options* options) {
+  for (int i = 1; i < argc; ++i) {
+    const char* arg = argv[i];
+    if (strncmp(arg, "--url=", 6) == 0) {
+      options->url = arg + 6;
+    } else if (strncmp(arg, "--threads=", 10) == 0) {
+      options->threads = atoi(arg + 10);
+    } else if (strncmp(arg, "--connections=", 14) == 0) {
+      options->connections = atoi(arg + 14);
+    } else if (strncmp(arg, "--duration=", 11) == 0) {
+      options->duration_seconds = atof(arg + 11);
+    } else if (strncmp(arg, "--rate=", 7) == 0) {
+      options->rate = atof(arg + 7);
+    } else if (strncmp(arg, "--pipeline=", 11) == 0) {
+      options->pipeline = atoi(arg + 11);
+    } else if (strncmp(arg, "--timeout_ms=", 13) == 0) {
+      options->timeout_ms = atoi(arg + 13);
+    } else if (strcmp(arg, "--engine=curl") == 0) {
+      options->native = false;
+    } else if (strcmp(arg, "--engine=native") == 0) {
+      options->native = true;
+    } else if (strcmp(arg, "--sync") == 0) {
+      options->sync = true;
+    } else {
+      return false;
+    }
+  }
+  if (options->sync) {
+    options->connections = options->threads;
+  }
+  return !options->url.empty() && options->threads > 0 &&
+         options->connections >= options->threads &&
+         options->duration_seconds > 0 && options->rate >= 0 &&
+         options->pipeline > 0;
+}
+
+const double kPercentiles[] = {50, 90, 99, 99.9, 99.99};
+const size_t kPercentileCount = sizeof(kPercentiles) / sizeof(kPercentiles[0]);
+
+// Print the heading of a table of latencies.
+void PrintLatencyHeading() {
+  printf("  %-14s %9s", "latency (ms)", "mean");
+  for (size_t i = 0; i < kPercentileCount; ++i) {
+    char label[16];
+    snprintf(label, sizeof(label), "p%g", kPercentiles[i]);
+    printf(" %9s", label);
+  }
+  printf(" %9s\n", "max");
+}
+
+// Print a latency distribution, in milliseconds.
+void PrintLatency(const char* label, const Histogram& histogram) {
+  printf("  %-14s %9.3f", label, histogram.Mean() / 1e6);
+  for (size_t i = 0; i < kPercentileCount; ++i) {
+    printf(" %9.3f", histogram.Percentile(kPercentiles[i]) / 1e6);
+  }
+  printf(" %9.3f\n", histogram.Max() / 1e6);
+}
+
+void PrintResults(const Options& options, const Results& results,
+                  uint64_t elapsed) {
+  const double seconds = static_cast<double>(elapsed) / kNanosPerSecond;
+  printf("%" PRIu64 " requests in %.2fs, %.1f MB of bodies read\n",
+         results.completed, seconds, results.body_bytes / 1e6);
+  if (results.errors > 0 || results.non_2xx > 0) {
+    printf("  errors: %" PRIu64 ", non-2xx responses: %" PRIu64 "\n",
+           results.errors, results.non_2xx);
+  }
+  printf("  throughput: %.1f requests/s\n", results.completed / seconds);
+  PrintLatencyHeading();
+  if (options.rate > 0) {
+    PrintLatency("corrected", results.latency);
+    PrintLatency("service time", results.service_time);
+    printf("  (corrected latency is measured from when each request was "
+           "due to be sent)\n");
+    if (results.unsent > 0) {
+      printf("  (%" PRIu64 " requests due before the end were never sent; "
+             "they count in\n   corrected latency as waiting until the "
+             "end)\n",
+             results.unsent);
+    }
+  } else {
+    PrintLatency("service time", results.service_time);
+    printf("  (closed loop: latency is not corrected for coordinated "
+           "omission; use --rate)\n");
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  Options options;
+  if (!ParseOptions(argc, argv, &options)) {
+    PrintUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  Status status;
+  Shared<Http>::Ptr http(Http::Create(
+      options.native ? ::enquery::HTTP_ENGINE_NATIVE
+                     : ::enquery::HTTP_ENGINE_CURL,
+      &status));
+  if (status.IsFailure()) {
+    fprintf(stderr, "failed to create http: %s\n", status.GetMessage());
+    return EXIT_FAILURE;
+  }
+  Execution* pool = ThreadPoolExecution::Create(
+      ThreadPoolExecution::Settings().set_thread_count(options.threads),
+      &status);
+  if (pool == NULL) {
+    fprintf(stderr, "failed to create thread pool: %s\n", status.GetMessage());
+    return EXIT_FAILURE;
+  }
+  Shared<Executive>::Ptr executive(Executive::Create(
+      Executive::DefaultSettings().set_execution(pool).set_take_ownership(
+          true)));
+
+  printf("Running %.0fs test @ %s\n", options.duration_seconds,
+         options.url.c_str());
+  printf("  %d threads and %d connections, ", options.threads,
+         options.connections);
+  if (options.rate > 0) {
+    printf("%.0f requests/s\n", options.rate);
+  } else {
+    printf("closed loop\n");
+  }
+
+  std::vector<Worker*> workers;
+  for (int i = 0; i < options.threads; ++i) {
+    workers.push_back(new Worker(options, http.get(), i));
+  }
+  const uint64_t start = MonotonicNanos();
+  const uint64_t end =
+      start + static_cast<uint64_t>(options.duration_seconds * kNanosPerSecond);
+  std::vector<Future<Status> > futures(workers.size());
+  for (size_t i = 0; i < workers.size(); ++i) {
+    workers[i]->Prepare(start, end);
+    status = executive->Submit(Worker::Run, workers[i], &futures[i]);
+    if (status.IsFailure()) {
+      fprintf(stderr, "failed to start worker: %s\n", status.GetMessage());
+      return EXIT_FAILURE;
+    }
+  }
+
+  Results results;
+  bool failed = false;
+  for (size_t i = 0; i < workers.size(); ++i) {
+    status = futures[i].GetValue();
+    if (status.IsFailure()) {
+      fprintf(stderr, "worker failed: %s\n", status.GetMessage());
+      failed = true;
+    }
+    results.Merge(workers[i]->results());
+  }
+  const uint64_t elapsed = MonotonicNanos() - start;
+  for (size_t i = 0; i < workers.size(); ++i) {
+    delete workers[i];
+  }
+
+  PrintResults(options, results, elapsed);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
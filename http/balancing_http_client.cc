@@ -0,0 +1,346 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "enquery/balancing_http_client.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <set>
+#include <string>
+#include <vector>
+#include "enquery/futures.h"
+#include "enquery/http_request.h"
+#include "enquery/http_response.h"
+#include "enquery/mutex.h"
+#include "enquery/portability.h"
+#include "enquery/scope_lock.h"
+#include "enquery/scope_pointer.h"
+#include "enquery/shared.h"
+#include "enquery/status.h"
+#include "enquery/utility.h"
+#include "http/http_util.h"
+
+namespace enquery {
+
+namespace {
+
+const char kModule[] = "BalancingHttpClient";
+
+const uint64_t kNanosPerMilli = 1000000;
+
+}  // namespace
+
+class BalancingHttpClient::Rep {
+ public:
+  Rep(AsyncHttpClient* client, const Settings& settings)
+      : client_(client),
+        settings_(settings),
+        mutex_("BalancingHttpClient"),
+        endpoints_(settings.endpoints().size()),
+        random_(MonotonicNanos() | 1) {
+    for (size_t i = 0; i < endpoints_.size(); ++i) {
+      endpoints_[i].prefix = settings.endpoints()[i];
+    }
+  }
+
+  ~Rep() { delete client_; }
+
+  Status Init() const {
+    if (client_ == NULL) {
+      return Status::MakeError(kModule, "client was null");
+    }
+    if (endpoints_.empty()) {
+      return Status::MakeError(kModule, "no endpoints");
+    }
+    if (settings_.ewma_weight() <= 0 || settings_.ewma_weight() > 1) {
+      return Status::MakeError(kModule, "EWMA weight must be in (0, 1]");
+    }
+    if (settings_.max_failures() < 1 || settings_.ejection_ms() < 0) {
+      return Status::MakeError(kModule, "invalid ejection settings");
+    }
+    return Status::OK();
+  }
+
+  Status SendRequest(const HttpRequest& request, Future<HttpResult>* future) {
+    assert(future != NULL);
+    if (!IsPath(request.uri())) {
+      return client_->SendRequest(request, future);
+    }
+    Shared<Call>::Ptr call(new Call());
+    HttpRequest balanced(request);
+    {
+      ScopeLock lock(&mutex_);
+      call->endpoint = Choose(MonotonicNanos());
+      ++endpoints_[call->endpoint].requests;
+      ++endpoints_[call->endpoint].outstanding;
+      balanced.set_uri((endpoints_[call->endpoint].prefix +
+                        request.uri()).c_str());
+    }
+    call->sent_at = MonotonicNanos();
+    Status status = client_->SendRequest(balanced, &call->attempt);
+    if (status.IsFailure()) {
+      ScopeLock lock(&mutex_);
+      --endpoints_[call->endpoint].outstanding;
+      return status;
+    }
+    {
+      ScopeLock lock(&mutex_);
+      active_.insert(call.get());
+    }
+    *future = call->promise.GetFuture();
+    call->attempt.Notify(OnDone, this, call);
+    return Status::OK();
+  }
+
+  void Cancel(const Future<HttpResult>& future) {
+    Future<HttpResult> attempt;
+    bool found = false;
+    {
+      ScopeLock lock(&mutex_);
+      for (std::set<Call*>::iterator it = active_.begin();
+           it != active_.end(); ++it) {
+        if ((*it)->promise.GetFuture() == future) {
+          attempt = (*it)->attempt;
+          found = true;
+          break;
+        }
+      }
+    }
+    client_->Cancel(found ? attempt : future);
+  }
+
+  HttpStream* OpenStream(const HttpRequest& request, Status* status) {
+    if (!IsPath(request.uri())) {
+      return client_->OpenStream(request, status);
+    }
+    HttpRequest balanced(request);
+    {
+      ScopeLock lock(&mutex_);
+      balanced.set_uri(
+          (endpoints_[Choose(MonotonicNanos())].prefix + request.uri())
+              .c_str());
+    }
+    return client_->OpenStream(balanced, status);
+  }
+
+  HttpByteCounts GetByteCounts() const { return client_->GetByteCounts(); }
+
+  void GetStatistics(std::vector<EndpointStatistics>* stats) const {
+    assert(stats != NULL);
+    const uint64_t now = MonotonicNanos();
+    ScopeLock lock(&mutex_);
+    stats->resize(endpoints_.size());
+    for (size_t i = 0; i < endpoints_.size(); ++i) {
+      const Endpoint& endpoint = endpoints_[i];
+      (*stats)[i]
+          .set_endpoint(endpoint.prefix)
+          .set_requests(endpoint.requests)
+          .set_failures(endpoint.failures)
+          .set_outstanding(endpoint.outstanding)
+          .set_ewma_latency_nanos(static_cast<uint64_t>(endpoint.ewma))
+          .set_ejections(endpoint.ejections)
+          .set_ejected(endpoint.ejected_until > now);
+    }
+  }
+
+ private:
+  // A balanced request, from when it is sent until its result is
+  // delivered.
+  struct Call {
+    Call() : endpoint(0), sent_at(0) {}
+    Promise<HttpResult> promise;
+    Future<HttpResult> attempt;  // Set before the call is shared.
+    size_t endpoint;
+    uint64_t sent_at;
+  };
+
+  struct Endpoint {
+    Endpoint()
+        : requests(0),
+          failures(0),
+          outstanding(0),
+          ewma(0),
+          ejections(0),
+          consecutive_failures(0),
+          ejected_until(0) {}
+    std::string prefix;
+    uint64_t requests;
+    uint64_t failures;
+    uint64_t outstanding;
+    double ewma;  // Latency in nanoseconds; zero until one is seen.
+    uint64_t ejections;
+    int consecutive_failures;
+    uint64_t ejected_until;  // Zero unless ejected (or just returned.)
+  };
+
+  static bool IsPath(const char* uri) { return uri[0] == '/'; }
+
+  // Return the latency to assume for an endpoint that hasn't answered
+  // yet: the mean of those that have, or one if none has. The caller
+  // holds the lock.
+  double PriorLatency() const {
+    double total = 0;
+    size_t known = 0;
+    for (size_t i = 0; i < endpoints_.size(); ++i) {
+      if (endpoints_[i].ewma > 0) {
+        total += endpoints_[i].ewma;
+        ++known;
+      }
+    }
+    return known > 0 ? total / known : 1;
+  }
+
+  // Return the cost of sending another request to 'endpoint'. One whose
+  // latency isn't known yet is assumed to take 'prior', so that it is
+  // tried, but not with every request while it has yet to answer.
+  static double Cost(const Endpoint& endpoint, double prior) {
+    const double latency = endpoint.ewma > 0 ? endpoint.ewma : prior;
+    return latency * (endpoint.outstanding + 1);
+  }
+
+  // Return the index of the endpoint to send a request to at 'now'. The
+  // caller holds the lock.
+  size_t Choose(uint64_t now) {
+    eligible_.clear();
+    for (size_t i = 0; i < endpoints_.size(); ++i) {
+      Endpoint& endpoint = endpoints_[i];
+      if (endpoint.ejected_until != 0 && endpoint.ejected_until <= now) {
+        // Back from ejection, on probation: one failure ejects it again.
+        endpoint.ejected_until = 0;
+        endpoint.consecutive_failures = settings_.max_failures() - 1;
+      }
+      if (endpoint.ejected_until == 0) {
+        eligible_.push_back(i);
+      }
+    }
+    if (eligible_.empty()) {
+      for (size_t i = 0; i < endpoints_.size(); ++i) {
+        eligible_.push_back(i);
+      }
+    }
+    if (eligible_.size() == 1) {
+      return eligible_[0];
+    }
+
+    const size_t first = random_.Next() % eligible_.size();
+    size_t second = random_.Next() % (eligible_.size() - 1);
+    if (second >= first) {
+      ++second;
+    }
+    const size_t a = eligible_[first];
+    const size_t b = eligible_[second];
+    const double prior = PriorLatency();
+    const double cost_a = Cost(endpoints_[a], prior);
+    const double cost_b = Cost(endpoints_[b], prior);
+    if (cost_a != cost_b) {
+      return cost_b < cost_a ? b : a;
+    }
+    return endpoints_[b].outstanding < endpoints_[a].outstanding ? b : a;
+  }
+
+  static void OnDone(Rep* rep, Shared<Call>::Ptr call) {
+    const HttpResult result = call->attempt.GetValue();
+    rep->Record(*call.get(), result);
+    call->promise.SetValue(result);
+  }
+
+  // Account for the completion of 'call' with 'result'.
+  void Record(const Call& call, const HttpResult& result) {
+    const uint64_t now = MonotonicNanos();
+    ScopeLock lock(&mutex_);
+    active_.erase(const_cast<Call*>(&call));
+    Endpoint& endpoint = endpoints_[call.endpoint];
+    --endpoint.outstanding;
+    if (result.status().GetCode() == ECANCELED) {
+      return;
+    }
+    if (result.status().IsFailure() || result.response()->StatusCode() >= 500) {
+      ++endpoint.failures;
+      if (++endpoint.consecutive_failures >= settings_.max_failures() &&
+          endpoint.ejected_until == 0) {
+        endpoint.ejected_until = now + settings_.ejection_ms() * kNanosPerMilli;
+        ++endpoint.ejections;
+      }
+      return;
+    }
+    endpoint.consecutive_failures = 0;
+    const double latency = static_cast<double>(now - call.sent_at);
+    if (endpoint.ewma == 0) {
+      endpoint.ewma = latency;
+    } else {
+      endpoint.ewma += settings_.ewma_weight() * (latency - endpoint.ewma);
+    }
+  }
+
+  Rep(const Rep& no_copy);
+  Rep& operator=(const Rep& no_assign);
+
+  AsyncHttpClient* const client_;
+  const Settings settings_;
+
+  // Guards the members below.
+  mutable Mutex mutex_;
+  std::vector<Endpoint> endpoints_;
+  std::set<Call*> active_;      // Calls whose result hasn't been delivered.
+  std::vector<size_t> eligible_;  // Scratch space for Choose().
+  XorShiftRandom random_;
+};
+
+BalancingHttpClient::BalancingHttpClient(Rep* rep) : rep_(rep) {
+  assert(rep != NULL);
+}
+
+BalancingHttpClient::~BalancingHttpClient() { delete rep_; }
+
+BalancingHttpClient* BalancingHttpClient::Create(AsyncHttpClient* client,
+                                                 const Settings& settings,
+                                                 Status* status_out) {
+  ScopePointer<Rep> rep(new Rep(client, settings));
+  Status status = rep->Init();
+  if (status.IsFailure()) {
+    MaybeAssign(status_out, status);
+    return NULL;
+  }
+
+  BalancingHttpClient* balancing_client = new BalancingHttpClient(rep.Get());
+  rep.ReleaseOwnership();
+
+  return balancing_client;
+}
+
+Status BalancingHttpClient::SendRequest(const HttpRequest& request,
+                                        Future<HttpResult>* future) {
+  return rep_->SendRequest(request, future);
+}
+
+void BalancingHttpClient::Cancel(const Future<HttpResult>& future) {
+  rep_->Cancel(future);
+}
+
+HttpStream* BalancingHttpClient::OpenStream(const HttpRequest& request,
+                                            Status* status) {
+  return rep_->OpenStream(request, status);
+}
+
+HttpByteCounts BalancingHttpClient::GetByteCounts() const {
+  return rep_->GetByteCounts();
+}
+
+void BalancingHttpClient::GetStatistics(
+    std::vector<EndpointStatistics>* stats) const {
+  rep_->GetStatistics(stats);
+}
+
+}  // namespace enquery
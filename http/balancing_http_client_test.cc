@@ -0,0 +1,197 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "enquery/async_http_client.h"
+#include "enquery/balancing_http_client.h"
+#include "enquery/futures.h"
+#include "enquery/http_client.h"
+#include "enquery/http_request.h"
+#include "enquery/http_response.h"
+#include "enquery/shared.h"
+#include "enquery/status.h"
+#include "enquery/testing.h"
+#include "http/http_test_client.h"
+
+using ::enquery::AsyncHttpClient;
+using ::enquery::BalancingHttpClient;
+using ::enquery::FakeAsyncHttpClient;
+using ::enquery::Future;
+using ::enquery::HttpRequest;
+using ::enquery::HttpResult;
+using ::enquery::Send;
+using ::enquery::Shared;
+using ::enquery::Status;
+using ::enquery::Wrap;
+
+namespace {
+
+// Return the statistics of the endpoint at 'index'.
+BalancingHttpClient::EndpointStatistics StatisticsOf(
+    const BalancingHttpClient& client, size_t index) {
+  std::vector<BalancingHttpClient::EndpointStatistics> stats;
+  client.GetStatistics(&stats);
+  return stats[index];
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  // Settings are checked.
+  {
+    Status status;
+    ASSERT_TRUE(BalancingHttpClient::Create(
+                    new FakeAsyncHttpClient(), BalancingHttpClient::Settings(),
+                    &status) == NULL);
+    ASSERT_TRUE(status.IsFailure());
+    ASSERT_TRUE(BalancingHttpClient::Create(
+                    new FakeAsyncHttpClient(), BalancingHttpClient::Settings()
+                                          .add_endpoint("http://a")
+                                          .set_ewma_weight(0),
+                    &status) == NULL);
+    ASSERT_TRUE(status.IsFailure());
+  }
+
+  // Paths go to an endpoint; full URIs pass through untouched.
+  {
+    FakeAsyncHttpClient* fake = new FakeAsyncHttpClient();
+    Shared<BalancingHttpClient>::Ptr client(Wrap<BalancingHttpClient>(
+        fake, BalancingHttpClient::Settings().add_endpoint("http://a:80")));
+    Future<HttpResult> balanced = Send(client.get(), "/x?y=1");
+    Send(client.get(), "http://b/z");
+    ASSERT_EQUALS(fake->uri(0), "http://a:80/x?y=1");
+    ASSERT_EQUALS(fake->uri(1), "http://b/z");
+    fake->Respond(0, 200);
+    ASSERT_EQUALS(balanced.GetValue().response()->StatusCode(), 200);
+    fake->Respond(0, 200);
+    ASSERT_EQUALS(StatisticsOf(*client.get(), 0).requests(), 1u);
+  }
+
+  // Requests favour the endpoint that answers quickly.
+  {
+    FakeAsyncHttpClient* fake = new FakeAsyncHttpClient();
+    Shared<BalancingHttpClient>::Ptr client(Wrap<BalancingHttpClient>(
+        fake, BalancingHttpClient::Settings()
+                  .add_endpoint("http://fast")
+                  .add_endpoint("http://slow")));
+    // Learn each endpoint's latency.
+    while (StatisticsOf(*client.get(), 0).ewma_latency_nanos() == 0 ||
+           StatisticsOf(*client.get(), 1).ewma_latency_nanos() == 0) {
+      Send(client.get(), "/");
+      if (fake->uri(0) == "http://slow/") {
+        usleep(20000);
+      }
+      fake->Respond(0, 200);
+    }
+    for (int i = 0; i < 20; ++i) {
+      Send(client.get(), "/");
+      fake->Respond(0, 200);
+    }
+    ASSERT_TRUE(StatisticsOf(*client.get(), 0).requests() >
+                StatisticsOf(*client.get(), 1).requests());
+    ASSERT_EQUALS(StatisticsOf(*client.get(), 1).outstanding(), 0u);
+  }
+
+  // An endpoint that hasn't answered yet isn't chosen while its first
+  // request is outstanding, so one that never answers gets no more.
+  {
+    FakeAsyncHttpClient* fake = new FakeAsyncHttpClient();
+    Shared<BalancingHttpClient>::Ptr client(Wrap<BalancingHttpClient>(
+        fake, BalancingHttpClient::Settings()
+                  .add_endpoint("http://a")
+                  .add_endpoint("http://b")));
+    Send(client.get(), "/");
+    const std::string hung = fake->uri(0);
+    for (int i = 0; i < 20; ++i) {
+      Send(client.get(), "/");
+      ASSERT_TRUE(fake->uri(1) != hung);
+      fake->Respond(1, 200);
+    }
+    fake->Respond(0, 200);
+  }
+
+  // An endpoint that keeps failing is ejected, and is back once the
+  // ejection ends. While every endpoint is ejected, they are all used.
+  {
+    FakeAsyncHttpClient* fake = new FakeAsyncHttpClient();
+    Shared<BalancingHttpClient>::Ptr client(Wrap<BalancingHttpClient>(
+        fake, BalancingHttpClient::Settings()
+                  .add_endpoint("http://a")
+                  .set_max_failures(2)
+                  .set_ejection_ms(50)));
+    Send(client.get(), "/");
+    fake->Respond(0, 500);
+    Send(client.get(), "/");
+    client->Cancel(Send(client.get(), "/"));  // Cancelling isn't failing.
+    fake->Fail(0, EIO);
+    BalancingHttpClient::EndpointStatistics stats =
+        StatisticsOf(*client.get(), 0);
+    ASSERT_EQUALS(stats.failures(), 2u);
+    ASSERT_EQUALS(stats.ejections(), 1u);
+    ASSERT_TRUE(stats.ejected());
+    Send(client.get(), "/");
+    ASSERT_EQUALS(fake->uri(0), "http://a/");
+    fake->Respond(0, 200);
+
+    usleep(60000);
+    ASSERT_TRUE(!StatisticsOf(*client.get(), 0).ejected());
+  }
+
+  // Ejected endpoints get no requests while others are available.
+  {
+    FakeAsyncHttpClient* fake = new FakeAsyncHttpClient();
+    Shared<BalancingHttpClient>::Ptr client(Wrap<BalancingHttpClient>(
+        fake, BalancingHttpClient::Settings()
+                  .add_endpoint("http://a")
+                  .add_endpoint("http://b")
+                  .set_max_failures(1)));
+    Send(client.get(), "/");
+    const std::string failed = fake->uri(0);
+    fake->Fail(0, ECONNREFUSED);
+    for (int i = 0; i < 10; ++i) {
+      Send(client.get(), "/");
+      ASSERT_TRUE(fake->uri(0) != failed);
+      fake->Respond(0, 200);
+    }
+  }
+
+  // Requests may be cancelled.
+  {
+    FakeAsyncHttpClient* fake = new FakeAsyncHttpClient();
+    Shared<BalancingHttpClient>::Ptr client(Wrap<BalancingHttpClient>(
+        fake, BalancingHttpClient::Settings().add_endpoint("http://a")));
+    Future<HttpResult> future = Send(client.get(), "/");
+    client->Cancel(future);
+    ASSERT_EQUALS(future.GetValue().status().GetCode(), ECANCELED);
+    ASSERT_EQUALS(fake->waiting(), 0u);
+    ASSERT_EQUALS(StatisticsOf(*client.get(), 0).failures(), 0u);
+  }
+
+  // Deleting the client fails the requests in flight.
+  {
+    FakeAsyncHttpClient* fake = new FakeAsyncHttpClient();
+    BalancingHttpClient* client = Wrap<BalancingHttpClient>(
+        fake, BalancingHttpClient::Settings().add_endpoint("http://a"));
+    Future<HttpResult> future = Send(client, "/");
+    delete client;
+    ASSERT_TRUE(future.GetValue().status().IsFailure());
+  }
+
+  return EXIT_SUCCESS;
+}
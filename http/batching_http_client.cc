@@ -0,0 +1,479 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "enquery/batching_http_client.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "enquery/futures.h"
+#include "enquery/http_request.h"
+#include "enquery/http_response.h"
+#include "enquery/mutex.h"
+#include "enquery/scope_lock.h"
+#include "enquery/scope_pointer.h"
+#include "enquery/shared.h"
+#include "enquery/status.h"
+#include "enquery/timer_queue.h"
+#include "enquery/utility.h"
+#include "http/http_util.h"
+
+namespace enquery {
+
+namespace {
+
+const char kModule[] = "BatchingHttpClient";
+
+const uint64_t kNanosPerMicro = 1000;
+
+// One request's response, cut from the response to its batch, which it
+// keeps a share of.
+class PartResponse : public HttpResponse {
+ public:
+  PartResponse(Shared<HttpResponse>::Ptr batch, const HttpBatchPart& part)
+      : batch_(batch), part_(part) {}
+
+  virtual const char* Body() const { return part_.body.data(); }
+  virtual size_t BodySize() const { return part_.body.size(); }
+  virtual int StatusCode() const { return part_.status_code; }
+
+  // The headers, and timings, are those of the batch.
+  virtual size_t HeaderCount() const { return batch_->HeaderCount(); }
+  virtual void GetHeader(size_t index, Slice* name, Slice* value) const {
+    batch_->GetHeader(index, name, value);
+  }
+  virtual bool FindHeader(const char* name, Slice* value) const {
+    return batch_->FindHeader(name, value);
+  }
+  virtual const HttpTimings& Timings() const { return batch_->Timings(); }
+
+ private:
+  PartResponse(const PartResponse& no_copy);
+  PartResponse& operator=(const PartResponse& no_assign);
+
+  const Shared<HttpResponse>::Ptr batch_;
+  const HttpBatchPart part_;
+};
+
+}  // namespace
+
+class BatchingHttpClient::Rep {
+ public:
+  Rep(AsyncHttpClient* client, const Settings& settings)
+      : client_(client),
+        settings_(settings),
+        timers_(NULL),
+        mutex_("BatchingHttpClient"),
+        stopping_(false),
+        requests_(0),
+        batches_(0) {}
+
+  ~Rep() {
+    // Stop the timers, so that no more batches are sent, and fail the
+    // requests still waiting in one. Then the wrapped client completes
+    // those it has (and so runs their callbacks, which use this Rep.)
+    Calls waiting;
+    {
+      ScopeLock lock(&mutex_);
+      stopping_ = true;
+    }
+    delete timers_;
+    timers_ = NULL;
+    {
+      ScopeLock lock(&mutex_);
+      for (Batches::iterator it = open_.begin(); it != open_.end(); ++it) {
+        const Calls& calls = it->second->calls;
+        waiting.insert(waiting.end(), calls.begin(), calls.end());
+      }
+      open_.clear();
+    }
+    const HttpResult shut_down(Status::MakeError(kModule, "client shut down"),
+                               Shared<HttpResponse>::Ptr());
+    for (size_t i = 0; i < waiting.size(); ++i) {
+      Complete(waiting[i].get(), shut_down);
+    }
+    delete client_;
+  }
+
+  Status Init() {
+    if (client_ == NULL) {
+      return Status::MakeError(kModule, "client was null");
+    }
+    if (settings_.window_us() < 0) {
+      return Status::MakeError(kModule, "window must not be negative");
+    }
+    if (settings_.max_batch_size() < 1) {
+      return Status::MakeError(kModule, "batch size must be at least 1");
+    }
+    Status status;
+    timers_ = TimerQueue::Create(&status);
+    return status;
+  }
+
+  Status SendRequest(const HttpRequest& request, Future<HttpResult>* future) {
+    assert(future != NULL);
+    if (settings_.window_us() == 0 || !IsBatchable(request)) {
+      return client_->SendRequest(request, future);
+    }
+
+    Shared<Call>::Ptr call(new Call(request));
+    Shared<Batch>::Ptr batch;
+    bool opened = false;
+    bool full = false;
+    TimerQueue::TimerId timer = 0;
+    {
+      ScopeLock lock(&mutex_);
+      if (stopping_) {
+        return Status::MakeError(kModule, "client shut down");
+      }
+      ++requests_;
+      const std::string host = HostFromUri(request.uri());
+      Shared<Batch>::Ptr& open = open_[host];
+      if (open.get() == NULL) {
+        open = Shared<Batch>::Ptr(new Batch(host));
+        opened = true;
+      }
+      batch = open;
+      batch->calls.push_back(call);
+      active_.insert(call.get());
+      if (batch->calls.size() >= static_cast<size_t>(
+                                     settings_.max_batch_size())) {
+        open_.erase(host);
+        full = true;
+        timer = batch->timer;
+      }
+    }
+    *future = call->promise.GetFuture();
+
+    if (full) {
+      if (timer != 0) {
+        timers_->Cancel(timer);
+      }
+      Send(batch);
+    } else if (opened) {
+      // Should the batch fill before the timer is set, the timer finds it
+      // gone, and does nothing.
+      timer = timers_->Schedule(settings_.window_us() * kNanosPerMicro,
+                                new BatchCallback(OnTimer, this, batch));
+      ScopeLock lock(&mutex_);
+      batch->timer = timer;
+    }
+    return Status::OK();
+  }
+
+  void Cancel(const Future<HttpResult>& future) {
+    Future<HttpResult> sent;
+    Promise<HttpResult> promise;
+    bool found = false;
+    bool forward = false;
+    {
+      ScopeLock lock(&mutex_);
+      std::set<Call*>::iterator it = active_.begin();
+      while (it != active_.end() && !((*it)->promise.GetFuture() == future)) {
+        ++it;
+      }
+      if (it != active_.end()) {
+        Call* call = *it;
+        found = true;
+        if (call->sent) {
+          sent = call->future;
+          forward = true;
+        } else {
+          // Waiting in a batch, or sent in a combined one: either way,
+          // it completes now.
+          call->done = true;
+          active_.erase(it);
+          promise = call->promise;
+        }
+      }
+    }
+    if (!found) {
+      // Not batchable, so sent as it was, or already complete.
+      client_->Cancel(future);
+    } else if (forward) {
+      client_->Cancel(sent);
+    } else {
+      promise.SetValue(HttpResult(
+          Status::MakeError(kModule, "request cancelled", ECANCELED),
+          Shared<HttpResponse>::Ptr()));
+    }
+  }
+
+  HttpStream* OpenStream(const HttpRequest& request, Status* status) {
+    return client_->OpenStream(request, status);
+  }
+
+  HttpByteCounts GetByteCounts() const { return client_->GetByteCounts(); }
+
+  void GetStatistics(BatchingHttpClient::Statistics* stats) const {
+    assert(stats != NULL);
+    ScopeLock lock(&mutex_);
+    stats->set_requests(requests_).set_batches(batches_);
+  }
+
+ private:
+  // A batchable request, from when it is sent until its result is
+  // delivered.
+  struct Call {
+    explicit Call(const HttpRequest& r)
+        : request(r), sent(false), done(false) {}
+    const HttpRequest request;
+    Promise<HttpResult> promise;
+
+    // Guarded by the Rep's mutex.
+    Future<HttpResult> future;  // From the wrapped client, once 'sent'.
+    bool sent;                  // Sent by itself, rather than combined.
+    bool done;                  // The result has been delivered.
+  };
+
+  typedef std::vector<Shared<Call>::Ptr> Calls;
+
+  // Requests for one host, waiting to be sent together.
+  struct Batch {
+    explicit Batch(const std::string& h) : host(h), timer(0) {}
+    const std::string host;
+    Calls calls;                // Guarded by the Rep's mutex...
+    TimerQueue::TimerId timer;  // ...as is this.
+  };
+
+  typedef std::map<std::string, Shared<Batch>::Ptr> Batches;
+
+  // A batch combined into one request, from when that is sent until its
+  // response is split among the calls.
+  struct Combined {
+    explicit Combined(const Calls& c) : calls(c) {}
+    const Calls calls;
+    Future<HttpResult> future;  // Set before it is shared.
+  };
+
+  typedef void (*BatchFunction)(Rep*, Shared<Batch>::Ptr);
+  typedef Callback_2<BatchFunction, Rep*, Shared<Batch>::Ptr> BatchCallback;
+
+  bool IsBatchable(const HttpRequest& request) const {
+    if (settings_.encoder() != NULL) {
+      return settings_.encoder()->IsBatchable(request);
+    }
+    return (request.method() == HttpRequest::GET ||
+            request.method() == HttpRequest::HEAD) &&
+           !request.HasBody();
+  }
+
+  // Send 'batch' if it is still open. Run by the timer queue once the
+  // window has passed.
+  static void OnTimer(Rep* rep, Shared<Batch>::Ptr batch) {
+    {
+      ScopeLock lock(&rep->mutex_);
+      Batches::iterator it = rep->open_.find(batch->host);
+      if (it == rep->open_.end() || it->second.get() != batch.get()) {
+        return;  // It filled up, and was sent.
+      }
+      rep->open_.erase(it);
+    }
+    rep->Send(batch);
+  }
+
+  // Send the calls in 'batch' that haven't been cancelled, which is no
+  // longer open.
+  void Send(Shared<Batch>::Ptr batch) {
+    Calls calls;
+    {
+      ScopeLock lock(&mutex_);
+      for (size_t i = 0; i < batch->calls.size(); ++i) {
+        if (!batch->calls[i]->done) {
+          calls.push_back(batch->calls[i]);
+        }
+      }
+      if (calls.empty()) {
+        return;
+      }
+      ++batches_;
+    }
+    if (settings_.encoder() != NULL && calls.size() > 1) {
+      SendCombined(calls);
+      return;
+    }
+    for (size_t i = 0; i < calls.size(); ++i) {
+      SendOne(calls[i]);
+    }
+  }
+
+  // Send 'call' by itself.
+  void SendOne(Shared<Call>::Ptr call) {
+    Future<HttpResult> future;
+    const Status status = client_->SendRequest(call->request, &future);
+    if (status.IsFailure()) {
+      Complete(call.get(), HttpResult(status, Shared<HttpResponse>::Ptr()));
+      return;
+    }
+    bool cancelled = false;
+    {
+      ScopeLock lock(&mutex_);
+      cancelled = call->done;
+      if (!cancelled) {
+        call->future = future;
+        call->sent = true;
+      }
+    }
+    if (cancelled) {
+      // The caller cancelled the request while this was sent.
+      client_->Cancel(future);
+    } else {
+      future.Notify(OnSent, this, call);
+    }
+  }
+
+  static void OnSent(Rep* rep, Shared<Call>::Ptr call) {
+    rep->Complete(call.get(), call->future.GetValue());
+  }
+
+  // Combine 'calls' into one request with the encoder, and send that.
+  void SendCombined(const Calls& calls) {
+    std::vector<const HttpRequest*> requests(calls.size());
+    for (size_t i = 0; i < calls.size(); ++i) {
+      requests[i] = &calls[i]->request;
+    }
+    Shared<Combined>::Ptr combined(new Combined(calls));
+    HttpRequest request;
+    Status status = settings_.encoder()->Encode(requests, &request);
+    if (status.IsSuccess()) {
+      status = client_->SendRequest(request, &combined->future);
+    }
+    if (status.IsFailure()) {
+      Fail(calls, status);
+      return;
+    }
+    combined->future.Notify(OnCombinedDone, this, combined);
+  }
+
+  // Split the response to a combined batch among its calls.
+  static void OnCombinedDone(Rep* rep, Shared<Combined>::Ptr combined) {
+    const HttpResult result = combined->future.GetValue();
+    const Calls& calls = combined->calls;
+    if (result.status().IsFailure()) {
+      rep->Fail(calls, result.status());
+      return;
+    }
+    std::vector<HttpBatchPart> parts(calls.size());
+    Status status = rep->settings_.encoder()->Decode(*result.response(),
+                                                     calls.size(), &parts);
+    if (status.IsSuccess() && parts.size() != calls.size()) {
+      status = Status::MakeError(kModule, "wrong number of parts decoded");
+    }
+    if (status.IsFailure()) {
+      rep->Fail(calls, status);
+      return;
+    }
+    for (size_t i = 0; i < calls.size(); ++i) {
+      if (parts[i].status_code == 0) {
+        rep->Complete(calls[i].get(),
+                      HttpResult(Status::MakeError(
+                                     kModule, "batch response has no part"),
+                                 Shared<HttpResponse>::Ptr()));
+      } else {
+        rep->Complete(
+            calls[i].get(),
+            HttpResult(Status::OK(),
+                       Shared<HttpResponse>::Ptr(new PartResponse(
+                           result.shared_response(), parts[i]))));
+      }
+    }
+  }
+
+  // Complete every one of 'calls' with 'status'.
+  void Fail(const Calls& calls, const Status& status) {
+    const HttpResult result(status, Shared<HttpResponse>::Ptr());
+    for (size_t i = 0; i < calls.size(); ++i) {
+      Complete(calls[i].get(), result);
+    }
+  }
+
+  // Deliver 'result' for 'call', unless it was cancelled.
+  void Complete(Call* call, const HttpResult& result) {
+    {
+      ScopeLock lock(&mutex_);
+      if (call->done) {
+        return;
+      }
+      call->done = true;
+      active_.erase(call);
+    }
+    call->promise.SetValue(result);
+  }
+
+  Rep(const Rep& no_copy);
+  Rep& operator=(const Rep& no_assign);
+
+  AsyncHttpClient* const client_;
+  const Settings settings_;
+  TimerQueue* timers_;
+
+  // Guards the members below.
+  mutable Mutex mutex_;
+  bool stopping_;
+  Batches open_;            // Batches collecting requests, by host.
+  std::set<Call*> active_;  // Calls whose result hasn't been delivered.
+  uint64_t requests_;
+  uint64_t batches_;
+};
+
+BatchingHttpClient::BatchingHttpClient(Rep* rep) : rep_(rep) {
+  assert(rep != NULL);
+}
+
+BatchingHttpClient::~BatchingHttpClient() { delete rep_; }
+
+BatchingHttpClient* BatchingHttpClient::Create(AsyncHttpClient* client,
+                                               const Settings& settings,
+                                               Status* status_out) {
+  ScopePointer<Rep> rep(new Rep(client, settings));
+  Status status = rep->Init();
+  if (status.IsFailure()) {
+    MaybeAssign(status_out, status);
+    return NULL;
+  }
+
+  BatchingHttpClient* batching_client = new BatchingHttpClient(rep.Get());
+  rep.ReleaseOwnership();
+
+  return batching_client;
+}
+
+Status BatchingHttpClient::SendRequest(const HttpRequest& request,
+                                       Future<HttpResult>* future) {
+  return rep_->SendRequest(request, future);
+}
+
+void BatchingHttpClient::Cancel(const Future<HttpResult>& future) {
+  rep_->Cancel(future);
+}
+
+HttpStream* BatchingHttpClient::OpenStream(const HttpRequest& request,
+                                           Status* status) {
+  return rep_->OpenStream(request, status);
+}
+
+HttpByteCounts BatchingHttpClient::GetByteCounts() const {
+  return rep_->GetByteCounts();
+}
+
+void BatchingHttpClient::GetStatistics(Statistics* stats) const {
+  rep_->GetStatistics(stats);
+}
+
+}  // namespace enquery
@@ -0,0 +1,255 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "enquery/async_http_client.h"
+#include "enquery/batching_http_client.h"
+#include "enquery/futures.h"
+#include "enquery/http.h"
+#include "enquery/http_request.h"
+#include "enquery/http_response.h"
+#include "enquery/shared.h"
+#include "enquery/slice.h"
+#include "enquery/status.h"
+#include "enquery/testing.h"
+#include "http/http_test_client.h"
+#include "http/http_test_server.h"
+
+using ::enquery::AsyncHttpClient;
+using ::enquery::BatchingHttpClient;
+using ::enquery::BodyOf;
+using ::enquery::FakeAsyncHttpClient;
+using ::enquery::Future;
+using ::enquery::Http;
+using ::enquery::HttpBatchEncoder;
+using ::enquery::HttpBatchPart;
+using ::enquery::HttpRequest;
+using ::enquery::HttpResponse;
+using ::enquery::HttpResult;
+using ::enquery::HttpTestServer;
+using ::enquery::Send;
+using ::enquery::Shared;
+using ::enquery::Slice;
+using ::enquery::StatisticsOf;
+using ::enquery::Status;
+using ::enquery::Wrap;
+
+namespace {
+
+// Combines GETs for "http://host/key" into a GET for
+// "http://host/multi?keys=key1,key2", and splits a response whose body
+// is that URI (as the fake client answers) back into the keys. A key of
+// "missing" gets no part.
+class KeyEncoder : public HttpBatchEncoder {
+ public:
+  virtual bool IsBatchable(const HttpRequest& request) {
+    return request.method() == HttpRequest::GET;
+  }
+
+  virtual Status Encode(const std::vector<const HttpRequest*>& requests,
+                        HttpRequest* batch) {
+    std::string uri;
+    for (size_t i = 0; i < requests.size(); ++i) {
+      const char* key = strrchr(requests[i]->uri(), '/') + 1;
+      if (i == 0) {
+        uri.assign(requests[i]->uri(), key).append("multi?keys=");
+      } else {
+        uri.push_back(',');
+      }
+      uri.append(key);
+    }
+    batch->set_uri(uri.c_str());
+    return Status::OK();
+  }
+
+  virtual Status Decode(const HttpResponse& response, size_t count,
+                        std::vector<HttpBatchPart>* parts) {
+    const std::string body(response.Body(), response.BodySize());
+    size_t start = body.find("keys=");
+    if (start == std::string::npos) {
+      return Status::MakeError("KeyEncoder", "not a batch");
+    }
+    start += 5;
+    for (size_t i = 0; i < count; ++i) {
+      size_t end = body.find(',', start);
+      end = end == std::string::npos ? body.size() : end;
+      if (body.compare(start, end - start, "missing") != 0) {
+        (*parts)[i].status_code = 200;
+        (*parts)[i].body = Slice(response.Body() + start, end - start);
+      }
+      start = end + 1;
+    }
+    return Status::OK();
+  }
+};
+
+// A full batch is sent at once, all of it together.
+void TestFullBatch() {
+  FakeAsyncHttpClient* fake = new FakeAsyncHttpClient();
+  BatchingHttpClient* client = Wrap<BatchingHttpClient>(
+      fake, BatchingHttpClient::Settings().set_window_us(10000000)
+                .set_max_batch_size(3));
+  Future<HttpResult> a = Send(client, "http://a/1");
+  Future<HttpResult> b = Send(client, "http://a/2");
+  ASSERT_EQUALS(fake->waiting(), 0u);
+  Future<HttpResult> c = Send(client, "http://a/3");
+  ASSERT_EQUALS(fake->waiting(), 3u);
+  ASSERT_EQUALS(fake->uri(0), std::string("http://a/1"));
+  ASSERT_EQUALS(fake->uri(2), std::string("http://a/3"));
+
+  fake->RespondAll(200);
+  ASSERT_EQUALS(BodyOf(a), std::string("http://a/1"));
+  ASSERT_EQUALS(BodyOf(b), std::string("http://a/2"));
+  ASSERT_EQUALS(BodyOf(c), std::string("http://a/3"));
+  ASSERT_EQUALS(StatisticsOf(*client).requests(), 3u);
+  ASSERT_EQUALS(StatisticsOf(*client).batches(), 1u);
+  delete client;
+}
+
+// A batch that doesn't fill is sent when its window closes; each host
+// has its own batch; and only GET and HEAD requests are batched.
+void TestWindow() {
+  FakeAsyncHttpClient* fake = new FakeAsyncHttpClient();
+  BatchingHttpClient* client = Wrap<BatchingHttpClient>(
+      fake, BatchingHttpClient::Settings().set_window_us(20000));
+  Future<HttpResult> post = Send(client, "http://a/p", HttpRequest::POST);
+  ASSERT_EQUALS(fake->waiting(), 1u);
+  Future<HttpResult> a = Send(client, "http://a/1");
+  Future<HttpResult> b = Send(client, "http://b/1");
+  Future<HttpResult> head = Send(client, "http://a/2", HttpRequest::HEAD);
+  ASSERT_EQUALS(fake->waiting(), 1u);
+  fake->WaitFor(4);
+  fake->RespondAll(200);
+  ASSERT_EQUALS(BodyOf(a), std::string("http://a/1"));
+  ASSERT_EQUALS(BodyOf(b), std::string("http://b/1"));
+  ASSERT_EQUALS(BodyOf(head), std::string("http://a/2"));
+  ASSERT_EQUALS(BodyOf(post), std::string("http://a/p"));
+  ASSERT_EQUALS(StatisticsOf(*client).requests(), 3u);
+  ASSERT_EQUALS(StatisticsOf(*client).batches(), 2u);
+  delete client;
+}
+
+// A request cancelled while waiting is dropped from its batch, and one
+// still waiting when the client is deleted fails.
+void TestCancelAndShutDown() {
+  FakeAsyncHttpClient* fake = new FakeAsyncHttpClient();
+  BatchingHttpClient* client = Wrap<BatchingHttpClient>(
+      fake, BatchingHttpClient::Settings().set_window_us(20000));
+  Future<HttpResult> a = Send(client, "http://a/1");
+  Future<HttpResult> b = Send(client, "http://a/2");
+  client->Cancel(a);
+  ASSERT_EQUALS(a.GetValue().status().GetCode(), ECANCELED);
+  fake->WaitFor(1);
+  usleep(20000);
+  ASSERT_EQUALS(fake->waiting(), 1u);
+  ASSERT_EQUALS(fake->uri(0), std::string("http://a/2"));
+  fake->RespondAll(200);
+  ASSERT_EQUALS(BodyOf(b), std::string("http://a/2"));
+
+  Future<HttpResult> c = Send(client, "http://a/3");
+  delete client;
+  ASSERT_TRUE(c.GetValue().status().IsFailure());
+}
+
+// With an encoder, a batch is combined into one request, whose response
+// is split among the callers.
+void TestEncoder() {
+  KeyEncoder encoder;
+  FakeAsyncHttpClient* fake = new FakeAsyncHttpClient();
+  BatchingHttpClient* client = Wrap<BatchingHttpClient>(
+      fake, BatchingHttpClient::Settings()
+                .set_window_us(10000000)
+                .set_max_batch_size(3)
+                .set_encoder(&encoder));
+  Future<HttpResult> x = Send(client, "http://a/x");
+  Future<HttpResult> missing = Send(client, "http://a/missing");
+  Future<HttpResult> z = Send(client, "http://a/z");
+  ASSERT_EQUALS(fake->waiting(), 1u);
+  ASSERT_EQUALS(fake->uri(0), std::string("http://a/multi?keys=x,missing,z"));
+  fake->RespondAll(200);
+  ASSERT_EQUALS(BodyOf(x), std::string("x"));
+  ASSERT_EQUALS(BodyOf(z), std::string("z"));
+  ASSERT_EQUALS(x.GetValue().response()->StatusCode(), 200);
+  ASSERT_TRUE(missing.GetValue().status().IsFailure());
+
+  // Requests the encoder refuses are sent as they are.
+  Future<HttpResult> put = Send(client, "http://a/p", HttpRequest::PUT);
+  ASSERT_EQUALS(fake->waiting(), 1u);
+  fake->RespondAll(200);
+  ASSERT_EQUALS(BodyOf(put), std::string("http://a/p"));
+  delete client;
+}
+
+// In front of a native client that pipelines, a batch shares one
+// connection.
+void TestPipelining() {
+  Status status;
+  Shared<Http>::Ptr http(Http::Create(::enquery::HTTP_ENGINE_NATIVE, &status));
+  ASSERT_TRUE(status.IsSuccess());
+  HttpTestServer server;
+  ASSERT_TRUE(server.Start().IsSuccess());
+  AsyncHttpClient* native = http->CreateAsyncClient(
+      AsyncHttpClient::Settings()
+          .set_max_connections_per_host(1)
+          .set_max_pipelined_requests(16),
+      &status);
+  ASSERT_TRUE(status.IsSuccess());
+  BatchingHttpClient* client = BatchingHttpClient::Create(
+      native, BatchingHttpClient::Settings().set_max_batch_size(16),
+      &status);
+  ASSERT_TRUE(status.IsSuccess());
+
+  const int kRequests = 16;
+  std::vector<Future<HttpResult> > futures;
+  for (int i = 0; i < kRequests; ++i) {
+    char path[32];
+    snprintf(path, sizeof(path), "/%d", i);
+    futures.push_back(Send(client, server.Url(path)));
+  }
+  for (int i = 0; i < kRequests; ++i) {
+    HttpResult result = futures[i].GetValue();
+    ASSERT_TRUE(result.status().IsSuccess());
+    ASSERT_EQUALS(result.response()->BodySize(), static_cast<size_t>(i));
+  }
+  ASSERT_EQUALS(server.connections_accepted(), 1u);
+  delete client;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  // Settings are checked.
+  {
+    Status status;
+    ASSERT_TRUE(BatchingHttpClient::Create(
+                    new FakeAsyncHttpClient(),
+                    BatchingHttpClient::Settings().set_max_batch_size(0),
+                    &status) == NULL);
+    ASSERT_TRUE(status.IsFailure());
+  }
+
+  TestFullBatch();
+  TestWindow();
+  TestCancelAndShutDown();
+  TestEncoder();
+  TestPipelining();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,465 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "enquery/caching_http_client.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <list>
+#include <map>
+#include <string>
+#include "enquery/http_request.h"
+#include "enquery/http_response.h"
+#include "enquery/mutex.h"
+#include "enquery/portability.h"
+#include "enquery/scope_lock.h"
+#include "enquery/scope_pointer.h"
+#include "enquery/shared.h"
+#include "enquery/slice.h"
+#include "enquery/status.h"
+#include "enquery/utility.h"
+#include "http/shared_http_response.h"
+
+namespace enquery {
+
+namespace {
+
+const char kModule[] = "CachingHttpClient";
+
+const uint64_t kNanosPerSecond = 1000000000;
+
+std::string ToString(const Slice& slice) {
+  return std::string(slice.data(), slice.size());
+}
+
+// Set 'value' to the values of every header 'name' in 'response', joined
+// by commas. Return false if there are none.
+bool JoinHeaders(const HttpResponse& response, const char* name,
+                 std::string* value) {
+  value->clear();
+  bool found = false;
+  for (size_t i = 0; i < response.HeaderCount(); ++i) {
+    Slice header_name, header_value;
+    response.GetHeader(i, &header_name, &header_value);
+    if (header_name.size() == strlen(name) &&
+        strncasecmp(header_name.data(), name, header_name.size()) == 0) {
+      if (found) {
+        value->push_back(',');
+      }
+      value->append(header_value.data(), header_value.size());
+      found = true;
+    }
+  }
+  return found;
+}
+
+// Return true if the Cache-Control 'value' has the directive 'name'. If
+// 'argument' isn't NULL, set it to the directive's argument (unquoted.)
+bool FindDirective(const std::string& value, const char* name,
+                   std::string* argument) {
+  const size_t length = strlen(name);
+  size_t start = 0;
+  while (start < value.size()) {
+    size_t end = value.find(',', start);
+    if (end == std::string::npos) {
+      end = value.size();
+    }
+    start = value.find_first_not_of(" \t", start);
+    if (start < end && strncasecmp(value.c_str() + start, name, length) == 0) {
+      const size_t after = start + length;
+      if (after == end || value[after] == '=' || value[after] == ' ' ||
+          value[after] == '\t') {
+        if (argument) {
+          argument->clear();
+          if (after < end && value[after] == '=') {
+            *argument = value.substr(after + 1, end - after - 1);
+            const size_t last = argument->find_last_not_of(" \t\"");
+            argument->erase(last == std::string::npos ? 0 : last + 1);
+            argument->erase(0, argument->find_first_not_of('"'));
+          }
+        }
+        return true;
+      }
+    }
+    start = end + 1;
+  }
+  return false;
+}
+
+// Parse an HTTP date (RFC 7231, IMF-fixdate) into seconds since the
+// epoch. Return false if it isn't one.
+bool ParseHttpDate(const std::string& value, time_t* seconds) {
+  struct tm tm;
+  memset(&tm, 0, sizeof(tm));
+  const char* end = strptime(value.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  if (end == NULL) {
+    return false;
+  }
+  *seconds = timegm(&tm);
+  return true;
+}
+
+// Return true if 'response' says how long it stays fresh.
+bool HasFreshness(const HttpResponse& response) {
+  std::string value;
+  return JoinHeaders(response, "cache-control", &value) ||
+         JoinHeaders(response, "expires", &value);
+}
+
+// Return how many seconds 'response' stays fresh for, from when it left
+// the server, going by its headers. Heuristic freshness is not used, so
+// a response without Cache-Control or Expires is stale at once.
+int64_t FreshnessLifetime(const HttpResponse& response) {
+  std::string cache_control, value;
+  JoinHeaders(response, "cache-control", &cache_control);
+  if (FindDirective(cache_control, "no-cache", NULL)) {
+    return 0;
+  }
+  if (FindDirective(cache_control, "max-age", &value)) {
+    return strtoll(value.c_str(), NULL, 10);
+  }
+  time_t expires, date;
+  if (!JoinHeaders(response, "expires", &value) ||
+      !ParseHttpDate(value, &expires)) {
+    return 0;  // An invalid Expires means "already expired."
+  }
+  if (!JoinHeaders(response, "date", &value) || !ParseHttpDate(value, &date)) {
+    date = time(NULL);
+  }
+  return static_cast<int64_t>(expires) - static_cast<int64_t>(date);
+}
+
+// Return the seconds that 'response' had spent in other caches.
+int64_t Age(const HttpResponse& response) {
+  std::string value;
+  return JoinHeaders(response, "age", &value)
+             ? strtoll(value.c_str(), NULL, 10)
+             : 0;
+}
+
+// Return true if responses with status 'code' may be stored without
+// being marked cacheable (RFC 7231, section 6.1.)
+bool IsCacheableStatus(int code) {
+  switch (code) {
+    case 200:
+    case 203:
+    case 204:
+    case 300:
+    case 301:
+    case 404:
+    case 405:
+    case 410:
+    case 414:
+    case 501:
+      return true;
+    default:
+      return false;
+  }
+}
+
+}  // namespace
+
+class CachingHttpClient::Rep {
+ public:
+  Rep(HttpClient* client, const Settings& settings)
+      : client_(client),
+        settings_(settings),
+        mutex_("CachingHttpClient"),
+        bytes_(0),
+        hits_(0),
+        revalidations_(0),
+        misses_(0),
+        evictions_(0) {}
+
+  Status Init() {
+    if (client_.Get() == NULL) {
+      return Status::MakeError(kModule, "client was null");
+    }
+    if (settings_.max_bytes() == 0) {
+      return Status::MakeError(kModule, "max_bytes must be positive");
+    }
+    return Status::OK();
+  }
+
+  HttpResponse* SendRequest(const HttpRequest& request, Status* status) {
+    if (!IsCacheable(request)) {
+      return client_->SendRequest(request, status);
+    }
+    const std::string key = MakeKey(request);
+    Slice cache_control;
+    const bool no_cache =
+        request.FindHeader("Cache-Control", &cache_control) &&
+        FindDirective(ToString(cache_control), "no-cache", NULL);
+
+    // Take what is stored for the key; the entry may change or go once
+    // the lock is released.
+    Shared<HttpResponse>::Ptr stored;
+    std::string etag, last_modified;
+    {
+      ScopeLock lock(&mutex_);
+      Index::iterator it = index_.find(key);
+      if (it != index_.end()) {
+        Entry& entry = *it->second;
+        lru_.splice(lru_.begin(), lru_, it->second);
+        if (!no_cache && MonotonicNanos() < entry.fresh_until) {
+          ++hits_;
+          MaybeAssign(status, Status::OK());
+          return new SharedHttpResponse(entry.response);
+        }
+        stored = entry.response;
+        etag = entry.etag;
+        last_modified = entry.last_modified;
+      }
+    }
+
+    if (etag.empty() && last_modified.empty()) {
+      return Fetch(key, request, status);
+    }
+
+    // Ask the server whether the stored response is still good.
+    HttpRequest conditional(request);
+    if (!etag.empty()) {
+      conditional.AddHeader("If-None-Match", etag.c_str());
+    }
+    if (!last_modified.empty()) {
+      conditional.AddHeader("If-Modified-Since", last_modified.c_str());
+    }
+    Status result;
+    Shared<HttpResponse>::Ptr response(
+        client_->SendRequest(conditional, &result));
+    if (result.IsFailure()) {
+      MaybeAssign(status, result);
+      return NULL;
+    }
+    if (response->StatusCode() != 304) {
+      return Store(key, response, status);
+    }
+
+    // The server's answer may give the stored response a new lifetime;
+    // otherwise it has the one it came with, from now.
+    const HttpResponse& answer = *response.get();
+    const int64_t lifetime =
+        FreshnessLifetime(HasFreshness(answer) ? answer : *stored.get()) -
+        Age(answer);
+    {
+      ScopeLock lock(&mutex_);
+      ++revalidations_;
+      Index::iterator it = index_.find(key);
+      if (it != index_.end() && it->second->response == stored) {
+        it->second->fresh_until = FreshUntil(lifetime);
+      }
+    }
+    MaybeAssign(status, Status::OK());
+    return new SharedHttpResponse(stored);
+  }
+
+  Status StreamRequest(const HttpRequest& request, HttpSink* sink) {
+    return client_->StreamRequest(request, sink);
+  }
+
+  HttpByteCounts GetByteCounts() const { return client_->GetByteCounts(); }
+
+  void GetStatistics(CachingHttpClient::Statistics* stats) const {
+    assert(stats != NULL);
+    ScopeLock lock(&mutex_);
+    stats->set_hits(hits_)
+        .set_revalidations(revalidations_)
+        .set_misses(misses_)
+        .set_evictions(evictions_)
+        .set_bytes(bytes_);
+  }
+
+ private:
+  // A stored response. Entries are kept in a list, most recently used
+  // first, and indexed by key.
+  struct Entry {
+    std::string key;
+    Shared<HttpResponse>::Ptr response;
+    uint64_t fresh_until;  // MonotonicNanos() at which it goes stale.
+    std::string etag;
+    std::string last_modified;
+    size_t size;
+  };
+
+  typedef std::list<Entry> Lru;
+  typedef std::map<std::string, Lru::iterator> Index;
+
+  // Return true if the response to 'request' may come from the cache.
+  static bool IsCacheable(const HttpRequest& request) {
+    if (request.method() != HttpRequest::GET &&
+        request.method() != HttpRequest::HEAD) {
+      return false;
+    }
+    Slice value;
+    if (request.FindHeader("If-None-Match", &value) ||
+        request.FindHeader("If-Modified-Since", &value)) {
+      return false;  // The caller is revalidating its own copy.
+    }
+    return !request.FindHeader("Cache-Control", &value) ||
+           !FindDirective(ToString(value), "no-store", NULL);
+  }
+
+  // Return the key that the response to 'request' is stored under: the
+  // method, the URI and the values of the key headers.
+  std::string MakeKey(const HttpRequest& request) const {
+    std::string key(request.method() == HttpRequest::GET ? "GET " : "HEAD ");
+    key.append(request.uri());
+    const std::vector<std::string>& names = settings_.key_headers();
+    for (size_t i = 0; i < names.size(); ++i) {
+      Slice value;
+      key.push_back('\n');
+      if (request.FindHeader(names[i].c_str(), &value)) {
+        key.append(value.data(), value.size());
+      }
+    }
+    return key;
+  }
+
+  static uint64_t FreshUntil(int64_t lifetime) {
+    const uint64_t now = MonotonicNanos();
+    return lifetime > 0 ? now + lifetime * kNanosPerSecond : now;
+  }
+
+  // Send 'request' for a full response.
+  HttpResponse* Fetch(const std::string& key, const HttpRequest& request,
+                      Status* status) {
+    Status result;
+    Shared<HttpResponse>::Ptr response(client_->SendRequest(request, &result));
+    if (result.IsFailure()) {
+      MaybeAssign(status, result);
+      return NULL;
+    }
+    return Store(key, response, status);
+  }
+
+  // Store 'response' under 'key' if it may be, replacing any entry, and
+  // return it to the caller.
+  HttpResponse* Store(const std::string& key,
+                      const Shared<HttpResponse>::Ptr& response,
+                      Status* status) {
+    Entry entry;
+    entry.key = key;
+    entry.response = response;
+    entry.size = key.size() + response->BodySize();
+    for (size_t i = 0; i < response->HeaderCount(); ++i) {
+      Slice name, value;
+      response->GetHeader(i, &name, &value);
+      entry.size += name.size() + value.size();
+    }
+    Slice value;
+    if (response->FindHeader("ETag", &value)) {
+      entry.etag = ToString(value);
+    }
+    if (response->FindHeader("Last-Modified", &value)) {
+      entry.last_modified = ToString(value);
+    }
+    const int64_t lifetime =
+        FreshnessLifetime(*response.get()) - Age(*response.get());
+    entry.fresh_until = FreshUntil(lifetime);
+
+    std::string cache_control;
+    JoinHeaders(*response.get(), "cache-control", &cache_control);
+    const bool storable =
+        IsCacheableStatus(response->StatusCode()) &&
+        !FindDirective(cache_control, "no-store", NULL) &&
+        !(response->FindHeader("Vary", &value) && ToString(value) == "*") &&
+        (lifetime > 0 || !entry.etag.empty() || !entry.last_modified.empty()) &&
+        entry.size <= settings_.max_bytes();
+
+    ScopeLock lock(&mutex_);
+    ++misses_;
+    Index::iterator it = index_.find(key);
+    if (it != index_.end()) {
+      Remove(it);
+    }
+    if (storable) {
+      lru_.push_front(entry);
+      index_[key] = lru_.begin();
+      bytes_ += entry.size;
+      while (bytes_ > settings_.max_bytes()) {
+        Remove(index_.find(lru_.back().key));
+        ++evictions_;
+      }
+    }
+    MaybeAssign(status, Status::OK());
+    return new SharedHttpResponse(response);
+  }
+
+  // Forget the entry at 'it'. The caller holds the lock.
+  void Remove(Index::iterator it) {
+    bytes_ -= it->second->size;
+    lru_.erase(it->second);
+    index_.erase(it);
+  }
+
+  Rep(const Rep& no_copy);
+  Rep& operator=(const Rep& no_assign);
+
+  ScopePointer<HttpClient> client_;
+  const Settings settings_;
+  mutable Mutex mutex_;
+  Lru lru_;
+  Index index_;
+  uint64_t bytes_;
+  uint64_t hits_;
+  uint64_t revalidations_;
+  uint64_t misses_;
+  uint64_t evictions_;
+};
+
+CachingHttpClient::CachingHttpClient(Rep* rep) : rep_(rep) {
+  assert(rep != NULL);
+}
+
+CachingHttpClient::~CachingHttpClient() { delete rep_; }
+
+CachingHttpClient* CachingHttpClient::Create(HttpClient* client,
+                                             const Settings& settings,
+                                             Status* status_out) {
+  ScopePointer<Rep> rep(new Rep(client, settings));
+  Status status = rep->Init();
+  if (status.IsFailure()) {
+    MaybeAssign(status_out, status);
+    return NULL;
+  }
+
+  CachingHttpClient* caching_client = new CachingHttpClient(rep.Get());
+  rep.ReleaseOwnership();
+
+  return caching_client;
+}
+
+HttpResponse* CachingHttpClient::SendRequest(const HttpRequest& request,
+                                             Status* status) {
+  return rep_->SendRequest(request, status);
+}
+
+Status CachingHttpClient::StreamRequest(const HttpRequest& request,
+                                        HttpSink* sink) {
+  return rep_->StreamRequest(request, sink);
+}
+
+HttpByteCounts CachingHttpClient::GetByteCounts() const {
+  return rep_->GetByteCounts();
+}
+
+void CachingHttpClient::GetStatistics(Statistics* stats) const {
+  rep_->GetStatistics(stats);
+}
+
+}  // namespace enquery
@@ -0,0 +1,219 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include <stdlib.h>
+#include <string>
+#include "enquery/caching_http_client.h"
+#include "enquery/http.h"
+#include "enquery/http_client.h"
+#include "enquery/http_request.h"
+#include "enquery/http_response.h"
+#include "enquery/shared.h"
+#include "enquery/slice.h"
+#include "enquery/status.h"
+#include "enquery/testing.h"
+#include "http/http_test_server.h"
+
+using ::enquery::CachingHttpClient;
+using ::enquery::Http;
+using ::enquery::HttpByteCounts;
+using ::enquery::HttpClient;
+using ::enquery::HttpRequest;
+using ::enquery::HttpResponse;
+using ::enquery::HttpTestServer;
+using ::enquery::Shared;
+using ::enquery::Slice;
+using ::enquery::Status;
+
+namespace {
+
+// Create a cache holding at most 'max_bytes', in front of a new client.
+CachingHttpClient* CreateCache(Http* http, size_t max_bytes) {
+  Status status;
+  HttpClient* client = http->CreateClient(&status);
+  ASSERT_TRUE(status.IsSuccess());
+  CachingHttpClient* cache = CachingHttpClient::Create(
+      client, CachingHttpClient::Settings()
+                  .set_max_bytes(max_bytes)
+                  .add_key_header("Accept-Language"),
+      &status);
+  ASSERT_TRUE(status.IsSuccess());
+  return cache;
+}
+
+// Send 'request' for 'path' and check the status and size of the body.
+Shared<HttpResponse>::Ptr Get(HttpClient* client, const HttpTestServer& server,
+                              const char* path, HttpRequest request,
+                              size_t expected_size) {
+  const std::string uri = server.Url(path);
+  request.set_uri(uri.c_str());
+  Status status;
+  Shared<HttpResponse>::Ptr response(client->SendRequest(request, &status));
+  ASSERT_TRUE(status.IsSuccess());
+  ASSERT_EQUALS(response->StatusCode(), 200);
+  ASSERT_EQUALS(response->BodySize(), expected_size);
+  return response;
+}
+
+Shared<HttpResponse>::Ptr Get(HttpClient* client, const HttpTestServer& server,
+                              const char* path, size_t expected_size) {
+  return Get(client, server, path, HttpRequest(), expected_size);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  Status status;
+  Shared<Http>::Ptr http(Http::Create(&status));
+  ASSERT_TRUE(status.IsSuccess());
+
+  HttpTestServer server;
+  ASSERT_TRUE(server.Start().IsSuccess());
+
+  // A cache needs a client.
+  ASSERT_TRUE(CachingHttpClient::Create(NULL, CachingHttpClient::Settings(),
+                                        &status) == NULL);
+  ASSERT_TRUE(status.IsFailure());
+
+  // A fresh response is answered from the cache, sharing its body, and
+  // outlives the cache.
+  {
+    Shared<HttpResponse>::Ptr first, second;
+    {
+      Shared<CachingHttpClient>::Ptr cache(CreateCache(http.get(), 1 << 20));
+      const uint64_t served = server.requests_served();
+      first = Get(cache.get(), server, "/1000?max_age=60", 1000);
+      const HttpByteCounts counts = cache->GetByteCounts();
+      second = Get(cache.get(), server, "/1000?max_age=60", 1000);
+      ASSERT_EQUALS(server.requests_served(), served + 1);
+      ASSERT_TRUE(first->Body() == second->Body());
+      ASSERT_EQUALS(cache->GetByteCounts().response_wire_bytes,
+                    counts.response_wire_bytes);
+
+      CachingHttpClient::Statistics stats;
+      cache->GetStatistics(&stats);
+      ASSERT_EQUALS(stats.hits(), 1u);
+      ASSERT_EQUALS(stats.misses(), 1u);
+      ASSERT_TRUE(stats.bytes() >= 1000u);
+    }
+    ASSERT_EQUALS(std::string(second->Body(), second->BodySize()),
+                  std::string(1000, 'x'));
+  }
+
+  // A response with an ETag but no lifetime is revalidated every time;
+  // the server's 304 carries no body.
+  {
+    Shared<CachingHttpClient>::Ptr cache(CreateCache(http.get(), 1 << 20));
+    const uint64_t served = server.requests_served();
+    Shared<HttpResponse>::Ptr first =
+        Get(cache.get(), server, "/20000?etag=v1", 20000);
+    const HttpByteCounts counts = cache->GetByteCounts();
+    Shared<HttpResponse>::Ptr second =
+        Get(cache.get(), server, "/20000?etag=v1", 20000);
+    ASSERT_EQUALS(server.requests_served(), served + 2);
+    ASSERT_TRUE(first->Body() == second->Body());
+    ASSERT_TRUE(cache->GetByteCounts().response_wire_bytes <
+                counts.response_wire_bytes + 1000);
+    Slice etag;
+    ASSERT_TRUE(second->FindHeader("ETag", &etag));
+    ASSERT_EQUALS(std::string(etag.data(), etag.size()), "\"v1\"");
+
+    CachingHttpClient::Statistics stats;
+    cache->GetStatistics(&stats);
+    ASSERT_EQUALS(stats.hits(), 0u);
+    ASSERT_EQUALS(stats.revalidations(), 1u);
+    ASSERT_EQUALS(stats.misses(), 1u);
+  }
+
+  // "Cache-Control: no-cache" on a request revalidates a fresh response;
+  // without a validator, that means fetching it again.
+  {
+    Shared<CachingHttpClient>::Ptr cache(CreateCache(http.get(), 1 << 20));
+    const uint64_t served = server.requests_served();
+    Get(cache.get(), server, "/100?max_age=60", 100);
+    HttpRequest no_cache;
+    no_cache.AddHeader("Cache-Control", "no-cache");
+    Get(cache.get(), server, "/100?max_age=60", no_cache, 100);
+    ASSERT_EQUALS(server.requests_served(), served + 2);
+    Get(cache.get(), server, "/100?max_age=60", 100);
+    ASSERT_EQUALS(server.requests_served(), served + 2);
+  }
+
+  // Responses marked "no-store" aren't stored; requests marked "no-store"
+  // bypass the cache.
+  {
+    Shared<CachingHttpClient>::Ptr cache(CreateCache(http.get(), 1 << 20));
+    const uint64_t served = server.requests_served();
+    Get(cache.get(), server, "/100?no_store", 100);
+    Get(cache.get(), server, "/100?no_store", 100);
+    ASSERT_EQUALS(server.requests_served(), served + 2);
+    HttpRequest no_store;
+    no_store.AddHeader("Cache-Control", "no-store");
+    Get(cache.get(), server, "/200?max_age=60", no_store, 200);
+    Get(cache.get(), server, "/200?max_age=60", 200);
+    ASSERT_EQUALS(server.requests_served(), served + 4);
+
+    CachingHttpClient::Statistics stats;
+    cache->GetStatistics(&stats);
+    ASSERT_EQUALS(stats.misses(), 3u);
+    ASSERT_TRUE(stats.bytes() > 0u);
+  }
+
+  // Key headers keep apart responses to otherwise identical requests.
+  {
+    Shared<CachingHttpClient>::Ptr cache(CreateCache(http.get(), 1 << 20));
+    const uint64_t served = server.requests_served();
+    HttpRequest english, french;
+    english.AddHeader("Accept-Language", "en");
+    french.AddHeader("Accept-Language", "fr");
+    Get(cache.get(), server, "/300?max_age=60", english, 300);
+    Get(cache.get(), server, "/300?max_age=60", french, 300);
+    Get(cache.get(), server, "/300?max_age=60", english, 300);
+    ASSERT_EQUALS(server.requests_served(), served + 2);
+  }
+
+  // The least recently used responses are evicted to stay within size.
+  {
+    Shared<CachingHttpClient>::Ptr cache(CreateCache(http.get(), 5000));
+    const uint64_t served = server.requests_served();
+    Get(cache.get(), server, "/3000?max_age=60", 3000);
+    Get(cache.get(), server, "/3001?max_age=60", 3001);
+    Get(cache.get(), server, "/3001?max_age=60", 3001);
+    ASSERT_EQUALS(server.requests_served(), served + 2);
+    Get(cache.get(), server, "/3000?max_age=60", 3000);
+    ASSERT_EQUALS(server.requests_served(), served + 3);
+    Get(cache.get(), server, "/9000?max_age=60", 9000);
+    Get(cache.get(), server, "/9000?max_age=60", 9000);
+    ASSERT_EQUALS(server.requests_served(), served + 5);
+
+    CachingHttpClient::Statistics stats;
+    cache->GetStatistics(&stats);
+    ASSERT_EQUALS(stats.evictions(), 2u);
+    ASSERT_TRUE(stats.bytes() <= 5000u);
+  }
+
+  // Other methods go straight to the server.
+  {
+    Shared<CachingHttpClient>::Ptr cache(CreateCache(http.get(), 1 << 20));
+    const uint64_t served = server.requests_served();
+    HttpRequest post;
+    post.set_method(HttpRequest::POST).set_body("abc", 3);
+    Get(cache.get(), server, "/echo?max_age=60", post, 3);
+    Get(cache.get(), server, "/echo?max_age=60", post, 3);
+    ASSERT_EQUALS(server.requests_served(), served + 2);
+  }
+
+  return EXIT_SUCCESS;
+}
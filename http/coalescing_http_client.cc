@@ -0,0 +1,197 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "enquery/coalescing_http_client.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <map>
+#include <string>
+#include "enquery/http_request.h"
+#include "enquery/http_response.h"
+#include "enquery/mutex.h"
+#include "enquery/scope_lock.h"
+#include "enquery/scope_pointer.h"
+#include "enquery/shared.h"
+#include "enquery/slice.h"
+#include "enquery/status.h"
+#include "enquery/utility.h"
+#include "http/shared_http_response.h"
+
+namespace enquery {
+
+namespace {
+
+const char kModule[] = "CoalescingHttpClient";
+
+}  // namespace
+
+class CoalescingHttpClient::Rep {
+ public:
+  explicit Rep(HttpClient* client)
+      : client_(client),
+        mutex_("CoalescingHttpClient"),
+        sent_(0),
+        collapsed_(0) {}
+
+  Status Init() {
+    if (client_.Get() == NULL) {
+      return Status::MakeError(kModule, "client was null");
+    }
+    return Status::OK();
+  }
+
+  HttpResponse* SendRequest(const HttpRequest& request, Status* status) {
+    if (request.method() != HttpRequest::GET &&
+        request.method() != HttpRequest::HEAD) {
+      return client_->SendRequest(request, status);
+    }
+    const std::string key = MakeKey(request);
+
+    // Wait for an identical request that is already in flight...
+    mutex_.Lock();
+    Calls::iterator it = calls_.find(key);
+    if (it != calls_.end()) {
+      Shared<Call>::Ptr call = it->second;
+      ++collapsed_;
+      while (!call->done) {
+        call->cond.Wait(&mutex_);
+      }
+      mutex_.Unlock();
+      return Answer(*call.get(), status);
+    }
+
+    // ...or send this one, for everyone that asks while it is.
+    Shared<Call>::Ptr call(new Call());
+    calls_[key] = call;
+    ++sent_;
+    mutex_.Unlock();
+
+    HttpResponse* response = client_->SendRequest(request, &call->status);
+    call->response = Shared<HttpResponse>::Ptr(response);
+
+    mutex_.Lock();
+    call->done = true;
+    calls_.erase(key);
+    call->cond.Broadcast();
+    mutex_.Unlock();
+    return Answer(*call.get(), status);
+  }
+
+  Status StreamRequest(const HttpRequest& request, HttpSink* sink) {
+    return client_->StreamRequest(request, sink);
+  }
+
+  HttpByteCounts GetByteCounts() const { return client_->GetByteCounts(); }
+
+  void GetStatistics(CoalescingHttpClient::Statistics* stats) const {
+    assert(stats != NULL);
+    ScopeLock lock(&mutex_);
+    stats->set_sent(sent_).set_collapsed(collapsed_);
+  }
+
+ private:
+  // A request in flight, and then its outcome. The fields other than
+  // 'done' are written only by the sender, before it sets 'done'.
+  struct Call {
+    Call() : done(false) {}
+    bool done;
+    Status status;
+    Shared<HttpResponse>::Ptr response;
+    CondVar cond;  // Signalled when done.
+  };
+
+  typedef std::map<std::string, Shared<Call>::Ptr> Calls;
+
+  // Return a key that is the same only for identical requests: the
+  // method, the time limits, the URI and every header, each followed by a
+  // NUL (which none of them can contain.) A request that joins another
+  // with the same limits can't wait longer than its own would have taken.
+  static std::string MakeKey(const HttpRequest& request) {
+    char limits[32];
+    snprintf(limits, sizeof(limits), "%d %d", request.connect_timeout_ms(),
+             request.timeout_ms());
+    std::string key(request.method() == HttpRequest::GET ? "GET" : "HEAD");
+    key.push_back('\0');
+    key.append(limits).push_back('\0');
+    key.append(request.uri()).push_back('\0');
+    for (size_t i = 0; i < request.HeaderCount(); ++i) {
+      Slice name, value;
+      request.GetHeader(i, &name, &value);
+      key.append(name.data(), name.size()).push_back('\0');
+      key.append(value.data(), value.size()).push_back('\0');
+    }
+    return key;
+  }
+
+  // Give a caller its own handle on the outcome of 'call'.
+  static HttpResponse* Answer(const Call& call, Status* status) {
+    MaybeAssign(status, call.status);
+    if (call.response.get() == NULL) {
+      return NULL;
+    }
+    return new SharedHttpResponse(call.response);
+  }
+
+  Rep(const Rep& no_copy);
+  Rep& operator=(const Rep& no_assign);
+
+  ScopePointer<HttpClient> client_;
+  mutable Mutex mutex_;
+  Calls calls_;
+  uint64_t sent_;
+  uint64_t collapsed_;
+};
+
+CoalescingHttpClient::CoalescingHttpClient(Rep* rep) : rep_(rep) {
+  assert(rep != NULL);
+}
+
+CoalescingHttpClient::~CoalescingHttpClient() { delete rep_; }
+
+CoalescingHttpClient* CoalescingHttpClient::Create(HttpClient* client,
+                                                   Status* status_out) {
+  ScopePointer<Rep> rep(new Rep(client));
+  Status status = rep->Init();
+  if (status.IsFailure()) {
+    MaybeAssign(status_out, status);
+    return NULL;
+  }
+
+  CoalescingHttpClient* client_out = new CoalescingHttpClient(rep.Get());
+  rep.ReleaseOwnership();
+
+  return client_out;
+}
+
+HttpResponse* CoalescingHttpClient::SendRequest(const HttpRequest& request,
+                                                Status* status) {
+  return rep_->SendRequest(request, status);
+}
+
+Status CoalescingHttpClient::StreamRequest(const HttpRequest& request,
+                                           HttpSink* sink) {
+  return rep_->StreamRequest(request, sink);
+}
+
+HttpByteCounts CoalescingHttpClient::GetByteCounts() const {
+  return rep_->GetByteCounts();
+}
+
+void CoalescingHttpClient::GetStatistics(Statistics* stats) const {
+  rep_->GetStatistics(stats);
+}
+
+}  // namespace enquery
@@ -0,0 +1,240 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include "enquery/coalescing_http_client.h"
+#include "enquery/http.h"
+#include "enquery/http_client.h"
+#include "enquery/http_request.h"
+#include "enquery/http_response.h"
+#include "enquery/mutex.h"
+#include "enquery/scope_lock.h"
+#include "enquery/shared.h"
+#include "enquery/status.h"
+#include "enquery/testing.h"
+#include "http/http_test_client.h"
+#include "http/http_test_server.h"
+
+using ::enquery::CoalescingHttpClient;
+using ::enquery::CondVar;
+using ::enquery::FakeHttpResponse;
+using ::enquery::Http;
+using ::enquery::HttpByteCounts;
+using ::enquery::HttpClient;
+using ::enquery::HttpRequest;
+using ::enquery::HttpResponse;
+using ::enquery::HttpSink;
+using ::enquery::HttpTestServer;
+using ::enquery::Mutex;
+using ::enquery::ScopeLock;
+using ::enquery::Shared;
+using ::enquery::Status;
+
+namespace {
+
+const int kThreads = 8;
+
+// A client whose requests don't complete until they are released, so
+// that callers can be made to overlap. Requests for "fail" fail.
+class GatedClient : public HttpClient {
+ public:
+  GatedClient() : mutex_("GatedClient"), released_(false), requests_(0) {}
+
+  virtual HttpResponse* SendRequest(const HttpRequest& request,
+                                    Status* status) {
+    ScopeLock lock(&mutex_);
+    ++requests_;
+    while (!released_) {
+      cond_.Wait(&mutex_);
+    }
+    if (std::string(request.uri()) == "fail") {
+      *status = Status::MakeError("GatedClient", "failed");
+      return NULL;
+    }
+    *status = Status::OK();
+    return new FakeHttpResponse(200, request.uri());
+  }
+
+  virtual Status StreamRequest(const HttpRequest& request, HttpSink* sink) {
+    return Status::MakeError("GatedClient", "unsupported");
+  }
+
+  virtual HttpByteCounts GetByteCounts() const { return HttpByteCounts(); }
+
+  void Release() {
+    ScopeLock lock(&mutex_);
+    released_ = true;
+    cond_.Broadcast();
+  }
+
+  int requests() {
+    ScopeLock lock(&mutex_);
+    return requests_;
+  }
+
+ private:
+  Mutex mutex_;
+  CondVar cond_;
+  bool released_;
+  int requests_;
+};
+
+struct ThreadArgs {
+  HttpClient* client;
+  HttpRequest request;
+  Status status;
+  HttpResponse* response;
+};
+
+void* Send(void* arg) {
+  ThreadArgs* args = static_cast<ThreadArgs*>(arg);
+  args->response = args->client->SendRequest(args->request, &args->status);
+  return NULL;
+}
+
+// Send the requests in 'args' from kThreads threads at once, through a
+// coalescing client in front of a GatedClient, and release the requests
+// once they have all arrived. Return the number that reached the
+// GatedClient.
+int SendAtOnce(ThreadArgs* args) {
+  GatedClient* gated = new GatedClient();
+  Status status;
+  Shared<CoalescingHttpClient>::Ptr client(
+      CoalescingHttpClient::Create(gated, &status));
+  ASSERT_TRUE(status.IsSuccess());
+
+  pthread_t threads[kThreads];
+  for (int i = 0; i < kThreads; ++i) {
+    args[i].client = client.get();
+    args[i].response = NULL;
+    ASSERT_EQUALS(pthread_create(&threads[i], NULL, Send, &args[i]), 0);
+  }
+  CoalescingHttpClient::Statistics stats;
+  for (;;) {
+    client->GetStatistics(&stats);
+    if (stats.sent() + stats.collapsed() == static_cast<uint64_t>(kThreads) ||
+        gated->requests() == kThreads) {
+      break;  // All coalesced, or all passed through.
+    }
+    usleep(1000);
+  }
+  gated->Release();
+  for (int i = 0; i < kThreads; ++i) {
+    pthread_join(threads[i], NULL);
+  }
+  return gated->requests();
+}
+
+// Send 'request' from kThreads threads at once, as above.
+int SendAtOnce(const HttpRequest& request, ThreadArgs* args) {
+  for (int i = 0; i < kThreads; ++i) {
+    args[i].request = request;
+  }
+  return SendAtOnce(args);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  Status status;
+
+  // A coalescing client needs a client.
+  ASSERT_TRUE(CoalescingHttpClient::Create(NULL, &status) == NULL);
+  ASSERT_TRUE(status.IsFailure());
+
+  // Identical requests in flight together are sent once, and share the
+  // response.
+  {
+    ThreadArgs args[kThreads];
+    HttpRequest request;
+    request.set_uri("/document");
+    ASSERT_EQUALS(SendAtOnce(request, args), 1);
+    for (int i = 0; i < kThreads; ++i) {
+      ASSERT_TRUE(args[i].status.IsSuccess());
+      ASSERT_EQUALS(std::string(args[i].response->Body(),
+                                args[i].response->BodySize()),
+                    "/document");
+      ASSERT_TRUE(args[i].response->Body() == args[0].response->Body());
+    }
+    for (int i = 0; i < kThreads; ++i) {
+      delete args[i].response;
+    }
+  }
+
+  // So is a failure.
+  {
+    ThreadArgs args[kThreads];
+    HttpRequest request;
+    request.set_uri("fail");
+    ASSERT_EQUALS(SendAtOnce(request, args), 1);
+    for (int i = 0; i < kThreads; ++i) {
+      ASSERT_TRUE(args[i].status.IsFailure());
+      ASSERT_TRUE(args[i].response == NULL);
+    }
+  }
+
+  // Requests with different time limits aren't, so that none waits
+  // longer than its own limit for another's response.
+  {
+    ThreadArgs args[kThreads];
+    for (int i = 0; i < kThreads; ++i) {
+      args[i].request.set_uri("/document").set_timeout_ms(1000 + i);
+    }
+    ASSERT_EQUALS(SendAtOnce(args), kThreads);
+    for (int i = 0; i < kThreads; ++i) {
+      delete args[i].response;
+    }
+  }
+
+  // Requests other than GET and HEAD are all sent.
+  {
+    ThreadArgs args[kThreads];
+    HttpRequest request;
+    request.set_uri("/document").set_method(HttpRequest::POST);
+    ASSERT_EQUALS(SendAtOnce(request, args), kThreads);
+    for (int i = 0; i < kThreads; ++i) {
+      delete args[i].response;
+    }
+  }
+
+  // Requests that don't overlap aren't coalesced.
+  {
+    Shared<Http>::Ptr http(Http::Create(&status));
+    ASSERT_TRUE(status.IsSuccess());
+    HttpTestServer server;
+    ASSERT_TRUE(server.Start().IsSuccess());
+    Shared<CoalescingHttpClient>::Ptr client(
+        CoalescingHttpClient::Create(http->CreateClient(&status), &status));
+    ASSERT_TRUE(status.IsSuccess());
+    const std::string uri = server.Url("/100");
+    HttpRequest request;
+    request.set_uri(uri.c_str());
+    for (int i = 0; i < 3; ++i) {
+      Shared<HttpResponse>::Ptr response(client->SendRequest(request, &status));
+      ASSERT_TRUE(status.IsSuccess());
+      ASSERT_EQUALS(response->BodySize(), 100u);
+    }
+    ASSERT_EQUALS(server.requests_served(), 3u);
+    CoalescingHttpClient::Statistics stats;
+    client->GetStatistics(&stats);
+    ASSERT_EQUALS(stats.sent(), 3u);
+    ASSERT_EQUALS(stats.collapsed(), 0u);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,765 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "http/curl_async_http_client.h"
+#include <assert.h>
+#include <curl/curl.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <deque>
+#include <set>
+#include <string>
+#include <vector>
+#include "http/curl_http_response.h"
+#include "http/curl_request.h"
+#include "enquery/buffer.h"
+#include "enquery/futures.h"
+#include "enquery/http_request.h"
+#include "enquery/mutex.h"
+#include "enquery/portability.h"
+#include "enquery/reactor.h"
+#include "enquery/scope_lock.h"
+#include "enquery/scope_pointer.h"
+#include "enquery/slice.h"
+#include "enquery/thread.h"
+#include "enquery/trace.h"
+#include "enquery/utility.h"
+
+namespace {
+
+const char* const kModule = "CurlAsyncHttpClient";
+
+const uint64_t kNanosPerMilli = 1000000;
+
+// The most easy handles each I/O thread keeps for reuse.
+const size_t kMaxFreeHandles = 256;
+
+}  // namespace
+
+namespace enquery {
+
+namespace {
+
+struct Transfer;
+
+// Implemented by the I/O thread that runs a transfer.
+class TransferRunner {
+ public:
+  // Ask for 'transfer' to be resumed if it is paused, or abandoned if its
+  // stream has been deleted. May be called from any thread.
+  virtual void Poke(Transfer* transfer) = 0;
+
+ protected:
+  virtual ~TransferRunner() {}
+};
+
+// The state shared by a streaming transfer and its HttpStream.
+struct StreamState {
+  explicit StreamState(size_t limit_bytes)
+      : mutex("CurlHttpStream"),
+        limit(limit_bytes),
+        buffered(0),
+        received(0),
+        paused(false),
+        done(false),
+        abandoned(false),
+        runner(NULL),
+        transfer(NULL) {}
+  Mutex mutex;
+  CondVar cond;
+  std::deque<std::string> chunks;
+  const size_t limit;
+  size_t buffered;         // Total size of 'chunks'.
+  uint64_t received;       // Bytes of the body queued so far.
+  bool paused;             // The transfer waits for buffer space.
+  bool done;               // The transfer has ended...
+  Status status;           // ...with this status.
+  bool abandoned;          // The stream has been deleted.
+  TransferRunner* runner;  // NULL once the transfer has ended.
+  Transfer* transfer;
+  Shared<HttpResponse>::Ptr head;  // Set before the first of the body.
+};
+
+// A request in progress. Owned by the I/O thread from submission until
+// it ends. The response body goes to 'response_body' or, for a streaming
+// request, to 'stream'.
+struct Transfer {
+  Transfer(const HttpRequest& r, size_t compress_above)
+      : request(r),
+        body(request, compress_above),
+        curl(NULL),
+        started_at(0) {}
+  HttpRequest request;
+  CurlRequestBody body;
+  Shared<Buffer>::Ptr response_body;
+  Shared<Buffer>::Ptr response_headers;
+  Shared<HttpResponse>::Ptr response;  // Set when the transfer succeeds.
+  Shared<StreamState>::Ptr stream;
+  Promise<HttpResult> promise;
+  CURL* curl;
+  uint64_t started_at;
+  CurlTimeouts timeouts;  // As applied to 'curl'.
+};
+
+// Deliver the outcome of 'transfer' and delete it.
+void Complete(Transfer* transfer, const Status& status) {
+  if (StreamState* stream = transfer->stream.get()) {
+    {
+      ScopeLock lock(&stream->mutex);
+      stream->done = true;
+      stream->status = status;
+      stream->runner = NULL;
+      stream->transfer = NULL;
+      stream->cond.Broadcast();
+    }
+    delete transfer;
+    return;
+  }
+
+  Shared<HttpResponse>::Ptr response;
+  if (status.IsSuccess()) {
+    response = transfer->response;
+  }
+  Promise<HttpResult> promise(transfer->promise);
+  delete transfer;
+  promise.SetValue(HttpResult(status, response));
+}
+
+// Give the stream of 'transfer' the head of its response, unless that has
+// been done already. The header block is copied, since curl goes on to
+// append any trailers to it. Called with the stream's mutex held.
+void SetStreamHead(Transfer* transfer) {
+  StreamState* stream = transfer->stream.get();
+  if (stream->head.get() != NULL) {
+    return;
+  }
+  Shared<Buffer>::Ptr headers(new Buffer(*transfer->response_headers.get()));
+  stream->head = Shared<HttpResponse>::Ptr(MakeCurlHttpResponse(
+      transfer->curl, Shared<Buffer>::Ptr(new Buffer()), headers));
+  stream->cond.Broadcast();
+}
+
+// Write callback for streaming transfers. Data is queued for the reader
+// until 'limit' bytes are waiting; after that the transfer is paused, and
+// curl offers the same data again once it is resumed.
+size_t WriteStream(char* data, size_t size, size_t nmemb, void* user) {
+  StreamState* stream = static_cast<StreamState*>(user);
+  const size_t total_bytes = size * nmemb;
+  ScopeLock lock(&stream->mutex);
+  if (stream->abandoned) {
+    return 0;
+  }
+  SetStreamHead(stream->transfer);
+  if (stream->buffered >= stream->limit) {
+    stream->paused = true;
+    return CURL_WRITEFUNC_PAUSE;
+  }
+  stream->chunks.push_back(std::string(data, total_bytes));
+  stream->buffered += total_bytes;
+  stream->received += total_bytes;
+  stream->cond.Signal();
+  return total_bytes;
+}
+
+class CurlHttpStream : public HttpStream {
+ public:
+  explicit CurlHttpStream(Shared<StreamState>::Ptr state) : state_(state) {}
+
+  virtual ~CurlHttpStream() {
+    ScopeLock lock(&state_->mutex);
+    state_->abandoned = true;
+    state_->chunks.clear();
+    state_->buffered = 0;
+    if (state_->runner) {
+      state_->runner->Poke(state_->transfer);
+    }
+  }
+
+  virtual const HttpResponse* Head() {
+    ScopeLock lock(&state_->mutex);
+    while (state_->head.get() == NULL && !state_->done) {
+      state_->cond.Wait(&state_->mutex);
+    }
+    return state_->head.get();
+  }
+
+  virtual Status Next(Slice* chunk) {
+    assert(chunk != NULL);
+    current_.clear();
+    ScopeLock lock(&state_->mutex);
+    while (state_->chunks.empty() && !state_->done) {
+      state_->cond.Wait(&state_->mutex);
+    }
+    if (state_->chunks.empty()) {
+      *chunk = Slice();
+      return state_->status;
+    }
+
+    current_.swap(state_->chunks.front());
+    state_->chunks.pop_front();
+    state_->buffered -= current_.size();
+    *chunk = Slice(current_.data(), current_.size());
+
+    // Resume at half full, so that a reader that keeps up doesn't pause
+    // and resume the transfer on every chunk.
+    if (state_->paused && state_->buffered <= state_->limit / 2) {
+      state_->paused = false;
+      if (state_->runner) {
+        state_->runner->Poke(state_->transfer);
+      }
+    }
+    return Status::OK();
+  }
+
+ private:
+  CurlHttpStream(const CurlHttpStream& no_copy);
+  CurlHttpStream& operator=(const CurlHttpStream& no_assign);
+
+  Shared<StreamState>::Ptr state_;
+  std::string current_;
+};
+
+// Return the client's default time limits on requests.
+CurlTimeouts DefaultTimeouts(const AsyncHttpClient::Settings& settings) {
+  CurlTimeouts timeouts;
+  timeouts.connect_ms = settings.connect_timeout_ms();
+  timeouts.total_ms = settings.timeout_ms();
+  timeouts.low_speed_bytes = settings.low_speed_bytes_per_second();
+  timeouts.low_speed_seconds = settings.low_speed_seconds();
+  return timeouts;
+}
+
+}  // namespace
+
+class CurlAsyncHttpClient::IoThread : public Reactor::Handler,
+                                      public TransferRunner {
+ public:
+  IoThread(const AsyncHttpClient::Settings& settings, CurlShare* share,
+           HttpByteCounts* byte_counts)
+      : settings_(settings),
+        share_(share),
+        default_timeouts_(DefaultTimeouts(settings)),
+        byte_counts_(byte_counts),
+        mutex_("CurlAsyncHttpClient::IoThread"),
+        stopping_(false),
+        reactor_(NULL),
+        multi_(NULL),
+        thread_(NULL),
+        timer_armed_(false),
+        timer_deadline_(0) {}
+
+  virtual ~IoThread() {
+    if (thread_) {
+      {
+        ScopeLock lock(&mutex_);
+        stopping_ = true;
+      }
+      reactor_->Wakeup();
+      delete thread_;  // Joins.
+    }
+
+    // The thread has exited; fail whatever it left behind.
+    const Status shut_down = Status::MakeError(kModule, "client shut down");
+    for (size_t i = 0; i < pending_.size(); ++i) {
+      Complete(pending_[i], shut_down);
+    }
+    for (std::set<Transfer*>::iterator it = in_flight_.begin();
+         it != in_flight_.end(); ++it) {
+      curl_multi_remove_handle(multi_, (*it)->curl);
+      curl_easy_cleanup((*it)->curl);
+      Complete(*it, shut_down);
+    }
+    for (size_t i = 0; i < free_handles_.size(); ++i) {
+      curl_easy_cleanup(free_handles_[i]);
+    }
+    if (multi_) {
+      curl_multi_cleanup(multi_);
+    }
+    delete reactor_;
+  }
+
+  Status Init() {
+    Status status;
+    reactor_ = Reactor::Create(
+        Reactor::DefaultSettings().set_backend(settings_.reactor_backend()),
+        &status);
+    if (!reactor_) {
+      return status;
+    }
+
+    multi_ = curl_multi_init();
+    if (!multi_) {
+      return Status::MakeError(kModule, "curl_multi_init() failed");
+    }
+    curl_multi_setopt(multi_, CURLMOPT_SOCKETFUNCTION, SocketCallback);
+    curl_multi_setopt(multi_, CURLMOPT_SOCKETDATA, this);
+    curl_multi_setopt(multi_, CURLMOPT_TIMERFUNCTION, TimerCallback);
+    curl_multi_setopt(multi_, CURLMOPT_TIMERDATA, this);
+    if (settings_.max_connections_per_host() > 0) {
+      curl_multi_setopt(multi_, CURLMOPT_MAX_HOST_CONNECTIONS,
+                        static_cast<long>(  // NOLINT
+                            settings_.max_connections_per_host()));
+    }
+    if (settings_.max_total_connections() > 0) {
+      curl_multi_setopt(multi_, CURLMOPT_MAX_TOTAL_CONNECTIONS,
+                        static_cast<long>(  // NOLINT
+                            settings_.max_total_connections()));
+    }
+#if LIBCURL_VERSION_NUM >= 0x074300
+    if (settings_.max_concurrent_streams() > 0) {
+      curl_multi_setopt(multi_, CURLMOPT_MAX_CONCURRENT_STREAMS,
+                        static_cast<long>(  // NOLINT
+                            settings_.max_concurrent_streams()));
+    }
+#endif
+
+    thread_ = Thread::Create(ThreadMain, this, &status);
+    return status;
+  }
+
+  // Hand a transfer to the I/O thread. Fails only if shutting down.
+  Status Submit(Transfer* transfer) {
+    bool was_empty = false;
+    {
+      ScopeLock lock(&mutex_);
+      if (stopping_) {
+        return Status::MakeError(kModule, "client shut down");
+      }
+      was_empty = pending_.empty();
+      pending_.push_back(transfer);
+    }
+
+    // The thread takes every pending transfer at once, so only the first
+    // needs to wake it.
+    if (was_empty) {
+      reactor_->Wakeup();
+    }
+    return Status::OK();
+  }
+
+  virtual void Poke(Transfer* transfer) {
+    {
+      ScopeLock lock(&mutex_);
+      poked_.push_back(transfer);
+    }
+    reactor_->Wakeup();
+  }
+
+  // Ask for the transfer whose result 'future' is to receive to be
+  // abandoned, if this thread is running it.
+  void Cancel(const Future<HttpResult>& future) {
+    {
+      ScopeLock lock(&mutex_);
+      cancelled_.push_back(future);
+    }
+    reactor_->Wakeup();
+  }
+
+  // A socket that curl asked us to watch is ready.
+  virtual void OnReady(int fd, int events) {
+    int mask = 0;
+    if (events & Reactor::READABLE) {
+      mask |= CURL_CSELECT_IN;
+    }
+    if (events & Reactor::WRITABLE) {
+      mask |= CURL_CSELECT_OUT;
+    }
+    int running = 0;
+    curl_multi_socket_action(multi_, fd, mask, &running);
+  }
+
+ private:
+  IoThread(const IoThread& no_copy);
+  IoThread& operator=(const IoThread& no_assign);
+
+  static void* ThreadMain(void* arg) {
+    static_cast<IoThread*>(arg)->Run();
+    return NULL;
+  }
+
+  // Called by curl to change the events watched on a socket. Sockets are
+  // tagged (with curl_multi_assign) once registered with the reactor.
+  static int SocketCallback(CURL* easy, curl_socket_t fd, int what,
+                            void* user, void* socket_data) {
+    IoThread* self = static_cast<IoThread*>(user);
+    if (what == CURL_POLL_REMOVE) {
+      if (socket_data) {
+        self->reactor_->Remove(fd);
+        curl_multi_assign(self->multi_, fd, NULL);
+      }
+      return 0;
+    }
+
+    int events = 0;
+    if (what & CURL_POLL_IN) {
+      events |= Reactor::READABLE;
+    }
+    if (what & CURL_POLL_OUT) {
+      events |= Reactor::WRITABLE;
+    }
+    if (socket_data) {
+      self->reactor_->Modify(fd, events);
+    } else {
+      self->reactor_->Add(fd, events, self);
+      curl_multi_assign(self->multi_, fd, self);
+    }
+    return 0;
+  }
+
+  // Called by curl to set (or, with a negative timeout, cancel) the time
+  // at which it wants curl_multi_socket_action() called for timeouts.
+  static int TimerCallback(CURLM* multi, long timeout_ms,  // NOLINT
+                           void* user) {
+    IoThread* self = static_cast<IoThread*>(user);
+    if (timeout_ms < 0) {
+      self->timer_armed_ = false;
+    } else {
+      self->timer_armed_ = true;
+      self->timer_deadline_ = MonotonicNanos() + timeout_ms * kNanosPerMilli;
+    }
+    return 0;
+  }
+
+  void Run() {
+    for (;;) {
+      std::vector<Transfer*> pending;
+      std::vector<Transfer*> poked;
+      std::vector<Future<HttpResult> > cancelled;
+      {
+        ScopeLock lock(&mutex_);
+        if (stopping_) {
+          break;
+        }
+        pending.swap(pending_);
+        poked.swap(poked_);
+        cancelled.swap(cancelled_);
+      }
+      for (size_t i = 0; i < pending.size(); ++i) {
+        Start(pending[i]);
+      }
+      for (size_t i = 0; i < poked.size(); ++i) {
+        HandlePoke(poked[i]);
+      }
+      for (size_t i = 0; i < cancelled.size(); ++i) {
+        HandleCancel(cancelled[i]);
+      }
+
+      int timeout_ms = -1;
+      if (timer_armed_) {
+        const uint64_t now = MonotonicNanos();
+        timeout_ms = (timer_deadline_ <= now)
+                         ? 0
+                         : static_cast<int>((timer_deadline_ - now +
+                                             kNanosPerMilli - 1) /
+                                            kNanosPerMilli);
+      }
+      reactor_->Poll(timeout_ms);
+
+      if (timer_armed_ && MonotonicNanos() >= timer_deadline_) {
+        timer_armed_ = false;
+        int running = 0;
+        curl_multi_socket_action(multi_, CURL_SOCKET_TIMEOUT, 0, &running);
+      }
+      CheckCompleted();
+    }
+  }
+
+  void Start(Transfer* transfer) {
+    CURL* curl = NULL;
+    if (!free_handles_.empty()) {
+      curl = free_handles_.back();
+      free_handles_.pop_back();
+    } else {
+      curl = curl_easy_init();
+    }
+    if (!curl) {
+      Complete(transfer, Status::MakeError(kModule, "curl_easy_init() failed"));
+      return;
+    }
+
+#if LIBCURL_VERSION_NUM >= 0x074100
+    const long max_age_seconds =  // NOLINT
+        settings_.idle_timeout_ms() > 1000 ? settings_.idle_timeout_ms() / 1000
+                                           : 1;
+    curl_easy_setopt(curl, CURLOPT_MAXAGE_CONN, max_age_seconds);
+#endif
+    curl_easy_setopt(curl, CURLOPT_PRIVATE, transfer);
+    share_->Attach(curl);
+    if (settings_.accept_encoding()) {
+      curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+    }
+
+    Status status =
+        PrepareCurlRequest(curl, transfer->request, &transfer->body);
+    if (status.IsSuccess()) {
+      status = SetCurlHttpVersion(curl, transfer->request,
+                                  settings_.http_version());
+    }
+    if (status.IsSuccess()) {
+      status = SetCurlTimeouts(curl, transfer->request, default_timeouts_,
+                               &transfer->timeouts);
+    }
+    if (status.IsSuccess()) {
+      if (transfer->stream.get()) {
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteStream);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, transfer->stream.get());
+      } else {
+        status = SetCurlResponseBuffer(curl, transfer->response_body.get());
+      }
+    }
+    if (status.IsSuccess()) {
+      status =
+          SetCurlResponseHeaders(curl, transfer->response_headers.get());
+    }
+    if (status.IsSuccess()) {
+      transfer->started_at = MonotonicNanos();
+      const CURLMcode code = curl_multi_add_handle(multi_, curl);
+      if (code != CURLM_OK) {
+        status = Status::MakeError(kCurlModule, curl_multi_strerror(code));
+      }
+    }
+    if (status.IsFailure()) {
+      ReleaseHandle(curl);
+      Complete(transfer, status);
+      return;
+    }
+    transfer->curl = curl;
+    in_flight_.insert(transfer);
+  }
+
+  // Resume or abandon a streaming transfer, if it hasn't already ended.
+  // (A transfer that has ended may have been replaced by another at the
+  // same address; resuming that one is harmless.)
+  void HandlePoke(Transfer* transfer) {
+    if (in_flight_.find(transfer) == in_flight_.end()) {
+      return;
+    }
+    bool abandoned = false;
+    {
+      ScopeLock lock(&transfer->stream->mutex);
+      abandoned = transfer->stream->abandoned;
+    }
+    if (!abandoned) {
+      curl_easy_pause(transfer->curl, CURLPAUSE_CONT);
+      return;
+    }
+    curl_multi_remove_handle(multi_, transfer->curl);
+    ReleaseHandle(transfer->curl);
+    in_flight_.erase(transfer);
+    Complete(transfer, Status::MakeError(kModule, "stream abandoned"));
+  }
+
+  // Abandon the transfer whose result 'future' is to receive, if it is in
+  // flight here. Transfers are searched one by one: cancelling is rare
+  // enough (e.g. the loser of a hedged request) not to warrant an index.
+  void HandleCancel(const Future<HttpResult>& future) {
+    for (std::set<Transfer*>::iterator it = in_flight_.begin();
+         it != in_flight_.end(); ++it) {
+      Transfer* transfer = *it;
+      if (transfer->stream.get() == NULL &&
+          transfer->promise.GetFuture() == future) {
+        curl_multi_remove_handle(multi_, transfer->curl);
+        ReleaseHandle(transfer->curl);
+        in_flight_.erase(it);
+        Complete(transfer,
+                 Status::MakeError(kModule, "request cancelled", ECANCELED));
+        return;
+      }
+    }
+  }
+
+  // Deliver the outcome of transfers that curl has finished.
+  void CheckCompleted() {
+    CURLMsg* message = NULL;
+    int remaining = 0;
+    while ((message = curl_multi_info_read(multi_, &remaining)) != NULL) {
+      if (message->msg != CURLMSG_DONE) {
+        continue;
+      }
+      CURL* curl = message->easy_handle;
+      const CURLcode result = message->data.result;
+      char* data = NULL;
+      curl_easy_getinfo(curl, CURLINFO_PRIVATE, &data);
+      Transfer* transfer = reinterpret_cast<Transfer*>(data);
+
+      curl_multi_remove_handle(multi_, curl);
+      if (Tracer::IsEnabled()) {
+        TraceTransferPhases(curl, transfer->started_at);
+      }
+      if (result == CURLE_OK) {
+        uint64_t received = 0;
+        if (StreamState* stream = transfer->stream.get()) {
+          // A response without a body still has a head.
+          ScopeLock lock(&stream->mutex);
+          SetStreamHead(transfer);
+          received = stream->received;
+        } else {
+          received = transfer->response_body->Size();
+          transfer->response = Shared<HttpResponse>::Ptr(MakeCurlHttpResponse(
+              curl, transfer->response_body, transfer->response_headers));
+        }
+        AddCurlByteCounts(curl, transfer->body, received, byte_counts_);
+      }
+
+      // The error is read from the handle, so before it is reset.
+      Status status;
+      if (transfer->body.status().IsFailure()) {
+        status = transfer->body.status();
+      } else if (result != CURLE_OK) {
+        status = MakeCurlError(curl, result, transfer->timeouts,
+                               MonotonicNanos() - transfer->started_at);
+      }
+      ReleaseHandle(curl);
+      in_flight_.erase(transfer);
+      Complete(transfer, status);
+    }
+  }
+
+  // Keep an easy handle for reuse. Connections belong to the multi
+  // handle, so any handle may be used for any host.
+  void ReleaseHandle(CURL* curl) {
+    if (free_handles_.size() < kMaxFreeHandles) {
+      curl_easy_reset(curl);
+      free_handles_.push_back(curl);
+    } else {
+      curl_easy_cleanup(curl);
+    }
+  }
+
+  const AsyncHttpClient::Settings settings_;
+  CurlShare* const share_;  // Owned by the client.
+  const CurlTimeouts default_timeouts_;
+  HttpByteCounts* const byte_counts_;  // Owned by the client.
+
+  // Guards the members below, which are shared with submitting threads.
+  Mutex mutex_;
+  std::vector<Transfer*> pending_;
+  std::vector<Transfer*> poked_;
+  std::vector<Future<HttpResult> > cancelled_;
+  bool stopping_;
+
+  // Used only by the I/O thread, once started.
+  Reactor* reactor_;
+  CURLM* multi_;
+  Thread* thread_;
+  bool timer_armed_;
+  uint64_t timer_deadline_;
+  std::set<Transfer*> in_flight_;
+  std::vector<CURL*> free_handles_;
+};
+
+CurlAsyncHttpClient::CurlAsyncHttpClient(
+    Shared<void>::Ptr library_ref, Shared<CurlShare>::Ptr share,
+    const AsyncHttpClient::Settings& settings)
+    : library_ref_(library_ref),
+      share_(share),
+      settings_(settings),
+      next_thread_(0) {}
+
+CurlAsyncHttpClient::~CurlAsyncHttpClient() {
+  for (size_t i = 0; i < threads_.size(); ++i) {
+    delete threads_[i];
+  }
+}
+
+AsyncHttpClient* CurlAsyncHttpClient::Create(
+    Shared<void>::Ptr library_ref, Shared<CurlShare>::Ptr share,
+    const AsyncHttpClient::Settings& settings, Status* status_out) {
+  ScopePointer<CurlAsyncHttpClient> client(
+      new CurlAsyncHttpClient(library_ref, share, settings));
+  Status status = client->Init();
+  MaybeAssign(status_out, status);
+  if (status.IsFailure()) {
+    return NULL;
+  }
+  CurlAsyncHttpClient* result = client.Get();
+  client.ReleaseOwnership();
+  return result;
+}
+
+Status CurlAsyncHttpClient::Init() {
+  if (settings_.io_thread_count() < 1) {
+    return Status::MakeError(kModule, "I/O thread count must be positive");
+  }
+  for (int i = 0; i < settings_.io_thread_count(); ++i) {
+    IoThread* thread = new IoThread(settings_, share_.get(), &byte_counts_);
+    threads_.push_back(thread);
+    Status status = thread->Init();
+    if (status.IsFailure()) {
+      return status;
+    }
+  }
+  return Status::OK();
+}
+
+HttpByteCounts CurlAsyncHttpClient::GetByteCounts() const {
+  return LoadByteCounts(byte_counts_);
+}
+
+CurlAsyncHttpClient::IoThread* CurlAsyncHttpClient::NextThread() {
+  const unsigned int index = __sync_fetch_and_add(&next_thread_, 1);
+  return threads_[index % threads_.size()];
+}
+
+Status CurlAsyncHttpClient::SendRequest(const HttpRequest& request,
+                                        Future<HttpResult>* future) {
+  assert(future != NULL);
+  Transfer* transfer =
+      new Transfer(request, settings_.compress_requests_above());
+  transfer->response_body = Shared<Buffer>::Ptr(new Buffer());
+  transfer->response_headers = Shared<Buffer>::Ptr(new Buffer());
+  Future<HttpResult> result = transfer->promise.GetFuture();
+  Status status = NextThread()->Submit(transfer);
+  if (status.IsFailure()) {
+    delete transfer;
+    return status;
+  }
+  *future = result;
+  return Status::OK();
+}
+
+void CurlAsyncHttpClient::Cancel(const Future<HttpResult>& future) {
+  // The future doesn't say which thread has the transfer, so every
+  // thread looks for it.
+  for (size_t i = 0; i < threads_.size(); ++i) {
+    threads_[i]->Cancel(future);
+  }
+}
+
+HttpStream* CurlAsyncHttpClient::OpenStream(const HttpRequest& request,
+                                            Status* status_out) {
+  IoThread* thread = NextThread();
+  Transfer* transfer =
+      new Transfer(request, settings_.compress_requests_above());
+  transfer->response_headers = Shared<Buffer>::Ptr(new Buffer());
+  transfer->stream = Shared<StreamState>::Ptr(new StreamState(
+      std::max(static_cast<size_t>(1), settings_.stream_buffer_size())));
+  transfer->stream->runner = thread;
+  transfer->stream->transfer = transfer;
+  ScopePointer<HttpStream> stream(new CurlHttpStream(transfer->stream));
+
+  Status status = thread->Submit(transfer);
+  MaybeAssign(status_out, status);
+  if (status.IsFailure()) {
+    transfer->stream->runner = NULL;
+    delete transfer;
+    return NULL;
+  }
+  return stream.ReleaseOwnership();
+}
+
+}  // namespace enquery
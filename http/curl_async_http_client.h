@@ -0,0 +1,80 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef HTTP_CURL_ASYNC_HTTP_CLIENT_H_
+#define HTTP_CURL_ASYNC_HTTP_CLIENT_H_
+
+#include <vector>
+#include "enquery/async_http_client.h"
+#include "enquery/shared.h"
+#include "enquery/status.h"
+#include "http/curl_share.h"
+
+namespace enquery {
+
+class HttpRequest;
+
+// An AsyncHttpClient built on the curl multi "socket action" interface.
+// Each I/O thread owns a curl multi handle and a Reactor; curl tells the
+// thread which sockets to watch, and the thread tells curl when they are
+// ready. Connections are cached per I/O thread and shared by all of its
+// transfers. Every transfer is also attached to a CurlShare, through which
+// it shares resolved addresses and TLS sessions with the other clients
+// created by the same CurlHttp.
+class CurlAsyncHttpClient : public AsyncHttpClient {
+ public:
+  virtual ~CurlAsyncHttpClient();
+
+  // Create a client and start its I/O threads. Returns NULL on failure
+  // and populates the caller's (optional) Status.
+  static AsyncHttpClient* Create(Shared<void>::Ptr library_ref,
+                                 Shared<CurlShare>::Ptr share,
+                                 const AsyncHttpClient::Settings& settings,
+                                 Status* status);
+
+  virtual Status SendRequest(const HttpRequest& request,
+                             Future<HttpResult>* future);
+
+  virtual void Cancel(const Future<HttpResult>& future);
+
+  virtual HttpStream* OpenStream(const HttpRequest& request, Status* status);
+
+  virtual HttpByteCounts GetByteCounts() const;
+
+ private:
+  class IoThread;
+
+  CurlAsyncHttpClient(Shared<void>::Ptr library_ref,
+                      Shared<CurlShare>::Ptr share,
+                      const AsyncHttpClient::Settings& settings);
+  CurlAsyncHttpClient(const CurlAsyncHttpClient& no_copy);
+  CurlAsyncHttpClient& operator=(const CurlAsyncHttpClient& no_assign);
+
+  Status Init();
+
+  // Return the I/O thread for the next request, round-robin.
+  IoThread* NextThread();
+
+  Shared<void>::Ptr library_ref_;
+  Shared<CurlShare>::Ptr share_;  // Outlives the threads' handles.
+  const AsyncHttpClient::Settings settings_;
+  std::vector<IoThread*> threads_;
+  unsigned int next_thread_;
+  HttpByteCounts byte_counts_;
+};
+
+}  // namespace enquery
+
+#endif  // HTTP_CURL_ASYNC_HTTP_CLIENT_H_
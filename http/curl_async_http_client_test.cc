@@ -0,0 +1,355 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "enquery/async_http_client.h"
+#include "enquery/futures.h"
+#include "enquery/http.h"
+#include "enquery/http_request.h"
+#include "enquery/http_response.h"
+#include "enquery/shared.h"
+#include "enquery/slice.h"
+#include "enquery/status.h"
+#include "enquery/testing.h"
+#include "http/http_test_server.h"
+
+using ::enquery::AsyncHttpClient;
+using ::enquery::Future;
+using ::enquery::Http;
+using ::enquery::HttpByteCounts;
+using ::enquery::HttpRequest;
+using ::enquery::HttpResponse;
+using ::enquery::HttpResult;
+using ::enquery::HttpStream;
+using ::enquery::HttpTestServer;
+using ::enquery::Shared;
+using ::enquery::Slice;
+using ::enquery::StalledTestServer;
+using ::enquery::Status;
+
+namespace {
+
+const int kRequests = 200;
+
+// Send a GET for 'path' and return the future result.
+Future<HttpResult> Get(AsyncHttpClient* client, const std::string& uri) {
+  HttpRequest request;
+  request.set_uri(uri.c_str());
+  Future<HttpResult> future;
+  ASSERT_TRUE(client->SendRequest(request, &future).IsSuccess());
+  return future;
+}
+
+void CountCompletion(int* completed) { __sync_fetch_and_add(completed, 1); }
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  Status status;
+  Shared<Http>::Ptr http(Http::Create(&status));
+  ASSERT_TRUE(status.IsSuccess());
+
+  // Many requests in flight at once across two I/O threads.
+  {
+    HttpTestServer server;
+    ASSERT_TRUE(server.Start().IsSuccess());
+    Shared<AsyncHttpClient>::Ptr client(http->CreateAsyncClient(
+        AsyncHttpClient::Settings().set_io_thread_count(2), &status));
+    ASSERT_TRUE(status.IsSuccess());
+
+    std::vector<Future<HttpResult> > futures;
+    std::vector<size_t> sizes;
+    for (int i = 0; i < kRequests; ++i) {
+      const size_t size = 1 + (i * 997) % 20000;
+      char path[32];
+      snprintf(path, sizeof(path), "/%lu",
+               static_cast<unsigned long>(size));  // NOLINT
+      futures.push_back(Get(client.get(), server.Url(path)));
+      sizes.push_back(size);
+    }
+    for (int i = 0; i < kRequests; ++i) {
+      HttpResult result = futures[i].GetValue();
+      ASSERT_TRUE(result.status().IsSuccess());
+      ASSERT_TRUE(result.response() != NULL);
+      ASSERT_EQUALS(result.response()->BodySize(), sizes[i]);
+      ASSERT_EQUALS(result.response()->StatusCode(), 200);
+    }
+    ASSERT_EQUALS(server.requests_served(),
+                  static_cast<uint64_t>(kRequests));
+  }
+
+  // Connections are bounded per host and reused.
+  {
+    HttpTestServer server;
+    ASSERT_TRUE(server.Start().IsSuccess());
+    Shared<AsyncHttpClient>::Ptr client(http->CreateAsyncClient(
+        AsyncHttpClient::Settings().set_max_connections_per_host(2),
+        &status));
+    ASSERT_TRUE(status.IsSuccess());
+    std::vector<Future<HttpResult> > futures;
+    for (int i = 0; i < 20; ++i) {
+      futures.push_back(Get(client.get(), server.Url("/10")));
+    }
+    for (size_t i = 0; i < futures.size(); ++i) {
+      ASSERT_TRUE(futures[i].GetValue().status().IsSuccess());
+    }
+    ASSERT_TRUE(server.connections_accepted() <= 2);
+  }
+
+  // Notify() callbacks run when each request completes.
+  {
+    HttpTestServer server;
+    ASSERT_TRUE(server.Start().IsSuccess());
+    Shared<AsyncHttpClient>::Ptr client(
+        http->CreateAsyncClient(AsyncHttpClient::Settings(), &status));
+    ASSERT_TRUE(status.IsSuccess());
+    int completed = 0;
+    std::vector<Future<HttpResult> > futures;
+    for (int i = 0; i < 10; ++i) {
+      futures.push_back(Get(client.get(), server.Url("/1")));
+      futures.back().Notify(CountCompletion, &completed);
+    }
+    // Callbacks run just after the value is set, so wait for them.
+    for (int i = 0; i < 5000 && __sync_fetch_and_add(&completed, 0) < 10;
+         ++i) {
+      usleep(1000);
+    }
+    ASSERT_EQUALS(__sync_fetch_and_add(&completed, 0), 10);
+  }
+
+  // A stream delivers the whole body, in order, even to a reader that
+  // falls far behind, and deleting a stream part way abandons it.
+  {
+    HttpTestServer server;
+    ASSERT_TRUE(server.Start().IsSuccess());
+    Shared<AsyncHttpClient>::Ptr client(http->CreateAsyncClient(
+        AsyncHttpClient::Settings().set_stream_buffer_size(32768), &status));
+    ASSERT_TRUE(status.IsSuccess());
+    const std::string uri = server.Url("/4000000");
+    HttpRequest request;
+    request.set_uri(uri.c_str());
+
+    HttpStream* stream = client->OpenStream(request, &status);
+    ASSERT_TRUE(status.IsSuccess());
+    size_t total = 0;
+    int chunks = 0;
+    Slice chunk;
+    while ((status = stream->Next(&chunk)).IsSuccess() && !chunk.IsEmpty()) {
+      total += chunk.size();
+      if (++chunks % 16 == 0) {
+        usleep(1000);
+      }
+    }
+    ASSERT_TRUE(status.IsSuccess());
+    ASSERT_EQUALS(total, 4000000u);
+    delete stream;
+
+    stream = client->OpenStream(request, &status);
+    ASSERT_TRUE(stream->Next(&chunk).IsSuccess());
+    ASSERT_TRUE(!chunk.IsEmpty());
+    delete stream;
+
+    // The head comes before the body, and comes even without one.
+    const std::string tagged_uri = server.Url("/10?etag=x");
+    stream = client->OpenStream(HttpRequest().set_uri(tagged_uri.c_str()),
+                                &status);
+    ASSERT_TRUE(status.IsSuccess());
+    const HttpResponse* head = stream->Head();
+    ASSERT_TRUE(head != NULL);
+    ASSERT_EQUALS(head->StatusCode(), 200);
+    ASSERT_EQUALS(head->BodySize(), 0u);
+    Slice etag;
+    ASSERT_TRUE(head->FindHeader("etag", &etag));
+    ASSERT_EQUALS(std::string(etag.data(), etag.size()), std::string("\"x\""));
+    ASSERT_TRUE(stream->Next(&chunk).IsSuccess());
+    ASSERT_EQUALS(chunk.size(), 10u);
+    ASSERT_TRUE(stream->Head() == head);
+    delete stream;
+
+    const std::string error_uri = server.Url("/status/500");
+    stream = client->OpenStream(HttpRequest().set_uri(error_uri.c_str()),
+                                &status);
+    ASSERT_TRUE(status.IsSuccess());
+    head = stream->Head();
+    ASSERT_TRUE(head != NULL);
+    ASSERT_EQUALS(head->StatusCode(), 500);
+    ASSERT_TRUE(stream->Next(&chunk).IsSuccess());
+    ASSERT_TRUE(chunk.IsEmpty());
+    delete stream;
+
+    HttpResult result = Get(client.get(), server.Url("/10")).GetValue();
+    ASSERT_TRUE(result.status().IsSuccess());
+
+    // A stream that fails reports it at the end.
+    stream = client->OpenStream(HttpRequest().set_uri("http://127.0.0.1:1/"),
+                                &status);
+    ASSERT_TRUE(stream->Head() == NULL);
+    ASSERT_TRUE(stream->Next(&chunk).IsFailure());
+    ASSERT_TRUE(chunk.IsEmpty());
+    delete stream;
+  }
+
+  // Request bodies are sent from borrowed memory.
+  {
+    HttpTestServer server;
+    ASSERT_TRUE(server.Start().IsSuccess());
+    Shared<AsyncHttpClient>::Ptr client(
+        http->CreateAsyncClient(AsyncHttpClient::Settings(), &status));
+    ASSERT_TRUE(status.IsSuccess());
+    const std::string data(1000000, 'q');
+    const Slice slices[] = {Slice(data.data(), 10),
+                            Slice(data.data() + 10, data.size() - 10)};
+    const std::string uri = server.Url("/echo");
+    HttpRequest request;
+    request.set_uri(uri.c_str())
+        .set_method(HttpRequest::POST)
+        .set_body_slices(slices, 2);
+    Future<HttpResult> future;
+    ASSERT_TRUE(client->SendRequest(request, &future).IsSuccess());
+    HttpResult result = future.GetValue();
+    ASSERT_TRUE(result.status().IsSuccess());
+    ASSERT_TRUE(std::string(result.response()->Body(),
+                            result.response()->BodySize()) == data);
+  }
+
+  // With compression on, the echoed body is compressed both ways, and
+  // streams are decoded too.
+  {
+    HttpTestServer server;
+    ASSERT_TRUE(server.Start().IsSuccess());
+    Shared<AsyncHttpClient>::Ptr client(http->CreateAsyncClient(
+        AsyncHttpClient::Settings().set_accept_encoding(true)
+            .set_compress_requests_above(1),
+        &status));
+    ASSERT_TRUE(status.IsSuccess());
+    const std::string data(1000000, 'q');
+    const std::string uri = server.Url("/echo");
+    HttpRequest request;
+    request.set_uri(uri.c_str())
+        .set_method(HttpRequest::POST)
+        .set_body(data.data(), data.size());
+    Future<HttpResult> future;
+    ASSERT_TRUE(client->SendRequest(request, &future).IsSuccess());
+    HttpResult result = future.GetValue();
+    ASSERT_TRUE(result.status().IsSuccess());
+    ASSERT_TRUE(std::string(result.response()->Body(),
+                            result.response()->BodySize()) == data);
+
+    const std::string stream_uri = server.Url("/500000");
+    HttpStream* stream = client->OpenStream(
+        HttpRequest().set_uri(stream_uri.c_str()), &status);
+    ASSERT_TRUE(status.IsSuccess());
+    size_t total = 0;
+    Slice chunk;
+    while ((status = stream->Next(&chunk)).IsSuccess() && !chunk.IsEmpty()) {
+      total += chunk.size();
+    }
+    ASSERT_TRUE(status.IsSuccess());
+    ASSERT_EQUALS(total, 500000u);
+    delete stream;
+
+    const HttpByteCounts counts = client->GetByteCounts();
+    ASSERT_EQUALS(counts.request_body_bytes, 1000000u);
+    ASSERT_EQUALS(counts.response_body_bytes, 1500000u);
+#ifdef HAVE_ZLIB
+    ASSERT_TRUE(counts.request_wire_bytes < 100000u);
+    ASSERT_TRUE(counts.response_wire_bytes < 100000u);
+#endif
+  }
+
+  // Over HTTP/2, concurrent requests share one connection, up to the
+  // stream limit, and bodies flow both ways under flow control.
+  {
+    HttpTestServer server;
+    ASSERT_TRUE(server.Start().IsSuccess());
+    Shared<AsyncHttpClient>::Ptr client(http->CreateAsyncClient(
+        AsyncHttpClient::Settings()
+            .set_http_version(::enquery::HTTP_VERSION_2_PRIOR_KNOWLEDGE)
+            .set_max_connections_per_host(1)
+            .set_max_concurrent_streams(8),
+        &status));
+    ASSERT_TRUE(status.IsSuccess());
+
+    std::vector<Future<HttpResult> > futures;
+    for (int i = 0; i < kRequests; ++i) {
+      futures.push_back(Get(client.get(), server.Url("/100000")));
+    }
+    for (int i = 0; i < kRequests; ++i) {
+      HttpResult result = futures[i].GetValue();
+      ASSERT_TRUE(result.status().IsSuccess());
+      ASSERT_EQUALS(result.response()->BodySize(), 100000u);
+      ASSERT_EQUALS(result.response()->StatusCode(), 200);
+    }
+    ASSERT_EQUALS(server.connections_accepted(), 1u);
+    ASSERT_TRUE(server.max_concurrent_streams() > 1);
+    ASSERT_TRUE(server.max_concurrent_streams() <= 8);
+
+    const std::string data(1000000, 'h');
+    const std::string uri = server.Url("/echo");
+    HttpRequest request;
+    request.set_uri(uri.c_str())
+        .set_method(HttpRequest::POST)
+        .set_body(data.data(), data.size());
+    Future<HttpResult> future;
+    ASSERT_TRUE(client->SendRequest(request, &future).IsSuccess());
+    HttpResult result = future.GetValue();
+    ASSERT_TRUE(result.status().IsSuccess());
+    ASSERT_TRUE(std::string(result.response()->Body(),
+                            result.response()->BodySize()) == data);
+    ASSERT_EQUALS(server.connections_accepted(), 1u);
+  }
+
+  // Failures are reported through the result's status.
+  {
+    Shared<AsyncHttpClient>::Ptr client(
+        http->CreateAsyncClient(AsyncHttpClient::Settings(), &status));
+    ASSERT_TRUE(status.IsSuccess());
+    HttpResult result = Get(client.get(), "http://127.0.0.1:1/").GetValue();
+    ASSERT_EQUALS(result.status().GetCode(), enquery::kHttpConnectFailed);
+    ASSERT_TRUE(result.response() == NULL);
+  }
+
+  // A request to a server that doesn't answer times out, at the request's
+  // limit in place of the client's.
+  {
+    StalledTestServer server;
+    ASSERT_TRUE(server.Start().IsSuccess());
+    Shared<AsyncHttpClient>::Ptr client(http->CreateAsyncClient(
+        AsyncHttpClient::Settings().set_timeout_ms(100), &status));
+    ASSERT_TRUE(status.IsSuccess());
+    const std::string uri = server.Url("http", "/");
+    HttpResult result = Get(client.get(), uri).GetValue();
+    ASSERT_EQUALS(result.status().GetCode(), enquery::kHttpDeadlineExceeded);
+    HttpRequest request;
+    request.set_uri(uri.c_str()).set_timeout_ms(-1).set_low_speed_limit(1, 1);
+    Future<HttpResult> future;
+    ASSERT_TRUE(client->SendRequest(request, &future).IsSuccess());
+    ASSERT_EQUALS(future.GetValue().status().GetCode(), enquery::kHttpTooSlow);
+  }
+
+  // A client with no I/O threads can't be created.
+  {
+    AsyncHttpClient* client = http->CreateAsyncClient(
+        AsyncHttpClient::Settings().set_io_thread_count(0), &status);
+    ASSERT_TRUE(client == NULL);
+    ASSERT_TRUE(status.IsFailure());
+  }
+
+  return EXIT_SUCCESS;
+}
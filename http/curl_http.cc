@@ -14,16 +14,18 @@
 // contributors.
 
 #include "http/curl_http.h"
+#include "http/curl_async_http_client.h"
 #include "http/curl_http_client.h"
 #include <assert.h>
 #include <curl/curl.h>
-#include <pthread.h>
 #include <stdlib.h>
+#include "enquery/mutex.h"
 #include "enquery/scope_lock.h"
 #include "enquery/status.h"
 #include "enquery/utility.h"
 
 using ::enquery::MaybeAssign;
+using ::enquery::Mutex;
 using ::enquery::ScopeLock;
 using ::enquery::Shared;
 using ::enquery::Status;
@@ -34,7 +36,7 @@ namespace {
 const char* const kCurlModule = "curl";
 
 // The global mutex used to protect access to the reference count.
-pthread_mutex_t g_curl_library_mutex = PTHREAD_MUTEX_INITIALIZER;
+Mutex g_curl_library_mutex("CurlHttp::library");
 
 // The global library reference count
 int g_curl_library_reference_count = 0;
@@ -66,7 +68,8 @@ void UnloadLibrary(void* not_used) {
 
 namespace enquery {
 
-CurlHttp::CurlHttp(Shared<void>::Ptr ref) : module_ref_(ref) {}
+CurlHttp::CurlHttp(Shared<void>::Ptr ref, Shared<CurlShare>::Ptr share)
+    : module_ref_(ref), share_(share) {}
 
 CurlHttp::~CurlHttp() {}
 
@@ -76,13 +79,24 @@ Http* CurlHttp::Create(Status* out_status) {
   if (status.IsFailure()) {
     return NULL;
   }
-  return new CurlHttp(Shared<void>::Ptr(NULL, UnloadLibrary));
+  Shared<void>::Ptr ref(NULL, UnloadLibrary);
+  Shared<CurlShare>::Ptr share(CurlShare::Create(ref, out_status));
+  if (share.get() == NULL) {
+    return NULL;
+  }
+  return new CurlHttp(ref, share);
 }
 
-HttpClient* CurlHttp::CreateClient(Status* out_status) {
+HttpClient* CurlHttp::CreateClient(const HttpClient::Settings& settings,
+                                   Status* out_status) {
   Status status;
   MaybeAssign(out_status, status);
-  return new CurlHttpClient(module_ref_);
+  return new CurlHttpClient(module_ref_, share_, settings);
+}
+
+AsyncHttpClient* CurlHttp::CreateAsyncClient(
+    const AsyncHttpClient::Settings& settings, Status* status) {
+  return CurlAsyncHttpClient::Create(module_ref_, share_, settings, status);
 }
 
 int CurlHttp::GetReferenceCount() {
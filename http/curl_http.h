@@ -19,6 +19,7 @@
 #include "enquery/http.h"
 #include "enquery/shared.h"
 #include "enquery/status.h"
+#include "http/curl_share.h"
 
 namespace enquery {
 
@@ -29,17 +30,28 @@ class CurlHttp : public Http {
   // Create an instance of the http library.
   static Http* Create(Status* status);
 
+  using Http::CreateClient;
+
   // Create an instance of an http client.
-  virtual HttpClient* CreateClient(Status* status);
+  virtual HttpClient* CreateClient(const HttpClient::Settings& settings,
+                                   Status* status);
+
+  // Create an asynchronous http client.
+  virtual AsyncHttpClient* CreateAsyncClient(
+      const AsyncHttpClient::Settings& settings, Status* status);
 
   // Do not use. This is for unit testing the library.
   static int GetReferenceCount();
 
  private:
-  explicit CurlHttp(Shared<void>::Ptr ref);
+  CurlHttp(Shared<void>::Ptr ref, Shared<CurlShare>::Ptr share);
   CurlHttp(const CurlHttp& copy_from);
   CurlHttp& operator=(const CurlHttp& assign_from);
   Shared<void>::Ptr module_ref_;
+
+  // Shared by all the clients, so that short-lived clients don't repeat
+  // DNS lookups and TLS handshakes.
+  Shared<CurlShare>::Ptr share_;
 };
 
 }  // namespace enquery
@@ -19,195 +19,295 @@
 #include <stdlib.h>
 #include <string.h>
 #include <algorithm>
+#include <string>
+#include <vector>
 #include "http/curl_http_response.h"
+#include "http/curl_request.h"
+#include "http/http_util.h"
 #include "enquery/buffer.h"
 #include "enquery/http_request.h"
 #include "enquery/http_response.h"
+#include "enquery/portability.h"
+#include "enquery/scope_lock.h"
+#include "enquery/scope_pointer.h"
 #include "enquery/shared.h"
 #include "enquery/slice.h"
+#include "enquery/trace.h"
 #include "enquery/utility.h"
 
-using enquery::Buffer;
-using enquery::Slice;
-
 namespace {
-const char* const kCurlModule = "curl";
-
-// The curl_handle_deleter() function is used in conjunction with shared
-// pointers to provide RAII-style automatic cleanup for cURL handles.
-void curl_handle_deleter(CURL* curl) { curl_easy_cleanup(curl); }
-
-// The cURL library requires programmers to implement callbacks for providing
-// data in an HTTP request as well as receiving response data. The functions
-// are named from the point of view of the library. Thus, curl_read_buffer()
-// is called by the library to obtain data from the program to send in the
-// HTTP request. The curl_write_buffer() function is called to write response
-// data received from the server back to the program's buffer.
-
-size_t curl_read_buffer(char* data, size_t size, size_t nmemb, void* user) {
-  assert(user != NULL);
-  const size_t total_bytes = size * nmemb;
-  if (total_bytes == 0) {
-    return 0;
-  }
-  assert(data != NULL);
-  Slice* slice = reinterpret_cast<Slice*>(user);
-  // It's plausible that the curl library could ask for more data than we
-  // actually reference in our slice. Determine the actual number that we
-  // can copy and return that.
-  const size_t num_read = std::min(total_bytes, slice->size());
-  memcpy(data, slice->data(), num_read);
-  return num_read;
-}
 
-// Callback function that appends received data to a Buffer.
-size_t curl_write_buffer(char* data, size_t size, size_t nmemb, void* user) {
-  assert(user != NULL);
-  const size_t total_bytes = size * nmemb;
-  if (total_bytes == 0) {
-    return 0;
-  }
-  assert(data != NULL);
-  Buffer* buffer = reinterpret_cast<Buffer*>(user);
-  buffer->Append(data, total_bytes);
-  return total_bytes;
+const uint64_t kNanosPerMilli = 1000000;
+
+void CleanupHandles(const std::vector<CURL*>& handles) {
+  for (size_t i = 0; i < handles.size(); ++i) {
+    curl_easy_cleanup(handles[i]);
+  }
 }
 
-// Return method name from the enumeration.
-const char* HttpMethodNameFromMethod(const enquery::HttpRequest::Method m) {
-  using enquery::HttpRequest;
-  switch (m) {
-    case HttpRequest::GET:
-      return "GET";
-    case HttpRequest::HEAD:
-      return "HEAD";
-    case HttpRequest::POST:
-      return "POST";
-    case HttpRequest::PUT:
-      return "PUT";
-    case HttpRequest::DELETE:
-      return "DELETE";
-    case HttpRequest::TRACE:
-      return "TRACE";
-    default:
-      return "NONE";
+// Passes a response on to another sink, counting its body. The head is
+// built from the transfer on 'curl' and the header lines collected into
+// 'headers', and passed on before the first of the body.
+class CountingSink : public enquery::HttpSink {
+ public:
+  CountingSink(enquery::HttpSink* sink, CURL* curl,
+               enquery::Shared<enquery::Buffer>::Ptr headers)
+      : sink_(sink), curl_(curl), headers_(headers), started_(false),
+        count_(0) {}
+
+  // Pass the head on, unless that has been done already.
+  bool Start() {
+    if (started_) {
+      return true;
+    }
+    started_ = true;
+    enquery::Shared<enquery::Buffer>::Ptr body(new enquery::Buffer());
+    enquery::ScopePointer<enquery::CurlHttpResponse> head(
+        enquery::MakeCurlHttpResponse(curl_, body, headers_));
+    return sink_->OnResponse(*head.Get());
   }
+
+  virtual bool OnData(const enquery::Slice& data) {
+    if (!Start()) {
+      return false;
+    }
+    count_ += data.size();
+    return sink_->OnData(data);
+  }
+
+  uint64_t count() const { return count_; }
+
+ private:
+  enquery::HttpSink* sink_;
+  CURL* curl_;
+  enquery::Shared<enquery::Buffer>::Ptr headers_;
+  bool started_;
+  uint64_t count_;
+};
+
+// Return the client's default time limits on requests.
+enquery::CurlTimeouts DefaultTimeouts(
+    const enquery::HttpClient::Settings& settings) {
+  enquery::CurlTimeouts timeouts;
+  timeouts.connect_ms = settings.connect_timeout_ms();
+  timeouts.total_ms = settings.timeout_ms();
+  timeouts.low_speed_bytes = settings.low_speed_bytes_per_second();
+  timeouts.low_speed_seconds = settings.low_speed_seconds();
+  return timeouts;
 }
 
 }  // namespace
 
 namespace enquery {
 
-CurlHttpClient::CurlHttpClient(Shared<void>::Ptr library_ref)
-    : library_ref_(library_ref) {}
+CurlHttpClient::CurlHttpClient(Shared<void>::Ptr library_ref,
+                               Shared<CurlShare>::Ptr share,
+                               const HttpClient::Settings& settings)
+    : library_ref_(library_ref),
+      share_(share),
+      settings_(settings),
+      idle_timeout_nanos_(settings.idle_timeout_ms() * kNanosPerMilli),
+      default_timeouts_(DefaultTimeouts(settings)),
+      pool_mutex_("CurlHttpClient::pool"),
+      next_eviction_(0) {}
 
-CurlHttpClient::~CurlHttpClient() {}
-
-HttpResponse* CurlHttpClient::SendRequest(const HttpRequest& request,
-                                          Status* status_out) {
-  // curl_easy_init() must be called to obtain a context.
-  Status status(Status::OK());
-  Shared<CURL>::Ptr curl(curl_easy_init(), curl_handle_deleter);
-  if (curl.get() == NULL) {
-    MaybeAssign(status_out,
-                Status::MakeError(kCurlModule, "curl_easy_init() failed"));
-    return NULL;
+CurlHttpClient::~CurlHttpClient() {
+  for (std::map<std::string, IdleList>::iterator it = idle_.begin();
+       it != idle_.end(); ++it) {
+    for (size_t i = 0; i < it->second.size(); ++i) {
+      curl_easy_cleanup(it->second[i].curl);
+    }
   }
+}
 
-  CURLcode result = CURLE_OK;
+CURL* CurlHttpClient::AcquireHandle(const std::string& host) {
+  std::vector<CURL*> expired;
+  CURL* curl = NULL;
+  {
+    ScopeLock lock(&pool_mutex_);
+    const uint64_t now = MonotonicNanos();
+    EvictExpired(now, &expired);
+    std::map<std::string, IdleList>::iterator it = idle_.find(host);
+    if (it != idle_.end() && !it->second.empty()) {
+      // Take the most recently used handle: its connection is the least
+      // likely to have been closed by the server.
+      const IdleHandle& newest = it->second.back();
+      if (now - newest.idle_since <= idle_timeout_nanos_) {
+        curl = newest.curl;
+        it->second.pop_back();
+      } else {
+        for (size_t i = 0; i < it->second.size(); ++i) {
+          expired.push_back(it->second[i].curl);
+        }
+        it->second.clear();
+      }
+    }
+  }
 
-  // Which method are we using?
-  switch (request.method()) {
-    case HttpRequest::GET:
-      // libcurl defaults to GET; do nothing.
-      break;
+  // Closing connections may block, so it's done outside the lock.
+  CleanupHandles(expired);
+  return curl ? curl : curl_easy_init();
+}
 
-    case HttpRequest::POST:
-      result = curl_easy_setopt(curl.get(), CURLOPT_POST, 1);
-      break;
+void CurlHttpClient::ReleaseHandle(const std::string& host, CURL* curl) {
+  if (settings_.max_idle_per_host() <= 0) {
+    curl_easy_cleanup(curl);
+    return;
+  }
 
-    case HttpRequest::PUT:
-      result = curl_easy_setopt(curl.get(), CURLOPT_PUT, 1);
-      break;
+  // Clear the options set for the last request, which may point to data
+  // that's about to go away. Open connections are kept.
+  curl_easy_reset(curl);
 
-    case HttpRequest::HEAD:
-    case HttpRequest::DELETE:
-    case HttpRequest::TRACE:
-      result = curl_easy_setopt(curl.get(), CURLOPT_CUSTOMREQUEST,
-                                HttpMethodNameFromMethod(request.method()));
-      break;
+  std::vector<CURL*> expired;
+  {
+    ScopeLock lock(&pool_mutex_);
+    const uint64_t now = MonotonicNanos();
+    IdleList& list = idle_[host];
+    list.push_back(IdleHandle(curl, now));
+    while (list.size() > static_cast<size_t>(settings_.max_idle_per_host())) {
+      expired.push_back(list.front().curl);
+      list.pop_front();
+    }
+    EvictExpired(now, &expired);
   }
+  CleanupHandles(expired);
+}
 
-  if (result != 0) {
-    MaybeAssign(status_out,
-                Status::MakeError(kCurlModule, curl_easy_strerror(result)));
-    return NULL;
+void CurlHttpClient::EvictExpired(uint64_t now, std::vector<CURL*>* expired) {
+  // Sweeping every host on every call would make the pool's cost grow
+  // with the number of hosts, so sweep at most twice per timeout.
+  if (now < next_eviction_) {
+    return;
   }
+  next_eviction_ = now + idle_timeout_nanos_ / 2;
 
-  // Set the URL to use for the request
-  result = curl_easy_setopt(curl.get(), CURLOPT_URL, request.uri());
-  if (result != 0) {
-    MaybeAssign(status_out,
-                Status::MakeError(kCurlModule, curl_easy_strerror(result)));
-    return NULL;
-  }
-
-  // Declare a slice that references the body data. It's O.K. if the data
-  // is empty; we only set up the "read" callback in the case where we
-  // actually have body data to send.
-  Slice body_slice(request.body());
-
-  // Do we have a body?
-  if (request.HasBody()) {
-    // Set up the read callback function
-    result =
-        curl_easy_setopt(curl.get(), CURLOPT_READFUNCTION, curl_read_buffer);
-    if (result != 0) {
-      MaybeAssign(status_out,
-                  Status::MakeError(kCurlModule, curl_easy_strerror(result)));
-      return NULL;
+  std::map<std::string, IdleList>::iterator it = idle_.begin();
+  while (it != idle_.end()) {
+    IdleList& list = it->second;
+    while (!list.empty() &&
+           now - list.front().idle_since > idle_timeout_nanos_) {
+      expired->push_back(list.front().curl);
+      list.pop_front();
     }
-
-    // Set up the read callback parameter
-    result = curl_easy_setopt(curl.get(), CURLOPT_READDATA, &body_slice);
-    if (result != 0) {
-      MaybeAssign(status_out,
-                  Status::MakeError(kCurlModule, curl_easy_strerror(result)));
-      return NULL;
+    if (list.empty()) {
+      idle_.erase(it++);
+    } else {
+      ++it;
     }
   }
+}
 
-  // Set up the "write callback" - the function that the curl API uses to
-  // write response data back to the client.
-  result =
-      curl_easy_setopt(curl.get(), CURLOPT_WRITEFUNCTION, curl_write_buffer);
-  if (result != 0) {
-    MaybeAssign(status_out,
-                Status::MakeError(kCurlModule, curl_easy_strerror(result)));
-    return NULL;
+HttpByteCounts CurlHttpClient::GetByteCounts() const {
+  return LoadByteCounts(byte_counts_);
+}
+
+HttpResponse* CurlHttpClient::SendRequest(const HttpRequest& request,
+                                          Status* status_out) {
+  HttpResponse* response = NULL;
+  Status status = Perform(request, NULL, &response);
+  MaybeAssign(status_out, status);
+  return response;
+}
+
+Status CurlHttpClient::StreamRequest(const HttpRequest& request,
+                                     HttpSink* sink) {
+  assert(sink != NULL);
+  return Perform(request, sink, NULL);
+}
+
+Status CurlHttpClient::Perform(const HttpRequest& request, HttpSink* sink,
+                               HttpResponse** response) {
+  TraceScope trace("http", "http.request");
+
+  // Obtain a handle from the pool, or a new one from curl_easy_init().
+  const std::string host = HostFromUri(request.uri());
+  ScopedHandle curl(this, host);
+  if (curl.get() == NULL) {
+    return Status::MakeError(kCurlModule, "curl_easy_init() failed");
   }
 
-  // Set the write callback parameter: we're passing a pointer to a Buffer
-  // instance. Assuming the request succeeds, we'll construct the HttpResponse
-  // object with the shared pointer to the buffer.
-  Shared<Buffer>::Ptr buf(new Buffer());
-  result = curl_easy_setopt(curl.get(), CURLOPT_WRITEDATA, buf.get());
-  if (result != 0) {
-    MaybeAssign(status_out,
-                Status::MakeError(kCurlModule, curl_easy_strerror(result)));
-    return NULL;
+#if LIBCURL_VERSION_NUM >= 0x074100
+  // Don't let curl reuse a connection that has been idle for longer than
+  // the pool would have kept it.
+  const long max_age_seconds =  // NOLINT
+      std::max(1, settings_.idle_timeout_ms() / 1000);
+  curl_easy_setopt(curl.get(), CURLOPT_MAXAGE_CONN, max_age_seconds);
+#endif
+
+  // Share resolved addresses and TLS sessions with other clients. The
+  // connections stay with the handle, and so with this client's pool.
+  share_->Attach(curl.get());
+
+  // An empty string asks for every encoding curl supports, and has it
+  // decode the response before passing it on.
+  if (settings_.accept_encoding()) {
+    curl_easy_setopt(curl.get(), CURLOPT_ACCEPT_ENCODING, "");
+  }
+
+  // The request body is read from wherever the request keeps it as it is
+  // sent.
+  CurlRequestBody body(request, settings_.compress_requests_above());
+  Status status = PrepareCurlRequest(curl.get(), request, &body);
+  if (status.IsSuccess()) {
+    status =
+        SetCurlHttpVersion(curl.get(), request, settings_.http_version());
+  }
+  CurlTimeouts timeouts;
+  if (status.IsSuccess()) {
+    status = SetCurlTimeouts(curl.get(), request, default_timeouts_, &timeouts);
+  }
+
+  // The headers are collected into a buffer that the response (or, when
+  // streaming, the head passed to the sink) will share, as is the body
+  // unless streaming.
+  Shared<Buffer>::Ptr response_body;
+  Shared<Buffer>::Ptr response_headers(new Buffer());
+  CountingSink counting_sink(sink, curl.get(), response_headers);
+  if (status.IsSuccess()) {
+    if (sink) {
+      status = SetCurlResponseSink(curl.get(), &counting_sink);
+    } else {
+      response_body = Shared<Buffer>::Ptr(new Buffer());
+      status = SetCurlResponseBuffer(curl.get(), response_body.get());
+    }
+  }
+  if (status.IsSuccess()) {
+    status = SetCurlResponseHeaders(curl.get(), response_headers.get());
+  }
+  if (status.IsFailure()) {
+    return status;
   }
 
   // Send the request
-  result = curl_easy_perform(curl.get());
+  const uint64_t started_at = MonotonicNanos();
+  const CURLcode result = curl_easy_perform(curl.get());
+  if (Tracer::IsEnabled()) {
+    TraceTransferPhases(curl.get(), started_at);
+  }
+  if (body.status().IsFailure()) {
+    return body.status();
+  }
+  if (result == CURLE_WRITE_ERROR && sink) {
+    return Status::MakeError(kCurlModule, "response abandoned by sink");
+  }
   if (result != 0) {
-    MaybeAssign(status_out,
-                Status::MakeError(kCurlModule, curl_easy_strerror(result)));
-    return NULL;
+    return MakeCurlError(curl.get(), result, timeouts,
+                         MonotonicNanos() - started_at);
   }
 
-  MaybeAssign(status_out, status);
-  return new CurlHttpResponse(buf);
+  // A response without a body still has a head to pass on.
+  if (sink && !counting_sink.Start()) {
+    return Status::MakeError(kCurlModule, "response abandoned by sink");
+  }
+  AddCurlByteCounts(curl.get(), body,
+                    sink ? counting_sink.count() : response_body->Size(),
+                    &byte_counts_);
+  if (response) {
+    *response =
+        MakeCurlHttpResponse(curl.get(), response_body, response_headers);
+  }
+  return Status::OK();
 }
 
 }  // namespace enquery
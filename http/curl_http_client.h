@@ -16,27 +16,106 @@
 #ifndef HTTP_CURL_HTTP_CLIENT_H_
 #define HTTP_CURL_HTTP_CLIENT_H_
 
+#include <curl/curl.h>
+#include <stdint.h>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
 #include "enquery/http_client.h"
+#include "enquery/mutex.h"
 #include "enquery/shared.h"
 #include "enquery/status.h"
+#include "http/curl_request.h"
+#include "http/curl_share.h"
 
 namespace enquery {
 
 class HttpRequest;
 class HttpResponse;
+class HttpSink;
 
+// CurlHttpClient keeps a pool of idle curl easy handles for each host.
+// An easy handle caches the connections it has made, so reusing a handle
+// that last talked to the same host reuses its open connection and skips
+// DNS lookup, the TCP handshake and TLS negotiation. Handles are also
+// attached to a CurlShare, through which they share resolved addresses
+// and TLS sessions with every other client created by the same CurlHttp,
+// so a new connection to a host that any of them has talked to recently
+// skips the lookup and resumes the TLS session.
 class CurlHttpClient : public HttpClient {
  public:
-  explicit CurlHttpClient(Shared<void>::Ptr library_ref);
+  CurlHttpClient(Shared<void>::Ptr library_ref, Shared<CurlShare>::Ptr share,
+                 const HttpClient::Settings& settings);
   virtual ~CurlHttpClient();
 
   virtual HttpResponse* SendRequest(const HttpRequest& request, Status* status);
 
+  virtual Status StreamRequest(const HttpRequest& request, HttpSink* sink);
+
+  virtual HttpByteCounts GetByteCounts() const;
+
  private:
+  // An easy handle in the pool, with the time it was returned.
+  struct IdleHandle {
+    IdleHandle(CURL* c, uint64_t at) : curl(c), idle_since(at) {}
+    CURL* curl;
+    uint64_t idle_since;
+  };
+
+  // Idle handles for one host, least recently used first.
+  typedef std::deque<IdleHandle> IdleList;
+
+  // Holds a handle from the pool, returning it when destroyed.
+  class ScopedHandle {
+   public:
+    ScopedHandle(CurlHttpClient* client, const std::string& host)
+        : client_(client), host_(host), curl_(client->AcquireHandle(host)) {}
+    ~ScopedHandle() {
+      if (curl_) {
+        client_->ReleaseHandle(host_, curl_);
+      }
+    }
+    CURL* get() const { return curl_; }
+
+   private:
+    ScopedHandle(const ScopedHandle& no_copy);
+    ScopedHandle& operator=(const ScopedHandle& no_assign);
+
+    CurlHttpClient* client_;
+    const std::string& host_;
+    CURL* curl_;
+  };
+
   CurlHttpClient(const CurlHttpClient& no_copy);
   CurlHttpClient& operator=(const CurlHttpClient& no_assign);
 
+  // Take an idle handle for 'host' from the pool, or create one. Returns
+  // NULL if a handle can't be created.
+  CURL* AcquireHandle(const std::string& host);
+
+  // Return a handle to the pool for 'host', closing it instead if the
+  // host already has enough idle handles.
+  void ReleaseHandle(const std::string& host, CURL* curl);
+
+  // Send 'request', delivering the response body to 'sink' or, if it is
+  // NULL, setting 'response' to a new, complete response.
+  Status Perform(const HttpRequest& request, HttpSink* sink,
+                 HttpResponse** response);
+
+  // Move handles idle for longer than the timeout to 'expired'. Requires
+  // pool_mutex_ to be held.
+  void EvictExpired(uint64_t now, std::vector<CURL*>* expired);
+
   Shared<void>::Ptr library_ref_;
+  Shared<CurlShare>::Ptr share_;
+  const HttpClient::Settings settings_;
+  const uint64_t idle_timeout_nanos_;
+  const CurlTimeouts default_timeouts_;
+  Mutex pool_mutex_;
+  std::map<std::string, IdleList> idle_;
+  uint64_t next_eviction_;
+  HttpByteCounts byte_counts_;
 };
 
 }  // namespace enquery
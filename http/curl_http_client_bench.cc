@@ -0,0 +1,194 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+// Measures synchronous client request latency, and asynchronous client
+// throughput, against a loopback HTTP/1.1 server, for both the curl and
+// the native engines. One operation is one GET.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "enquery/async_http_client.h"
+#include "enquery/benchmark.h"
+#include "enquery/futures.h"
+#include "enquery/http.h"
+#include "enquery/http_client.h"
+#include "enquery/http_request.h"
+#include "enquery/http_response.h"
+#include "enquery/shared.h"
+#include "enquery/status.h"
+#include "http/http_test_server.h"
+
+using ::enquery::AsyncHttpClient;
+using ::enquery::BenchmarkState;
+using ::enquery::DoNotOptimize;
+using ::enquery::Future;
+using ::enquery::Http;
+using ::enquery::HttpClient;
+using ::enquery::HttpEngine;
+using ::enquery::HttpRequest;
+using ::enquery::HttpResponse;
+using ::enquery::HttpResult;
+using ::enquery::HttpTestServer;
+using ::enquery::Shared;
+using ::enquery::Status;
+
+namespace {
+
+// Requests kept in flight by the asynchronous benchmarks.
+const size_t kWindow = 64;
+
+HttpTestServer* g_server = NULL;
+
+void Get(BenchmarkState* state, HttpEngine engine, size_t body_size,
+         const HttpClient::Settings& settings) {
+  state->StopTiming();
+  Status status;
+  Shared<Http>::Ptr http(Http::Create(engine, &status));
+  Shared<HttpClient>::Ptr client(http->CreateClient(settings, &status));
+  char path[32];
+  snprintf(path, sizeof(path), "/%lu",
+           static_cast<unsigned long>(body_size));  // NOLINT
+  const std::string uri = g_server->Url(path);
+  HttpRequest request;
+  request.set_uri(uri.c_str());
+  state->StartTiming();
+
+  for (uint64_t i = 0; i < state->iterations(); ++i) {
+    Shared<HttpResponse>::Ptr response(client->SendRequest(request, &status));
+    if (status.IsFailure() || response->BodySize() != body_size) {
+      fprintf(stderr, "request failed: %s\n", status.GetMessage());
+      exit(EXIT_FAILURE);
+    }
+    DoNotOptimize(response);
+  }
+}
+
+void BM_CurlGet128(BenchmarkState* state) {
+  Get(state, ::enquery::HTTP_ENGINE_CURL, 128, HttpClient::Settings());
+}
+ENQUERY_BENCHMARK(BM_CurlGet128);
+
+void BM_CurlGet64K(BenchmarkState* state) {
+  Get(state, ::enquery::HTTP_ENGINE_CURL, 65536, HttpClient::Settings());
+}
+ENQUERY_BENCHMARK(BM_CurlGet64K);
+
+// A new connection for every request.
+void BM_CurlGet128NoReuse(BenchmarkState* state) {
+  Get(state, ::enquery::HTTP_ENGINE_CURL, 128,
+      HttpClient::Settings().set_max_idle_per_host(0));
+}
+ENQUERY_BENCHMARK(BM_CurlGet128NoReuse);
+
+// Keep kWindow requests in flight, sending another as each completes.
+void AsyncGet(BenchmarkState* state, HttpEngine engine, size_t body_size,
+              const AsyncHttpClient::Settings& settings) {
+  state->StopTiming();
+  Status status;
+  Shared<Http>::Ptr http(Http::Create(engine, &status));
+  Shared<AsyncHttpClient>::Ptr client(
+      http->CreateAsyncClient(settings, &status));
+  char path[32];
+  snprintf(path, sizeof(path), "/%lu",
+           static_cast<unsigned long>(body_size));  // NOLINT
+  const std::string uri = g_server->Url(path);
+  HttpRequest request;
+  request.set_uri(uri.c_str());
+  std::vector<Future<HttpResult> > window(kWindow);
+  state->StartTiming();
+
+  for (uint64_t i = 0; i < state->iterations() + kWindow; ++i) {
+    Future<HttpResult>& slot = window[i % kWindow];
+    if (slot.Valid()) {
+      HttpResult result = slot.GetValue();
+      if (result.status().IsFailure() ||
+          result.response()->BodySize() != body_size) {
+        fprintf(stderr, "request failed: %s\n", result.status().GetMessage());
+        exit(EXIT_FAILURE);
+      }
+      slot = Future<HttpResult>();
+    }
+    if (i < state->iterations()) {
+      status = client->SendRequest(request, &slot);
+      if (status.IsFailure()) {
+        fprintf(stderr, "send failed: %s\n", status.GetMessage());
+        exit(EXIT_FAILURE);
+      }
+    }
+  }
+}
+
+void BM_CurlAsyncGet128(BenchmarkState* state) {
+  AsyncGet(state, ::enquery::HTTP_ENGINE_CURL, 128,
+           AsyncHttpClient::Settings());
+}
+ENQUERY_BENCHMARK(BM_CurlAsyncGet128);
+
+void BM_CurlAsyncGet128TwoThreads(BenchmarkState* state) {
+  AsyncGet(state, ::enquery::HTTP_ENGINE_CURL, 128,
+           AsyncHttpClient::Settings().set_io_thread_count(2));
+}
+ENQUERY_BENCHMARK(BM_CurlAsyncGet128TwoThreads);
+
+// The same window of requests, multiplexed over one HTTP/2 connection.
+void BM_CurlAsyncGet128Http2(BenchmarkState* state) {
+  AsyncGet(state, ::enquery::HTTP_ENGINE_CURL, 128,
+           AsyncHttpClient::Settings()
+               .set_http_version(::enquery::HTTP_VERSION_2_PRIOR_KNOWLEDGE)
+               .set_max_connections_per_host(1));
+}
+ENQUERY_BENCHMARK(BM_CurlAsyncGet128Http2);
+
+void BM_NativeGet128(BenchmarkState* state) {
+  Get(state, ::enquery::HTTP_ENGINE_NATIVE, 128, HttpClient::Settings());
+}
+ENQUERY_BENCHMARK(BM_NativeGet128);
+
+void BM_NativeGet64K(BenchmarkState* state) {
+  Get(state, ::enquery::HTTP_ENGINE_NATIVE, 65536, HttpClient::Settings());
+}
+ENQUERY_BENCHMARK(BM_NativeGet64K);
+
+void BM_NativeAsyncGet128(BenchmarkState* state) {
+  AsyncGet(state, ::enquery::HTTP_ENGINE_NATIVE, 128,
+           AsyncHttpClient::Settings());
+}
+ENQUERY_BENCHMARK(BM_NativeAsyncGet128);
+
+// The same window of requests, pipelined over one HTTP/1.1 connection.
+void BM_NativeAsyncGet128Pipelined(BenchmarkState* state) {
+  AsyncGet(state, ::enquery::HTTP_ENGINE_NATIVE, 128,
+           AsyncHttpClient::Settings()
+               .set_max_connections_per_host(1)
+               .set_max_pipelined_requests(static_cast<int>(kWindow)));
+}
+ENQUERY_BENCHMARK(BM_NativeAsyncGet128Pipelined);
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  // Two server threads, so that the server keeps up with clients that
+  // use two.
+  HttpTestServer server(HttpTestServer::Settings().set_thread_count(2));
+  Status status = server.Start();
+  if (status.IsFailure()) {
+    fprintf(stderr, "failed to start server: %s\n", status.GetMessage());
+    return EXIT_FAILURE;
+  }
+  g_server = &server;
+  return ::enquery::Benchmark::Main(argc, argv);
+}
@@ -0,0 +1,520 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include "enquery/async_http_client.h"
+#include "enquery/futures.h"
+#include "enquery/http.h"
+#include "enquery/http_client.h"
+#include "enquery/http_request.h"
+#include "enquery/http_response.h"
+#include "enquery/portability.h"
+#include "enquery/shared.h"
+#include "enquery/slice.h"
+#include "enquery/status.h"
+#include "enquery/testing.h"
+#include "http/http_test_server.h"
+
+using ::enquery::AsyncHttpClient;
+using ::enquery::Future;
+using ::enquery::Http;
+using ::enquery::HttpByteCounts;
+using ::enquery::HttpClient;
+using ::enquery::HttpRequest;
+using ::enquery::HttpResponse;
+using ::enquery::HttpResult;
+using ::enquery::HttpTimings;
+using ::enquery::HttpTestServer;
+using ::enquery::MonotonicNanos;
+using ::enquery::StalledTestServer;
+using ::enquery::Shared;
+using ::enquery::Slice;
+using ::enquery::Status;
+
+namespace {
+
+const int kThreads = 4;
+const int kRequestsPerThread = 10;
+
+// Send a GET for 'path' and check the size of the body.
+void Get(HttpClient* client, const HttpTestServer& server, const char* path,
+         size_t expected_size) {
+  const std::string uri = server.Url(path);
+  HttpRequest request;
+  request.set_uri(uri.c_str());
+  Status status;
+  Shared<HttpResponse>::Ptr response(client->SendRequest(request, &status));
+  ASSERT_TRUE(status.IsSuccess());
+  ASSERT_EQUALS(response->BodySize(), expected_size);
+}
+
+// Send a GET for 'uri' that should fail, and return the error code. Check
+// that it failed within 'max_ms'.
+int FailingGet(HttpClient* client, const HttpRequest& request, int max_ms) {
+  const uint64_t start = MonotonicNanos();
+  Status status;
+  Shared<HttpResponse>::Ptr response(client->SendRequest(request, &status));
+  ASSERT_TRUE(status.IsFailure());
+  ASSERT_TRUE(MonotonicNanos() - start < max_ms * 1000000ull);
+  return status.GetCode();
+}
+
+// Counts the bytes and pieces of a body, noting the status code and ETag
+// of the head that comes first; gives up after 'limit' bytes.
+class CountingSink : public ::enquery::HttpSink {
+ public:
+  explicit CountingSink(size_t limit)
+      : status_code(0), bytes(0), chunks(0), limit_(limit) {}
+  virtual bool OnResponse(const HttpResponse& head) {
+    ASSERT_EQUALS(status_code, 0);
+    ASSERT_EQUALS(bytes, 0u);
+    ASSERT_EQUALS(head.BodySize(), 0u);
+    status_code = head.StatusCode();
+    Slice value;
+    if (head.FindHeader("etag", &value)) {
+      etag.assign(value.data(), value.size());
+    }
+    return true;
+  }
+  virtual bool OnData(const Slice& data) {
+    ASSERT_TRUE(status_code != 0);
+    bytes += data.size();
+    ++chunks;
+    return bytes <= limit_;
+  }
+  int status_code;
+  std::string etag;
+  size_t bytes;
+  size_t chunks;
+
+ private:
+  const size_t limit_;
+};
+
+// Produces 'size' bytes of a repeating pattern, without saying how many;
+// fails part way if 'fail_at' is reached.
+class PatternSource : public ::enquery::HttpBodySource {
+ public:
+  PatternSource(size_t size, size_t fail_at)
+      : size_(size), fail_at_(fail_at), position_(0) {}
+  virtual int64_t Size() { return kUnknownSize; }
+  virtual Status Read(char* data, size_t size, size_t* bytes_read) {
+    if (position_ >= fail_at_) {
+      return Status::MakeError("PatternSource", "failed");
+    }
+    size_t n = 0;
+    while (n < size && position_ < size_) {
+      data[n++] = Pattern(position_++);
+    }
+    *bytes_read = n;
+    return Status::OK();
+  }
+  virtual bool Rewind() {
+    position_ = 0;
+    return true;
+  }
+  static char Pattern(size_t i) { return static_cast<char>('a' + i % 23); }
+
+ private:
+  const size_t size_;
+  const size_t fail_at_;
+  size_t position_;
+};
+
+// Send 'request' to the server's "/echo" and return the response body.
+std::string Echo(HttpClient* client, const HttpTestServer& server,
+                 HttpRequest request, Status* status) {
+  const std::string uri = server.Url("/echo");
+  request.set_uri(uri.c_str());
+  Shared<HttpResponse>::Ptr response(client->SendRequest(request, status));
+  if (status->IsFailure()) {
+    return std::string();
+  }
+  return std::string(response->Body(), response->BodySize());
+}
+
+struct ThreadArgs {
+  HttpClient* client;
+  const HttpTestServer* server;
+};
+
+void* GetRepeatedly(void* arg) {
+  ThreadArgs* args = static_cast<ThreadArgs*>(arg);
+  for (int i = 0; i < kRequestsPerThread; ++i) {
+    Get(args->client, *args->server, "/100", 100);
+  }
+  return NULL;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  Status status;
+  Shared<Http>::Ptr http(Http::Create(&status));
+  ASSERT_TRUE(status.IsSuccess());
+
+  // Sequential requests to one host share a single connection.
+  {
+    HttpTestServer server;
+    ASSERT_TRUE(server.Start().IsSuccess());
+    Shared<HttpClient>::Ptr client(http->CreateClient(&status));
+    ASSERT_TRUE(status.IsSuccess());
+    for (int i = 0; i < 5; ++i) {
+      Get(client.get(), server, "/1000", 1000);
+    }
+    ASSERT_EQUALS(server.requests_served(), 5u);
+    ASSERT_EQUALS(server.connections_accepted(), 1u);
+  }
+
+  // With no idle connections allowed, every request connects anew.
+  {
+    HttpTestServer server;
+    ASSERT_TRUE(server.Start().IsSuccess());
+    Shared<HttpClient>::Ptr client(http->CreateClient(
+        HttpClient::Settings().set_max_idle_per_host(0), &status));
+    ASSERT_TRUE(status.IsSuccess());
+    for (int i = 0; i < 3; ++i) {
+      Get(client.get(), server, "/10", 10);
+    }
+    ASSERT_EQUALS(server.connections_accepted(), 3u);
+  }
+
+  // Connections idle for longer than the timeout are closed.
+  {
+    HttpTestServer server;
+    ASSERT_TRUE(server.Start().IsSuccess());
+    Shared<HttpClient>::Ptr client(http->CreateClient(
+        HttpClient::Settings().set_idle_timeout_ms(50), &status));
+    ASSERT_TRUE(status.IsSuccess());
+    Get(client.get(), server, "/10", 10);
+    Get(client.get(), server, "/10", 10);
+    ASSERT_EQUALS(server.connections_accepted(), 1u);
+    usleep(150000);
+    Get(client.get(), server, "/10", 10);
+    ASSERT_EQUALS(server.connections_accepted(), 2u);
+  }
+
+  // Clients created by the same Http, synchronous or asynchronous, share
+  // resolved addresses and TLS sessions, but each keeps its own
+  // connections.
+  {
+    HttpTestServer server;
+    ASSERT_TRUE(server.Start().IsSuccess());
+    Shared<HttpClient>::Ptr client(http->CreateClient(&status));
+    Shared<HttpClient>::Ptr other_client(http->CreateClient(&status));
+    Shared<AsyncHttpClient>::Ptr async_client(
+        http->CreateAsyncClient(AsyncHttpClient::Settings(), &status));
+    ASSERT_TRUE(status.IsSuccess());
+    Get(client.get(), server, "/10", 10);
+    Get(other_client.get(), server, "/10", 10);
+    Get(client.get(), server, "/10", 10);
+
+    const std::string uri = server.Url("/10");
+    HttpRequest request;
+    request.set_uri(uri.c_str());
+    for (int i = 0; i < 2; ++i) {
+      Future<HttpResult> future;
+      ASSERT_TRUE(async_client->SendRequest(request, &future).IsSuccess());
+      HttpResult result = future.GetValue();
+      ASSERT_TRUE(result.status().IsSuccess());
+      ASSERT_TRUE(result.response() != NULL);
+      ASSERT_EQUALS(result.response()->BodySize(), 10u);
+    }
+    ASSERT_EQUALS(server.requests_served(), 5u);
+    ASSERT_EQUALS(server.connections_accepted(), 3u);
+  }
+
+  // A streamed body arrives in pieces; a sink can give up part way.
+  {
+    HttpTestServer server;
+    ASSERT_TRUE(server.Start().IsSuccess());
+    Shared<HttpClient>::Ptr client(http->CreateClient(&status));
+    ASSERT_TRUE(status.IsSuccess());
+    const std::string uri = server.Url("/4000000");
+    HttpRequest request;
+    request.set_uri(uri.c_str());
+
+    CountingSink all(~static_cast<size_t>(0));
+    ASSERT_TRUE(client->StreamRequest(request, &all).IsSuccess());
+    ASSERT_EQUALS(all.status_code, 200);
+    ASSERT_EQUALS(all.bytes, 4000000u);
+    ASSERT_TRUE(all.chunks > 1);
+
+    // The head comes first, and comes even without a body.
+    const std::string tagged_uri = server.Url("/10?etag=x");
+    CountingSink tagged(~static_cast<size_t>(0));
+    ASSERT_TRUE(
+        client->StreamRequest(HttpRequest().set_uri(tagged_uri.c_str()),
+                              &tagged)
+            .IsSuccess());
+    ASSERT_EQUALS(tagged.etag, std::string("\"x\""));
+    ASSERT_EQUALS(tagged.bytes, 10u);
+    const std::string missing_uri = server.Url("/status/404");
+    CountingSink missing(~static_cast<size_t>(0));
+    ASSERT_TRUE(
+        client->StreamRequest(HttpRequest().set_uri(missing_uri.c_str()),
+                              &missing)
+            .IsSuccess());
+    ASSERT_EQUALS(missing.status_code, 404);
+    ASSERT_EQUALS(missing.bytes, 0u);
+
+    CountingSink some(100000);
+    ASSERT_TRUE(client->StreamRequest(request, &some).IsFailure());
+    ASSERT_TRUE(some.bytes < 4000000u);
+
+    // The client is still usable afterwards.
+    Get(client.get(), server, "/10", 10);
+  }
+
+  // Responses carry their status code, headers and timings.
+  {
+    HttpTestServer server;
+    ASSERT_TRUE(server.Start().IsSuccess());
+    Shared<HttpClient>::Ptr client(http->CreateClient(&status));
+    ASSERT_TRUE(status.IsSuccess());
+    std::string uri = server.Url("/1234");
+    HttpRequest request;
+    request.set_uri(uri.c_str());
+    Shared<HttpResponse>::Ptr response(client->SendRequest(request, &status));
+    ASSERT_TRUE(status.IsSuccess());
+    ASSERT_EQUALS(response->StatusCode(), 200);
+    ASSERT_EQUALS(response->HeaderCount(), 1u);
+    Slice name, value;
+    response->GetHeader(0, &name, &value);
+    ASSERT_TRUE(std::string(name.data(), name.size()) == "Content-Length");
+    ASSERT_TRUE(std::string(value.data(), value.size()) == "1234");
+    ASSERT_TRUE(response->FindHeader("content-length", &value));
+    ASSERT_TRUE(std::string(value.data(), value.size()) == "1234");
+    ASSERT_TRUE(!response->FindHeader("etag", &value));
+    const HttpTimings& timings = response->Timings();
+    ASSERT_TRUE(timings.total_nanos > 0);
+    ASSERT_TRUE(timings.first_byte_nanos <= timings.total_nanos);
+    ASSERT_TRUE(timings.connect_nanos <= timings.first_byte_nanos);
+
+    // An error status is a successful request.
+    uri = server.Url("/status/503");
+    request.set_uri(uri.c_str());
+    response = Shared<HttpResponse>::Ptr(client->SendRequest(request, &status));
+    ASSERT_TRUE(status.IsSuccess());
+    ASSERT_EQUALS(response->StatusCode(), 503);
+
+    // Only the final response's headers are kept, not those of a
+    // "100 Continue" sent before a large body.
+    const std::string data(2000000, 'z');
+    uri = server.Url("/echo");
+    request.set_uri(uri.c_str())
+        .set_method(HttpRequest::PUT)
+        .set_body(data.data(), data.size());
+    response = Shared<HttpResponse>::Ptr(client->SendRequest(request, &status));
+    ASSERT_TRUE(status.IsSuccess());
+    ASSERT_EQUALS(response->StatusCode(), 200);
+    ASSERT_EQUALS(response->HeaderCount(), 1u);
+  }
+
+  // Bodies are sent from memory, borrowed slices, a file range, or a
+  // source of unknown size (sent chunked), with POST or PUT.
+  {
+    HttpTestServer server;
+    ASSERT_TRUE(server.Start().IsSuccess());
+    Shared<HttpClient>::Ptr client(http->CreateClient(&status));
+    ASSERT_TRUE(status.IsSuccess());
+
+    std::string expected;
+    for (size_t i = 0; i < 3000000; ++i) {
+      expected.push_back(PatternSource::Pattern(i));
+    }
+
+    HttpRequest request;
+    request.set_method(HttpRequest::POST);
+    request.set_body(expected.data(), expected.size());
+    ASSERT_TRUE(Echo(client.get(), server, request, &status) == expected);
+    ASSERT_TRUE(status.IsSuccess());
+
+    const Slice slices[] = {Slice(expected.data(), 1),
+                            Slice(expected.data() + 1, 1000000),
+                            Slice(expected.data() + 1000001, 0),
+                            Slice(expected.data() + 1000001, 1999999)};
+    request.set_body_slices(slices, 4);
+    ASSERT_TRUE(Echo(client.get(), server, request, &status) == expected);
+    ASSERT_TRUE(status.IsSuccess());
+
+    char path[] = "/tmp/curl_http_client_test.XXXXXX";
+    const int fd = mkstemp(path);
+    ASSERT_TRUE(fd >= 0);
+    unlink(path);
+    ASSERT_EQUALS(write(fd, "skip", 4), 4);
+    ASSERT_EQUALS(write(fd, expected.data(), expected.size()),
+                  static_cast<ssize_t>(expected.size()));
+    request.set_method(HttpRequest::PUT).set_body_file(fd, 4, 3000000);
+    ASSERT_TRUE(Echo(client.get(), server, request, &status) == expected);
+    ASSERT_TRUE(status.IsSuccess());
+
+    // A range that runs past the end of the file fails the request.
+    request.set_body_file(fd, 5, 3000000);
+    Echo(client.get(), server, request, &status);
+    ASSERT_TRUE(status.IsFailure());
+    close(fd);
+
+    PatternSource source(3000000, ~static_cast<size_t>(0));
+    request.set_method(HttpRequest::POST).set_body_source(&source);
+    ASSERT_TRUE(Echo(client.get(), server, request, &status) == expected);
+    ASSERT_TRUE(status.IsSuccess());
+
+    // A source that fails fails the request, with the source's status.
+    PatternSource failing(3000000, 100000);
+    request.set_body_source(&failing);
+    Echo(client.get(), server, request, &status);
+    ASSERT_TRUE(status.IsFailure());
+    ASSERT_EQUALS(strcmp(status.GetModule(), "PatternSource"), 0);
+  }
+
+  // HTTP/2 requests reuse one connection, whose streams carry bodies both
+  // ways.
+  {
+    HttpTestServer server;
+    ASSERT_TRUE(server.Start().IsSuccess());
+    Shared<HttpClient>::Ptr client(http->CreateClient(
+        HttpClient::Settings().set_http_version(
+            ::enquery::HTTP_VERSION_2_PRIOR_KNOWLEDGE),
+        &status));
+    ASSERT_TRUE(status.IsSuccess());
+    for (int i = 0; i < 5; ++i) {
+      Get(client.get(), server, "/200000", 200000);
+    }
+    const std::string data(500000, 'y');
+    HttpRequest request;
+    request.set_method(HttpRequest::PUT).set_body(data.data(), data.size());
+    ASSERT_TRUE(Echo(client.get(), server, request, &status) == data);
+    ASSERT_TRUE(status.IsSuccess());
+    ASSERT_EQUALS(server.requests_served(), 6u);
+    ASSERT_EQUALS(server.connections_accepted(), 1u);
+  }
+
+  // Responses are decoded when compression is accepted, and large request
+  // bodies are compressed; the counters show the difference.
+  {
+    HttpTestServer server;
+    ASSERT_TRUE(server.Start().IsSuccess());
+    Shared<HttpClient>::Ptr plain(http->CreateClient(&status));
+    ASSERT_TRUE(status.IsSuccess());
+    Shared<HttpClient>::Ptr client(http->CreateClient(
+        HttpClient::Settings().set_accept_encoding(true)
+            .set_compress_requests_above(1000),
+        &status));
+    ASSERT_TRUE(status.IsSuccess());
+
+    Get(plain.get(), server, "/100000", 100000);
+    HttpByteCounts counts = plain->GetByteCounts();
+    ASSERT_EQUALS(counts.response_body_bytes, 100000u);
+    ASSERT_EQUALS(counts.response_wire_bytes, 100000u);
+
+    Get(client.get(), server, "/100000", 100000);
+    const std::string uri = server.Url("/100000");
+    HttpRequest request;
+    request.set_uri(uri.c_str());
+    CountingSink sink(~static_cast<size_t>(0));
+    ASSERT_TRUE(client->StreamRequest(request, &sink).IsSuccess());
+    ASSERT_EQUALS(sink.bytes, 100000u);
+    counts = client->GetByteCounts();
+    ASSERT_EQUALS(counts.response_body_bytes, 200000u);
+#ifdef HAVE_ZLIB
+    ASSERT_TRUE(counts.response_wire_bytes < 10000u);
+#endif
+
+    // Small bodies are sent as they are.
+    request = HttpRequest();
+    request.set_method(HttpRequest::POST).set_body("small", 5);
+    ASSERT_TRUE(Echo(client.get(), server, request, &status) == "small");
+    ASSERT_TRUE(status.IsSuccess());
+    counts = client->GetByteCounts();
+    ASSERT_EQUALS(counts.request_body_bytes, 5u);
+    ASSERT_EQUALS(counts.request_wire_bytes, 5u);
+
+    // Large ones are compressed, and survive being rewound for a redirect
+    // or retry; bodies of unknown size are compressed too.
+    std::string expected;
+    for (size_t i = 0; i < 3000000; ++i) {
+      expected.push_back(PatternSource::Pattern(i));
+    }
+    request.set_method(HttpRequest::PUT)
+        .set_body(expected.data(), expected.size());
+    ASSERT_TRUE(Echo(client.get(), server, request, &status) == expected);
+    ASSERT_TRUE(status.IsSuccess());
+    PatternSource source(3000000, ~static_cast<size_t>(0));
+    request.set_method(HttpRequest::POST).set_body_source(&source);
+    ASSERT_TRUE(Echo(client.get(), server, request, &status) == expected);
+    ASSERT_TRUE(status.IsSuccess());
+    counts = client->GetByteCounts();
+    ASSERT_EQUALS(counts.request_body_bytes, 6000005u);
+#ifdef HAVE_ZLIB
+    ASSERT_TRUE(counts.request_wire_bytes < 1000000u);
+#else
+    ASSERT_EQUALS(counts.request_wire_bytes, 6000005u);
+#endif
+  }
+
+  // Timeouts fail a request to a server that doesn't answer, each with its
+  // own code. Requests may override the client's limits. (A TLS handshake
+  // that gets no answer is part of connecting.)
+  {
+    StalledTestServer server;
+    ASSERT_TRUE(server.Start().IsSuccess());
+    Shared<HttpClient>::Ptr client(http->CreateClient(
+        HttpClient::Settings().set_timeout_ms(200), &status));
+    ASSERT_TRUE(status.IsSuccess());
+    const std::string http_uri = server.Url("http", "/");
+    const std::string https_uri = server.Url("https", "/");
+    HttpRequest request;
+    request.set_uri(http_uri.c_str());
+    ASSERT_EQUALS(FailingGet(client.get(), request, 2000),
+                  enquery::kHttpDeadlineExceeded);
+    request.set_uri(https_uri.c_str()).set_connect_timeout_ms(100);
+    ASSERT_EQUALS(FailingGet(client.get(), request, 2000),
+                  enquery::kHttpConnectTimeout);
+    request.set_uri(http_uri.c_str())
+        .set_connect_timeout_ms(0)
+        .set_timeout_ms(-1)
+        .set_low_speed_limit(1000, 1);
+    ASSERT_EQUALS(FailingGet(client.get(), request, 4000),
+                  enquery::kHttpTooSlow);
+  }
+
+  // Concurrent requests each use their own connection, and those are
+  // reused afterwards.
+  {
+    HttpTestServer server;
+    ASSERT_TRUE(server.Start().IsSuccess());
+    Shared<HttpClient>::Ptr client(http->CreateClient(&status));
+    ASSERT_TRUE(status.IsSuccess());
+    ThreadArgs args = {client.get(), &server};
+    pthread_t threads[kThreads];
+    for (int i = 0; i < kThreads; ++i) {
+      ASSERT_EQUALS(pthread_create(&threads[i], NULL, GetRepeatedly, &args),
+                    0);
+    }
+    for (int i = 0; i < kThreads; ++i) {
+      ASSERT_EQUALS(pthread_join(threads[i], NULL), 0);
+    }
+    ASSERT_EQUALS(server.requests_served(),
+                  static_cast<uint64_t>(kThreads * kRequestsPerThread));
+    ASSERT_TRUE(server.connections_accepted() <= kThreads);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -14,11 +14,23 @@
 // contributors.
 
 #include "http/curl_http_response.h"
+#include <assert.h>
+#include <string.h>
+#include <strings.h>
 #include "enquery/buffer.h"
+#include "enquery/scope_lock.h"
 
 namespace enquery {
 
-CurlHttpResponse::CurlHttpResponse(Shared<Buffer>::Ptr body) : body_(body) {}
+CurlHttpResponse::CurlHttpResponse(Shared<Buffer>::Ptr body,
+                                   Shared<Buffer>::Ptr headers,
+                                   int status_code, const HttpTimings& timings)
+    : body_(body),
+      headers_(headers),
+      status_code_(status_code),
+      timings_(timings),
+      parse_mutex_("CurlHttpResponse::headers"),
+      parsed_(false) {}
 
 CurlHttpResponse::~CurlHttpResponse() {}
 
@@ -26,4 +38,84 @@ const char* CurlHttpResponse::Body() const { return body_->Data(); }
 
 size_t CurlHttpResponse::BodySize() const { return body_->Size(); }
 
+int CurlHttpResponse::StatusCode() const { return status_code_; }
+
+size_t CurlHttpResponse::HeaderCount() const {
+  ParseHeaders();
+  return entries_.size();
+}
+
+void CurlHttpResponse::GetHeader(size_t index, Slice* name,
+                                 Slice* value) const {
+  ParseHeaders();
+  assert(index < entries_.size());
+  const HeaderEntry& entry = entries_[index];
+  const char* data = headers_->Data();
+  *name = Slice(data + entry.name_offset, entry.name_size);
+  *value = Slice(data + entry.value_offset, entry.value_size);
+}
+
+bool CurlHttpResponse::FindHeader(const char* name, Slice* value) const {
+  ParseHeaders();
+  const size_t size = strlen(name);
+  const char* data = headers_->Data();
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    const HeaderEntry& entry = entries_[i];
+    if (entry.name_size == size &&
+        strncasecmp(data + entry.name_offset, name, size) == 0) {
+      *value = Slice(data + entry.value_offset, entry.value_size);
+      return true;
+    }
+  }
+  return false;
+}
+
+const HttpTimings& CurlHttpResponse::Timings() const { return timings_; }
+
+void CurlHttpResponse::ParseHeaders() const {
+  if (__atomic_load_n(&parsed_, __ATOMIC_ACQUIRE)) {
+    return;
+  }
+  ScopeLock lock(&parse_mutex_);
+  if (parsed_) {
+    return;
+  }
+
+  // After the status line, each line is "Name: value" and ends with CRLF
+  // (or a bare LF.) The blank line at the end has no colon and is skipped,
+  // as are obsolete folded continuation lines.
+  const char* data = headers_->Data();
+  const size_t size = headers_->Size();
+  const char* status_end = static_cast<const char*>(memchr(data, '\n', size));
+  size_t line = status_end ? status_end - data + 1 : size;
+  while (line < size) {
+    const char* newline =
+        static_cast<const char*>(memchr(data + line, '\n', size - line));
+    const size_t end = newline ? newline - data : size;
+    const char* colon =
+        static_cast<const char*>(memchr(data + line, ':', end - line));
+    if (colon && data[line] != ' ' && data[line] != '\t') {
+      size_t value_start = colon - data + 1;
+      size_t value_end = end;
+      while (value_start < value_end &&
+             (data[value_start] == ' ' || data[value_start] == '\t')) {
+        ++value_start;
+      }
+      while (value_end > value_start &&
+             (data[value_end - 1] == '\r' || data[value_end - 1] == ' ' ||
+              data[value_end - 1] == '\t')) {
+        --value_end;
+      }
+      HeaderEntry entry;
+      entry.name_offset = line;
+      entry.name_size = colon - (data + line);
+      entry.value_offset = value_start;
+      entry.value_size = value_end - value_start;
+      entries_.push_back(entry);
+    }
+    line = end + 1;
+  }
+  __atomic_store_n(&parsed_, true, __ATOMIC_RELEASE);
+}
+
 }  // namespace enquery
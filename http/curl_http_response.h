@@ -16,25 +16,58 @@
 #ifndef HTTP_CURL_HTTP_RESPONSE_H_
 #define HTTP_CURL_HTTP_RESPONSE_H_
 
+#include <vector>
 #include "enquery/http_response.h"
+#include "enquery/mutex.h"
 #include "enquery/shared.h"
 
 namespace enquery {
 
 class Buffer;
 
+// The response to a request sent with curl. Headers are kept as received,
+// in a single buffer, and are only split into names and values the first
+// time they are asked for.
 class CurlHttpResponse : public HttpResponse {
  public:
-  explicit CurlHttpResponse(Shared<Buffer>::Ptr body);
+  // 'headers' holds the raw header block of the final response (status
+  // line included.)
+  CurlHttpResponse(Shared<Buffer>::Ptr body, Shared<Buffer>::Ptr headers,
+                   int status_code, const HttpTimings& timings);
   virtual ~CurlHttpResponse();
 
   virtual const char* Body() const;
   virtual size_t BodySize() const;
+  virtual int StatusCode() const;
+  virtual size_t HeaderCount() const;
+  virtual void GetHeader(size_t index, Slice* name, Slice* value) const;
+  virtual bool FindHeader(const char* name, Slice* value) const;
+  virtual const HttpTimings& Timings() const;
 
  private:
+  // The location of a header's name and value in headers_.
+  struct HeaderEntry {
+    size_t name_offset;
+    size_t name_size;
+    size_t value_offset;
+    size_t value_size;
+  };
+
   CurlHttpResponse(const CurlHttpResponse& no_copy);
   CurlHttpResponse& operator=(const CurlHttpResponse& no_assign);
+
+  // Split the header block into entries_, if not done already.
+  void ParseHeaders() const;
+
   Shared<Buffer>::Ptr body_;
+  Shared<Buffer>::Ptr headers_;
+  const int status_code_;
+  const HttpTimings timings_;
+
+  // Responses may be shared between threads, so parsing is guarded.
+  mutable Mutex parse_mutex_;
+  mutable bool parsed_;
+  mutable std::vector<HeaderEntry> entries_;
 };
 
 }  // namespace enquery
@@ -0,0 +1,665 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "http/curl_request.h"
+#include <assert.h>
+#include <curl/curl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#include <algorithm>
+#include <string>
+#include "http/curl_http_response.h"
+#include "enquery/buffer.h"
+#include "enquery/http_client.h"
+#include "enquery/http_request.h"
+#include "enquery/slice.h"
+#include "enquery/status.h"
+#include "enquery/trace.h"
+
+using enquery::Buffer;
+using enquery::CurlRequestBody;
+using enquery::Slice;
+
+namespace {
+
+// The cURL library requires programmers to implement callbacks for providing
+// data in an HTTP request as well as receiving response data. The functions
+// are named from the point of view of the library. Thus, curl_read_buffer()
+// is called by the library to obtain data from the program to send in the
+// HTTP request. The curl_write_buffer() function is called to write response
+// data received from the server back to the program's buffer.
+
+size_t curl_read_body(char* data, size_t size, size_t nmemb, void* user) {
+  assert(user != NULL);
+  const size_t total_bytes = size * nmemb;
+  if (total_bytes == 0) {
+    return 0;
+  }
+  assert(data != NULL);
+  return reinterpret_cast<CurlRequestBody*>(user)->Read(data, total_bytes);
+}
+
+// Called by curl to rewind the body, e.g. to send it again after a
+// redirect.
+int curl_seek_body(void* user, curl_off_t offset, int origin) {
+  assert(user != NULL);
+  if (origin != SEEK_SET) {
+    return CURL_SEEKFUNC_CANTSEEK;
+  }
+  return reinterpret_cast<CurlRequestBody*>(user)->Seek(offset)
+             ? CURL_SEEKFUNC_OK
+             : CURL_SEEKFUNC_CANTSEEK;
+}
+
+// Callback function that appends received data to a Buffer.
+size_t curl_write_buffer(char* data, size_t size, size_t nmemb, void* user) {
+  assert(user != NULL);
+  const size_t total_bytes = size * nmemb;
+  if (total_bytes == 0) {
+    return 0;
+  }
+  assert(data != NULL);
+  Buffer* buffer = reinterpret_cast<Buffer*>(user);
+  buffer->Append(data, total_bytes);
+  return total_bytes;
+}
+
+// Callback function that passes received data to an HttpSink. Returning
+// less than was given makes curl fail the transfer.
+size_t curl_write_sink(char* data, size_t size, size_t nmemb, void* user) {
+  assert(user != NULL);
+  const size_t total_bytes = size * nmemb;
+  if (total_bytes == 0) {
+    return 0;
+  }
+  enquery::HttpSink* sink = reinterpret_cast<enquery::HttpSink*>(user);
+  return sink->OnData(enquery::Slice(data, total_bytes)) ? total_bytes : 0;
+}
+
+// Callback function that collects header lines. A status line starts a
+// new response, so whatever came before is dropped.
+size_t curl_write_header(char* data, size_t size, size_t nmemb, void* user) {
+  assert(user != NULL);
+  const size_t total_bytes = size * nmemb;
+  Buffer* buffer = reinterpret_cast<Buffer*>(user);
+  if (total_bytes >= 5 && memcmp(data, "HTTP/", 5) == 0) {
+    *buffer = Buffer();
+  }
+  buffer->Append(data, total_bytes);
+  return total_bytes;
+}
+
+// Set the write callback and its parameter.
+enquery::Status SetWriteFunction(CURL* curl, curl_write_callback function,
+                                 void* user) {
+  CURLcode result = curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, function);
+  if (result == 0) {
+    result = curl_easy_setopt(curl, CURLOPT_WRITEDATA, user);
+  }
+  if (result != 0) {
+    return enquery::Status::MakeError(enquery::kCurlModule,
+                                      curl_easy_strerror(result));
+  }
+  return enquery::Status::OK();
+}
+
+#ifdef HAVE_ZLIB
+// Uncompressed data read from the body at a time when compressing it.
+const size_t kCompressChunkSize = 64 * 1024;
+
+// zlib's windowBits for the largest window, plus 16 for a gzip wrapper.
+const int kGzipWindowBits = 15 + 16;
+#endif
+
+// Return method name from the enumeration.
+const char* HttpMethodNameFromMethod(const enquery::HttpRequest::Method m) {
+  using enquery::HttpRequest;
+  switch (m) {
+    case HttpRequest::GET:
+      return "GET";
+    case HttpRequest::HEAD:
+      return "HEAD";
+    case HttpRequest::POST:
+      return "POST";
+    case HttpRequest::PUT:
+      return "PUT";
+    case HttpRequest::DELETE:
+      return "DELETE";
+    case HttpRequest::TRACE:
+      return "TRACE";
+    default:
+      return "NONE";
+  }
+}
+
+}  // namespace
+
+namespace enquery {
+
+const char* const kCurlModule = "curl";
+
+CurlRequestBody::CurlRequestBody(const HttpRequest& request,
+                                 size_t compress_above)
+    : request_(request),
+      position_(0),
+      slice_(0),
+      slice_offset_(0),
+      headers_(NULL),
+      zstream_(NULL),
+      raw_done_(false) {
+  if (*request.content_type() != '\0') {
+    const std::string header =
+        std::string("Content-Type: ") + request.content_type();
+    headers_ = curl_slist_append(headers_, header.c_str());
+  }
+  for (size_t i = 0; i < request.HeaderCount(); ++i) {
+    // curl sends "Name;" as a header with no value; "Name:" would remove
+    // the header instead.
+    Slice name, value;
+    request.GetHeader(i, &name, &value);
+    std::string header(name.data(), name.size());
+    if (value.IsEmpty()) {
+      header.push_back(';');
+    } else {
+      header.append(": ").append(value.data(), value.size());
+    }
+    headers_ = curl_slist_append(headers_, header.c_str());
+  }
+
+#ifdef HAVE_ZLIB
+  const int64_t size = request.BodySize();
+  if (compress_above > 0 && request.HasBody() &&
+      (size < 0 || static_cast<uint64_t>(size) >= compress_above)) {
+    // Speed matters more than ratio: the body is on its way to the wire.
+    z_stream* stream = new z_stream;
+    memset(stream, 0, sizeof(*stream));
+    if (deflateInit2(stream, Z_BEST_SPEED, Z_DEFLATED, kGzipWindowBits, 8,
+                     Z_DEFAULT_STRATEGY) == Z_OK) {
+      zstream_ = stream;
+      raw_.resize(kCompressChunkSize);
+      headers_ = curl_slist_append(headers_, "Content-Encoding: gzip");
+    } else {
+      delete stream;
+    }
+  }
+#else
+  (void)compress_above;
+#endif
+}
+
+CurlRequestBody::~CurlRequestBody() {
+#ifdef HAVE_ZLIB
+  if (zstream_ != NULL) {
+    z_stream* stream = static_cast<z_stream*>(zstream_);
+    deflateEnd(stream);
+    delete stream;
+  }
+#endif
+  curl_slist_free_all(headers_);
+}
+
+size_t CurlRequestBody::Read(char* data, size_t size) {
+  return zstream_ != NULL ? ReadCompressed(data, size) : ReadRaw(data, size);
+}
+
+size_t CurlRequestBody::ReadCompressed(char* data, size_t size) {
+#ifdef HAVE_ZLIB
+  z_stream* stream = static_cast<z_stream*>(zstream_);
+  stream->next_out = reinterpret_cast<Bytef*>(data);
+  stream->avail_out = static_cast<uInt>(size);
+
+  // Compress until curl's buffer is full or the body is done. Small
+  // bodies may take several reads of the source before any output.
+  while (stream->avail_out > 0) {
+    if (stream->avail_in == 0 && !raw_done_) {
+      const size_t count = ReadRaw(&raw_[0], raw_.size());
+      if (count == CURL_READFUNC_ABORT) {
+        return count;
+      }
+      raw_done_ = (count == 0);
+      stream->next_in = reinterpret_cast<Bytef*>(&raw_[0]);
+      stream->avail_in = static_cast<uInt>(count);
+    }
+    const int result = deflate(stream, raw_done_ ? Z_FINISH : Z_NO_FLUSH);
+    if (result == Z_STREAM_END) {
+      break;
+    }
+    if (result != Z_OK && result != Z_BUF_ERROR) {
+      status_ = Status::MakeError("zlib", stream->msg ? stream->msg
+                                                      : "deflate failed");
+      return CURL_READFUNC_ABORT;
+    }
+  }
+  return size - stream->avail_out;
+#else
+  (void)data;
+  (void)size;
+  return CURL_READFUNC_ABORT;
+#endif
+}
+
+size_t CurlRequestBody::ReadRaw(char* data, size_t size) {
+  switch (request_.body_type()) {
+    case HttpRequest::BUFFER: {
+      const Buffer& body = request_.body();
+      const size_t count =
+          std::min(size, body.Size() - static_cast<size_t>(position_));
+      memcpy(data, body.Data() + position_, count);
+      position_ += count;
+      return count;
+    }
+
+    case HttpRequest::SLICES: {
+      const std::vector<Slice>& slices = request_.body_slices();
+      size_t count = 0;
+      while (count < size && slice_ < slices.size()) {
+        const Slice& slice = slices[slice_];
+        const size_t n = std::min(size - count, slice.size() - slice_offset_);
+        memcpy(data + count, slice.data() + slice_offset_, n);
+        count += n;
+        slice_offset_ += n;
+        if (slice_offset_ == slice.size()) {
+          ++slice_;
+          slice_offset_ = 0;
+        }
+      }
+      position_ += count;
+      return count;
+    }
+
+    case HttpRequest::FILE_RANGE: {
+      const int64_t remaining = request_.BodySize() - position_;
+      const size_t wanted = static_cast<size_t>(
+          std::min(static_cast<int64_t>(size), remaining));
+      if (wanted == 0) {
+        return 0;
+      }
+      ssize_t n;
+      do {
+        n = pread(request_.body_fd(), data, wanted,
+                  request_.body_offset() + position_);
+      } while (n < 0 && errno == EINTR);
+      if (n < 0) {
+        status_ = Status::MakeFromSystemError(errno);
+        return CURL_READFUNC_ABORT;
+      }
+      if (n == 0) {
+        status_ = Status::MakeError(kCurlModule, "body file ended early");
+        return CURL_READFUNC_ABORT;
+      }
+      position_ += n;
+      return static_cast<size_t>(n);
+    }
+
+    case HttpRequest::SOURCE: {
+      size_t count = 0;
+      status_ = request_.body_source()->Read(data, size, &count);
+      if (status_.IsFailure()) {
+        return CURL_READFUNC_ABORT;
+      }
+      position_ += count;
+      return count;
+    }
+  }
+  return CURL_READFUNC_ABORT;
+}
+
+bool CurlRequestBody::Seek(int64_t offset) {
+#ifdef HAVE_ZLIB
+  if (zstream_ != NULL) {
+    // Compressed data can't be located from an uncompressed offset, so
+    // the whole body is compressed again.
+    if (offset != 0 || !SeekRaw(0)) {
+      return false;
+    }
+    z_stream* stream = static_cast<z_stream*>(zstream_);
+    deflateReset(stream);
+    stream->avail_in = 0;
+    raw_done_ = false;
+    return true;
+  }
+#endif
+  return SeekRaw(offset);
+}
+
+bool CurlRequestBody::SeekRaw(int64_t offset) {
+  const int64_t size = request_.BodySize();
+  if (offset < 0 || (size >= 0 && offset > size)) {
+    return false;
+  }
+
+  switch (request_.body_type()) {
+    case HttpRequest::SLICES: {
+      const std::vector<Slice>& slices = request_.body_slices();
+      slice_ = 0;
+      slice_offset_ = static_cast<size_t>(offset);
+      while (slice_ < slices.size() &&
+             slice_offset_ >= slices[slice_].size()) {
+        slice_offset_ -= slices[slice_].size();
+        ++slice_;
+      }
+      break;
+    }
+
+    case HttpRequest::SOURCE:
+      // Sources can only start again from the beginning.
+      if (offset != 0 || !request_.body_source()->Rewind()) {
+        return false;
+      }
+      break;
+
+    default:
+      break;
+  }
+  position_ = offset;
+  return true;
+}
+
+Status PrepareCurlRequest(CURL* curl, const HttpRequest& request,
+                          CurlRequestBody* body) {
+  CURLcode result = CURLE_OK;
+
+  // Which method are we using?
+  switch (request.method()) {
+    case HttpRequest::GET:
+      // libcurl defaults to GET; do nothing.
+      break;
+
+    case HttpRequest::POST:
+      result = curl_easy_setopt(curl, CURLOPT_POST, 1L);
+      break;
+
+    case HttpRequest::PUT:
+      result = curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
+      break;
+
+    case HttpRequest::HEAD:
+    case HttpRequest::DELETE:
+    case HttpRequest::TRACE:
+      result = curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST,
+                                HttpMethodNameFromMethod(request.method()));
+      break;
+  }
+
+  if (result != 0) {
+    return Status::MakeError(kCurlModule, curl_easy_strerror(result));
+  }
+
+  // Set the URL to use for the request
+  result = curl_easy_setopt(curl, CURLOPT_URL, request.uri());
+  if (result != 0) {
+    return Status::MakeError(kCurlModule, curl_easy_strerror(result));
+  }
+
+  // Do we have a body? It's O.K. if the data is empty; we only set up the
+  // "read" callback in the case where we actually have body data to send.
+  if (request.HasBody()) {
+    // Set up the read callback function and its parameter
+    result = curl_easy_setopt(curl, CURLOPT_READFUNCTION, curl_read_body);
+    if (result == 0) {
+      result = curl_easy_setopt(curl, CURLOPT_READDATA, body);
+    }
+
+    // Let curl rewind the body if it has to send it again
+    if (result == 0) {
+      result = curl_easy_setopt(curl, CURLOPT_SEEKFUNCTION, curl_seek_body);
+    }
+    if (result == 0) {
+      result = curl_easy_setopt(curl, CURLOPT_SEEKDATA, body);
+    }
+    if (result != 0) {
+      return Status::MakeError(kCurlModule, curl_easy_strerror(result));
+    }
+  }
+
+  // Headers to send. The list belongs to 'body', which outlives the
+  // transfer.
+  result = curl_easy_setopt(curl, CURLOPT_HTTPHEADER, body->headers());
+  if (result != 0) {
+    return Status::MakeError(kCurlModule, curl_easy_strerror(result));
+  }
+
+  // Tell curl the size of the body, so that it can send a Content-Length
+  // header; a size of -1 (unknown) makes it use chunked encoding instead,
+  // as it must for a body compressed on the fly. Without a size, curl
+  // would otherwise read a POST body from stdin.
+  curl_off_t body_size = request.HasBody() ? request.BodySize() : 0;
+  if (body->compressed()) {
+    body_size = -1;
+  }
+  if (request.method() == HttpRequest::POST) {
+    result = curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, body_size);
+  } else if (request.method() == HttpRequest::PUT) {
+    result = curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, body_size);
+  }
+  if (result != 0) {
+    return Status::MakeError(kCurlModule, curl_easy_strerror(result));
+  }
+
+  return Status::OK();
+}
+
+Status SetCurlResponseBuffer(CURL* curl, Buffer* buffer) {
+  return SetWriteFunction(curl, curl_write_buffer, buffer);
+}
+
+Status SetCurlResponseSink(CURL* curl, HttpSink* sink) {
+  return SetWriteFunction(curl, curl_write_sink, sink);
+}
+
+Status SetCurlResponseHeaders(CURL* curl, Buffer* headers) {
+  CURLcode result =
+      curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, curl_write_header);
+  if (result == 0) {
+    result = curl_easy_setopt(curl, CURLOPT_HEADERDATA, headers);
+  }
+  if (result != 0) {
+    return Status::MakeError(kCurlModule, curl_easy_strerror(result));
+  }
+  return Status::OK();
+}
+
+CurlHttpResponse* MakeCurlHttpResponse(CURL* curl, Shared<Buffer>::Ptr body,
+                                       Shared<Buffer>::Ptr headers) {
+  long status_code = 0;  // NOLINT
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status_code);
+
+  // curl reports cumulative microseconds since the start of the transfer.
+  curl_off_t dns = 0, connect = 0, tls = 0, first_byte = 0, total = 0;
+  curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &dns);
+  curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect);
+  curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &tls);
+  curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &first_byte);
+  curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total);
+  HttpTimings timings;
+  timings.dns_nanos = dns * 1000;
+  timings.connect_nanos = connect * 1000;
+  timings.tls_nanos = tls * 1000;
+  timings.first_byte_nanos = first_byte * 1000;
+  timings.total_nanos = total * 1000;
+
+  return new CurlHttpResponse(body, headers, static_cast<int>(status_code),
+                              timings);
+}
+
+void TraceTransferPhases(CURL* curl, uint64_t started_at) {
+  curl_off_t dns = 0, connect = 0, tls = 0, pretransfer = 0, first_byte = 0,
+             total = 0;
+  curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &dns);
+  curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect);
+  curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &tls);
+  curl_easy_getinfo(curl, CURLINFO_PRETRANSFER_TIME_T, &pretransfer);
+  curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &first_byte);
+  curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total);
+
+  // curl reports cumulative microseconds since the start of the transfer.
+  struct Phase {
+    const char* name;
+    curl_off_t begin;
+    curl_off_t end;
+  } phases[] = {{"http.dns", 0, dns},
+                {"http.connect", dns, connect},
+                {"http.tls", connect, tls},
+                {"http.wait", pretransfer, first_byte},
+                {"http.receive", first_byte, total}};
+
+  for (size_t i = 0; i < sizeof(phases) / sizeof(phases[0]); ++i) {
+    if (phases[i].end > phases[i].begin) {
+      Tracer::RecordComplete("http", phases[i].name,
+                             started_at + phases[i].begin * 1000,
+                             (phases[i].end - phases[i].begin) * 1000);
+    }
+  }
+}
+
+Status SetCurlHttpVersion(CURL* curl, const HttpRequest& request,
+                          HttpVersion version) {
+  long curl_version = CURL_HTTP_VERSION_1_1;  // NOLINT
+  bool multiplex = false;
+  switch (version) {
+    case HTTP_VERSION_1_1:
+      break;
+    case HTTP_VERSION_2:
+      // Only TLS connections may turn out to be HTTP/2.
+      curl_version = CURL_HTTP_VERSION_2TLS;
+      multiplex = strncasecmp(request.uri(), "https:", 6) == 0;
+      break;
+    case HTTP_VERSION_2_PRIOR_KNOWLEDGE:
+      curl_version = CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE;
+      multiplex = true;
+      break;
+  }
+  CURLcode result = curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, curl_version);
+  if (result == 0 && multiplex) {
+    result = curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+  }
+  if (result != 0) {
+    return Status::MakeError(kCurlModule, curl_easy_strerror(result));
+  }
+  return Status::OK();
+}
+
+Status SetCurlTimeouts(CURL* curl, const HttpRequest& request,
+                       const CurlTimeouts& defaults, CurlTimeouts* applied) {
+  *applied = defaults;
+  if (request.connect_timeout_ms() != 0) {
+    applied->connect_ms = std::max(0, request.connect_timeout_ms());
+  }
+  if (request.timeout_ms() != 0) {
+    applied->total_ms = std::max(0, request.timeout_ms());
+  }
+  if (request.low_speed_bytes_per_second() != 0) {
+    applied->low_speed_bytes =
+        std::max(0, request.low_speed_bytes_per_second());
+    applied->low_speed_seconds = std::max(0, request.low_speed_seconds());
+  }
+
+  // Every option is set, even to zero, since handles are reused.
+  CURLcode result = curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS,
+                                     static_cast<long>(applied->connect_ms));
+  if (result == 0) {
+    result = curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS,
+                              static_cast<long>(applied->total_ms));
+  }
+  if (result == 0) {
+    result = curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT,
+                              static_cast<long>(applied->low_speed_bytes));
+  }
+  if (result == 0) {
+    result = curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME,
+                              static_cast<long>(applied->low_speed_seconds));
+  }
+  if (result != 0) {
+    return Status::MakeError(kCurlModule, curl_easy_strerror(result));
+  }
+  return Status::OK();
+}
+
+Status MakeCurlError(CURL* curl, CURLcode result,
+                     const CurlTimeouts& timeouts, uint64_t elapsed_nanos) {
+  switch (result) {
+    case CURLE_OPERATION_TIMEDOUT:
+      break;
+    case CURLE_COULDNT_RESOLVE_HOST:
+    case CURLE_COULDNT_CONNECT:
+      return Status::MakeError(kCurlModule, curl_easy_strerror(result),
+                               kHttpConnectFailed);
+    case CURLE_SEND_ERROR:
+    case CURLE_RECV_ERROR:
+    case CURLE_GOT_NOTHING:
+      return Status::MakeError(kCurlModule, curl_easy_strerror(result),
+                               kHttpConnectionLost);
+    default:
+      return Status::MakeError(kCurlModule, curl_easy_strerror(result));
+  }
+
+  // While connecting, curl applies whichever of the connect and total
+  // limits is sooner. So a transfer that ran out of time at the total
+  // limit missed its deadline, wherever it was; one that ran out sooner
+  // without finishing connecting hit the connect limit; and any other hit
+  // the low speed limit.
+  const uint64_t elapsed_ms = elapsed_nanos / 1000000;
+  if (timeouts.total_ms > 0 &&
+      elapsed_ms >= static_cast<uint64_t>(timeouts.total_ms)) {
+    return Status::MakeError(kCurlModule, "request deadline exceeded",
+                             kHttpDeadlineExceeded);
+  }
+  curl_off_t pretransfer = 0;
+  curl_easy_getinfo(curl, CURLINFO_PRETRANSFER_TIME_T, &pretransfer);
+  if (pretransfer == 0) {
+    return Status::MakeError(kCurlModule, "connect timed out",
+                             kHttpConnectTimeout);
+  }
+  if (timeouts.low_speed_bytes > 0) {
+    return Status::MakeError(kCurlModule, "transfer too slow", kHttpTooSlow);
+  }
+  return Status::MakeError(kCurlModule, "request deadline exceeded",
+                           kHttpDeadlineExceeded);
+}
+
+void AddCurlByteCounts(CURL* curl, const CurlRequestBody& body,
+                       uint64_t response_body_bytes, HttpByteCounts* counts) {
+  curl_off_t uploaded = 0, downloaded = 0;
+  curl_easy_getinfo(curl, CURLINFO_SIZE_UPLOAD_T, &uploaded);
+  curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &downloaded);
+  __atomic_add_fetch(&counts->request_body_bytes, body.bytes_read(),
+                     __ATOMIC_RELAXED);
+  __atomic_add_fetch(&counts->request_wire_bytes, uploaded, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&counts->response_wire_bytes, downloaded,
+                     __ATOMIC_RELAXED);
+  __atomic_add_fetch(&counts->response_body_bytes, response_body_bytes,
+                     __ATOMIC_RELAXED);
+}
+
+HttpByteCounts LoadByteCounts(const HttpByteCounts& counts) {
+  HttpByteCounts copy;
+  copy.request_body_bytes =
+      __atomic_load_n(&counts.request_body_bytes, __ATOMIC_RELAXED);
+  copy.request_wire_bytes =
+      __atomic_load_n(&counts.request_wire_bytes, __ATOMIC_RELAXED);
+  copy.response_wire_bytes =
+      __atomic_load_n(&counts.response_wire_bytes, __ATOMIC_RELAXED);
+  copy.response_body_bytes =
+      __atomic_load_n(&counts.response_body_bytes, __ATOMIC_RELAXED);
+  return copy;
+}
+
+}  // namespace enquery
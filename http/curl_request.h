@@ -0,0 +1,172 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef HTTP_CURL_REQUEST_H_
+#define HTTP_CURL_REQUEST_H_
+
+#include <curl/curl.h>
+#include <stdint.h>
+#include <vector>
+#include "enquery/http_client.h"
+#include "enquery/http_request.h"
+#include "enquery/shared.h"
+#include "enquery/status.h"
+
+namespace enquery {
+
+class Buffer;
+class CurlHttpResponse;
+class HttpSink;
+
+// The module name used in Status errors from curl.
+extern const char* const kCurlModule;
+
+// CurlRequestBody feeds the body of a request to curl, in whichever form
+// the request supplies it, and holds the read position for one transfer.
+// Data is copied straight from where the caller keeps it (memory, a file
+// or a source) into curl's upload buffer, gzip-compressing it on the way
+// if the body is large enough. It also holds the headers to send with the
+// request.
+class CurlRequestBody {
+ public:
+  // 'request' must outlive the body. Bodies of at least 'compress_above'
+  // bytes, or of unknown size, are compressed if zlib is available; zero
+  // disables compression.
+  CurlRequestBody(const HttpRequest& request, size_t compress_above);
+  ~CurlRequestBody();
+
+  // Copy up to 'size' bytes into 'data'. Return the number copied, or
+  // CURL_READFUNC_ABORT on failure.
+  size_t Read(char* data, size_t size);
+
+  // Move the read position to 'offset' bytes from the start. Return false
+  // if that isn't possible. A compressed body can only start again.
+  bool Seek(int64_t offset);
+
+  // Return true if the body is being compressed.
+  bool compressed() const { return zstream_ != NULL; }
+
+  // Return the number of bytes of the body (before compression) read so
+  // far.
+  uint64_t bytes_read() const { return position_; }
+
+  // Return the headers to send: those the request adds, and those that
+  // describe the body (Content-Type and Content-Encoding). NULL if none.
+  curl_slist* headers() const { return headers_; }
+
+  // Return the failure that made Read() give up, if any.
+  const Status& status() const { return status_; }
+
+ private:
+  CurlRequestBody(const CurlRequestBody& no_copy);
+  CurlRequestBody& operator=(const CurlRequestBody& no_assign);
+
+  // Read the body as supplied, without compression.
+  size_t ReadRaw(char* data, size_t size);
+
+  // Read the body through the compressor.
+  size_t ReadCompressed(char* data, size_t size);
+
+  // Reposition the uncompressed body.
+  bool SeekRaw(int64_t offset);
+
+  const HttpRequest& request_;
+  int64_t position_;     // Bytes of the body read so far.
+  size_t slice_;         // For SLICES, the slice holding 'position_'...
+  size_t slice_offset_;  // ...and the offset within it.
+  Status status_;
+  curl_slist* headers_;
+
+  // Compression state, if compressing: a z_stream, the uncompressed data
+  // waiting to be compressed, and whether all of it has been read.
+  void* zstream_;
+  std::vector<char> raw_;
+  bool raw_done_;
+};
+
+// Set the options on the easy handle 'curl' that are needed to send
+// 'request', whose body is read through 'body'. 'body' must stay valid
+// until the transfer ends. Used by both the synchronous and asynchronous
+// clients, which then choose where the response body goes.
+Status PrepareCurlRequest(CURL* curl, const HttpRequest& request,
+                          CurlRequestBody* body);
+
+// Have the response body to the transfer on 'curl' appended to 'buffer'.
+Status SetCurlResponseBuffer(CURL* curl, Buffer* buffer);
+
+// Have the response body to the transfer on 'curl' passed to 'sink'. The
+// transfer fails if the sink returns false.
+Status SetCurlResponseSink(CURL* curl, HttpSink* sink);
+
+// Have the header block of the response to the transfer on 'curl'
+// appended to 'headers'. Only the final response's headers are kept: those
+// of interim responses ("100 Continue") and redirects are discarded.
+Status SetCurlResponseHeaders(CURL* curl, Buffer* headers);
+
+// Return a response for the completed transfer on 'curl', which received
+// 'body' and 'headers'. Must be called before the handle is reset.
+CurlHttpResponse* MakeCurlHttpResponse(CURL* curl, Shared<Buffer>::Ptr body,
+                                       Shared<Buffer>::Ptr headers);
+
+// Record the phases of a completed transfer, as measured by curl, on the
+// trace timeline. 'started_at' is the MonotonicNanos() time at which the
+// transfer was started.
+void TraceTransferPhases(CURL* curl, uint64_t started_at);
+
+// Set the version of HTTP used by 'curl'. Unless the version is HTTP/1.1,
+// the transfer also waits to multiplex over a connection being opened to
+// its host, if there may be one, rather than opening another.
+Status SetCurlHttpVersion(CURL* curl, const HttpRequest& request,
+                          HttpVersion version);
+
+// The time limits on a transfer, as given to curl. Zero means no limit
+// (or, for connecting, curl's own.)
+struct CurlTimeouts {
+  CurlTimeouts()
+      : connect_ms(0), total_ms(0), low_speed_bytes(0), low_speed_seconds(0) {}
+  int connect_ms;
+  int total_ms;
+  int low_speed_bytes;  // Per second.
+  int low_speed_seconds;
+};
+
+// Set the time limits on 'curl' for 'request': the request's own, where it
+// has them, otherwise 'defaults' (the client's.) Set 'applied' to the
+// limits set.
+Status SetCurlTimeouts(CURL* curl, const HttpRequest& request,
+                       const CurlTimeouts& defaults, CurlTimeouts* applied);
+
+// Return the Status for a transfer on 'curl' that failed with 'result'
+// after 'elapsed_nanos', under the limits 'timeouts'. Failures to connect
+// and lost connections get the codes kHttpConnectFailed and
+// kHttpConnectionLost. A timeout is given the code that says which limit
+// it hit (kHttpConnectTimeout, kHttpDeadlineExceeded or kHttpTooSlow);
+// curl reports them all alike.
+Status MakeCurlError(CURL* curl, CURLcode result,
+                     const CurlTimeouts& timeouts, uint64_t elapsed_nanos);
+
+// Add the bytes moved by the completed transfer on 'curl' to 'counts',
+// atomically: the request body as read from 'body', the bytes curl sent
+// and received, and 'response_body_bytes', the size of the decoded
+// response body.
+void AddCurlByteCounts(CURL* curl, const CurlRequestBody& body,
+                       uint64_t response_body_bytes, HttpByteCounts* counts);
+
+// Return a copy of 'counts', read atomically.
+HttpByteCounts LoadByteCounts(const HttpByteCounts& counts);
+
+}  // namespace enquery
+
+#endif  // HTTP_CURL_REQUEST_H_
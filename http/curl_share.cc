@@ -0,0 +1,108 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "http/curl_share.h"
+#include <curl/curl.h>
+#include <stdlib.h>
+#include "enquery/mutex.h"
+#include "enquery/scope_pointer.h"
+#include "enquery/status.h"
+#include "enquery/utility.h"
+#include "http/curl_request.h"
+
+namespace {
+
+// Return the lock site name for a kind of shared data.
+const char* SiteName(curl_lock_data data) {
+  switch (data) {
+    case CURL_LOCK_DATA_SHARE:
+      return "CurlShare::share";
+    case CURL_LOCK_DATA_DNS:
+      return "CurlShare::dns";
+    case CURL_LOCK_DATA_SSL_SESSION:
+      return "CurlShare::ssl_session";
+    default:
+      return "CurlShare::other";
+  }
+}
+
+}  // namespace
+
+namespace enquery {
+
+CurlShare::CurlShare(Shared<void>::Ptr library_ref)
+    : library_ref_(library_ref), share_(NULL) {
+  for (int i = 0; i < CURL_LOCK_DATA_LAST; ++i) {
+    locks_[i] = new Mutex(SiteName(static_cast<curl_lock_data>(i)));
+  }
+}
+
+CurlShare::~CurlShare() {
+  if (share_) {
+    curl_share_cleanup(share_);
+  }
+  for (int i = 0; i < CURL_LOCK_DATA_LAST; ++i) {
+    delete locks_[i];
+  }
+}
+
+CurlShare* CurlShare::Create(Shared<void>::Ptr library_ref,
+                             Status* status_out) {
+  ScopePointer<CurlShare> share(new CurlShare(library_ref));
+  Status status = share->Init();
+  MaybeAssign(status_out, status);
+  if (status.IsFailure()) {
+    return NULL;
+  }
+  return share.ReleaseOwnership();
+}
+
+Status CurlShare::Init() {
+  share_ = curl_share_init();
+  if (!share_) {
+    return Status::MakeError(kCurlModule, "curl_share_init() failed");
+  }
+  curl_share_setopt(share_, CURLSHOPT_LOCKFUNC, Lock);
+  curl_share_setopt(share_, CURLSHOPT_UNLOCKFUNC, Unlock);
+  curl_share_setopt(share_, CURLSHOPT_USERDATA, this);
+
+  // Connections are not shared: curl doesn't support a shared connection
+  // cache in use by several threads at once, and each client manages the
+  // lifetime of its own connections.
+  const curl_lock_data shared[] = {CURL_LOCK_DATA_DNS,
+                                   CURL_LOCK_DATA_SSL_SESSION};
+  for (size_t i = 0; i < sizeof(shared) / sizeof(shared[0]); ++i) {
+    const CURLSHcode code =
+        curl_share_setopt(share_, CURLSHOPT_SHARE, shared[i]);
+    if (code != CURLSHE_OK) {
+      return Status::MakeError(kCurlModule, curl_share_strerror(code));
+    }
+  }
+  return Status::OK();
+}
+
+void CurlShare::Lock(CURL* curl, curl_lock_data data, curl_lock_access access,
+                     void* user) {
+  (void)curl;
+  (void)access;
+  static_cast<CurlShare*>(user)->locks_[data]->Lock();
+}
+
+void CurlShare::Unlock(CURL* curl, curl_lock_data data, void* user) {
+  (void)curl;
+  static_cast<CurlShare*>(user)->locks_[data]->Unlock();
+}
+
+}  // namespace enquery
@@ -0,0 +1,62 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef HTTP_CURL_SHARE_H_
+#define HTTP_CURL_SHARE_H_
+
+#include <curl/curl.h>
+#include "enquery/mutex.h"
+#include "enquery/shared.h"
+#include "enquery/status.h"
+
+namespace enquery {
+
+// CurlShare owns a curl share handle, through which easy handles share
+// resolved addresses and TLS sessions. Each kind of shared data has its
+// own lock, so a DNS lookup doesn't wait for a TLS session lookup.
+//
+// Every easy handle attached to the share must be cleaned up before the
+// share is destroyed.
+class CurlShare {
+ public:
+  ~CurlShare();
+
+  // Create a share handle. Returns NULL on failure and populates the
+  // caller's (optional) Status. 'library_ref' keeps curl loaded for as
+  // long as the share exists.
+  static CurlShare* Create(Shared<void>::Ptr library_ref, Status* status);
+
+  // Attach 'curl' to the share. Must be repeated after curl_easy_reset().
+  void Attach(CURL* curl) { curl_easy_setopt(curl, CURLOPT_SHARE, share_); }
+
+ private:
+  explicit CurlShare(Shared<void>::Ptr library_ref);
+  CurlShare(const CurlShare& no_copy);
+  CurlShare& operator=(const CurlShare& no_assign);
+
+  Status Init();
+
+  static void Lock(CURL* curl, curl_lock_data data, curl_lock_access access,
+                   void* user);
+  static void Unlock(CURL* curl, curl_lock_data data, void* user);
+
+  Shared<void>::Ptr library_ref_;
+  CURLSH* share_;
+  Mutex* locks_[CURL_LOCK_DATA_LAST];
+};
+
+}  // namespace enquery
+
+#endif  // HTTP_CURL_SHARE_H_
@@ -0,0 +1,414 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "enquery/hedging_http_client.h"
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <set>
+#include <string>
+#include "enquery/futures.h"
+#include "enquery/histogram.h"
+#include "enquery/http_request.h"
+#include "enquery/mutex.h"
+#include "enquery/portability.h"
+#include "enquery/scope_lock.h"
+#include "enquery/scope_pointer.h"
+#include "enquery/shared.h"
+#include "enquery/status.h"
+#include "enquery/timer_queue.h"
+#include "enquery/utility.h"
+
+namespace enquery {
+
+namespace {
+
+const char kModule[] = "HedgingHttpClient";
+
+const uint64_t kNanosPerMilli = 1000000;
+
+// Latencies seen before the delay is first taken from them.
+const uint64_t kMinSamples = 100;
+
+// Latencies seen before the delay is taken from them again, and they are
+// forgotten, so that the delay follows changes in latency.
+const uint64_t kWindowSamples = 1000;
+
+// The most unused hedges that the budget accumulates.
+const double kMaxBudget = 10.0;
+
+}  // namespace
+
+class HedgingHttpClient::Rep {
+ public:
+  Rep(AsyncHttpClient* client, const Settings& settings)
+      : client_(client),
+        settings_(settings),
+        timers_(NULL),
+        mutex_("HedgingHttpClient"),
+        delay_nanos_(settings.initial_delay_ms() * kNanosPerMilli),
+        budget_(0),
+        requests_(0),
+        hedges_sent_(0),
+        hedges_won_(0),
+        hedges_denied_(0) {}
+
+  ~Rep() {
+    // Stop the timers first, so that no more hedges are sent; then the
+    // wrapped client, which completes the requests it still has (and so
+    // runs their callbacks, which use this Rep.)
+    delete timers_;
+    timers_ = NULL;
+    delete client_;
+  }
+
+  Status Init() {
+    if (client_ == NULL) {
+      return Status::MakeError(kModule, "client was null");
+    }
+    if (settings_.delay_percentile() < 0 ||
+        settings_.delay_percentile() > 100) {
+      return Status::MakeError(kModule, "delay percentile must be 0-100");
+    }
+    if (settings_.initial_delay_ms() < 0 || settings_.min_delay_ms() < 0) {
+      return Status::MakeError(kModule, "delays must not be negative");
+    }
+    Status status;
+    timers_ = TimerQueue::Create(&status);
+    return status;
+  }
+
+  Status SendRequest(const HttpRequest& request, Future<HttpResult>* future) {
+    assert(future != NULL);
+    if (!IsHedgeable(request)) {
+      return client_->SendRequest(request, future);
+    }
+    Shared<Call>::Ptr call(new Call(request));
+    Status status = client_->SendRequest(request, &call->primary);
+    if (status.IsFailure()) {
+      return status;
+    }
+
+    uint64_t delay = 0;
+    {
+      ScopeLock lock(&mutex_);
+      ++requests_;
+      budget_ = std::min(kMaxBudget,
+                         budget_ + settings_.max_hedge_percent() / 100);
+      delay = delay_nanos_;
+      active_.insert(call.get());
+    }
+    *future = call->promise.GetFuture();
+
+    const TimerQueue::TimerId timer =
+        timers_->Schedule(delay, new CallCallback(OnTimer, this, call));
+    {
+      ScopeLock lock(&call->mutex);
+      call->timer = timer;
+    }
+    call->primary.Notify(OnPrimaryDone, this, call);
+    return Status::OK();
+  }
+
+  void Cancel(const Future<HttpResult>& future) {
+    Future<HttpResult> primary, hedge;
+    bool found = false;
+    bool hedged = false;
+    {
+      ScopeLock lock(&mutex_);
+      std::set<Call*>::iterator it = active_.begin();
+      while (it != active_.end() && !((*it)->promise.GetFuture() == future)) {
+        ++it;
+      }
+      if (it != active_.end()) {
+        Call* call = *it;
+        ScopeLock call_lock(&call->mutex);
+        call->cancelled = true;
+        primary = call->primary;
+        hedge = call->hedge;
+        hedged = call->hedged;
+        found = true;
+      }
+    }
+    if (!found) {
+      // Not hedgeable, so sent as it was, or already complete.
+      client_->Cancel(future);
+      return;
+    }
+    client_->Cancel(primary);
+    if (hedged) {
+      client_->Cancel(hedge);
+    }
+  }
+
+  HttpStream* OpenStream(const HttpRequest& request, Status* status) {
+    return client_->OpenStream(request, status);
+  }
+
+  HttpByteCounts GetByteCounts() const { return client_->GetByteCounts(); }
+
+  void GetStatistics(HedgingHttpClient::Statistics* stats) const {
+    assert(stats != NULL);
+    ScopeLock lock(&mutex_);
+    stats->set_requests(requests_)
+        .set_hedges_sent(hedges_sent_)
+        .set_hedges_won(hedges_won_)
+        .set_hedges_denied(hedges_denied_);
+  }
+
+ private:
+  // A hedgeable request, from when it is sent until its result is
+  // delivered. Shared by the callbacks that the request and its hedge
+  // will run.
+  struct Call {
+    explicit Call(const HttpRequest& r)
+        : request(r),
+          mutex("HedgingHttpClient::Call"),
+          started_at(MonotonicNanos()),
+          timer(0),
+          hedged(false),
+          primary_done(false),
+          hedge_done(false),
+          done(false),
+          cancelled(false) {}
+    const HttpRequest request;
+    Promise<HttpResult> promise;
+    Future<HttpResult> primary;  // Set before the call is shared.
+
+    // Guards the members below.
+    Mutex mutex;
+    const uint64_t started_at;
+    TimerQueue::TimerId timer;
+    Future<HttpResult> hedge;  // Set if 'hedged'.
+    bool hedged;
+    bool primary_done;
+    bool hedge_done;
+    bool done;       // The result has been chosen.
+    bool cancelled;  // The caller cancelled the request.
+  };
+
+  typedef void (*CallFunction)(Rep*, Shared<Call>::Ptr);
+  typedef Callback_2<CallFunction, Rep*, Shared<Call>::Ptr> CallCallback;
+
+  static bool IsHedgeable(const HttpRequest& request) {
+    switch (request.method()) {
+      case HttpRequest::GET:
+      case HttpRequest::HEAD:
+      case HttpRequest::PUT:
+      case HttpRequest::DELETE:
+      case HttpRequest::TRACE:
+        return request.body_type() != HttpRequest::SOURCE;
+      default:
+        return false;
+    }
+  }
+
+  // Return the URI to send the hedge for a request for 'uri' to.
+  std::string HedgeUri(const char* uri) const {
+    const std::vector<std::string>& endpoints = settings_.endpoints();
+    for (size_t i = 0; i < endpoints.size(); ++i) {
+      const std::string& endpoint = endpoints[i];
+      if (strncmp(uri, endpoint.c_str(), endpoint.size()) == 0) {
+        return endpoints[(i + 1) % endpoints.size()] + (uri + endpoint.size());
+      }
+    }
+    return uri;
+  }
+
+  // Send a hedge for 'call', if it is still waiting and the budget
+  // allows. Run by the timer queue once the delay has passed.
+  static void OnTimer(Rep* rep, Shared<Call>::Ptr call) {
+    {
+      ScopeLock lock(&call->mutex);
+      if (call->done || call->cancelled) {
+        return;
+      }
+    }
+    {
+      ScopeLock lock(&rep->mutex_);
+      if (rep->budget_ < 1) {
+        ++rep->hedges_denied_;
+        return;
+      }
+      rep->budget_ -= 1;
+      ++rep->hedges_sent_;
+    }
+
+    HttpRequest request(call->request);
+    request.set_uri(rep->HedgeUri(call->request.uri()).c_str());
+    Future<HttpResult> hedge;
+    if (rep->client_->SendRequest(request, &hedge).IsFailure()) {
+      // Nothing was sent, so nothing is spent.
+      ScopeLock lock(&rep->mutex_);
+      rep->budget_ = std::min(kMaxBudget, rep->budget_ + 1);
+      --rep->hedges_sent_;
+      return;
+    }
+    bool wanted = false;
+    {
+      ScopeLock lock(&call->mutex);
+      if (!call->done && !call->cancelled) {
+        call->hedged = true;
+        call->hedge = hedge;
+        wanted = true;
+      }
+    }
+    if (wanted) {
+      hedge.Notify(OnHedgeDone, rep, call);
+    } else {
+      // The request completed (or was cancelled) while this was sent.
+      rep->client_->Cancel(hedge);
+    }
+  }
+
+  static void OnPrimaryDone(Rep* rep, Shared<Call>::Ptr call) {
+    rep->OnDone(call, false);
+  }
+
+  static void OnHedgeDone(Rep* rep, Shared<Call>::Ptr call) {
+    rep->OnDone(call, true);
+  }
+
+  // Handle the completion of the request sent for 'call' ('hedge' says
+  // which.) The first success is the result; a failure is, only if the
+  // other request has failed too, or was never sent.
+  void OnDone(Shared<Call>::Ptr call, bool hedge) {
+    const HttpResult result =
+        hedge ? call->hedge.GetValue() : call->primary.GetValue();
+    Future<HttpResult> loser;
+    bool cancel_loser = false;
+    TimerQueue::TimerId timer = 0;
+    {
+      ScopeLock lock(&call->mutex);
+      (hedge ? call->hedge_done : call->primary_done) = true;
+      if (call->done) {
+        return;  // The other request won.
+      }
+      const bool other_pending =
+          hedge ? !call->primary_done : call->hedged && !call->hedge_done;
+      if (result.status().IsFailure() && other_pending) {
+        return;
+      }
+      call->done = true;
+      if (other_pending) {
+        loser = hedge ? call->primary : call->hedge;
+        cancel_loser = true;
+      }
+      timer = call->timer;
+    }
+
+    {
+      ScopeLock lock(&mutex_);
+      active_.erase(call.get());
+      if (result.status().IsSuccess()) {
+        if (hedge) {
+          ++hedges_won_;
+        }
+        // When the hedge wins, the primary's latency isn't known, but is
+        // at least this. Leaving it out would bias the delay low, and
+        // each new delay lower still.
+        RecordLatency(MonotonicNanos() - call->started_at);
+      }
+    }
+    if (cancel_loser) {
+      client_->Cancel(loser);
+    }
+    if (timer != 0 && timers_ != NULL) {
+      timers_->Cancel(timer);
+    }
+    call->promise.SetValue(result);
+  }
+
+  // Record the latency of a request, updating the delay before hedging
+  // if enough have been seen. The caller holds the lock.
+  void RecordLatency(uint64_t nanos) {
+    latencies_.Record(nanos);
+    const uint64_t count = latencies_.Count();
+    if (count != kMinSamples && count != kWindowSamples) {
+      return;
+    }
+    delay_nanos_ =
+        std::max(latencies_.Percentile(settings_.delay_percentile()),
+                 settings_.min_delay_ms() * kNanosPerMilli);
+    if (count == kWindowSamples) {
+      latencies_.Clear();
+    }
+  }
+
+  Rep(const Rep& no_copy);
+  Rep& operator=(const Rep& no_assign);
+
+  AsyncHttpClient* const client_;
+  const Settings settings_;
+  TimerQueue* timers_;
+
+  // Guards the members below.
+  mutable Mutex mutex_;
+  std::set<Call*> active_;  // Calls whose result hasn't been chosen.
+  Histogram latencies_;     // Of primaries, at least until hedges won.
+  uint64_t delay_nanos_;
+  double budget_;  // Hedges that may be sent now.
+  uint64_t requests_;
+  uint64_t hedges_sent_;
+  uint64_t hedges_won_;
+  uint64_t hedges_denied_;
+};
+
+HedgingHttpClient::HedgingHttpClient(Rep* rep) : rep_(rep) {
+  assert(rep != NULL);
+}
+
+HedgingHttpClient::~HedgingHttpClient() { delete rep_; }
+
+HedgingHttpClient* HedgingHttpClient::Create(AsyncHttpClient* client,
+                                             const Settings& settings,
+                                             Status* status_out) {
+  ScopePointer<Rep> rep(new Rep(client, settings));
+  Status status = rep->Init();
+  if (status.IsFailure()) {
+    MaybeAssign(status_out, status);
+    return NULL;
+  }
+
+  HedgingHttpClient* hedging_client = new HedgingHttpClient(rep.Get());
+  rep.ReleaseOwnership();
+
+  return hedging_client;
+}
+
+Status HedgingHttpClient::SendRequest(const HttpRequest& request,
+                                      Future<HttpResult>* future) {
+  return rep_->SendRequest(request, future);
+}
+
+void HedgingHttpClient::Cancel(const Future<HttpResult>& future) {
+  rep_->Cancel(future);
+}
+
+HttpStream* HedgingHttpClient::OpenStream(const HttpRequest& request,
+                                          Status* status) {
+  return rep_->OpenStream(request, status);
+}
+
+HttpByteCounts HedgingHttpClient::GetByteCounts() const {
+  return rep_->GetByteCounts();
+}
+
+void HedgingHttpClient::GetStatistics(Statistics* stats) const {
+  rep_->GetStatistics(stats);
+}
+
+}  // namespace enquery
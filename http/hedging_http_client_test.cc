@@ -0,0 +1,184 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "enquery/async_http_client.h"
+#include "enquery/futures.h"
+#include "enquery/hedging_http_client.h"
+#include "enquery/http_request.h"
+#include "enquery/http_response.h"
+#include "enquery/shared.h"
+#include "enquery/status.h"
+#include "enquery/testing.h"
+#include "http/http_test_client.h"
+
+using ::enquery::BodyOf;
+using ::enquery::FakeAsyncHttpClient;
+using ::enquery::Future;
+using ::enquery::HedgingHttpClient;
+using ::enquery::HttpRequest;
+using ::enquery::HttpResult;
+using ::enquery::Send;
+using ::enquery::Shared;
+using ::enquery::StatisticsOf;
+using ::enquery::Wrap;
+
+namespace {
+
+HedgingHttpClient::Settings DefaultSettings() {
+  return HedgingHttpClient::Settings()
+      .add_endpoint("http://a")
+      .add_endpoint("http://b")
+      .set_initial_delay_ms(5)
+      .set_max_hedge_percent(100);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  // A request that completes in time isn't hedged.
+  {
+    FakeAsyncHttpClient* fake = new FakeAsyncHttpClient();
+    Shared<HedgingHttpClient>::Ptr client(
+        Wrap<HedgingHttpClient>(fake, DefaultSettings()));
+    Future<HttpResult> future =
+        Send(client.get(), "http://a/1", HttpRequest::GET);
+    fake->Respond(0, 200);
+    ASSERT_EQUALS(BodyOf(future), "http://a/1");
+    usleep(20000);
+    ASSERT_EQUALS(fake->waiting(), 0u);
+    ASSERT_EQUALS(StatisticsOf(*client.get()).requests(), 1u);
+    ASSERT_EQUALS(StatisticsOf(*client.get()).hedges_sent(), 0u);
+  }
+
+  // A slow request is hedged to the next endpoint; the hedge wins and the
+  // original is cancelled.
+  {
+    FakeAsyncHttpClient* fake = new FakeAsyncHttpClient();
+    Shared<HedgingHttpClient>::Ptr client(
+        Wrap<HedgingHttpClient>(fake, DefaultSettings()));
+    Future<HttpResult> future =
+        Send(client.get(), "http://b/2", HttpRequest::GET);
+    fake->WaitFor(2);
+    ASSERT_EQUALS(fake->uri(1), "http://a/2");
+    fake->Respond(1, 200);
+    ASSERT_EQUALS(BodyOf(future), "http://a/2");
+    ASSERT_EQUALS(fake->cancelled(), 1);
+    ASSERT_EQUALS(fake->waiting(), 0u);
+    ASSERT_EQUALS(StatisticsOf(*client.get()).hedges_sent(), 1u);
+    ASSERT_EQUALS(StatisticsOf(*client.get()).hedges_won(), 1u);
+  }
+
+  // If the original completes first, the hedge is cancelled.
+  {
+    FakeAsyncHttpClient* fake = new FakeAsyncHttpClient();
+    Shared<HedgingHttpClient>::Ptr client(
+        Wrap<HedgingHttpClient>(fake, DefaultSettings()));
+    Future<HttpResult> future =
+        Send(client.get(), "http://a/3", HttpRequest::PUT);
+    fake->WaitFor(2);
+    ASSERT_EQUALS(fake->uri(1), "http://b/3");
+    fake->Respond(0, 200);
+    ASSERT_EQUALS(BodyOf(future), "http://a/3");
+    ASSERT_EQUALS(fake->cancelled(), 1);
+    ASSERT_EQUALS(StatisticsOf(*client.get()).hedges_won(), 0u);
+  }
+
+  // A failure waits for the other request, which may still succeed.
+  {
+    FakeAsyncHttpClient* fake = new FakeAsyncHttpClient();
+    Shared<HedgingHttpClient>::Ptr client(
+        Wrap<HedgingHttpClient>(fake, DefaultSettings()));
+    Future<HttpResult> future =
+        Send(client.get(), "http://c/4", HttpRequest::GET);
+    fake->WaitFor(2);
+    ASSERT_EQUALS(fake->uri(1), "http://c/4");
+    fake->Fail(0, EIO);
+    fake->Respond(0, 200);
+    ASSERT_EQUALS(BodyOf(future), "http://c/4");
+    ASSERT_EQUALS(fake->cancelled(), 0);
+  }
+
+  // Without budget, nothing is hedged.
+  {
+    FakeAsyncHttpClient* fake = new FakeAsyncHttpClient();
+    Shared<HedgingHttpClient>::Ptr client(Wrap<HedgingHttpClient>(
+        fake, DefaultSettings().set_max_hedge_percent(0)));
+    Future<HttpResult> future =
+        Send(client.get(), "http://a/5", HttpRequest::GET);
+    while (StatisticsOf(*client.get()).hedges_denied() == 0) {
+      usleep(1000);
+    }
+    ASSERT_EQUALS(fake->waiting(), 1u);
+    fake->Respond(0, 200);
+    ASSERT_EQUALS(BodyOf(future), "http://a/5");
+  }
+
+  // A hedge that fails to send gives its budget back, for the next one.
+  {
+    FakeAsyncHttpClient* fake = new FakeAsyncHttpClient();
+    HedgingHttpClient::Settings settings = DefaultSettings();
+    settings.set_initial_delay_ms(20).set_max_hedge_percent(50);
+    Shared<HedgingHttpClient>::Ptr client(
+        Wrap<HedgingHttpClient>(fake, settings));
+    Future<HttpResult> first =
+        Send(client.get(), "http://a/6", HttpRequest::GET);
+    Future<HttpResult> second =
+        Send(client.get(), "http://a/7", HttpRequest::GET);
+    fake->FailNext();
+    fake->WaitFor(3);
+    ASSERT_EQUALS(fake->uri(2), "http://b/7");
+    ASSERT_EQUALS(StatisticsOf(*client.get()).hedges_sent(), 1u);
+    ASSERT_EQUALS(StatisticsOf(*client.get()).hedges_denied(), 0u);
+    fake->Respond(0, 200);
+    fake->Respond(0, 200);
+    ASSERT_EQUALS(BodyOf(first), "http://a/6");
+    ASSERT_EQUALS(BodyOf(second), "http://a/7");
+  }
+
+  // Requests that aren't idempotent aren't hedged.
+  {
+    FakeAsyncHttpClient* fake = new FakeAsyncHttpClient();
+    Shared<HedgingHttpClient>::Ptr client(
+        Wrap<HedgingHttpClient>(fake, DefaultSettings()));
+    Future<HttpResult> future =
+        Send(client.get(), "http://a/8", HttpRequest::POST);
+    usleep(20000);
+    ASSERT_EQUALS(fake->waiting(), 1u);
+    fake->Respond(0, 200);
+    ASSERT_EQUALS(BodyOf(future), "http://a/8");
+    ASSERT_EQUALS(StatisticsOf(*client.get()).requests(), 0u);
+  }
+
+  // Cancelling a request cancels its hedge too.
+  {
+    FakeAsyncHttpClient* fake = new FakeAsyncHttpClient();
+    Shared<HedgingHttpClient>::Ptr client(
+        Wrap<HedgingHttpClient>(fake, DefaultSettings()));
+    Future<HttpResult> future =
+        Send(client.get(), "http://a/9", HttpRequest::GET);
+    fake->WaitFor(2);
+    client->Cancel(future);
+    HttpResult result = future.GetValue();
+    ASSERT_EQUALS(result.status().GetCode(), ECANCELED);
+    ASSERT_EQUALS(fake->cancelled(), 2);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -17,6 +17,7 @@
 #include <stdlib.h>
 #include "http/curl_http_client.h"
 #include "http/curl_http.h"
+#include "http/native_http.h"
 #include "enquery/shared.h"
 #include "enquery/status.h"
 #include "enquery/utility.h"
@@ -28,8 +29,13 @@ Http::Http() {}
 Http::~Http() {}
 
 Http* Http::Create(Status* status_out) {
+  return Create(HTTP_ENGINE_CURL, status_out);
+}
+
+Http* Http::Create(HttpEngine engine, Status* status_out) {
   Status status(Status::OK());
-  Http* http = CurlHttp::Create(&status);
+  Http* http = engine == HTTP_ENGINE_NATIVE ? NativeHttp::Create(&status)
+                                            : CurlHttp::Create(&status);
   MaybeAssign(status_out, status);
   if (status.IsFailure()) {
     return NULL;
@@ -37,4 +43,8 @@ Http* Http::Create(Status* status_out) {
   return http;
 }
 
+HttpClient* Http::CreateClient(Status* status) {
+  return CreateClient(HttpClient::Settings(), status);
+}
+
 }  // namespace enquery
@@ -0,0 +1,990 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "http/http1_codec.h"
+#include <assert.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "enquery/buffer.h"
+#include "enquery/http_client.h"
+#include "enquery/http_request.h"
+#include "enquery/mutex.h"
+#include "enquery/scope_lock.h"
+#include "enquery/slice.h"
+
+namespace enquery {
+
+const char* const kNativeHttpModule = "NativeHttp";
+
+namespace {
+
+// The longest header block, and the longest chunk size or trailer line,
+// that a response may have.
+const size_t kMaxHeaderBytes = 64 * 1024;
+const size_t kMaxLineBytes = 8 * 1024;
+
+const uint64_t kNanosPerMilli = 1000000;
+
+// The connect limit used when none is given, as curl's.
+const uint64_t kDefaultConnectMs = 300000;
+
+// Bytes read from a file or source body at a time.
+const size_t kBodyPieceSize = 64 * 1024;
+
+// Room left before each piece of a chunked body for its size line.
+const size_t kChunkLineRoom = 24;
+
+// The most parts of a request sent by one system call.
+const int kMaxSendParts = 64;
+
+// The pool keeps at most this many buffers, none larger than this.
+const size_t kMaxPooledBuffers = 256;
+const size_t kMaxPooledCapacity = 1 << 20;
+
+Mutex g_pool_mutex("Http1::buffer_pool");
+
+// Allocated on first use and never freed, so that responses that outlive
+// static destruction may still release their buffers.
+std::vector<Buffer*>* g_pool = NULL;
+
+void ReleasePooledBuffer(Buffer* buffer) {
+  if (buffer == NULL) {
+    return;
+  }
+  if (buffer->Capacity() <= kMaxPooledCapacity) {
+    buffer->Clear();
+    ScopeLock lock(&g_pool_mutex);
+    if (g_pool->size() < kMaxPooledBuffers) {
+      g_pool->push_back(buffer);
+      return;
+    }
+  }
+  delete buffer;
+}
+
+const char* MethodName(HttpRequest::Method method) {
+  switch (method) {
+    case HttpRequest::GET:
+      return "GET";
+    case HttpRequest::HEAD:
+      return "HEAD";
+    case HttpRequest::POST:
+      return "POST";
+    case HttpRequest::PUT:
+      return "PUT";
+    case HttpRequest::DELETE:
+      return "DELETE";
+    case HttpRequest::TRACE:
+      return "TRACE";
+  }
+  return "GET";
+}
+
+// Return true if 'line' (of 'size' bytes) is the header 'name' (given in
+// lower case), setting 'value' to its value, trimmed.
+bool MatchHeader(const char* line, size_t size, const char* name,
+                 Slice* value) {
+  const size_t name_size = strlen(name);
+  if (size <= name_size || line[name_size] != ':' ||
+      strncasecmp(line, name, name_size) != 0) {
+    return false;
+  }
+  size_t start = name_size + 1;
+  size_t end = size;
+  while (start < end && (line[start] == ' ' || line[start] == '\t')) {
+    ++start;
+  }
+  while (end > start && (line[end - 1] == '\r' || line[end - 1] == ' ' ||
+                         line[end - 1] == '\t')) {
+    --end;
+  }
+  *value = Slice(line + start, end - start);
+  return true;
+}
+
+// Return true if the comma-separated list 'value' has 'token', ignoring
+// case.
+bool HasToken(const Slice& value, const char* token) {
+  const size_t token_size = strlen(token);
+  const char* p = value.data();
+  const char* end = p + value.size();
+  while (p < end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) {
+      ++p;
+    }
+    const char* start = p;
+    while (p < end && *p != ',') {
+      ++p;
+    }
+    const char* stop = p;
+    while (stop > start && (stop[-1] == ' ' || stop[-1] == '\t')) {
+      --stop;
+    }
+    if (static_cast<size_t>(stop - start) == token_size &&
+        strncasecmp(start, token, token_size) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+Status Malformed(const char* what) {
+  return Status::MakeError(kNativeHttpModule, what, EPROTO);
+}
+
+// Return true if 'c' may appear in a URI as written on the request line:
+// not a space or control character, as curl's URL parser insists.
+bool IsUriChar(char c) {
+  const unsigned char u = static_cast<unsigned char>(c);
+  return u > ' ' && u != 0x7f;
+}
+
+// Return true if 'name' is a token (RFC 9110, section 5.6.2.)
+bool IsFieldName(const char* name, size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    const unsigned char u = static_cast<unsigned char>(name[i]);
+    if (u <= ' ' || u >= 0x7f || strchr("\"(),/:;<=>?@[\\]{}", u)) {
+      return false;
+    }
+  }
+  return size > 0;
+}
+
+// Return true if 'value' has no control characters but tabs, so that it
+// can't end its line early.
+bool IsFieldValue(const char* value, size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    const unsigned char u = static_cast<unsigned char>(value[i]);
+    if ((u < ' ' && u != '\t') || u == 0x7f) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Return true if 'str' holds the same bytes as 'slice'.
+bool Equals(const std::string& str, const Slice& slice) {
+  return str.size() == slice.size() &&
+         memcmp(str.data(), slice.data(), slice.size()) == 0;
+}
+
+Status BadHeader() {
+  return Status::MakeError(kNativeHttpModule,
+                           "header has characters HTTP doesn't allow",
+                           EINVAL);
+}
+
+}  // namespace
+
+bool ParseHttp1Target(const char* uri, Http1Target* target) {
+  assert(uri != NULL);
+  assert(target != NULL);
+  if (strncasecmp(uri, "http://", 7) != 0) {
+    return false;
+  }
+  for (const char* p = uri; *p != '\0'; ++p) {
+    if (!IsUriChar(*p)) {
+      return false;
+    }
+  }
+  const char* authority = uri + 7;
+  const size_t authority_size = strcspn(authority, "/?#");
+  if (authority_size == 0 || memchr(authority, '@', authority_size)) {
+    return false;
+  }
+  target->authority.assign(authority, authority_size);
+
+  // The port follows the last colon, unless that is inside the brackets
+  // of an IPv6 address.
+  const std::string& hostport = target->authority;
+  size_t host_end = hostport.size();
+  const size_t colon = hostport.rfind(':');
+  const size_t bracket = hostport.rfind(']');
+  target->port = 80;
+  if (colon != std::string::npos &&
+      (bracket == std::string::npos || colon > bracket)) {
+    int port = 0;
+    for (size_t i = colon + 1; i < hostport.size(); ++i) {
+      if (hostport[i] < '0' || hostport[i] > '9' || port > 65535) {
+        return false;
+      }
+      port = port * 10 + (hostport[i] - '0');
+    }
+    if (colon + 1 < hostport.size()) {
+      if (port < 1 || port > 65535) {
+        return false;
+      }
+      target->port = port;
+    }
+    host_end = colon;
+  }
+  if (hostport[0] == '[') {
+    if (bracket == std::string::npos || bracket + 1 != host_end) {
+      return false;
+    }
+    target->host = hostport.substr(1, bracket - 1);
+  } else {
+    target->host = hostport.substr(0, host_end);
+  }
+  if (target->host.empty()) {
+    return false;
+  }
+
+  const char* path = authority + authority_size;
+  const size_t path_size = strcspn(path, "#");
+  target->path.clear();
+  if (path_size == 0 || path[0] != '/') {
+    target->path.push_back('/');
+  }
+  target->path.append(path, path_size);
+  return true;
+}
+
+bool IsHttp1Replayable(int method) {
+  return method == HttpRequest::GET || method == HttpRequest::HEAD;
+}
+
+Status AppendHttp1RequestHead(const HttpRequest& request,
+                              const Http1Target& target, std::string* out) {
+  assert(out != NULL);
+  const char* content_type = request.content_type();
+  if (!IsFieldValue(content_type, strlen(content_type))) {
+    return BadHeader();
+  }
+  for (size_t i = 0; i < request.HeaderCount(); ++i) {
+    Slice name, value;
+    request.GetHeader(i, &name, &value);
+    if (!IsFieldName(name.data(), name.size()) ||
+        !IsFieldValue(value.data(), value.size())) {
+      return BadHeader();
+    }
+  }
+
+  out->append(MethodName(request.method()));
+  out->push_back(' ');
+  out->append(target.path);
+  out->append(" HTTP/1.1\r\nHost: ");
+  out->append(target.authority);
+  out->append("\r\n");
+  if (*request.content_type() != '\0') {
+    out->append("Content-Type: ").append(request.content_type());
+    out->append("\r\n");
+  }
+  for (size_t i = 0; i < request.HeaderCount(); ++i) {
+    Slice name, value;
+    request.GetHeader(i, &name, &value);
+    out->append(name.data(), name.size()).append(": ");
+    out->append(value.data(), value.size()).append("\r\n");
+  }
+  return Status::OK();
+}
+
+void AppendHttp1Framing(const HttpRequest& request, std::string* out) {
+  assert(out != NULL);
+  const bool has_body = request.HasBody();
+  const int64_t size = has_body ? request.BodySize() : 0;
+  if (size < 0) {
+    out->append("Transfer-Encoding: chunked\r\n");
+  } else if (has_body || request.method() == HttpRequest::POST ||
+             request.method() == HttpRequest::PUT) {
+    char length[48];
+    snprintf(length, sizeof(length), "Content-Length: %llu\r\n",
+             static_cast<unsigned long long>(size));  // NOLINT
+    out->append(length);
+  }
+  out->append("\r\n");
+}
+
+Status Http1HeadCache::Get(const HttpRequest& request,
+                           const Http1Target& target,
+                           Shared<std::string>::Ptr* head) {
+  assert(head != NULL);
+  if (head_.get() == NULL || !Matches(request, target)) {
+    Shared<std::string>::Ptr block(new std::string());
+    Status status = AppendHttp1RequestHead(request, target, block.get());
+    if (status.IsFailure()) {
+      return status;
+    }
+    head_ = block;
+    method_ = request.method();
+    key_.clear();
+    key_.push_back(target.path);
+    key_.push_back(target.authority);
+    key_.push_back(request.content_type());
+    for (size_t i = 0; i < request.HeaderCount(); ++i) {
+      Slice name, value;
+      request.GetHeader(i, &name, &value);
+      key_.push_back(std::string(name.data(), name.size()));
+      key_.push_back(std::string(value.data(), value.size()));
+    }
+  }
+  *head = head_;
+  return Status::OK();
+}
+
+bool Http1HeadCache::Matches(const HttpRequest& request,
+                             const Http1Target& target) const {
+  if (method_ != request.method() ||
+      key_.size() != 3 + 2 * request.HeaderCount() ||
+      key_[0] != target.path || key_[1] != target.authority ||
+      key_[2] != request.content_type()) {
+    return false;
+  }
+  for (size_t i = 0; i < request.HeaderCount(); ++i) {
+    Slice name, value;
+    request.GetHeader(i, &name, &value);
+    if (!Equals(key_[3 + 2 * i], name) || !Equals(key_[4 + 2 * i], value)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+Http1RequestWriter::Http1RequestWriter()
+    : request_(NULL),
+      next_(0),
+      offset_(0),
+      reading_(false),
+      body_ended_(false),
+      body_read_(0),
+      sent_(0) {}
+
+void Http1RequestWriter::Reset(const HttpRequest* request,
+                               Shared<std::string>::Ptr head) {
+  assert(request != NULL);
+  assert(head.get() != NULL);
+  request_ = request;
+  head_ = head;
+  framing_.clear();
+  AppendHttp1Framing(*request, &framing_);
+  Restart();
+}
+
+bool Http1RequestWriter::Rewind() {
+  if (reading_ && (body_read_ > 0 || body_ended_) &&
+      request_->body_type() == HttpRequest::SOURCE &&
+      !request_->body_source()->Rewind()) {
+    return false;
+  }
+  Restart();
+  return true;
+}
+
+void Http1RequestWriter::Restart() {
+  parts_.clear();
+  next_ = 0;
+  offset_ = 0;
+  reading_ = false;
+  body_ended_ = false;
+  body_read_ = 0;
+  sent_ = 0;
+  AddPart(head_->data(), head_->size());
+  AddPart(framing_.data(), framing_.size());
+  if (!request_->HasBody()) {
+    return;
+  }
+  switch (request_->body_type()) {
+    case HttpRequest::BUFFER:
+      AddPart(request_->body().Data(), request_->body().Size());
+      break;
+    case HttpRequest::SLICES: {
+      const std::vector<Slice>& slices = request_->body_slices();
+      for (size_t i = 0; i < slices.size(); ++i) {
+        AddPart(slices[i].data(), slices[i].size());
+      }
+      break;
+    }
+    case HttpRequest::FILE_RANGE:
+    case HttpRequest::SOURCE:
+      reading_ = true;
+      break;
+  }
+}
+
+void Http1RequestWriter::AddPart(const char* data, size_t size) {
+  if (size > 0) {
+    struct iovec part;
+    part.iov_base = const_cast<char*>(data);
+    part.iov_len = size;
+    parts_.push_back(part);
+  }
+}
+
+Status Http1RequestWriter::ReadPiece() {
+  parts_.clear();
+  next_ = 0;
+  offset_ = 0;
+  const int64_t size = request_->BodySize();
+  if (request_->body_type() == HttpRequest::FILE_RANGE) {
+    const size_t length = static_cast<size_t>(std::min(
+        static_cast<uint64_t>(kBodyPieceSize), size - body_read_));
+    piece_.resize(length);
+    size_t done = 0;
+    while (done < length) {
+      ssize_t n;
+      do {
+        n = pread(request_->body_fd(), &piece_[done], length - done,
+                  request_->body_offset() + body_read_ + done);
+      } while (n < 0 && errno == EINTR);
+      if (n < 0) {
+        return Status::MakeFromSystemError(errno);
+      }
+      if (n == 0) {
+        return Status::MakeError(kNativeHttpModule, "body file ended early");
+      }
+      done += n;
+    }
+    body_read_ += length;
+    body_ended_ = body_read_ == static_cast<uint64_t>(size);
+    AddPart(piece_.data(), length);
+    return Status::OK();
+  }
+
+  // A chunk's size line goes in the room before its data, and its CRLF
+  // after, so that the chunk is sent as one part.
+  const bool chunked = size < 0;
+  piece_.resize(kChunkLineRoom + kBodyPieceSize + 2);
+  size_t count = 0;
+  Status status = request_->body_source()->Read(&piece_[kChunkLineRoom],
+                                                kBodyPieceSize, &count);
+  if (status.IsFailure()) {
+    return status;
+  }
+  body_read_ += count;
+  if (count == 0) {
+    body_ended_ = true;
+  }
+  if (!chunked && (body_ended_ ? body_read_ != static_cast<uint64_t>(size)
+                               : body_read_ > static_cast<uint64_t>(size))) {
+    return Status::MakeError(kNativeHttpModule,
+                             "body size differs from the size given");
+  }
+  if (!chunked) {
+    AddPart(&piece_[kChunkLineRoom], count);
+  } else if (count == 0) {
+    static const char kLastChunk[] = "0\r\n\r\n";
+    AddPart(kLastChunk, sizeof(kLastChunk) - 1);
+  } else {
+    char line[kChunkLineRoom];
+    const int line_size =
+        snprintf(line, sizeof(line), "%lx\r\n",
+                 static_cast<unsigned long>(count));  // NOLINT
+    const size_t start = kChunkLineRoom - line_size;
+    memcpy(&piece_[start], line, line_size);
+    memcpy(&piece_[kChunkLineRoom + count], "\r\n", 2);
+    AddPart(&piece_[start], line_size + count + 2);
+  }
+  return Status::OK();
+}
+
+Status Http1RequestWriter::Gather(struct iovec* iov, int max, int* count,
+                                  bool* complete) {
+  assert(iov != NULL);
+  assert(count != NULL);
+  assert(complete != NULL);
+  if (next_ == parts_.size() && reading_ && !body_ended_) {
+    Status status = ReadPiece();
+    if (status.IsFailure()) {
+      return status;
+    }
+  }
+  int used = 0;
+  size_t i = next_;
+  size_t offset = offset_;
+  for (; i < parts_.size() && used < max; ++i) {
+    iov[used].iov_base = static_cast<char*>(parts_[i].iov_base) + offset;
+    iov[used].iov_len = parts_[i].iov_len - offset;
+    offset = 0;
+    ++used;
+  }
+  *count = used;
+  *complete = i == parts_.size() && (!reading_ || body_ended_);
+  return Status::OK();
+}
+
+void Http1RequestWriter::Advance(size_t size) {
+  sent_ += size;
+  while (size > 0) {
+    assert(next_ < parts_.size());
+    const size_t rest = parts_[next_].iov_len - offset_;
+    if (size < rest) {
+      offset_ += size;
+      return;
+    }
+    size -= rest;
+    ++next_;
+    offset_ = 0;
+  }
+}
+
+Status Http1RequestWriter::Send(int fd) {
+  for (;;) {
+    struct iovec iov[kMaxSendParts];
+    int count = 0;
+    bool complete = false;
+    Status status = Gather(iov, kMaxSendParts, &count, &complete);
+    if (status.IsFailure() || count == 0) {
+      return status;
+    }
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = iov;
+    message.msg_iovlen = count;
+    const ssize_t n = sendmsg(fd, &message, MSG_NOSIGNAL);
+    if (n >= 0) {
+      Advance(n);
+      continue;
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return Status::OK();
+    }
+    return MakeHttp1SocketError(errno);
+  }
+}
+
+Http1Deadlines MakeHttp1Deadlines(const HttpRequest& request, int connect_ms,
+                                  int total_ms, int low_speed_bytes,
+                                  int low_speed_seconds, uint64_t now) {
+  if (request.connect_timeout_ms() != 0) {
+    connect_ms = std::max(0, request.connect_timeout_ms());
+  }
+  if (request.timeout_ms() != 0) {
+    total_ms = std::max(0, request.timeout_ms());
+  }
+  if (request.low_speed_bytes_per_second() != 0) {
+    low_speed_bytes = std::max(0, request.low_speed_bytes_per_second());
+    low_speed_seconds = std::max(0, request.low_speed_seconds());
+  }
+
+  Http1Deadlines deadlines;
+  deadlines.connect =
+      now + (connect_ms > 0 ? connect_ms : kDefaultConnectMs) * kNanosPerMilli;
+  if (total_ms > 0) {
+    deadlines.total = now + total_ms * kNanosPerMilli;
+  }
+  if (low_speed_bytes > 0 && low_speed_seconds > 0) {
+    deadlines.low_speed_bytes = low_speed_bytes;
+    deadlines.low_speed_nanos = low_speed_seconds * 1000 * kNanosPerMilli;
+  }
+  return deadlines;
+}
+
+Status ResolveHttp1Target(const Http1Target& target,
+                          std::vector<Http1Address>* addresses_out) {
+  assert(addresses_out != NULL);
+  char port[8];
+  snprintf(port, sizeof(port), "%d", target.port);
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_NUMERICSERV;
+  struct addrinfo* addresses = NULL;
+  const int result =
+      getaddrinfo(target.host.c_str(), port, &hints, &addresses);
+  if (result != 0) {
+    return Status::MakeError(kNativeHttpModule, gai_strerror(result),
+                             kHttpConnectFailed);
+  }
+
+  addresses_out->clear();
+  for (struct addrinfo* address = addresses; address != NULL;
+       address = address->ai_next) {
+    if (address->ai_addrlen > sizeof(struct sockaddr_storage)) {
+      continue;
+    }
+    addresses_out->push_back(Http1Address());
+    memcpy(&addresses_out->back().address, address->ai_addr,
+           address->ai_addrlen);
+    addresses_out->back().size = address->ai_addrlen;
+  }
+  freeaddrinfo(addresses);
+  return Status::OK();
+}
+
+Status StartHttp1Connect(const std::vector<Http1Address>& addresses,
+                         int* fd_out) {
+  assert(fd_out != NULL);
+  // Try each address until one connects, or starts to.
+  int error = ECONNREFUSED;
+  int fd = -1;
+  for (size_t i = 0; i < addresses.size(); ++i) {
+    const Http1Address& address = addresses[i];
+    fd = socket(address.address.ss_family,
+                SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+    if (fd < 0) {
+      error = errno;
+      continue;
+    }
+    const int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    const struct sockaddr* to =
+        reinterpret_cast<const struct sockaddr*>(&address.address);
+    if (connect(fd, to, address.size) == 0 || errno == EINPROGRESS) {
+      break;
+    }
+    error = errno;
+    close(fd);
+    fd = -1;
+  }
+  if (fd < 0) {
+    return MakeHttp1SocketError(error);
+  }
+  *fd_out = fd;
+  return Status::OK();
+}
+
+Status StartHttp1Connect(const Http1Target& target, int* fd) {
+  std::vector<Http1Address> addresses;
+  Status status = ResolveHttp1Target(target, &addresses);
+  if (status.IsFailure()) {
+    return status;
+  }
+  return StartHttp1Connect(addresses, fd);
+}
+
+Status FinishHttp1Connect(int fd) {
+  int error = 0;
+  socklen_t size = sizeof(error);
+  if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &size) != 0) {
+    error = errno;
+  }
+  return error == 0 ? Status::OK() : MakeHttp1SocketError(error);
+}
+
+Status MakeHttp1SocketError(int error) {
+  switch (error) {
+    case ECONNREFUSED:
+    case EHOSTUNREACH:
+    case ENETUNREACH:
+    case EADDRNOTAVAIL:
+      return Status::MakeError(kNativeHttpModule, "couldn't connect",
+                               kHttpConnectFailed);
+    case ETIMEDOUT:
+      return Status::MakeError(kNativeHttpModule, "connect timed out",
+                               kHttpConnectTimeout);
+    case ECONNRESET:
+    case EPIPE:
+      return Status::MakeError(kNativeHttpModule, "connection lost",
+                               kHttpConnectionLost);
+    default:
+      return Status::MakeFromSystemError(error);
+  }
+}
+
+Shared<Buffer>::Ptr TakePooledBuffer() {
+  Buffer* buffer = NULL;
+  {
+    ScopeLock lock(&g_pool_mutex);
+    if (g_pool == NULL) {
+      g_pool = new std::vector<Buffer*>();
+    }
+    if (!g_pool->empty()) {
+      buffer = g_pool->back();
+      g_pool->pop_back();
+    }
+  }
+  if (buffer == NULL) {
+    buffer = new Buffer();
+  }
+  return Shared<Buffer>::Ptr(buffer, ReleasePooledBuffer);
+}
+
+Http1ResponseParser::Http1ResponseParser()
+    : state_(DONE),
+      head_(false),
+      headers_(NULL),
+      handler_(NULL),
+      status_code_(0),
+      keep_alive_(false),
+      remaining_(0),
+      line_size_(0),
+      wire_bytes_(0),
+      body_bytes_(0),
+      abandoned_(false) {}
+
+void Http1ResponseParser::Reset(bool head, Buffer* headers,
+                                BodyHandler* handler) {
+  assert(headers != NULL);
+  assert(handler != NULL);
+  state_ = HEADERS;
+  head_ = head;
+  headers_ = headers;
+  handler_ = handler;
+  status_code_ = 0;
+  keep_alive_ = true;
+  remaining_ = 0;
+  line_.clear();
+  line_size_ = 0;
+  wire_bytes_ = 0;
+  body_bytes_ = 0;
+  abandoned_ = false;
+}
+
+Status Http1ResponseParser::Parse(const char* data, size_t size,
+                                  size_t* consumed) {
+  assert(consumed != NULL);
+  size_t offset = 0;
+  Status status;
+  while (offset < size && state_ != DONE && status.IsSuccess()) {
+    const char* piece = data + offset;
+    const size_t available = size - offset;
+    size_t used = 0;
+    switch (state_) {
+      case HEADERS:
+        status = ParseHeaders(piece, available, &used);
+        break;
+
+      case BODY_LENGTH:
+        used = static_cast<size_t>(
+            std::min(remaining_, static_cast<uint64_t>(available)));
+        remaining_ -= used;
+        status = Deliver(piece, used);
+        if (remaining_ == 0) {
+          state_ = DONE;
+        }
+        break;
+
+      case BODY_UNTIL_CLOSE:
+        used = available;
+        status = Deliver(piece, used);
+        break;
+
+      case CHUNK_SIZE:
+        if (TakeLine(piece, available, &used)) {
+          // The size is in hex, and may be followed by extensions.
+          char* end = NULL;
+          const unsigned long long chunk =  // NOLINT
+              strtoull(line_.c_str(), &end, 16);
+          if (end == line_.c_str() ||
+              (*end != '\0' && *end != ';' && *end != ' ')) {
+            status = Malformed("malformed chunk size");
+          } else if (chunk == 0) {
+            state_ = TRAILERS;
+          } else {
+            remaining_ = chunk;
+            state_ = CHUNK_DATA;
+          }
+          line_.clear();
+        } else if (line_.size() > kMaxLineBytes) {
+          status = Malformed("chunk size line too long");
+        }
+        break;
+
+      case CHUNK_DATA:
+        used = static_cast<size_t>(
+            std::min(remaining_, static_cast<uint64_t>(available)));
+        remaining_ -= used;
+        status = Deliver(piece, used);
+        if (remaining_ == 0) {
+          state_ = CHUNK_END;
+        }
+        break;
+
+      case CHUNK_END:
+        if (TakeLine(piece, available, &used)) {
+          if (!line_.empty()) {
+            status = Malformed("chunk longer than its size");
+          }
+          state_ = CHUNK_SIZE;
+          line_.clear();
+        } else if (!line_.empty() && line_ != "\r") {
+          // Only a CRLF may follow a chunk; don't wait for the rest.
+          status = Malformed("chunk longer than its size");
+        }
+        break;
+
+      case TRAILERS:
+        if (TakeLine(piece, available, &used)) {
+          if (line_.empty()) {
+            state_ = DONE;
+          }
+          line_.clear();
+        } else if (line_.size() > kMaxLineBytes) {
+          status = Malformed("trailer line too long");
+        }
+        break;
+
+      case DONE:
+        break;
+    }
+    offset += used;
+  }
+  wire_bytes_ += offset;
+  *consumed = offset;
+  return status;
+}
+
+Status Http1ResponseParser::Finish() {
+  if (state_ == BODY_UNTIL_CLOSE) {
+    state_ = DONE;
+  }
+  if (state_ == DONE) {
+    return Status::OK();
+  }
+  return Status::MakeError(kNativeHttpModule,
+                           "connection closed before the response was complete",
+                           kHttpConnectionLost);
+}
+
+Status Http1ResponseParser::ParseHeaders(const char* data, size_t size,
+                                         size_t* consumed) {
+  // The block ends at the first empty line (CRLF, or a bare LF.) Lines may
+  // be split between pieces, so the length of the one in progress is
+  // carried over in line_size_.
+  size_t pos = 0;
+  while (pos < size) {
+    const char* newline =
+        static_cast<const char*>(memchr(data + pos, '\n', size - pos));
+    if (newline == NULL) {
+      line_size_ += size - pos;
+      headers_->Append(data + pos, size - pos);
+      pos = size;
+      break;
+    }
+    const size_t end = newline - data + 1;
+    line_size_ += end - pos - 1;
+    headers_->Append(data + pos, end - pos);
+    pos = end;
+    const bool blank =
+        line_size_ == 0 ||
+        (line_size_ == 1 && headers_->Data()[headers_->Size() - 2] == '\r');
+    line_size_ = 0;
+    if (blank) {
+      *consumed = pos;
+      return StartBody();
+    }
+  }
+  *consumed = pos;
+  if (headers_->Size() > kMaxHeaderBytes) {
+    return Malformed("response header too large");
+  }
+  return Status::OK();
+}
+
+Status Http1ResponseParser::StartBody() {
+  const char* data = headers_->Data();
+  const size_t size = headers_->Size();
+  if (size < 12 || strncmp(data, "HTTP/1.", 7) != 0 || data[8] != ' ' ||
+      data[9] < '1' || data[9] > '9' || data[10] < '0' || data[10] > '9' ||
+      data[11] < '0' || data[11] > '9') {
+    return Malformed("malformed status line");
+  }
+  status_code_ = (data[9] - '0') * 100 + (data[10] - '0') * 10 +
+                 (data[11] - '0');
+
+  // Interim responses (e.g. "100 Continue") are followed by the real one.
+  if (status_code_ < 200 && status_code_ != 101) {
+    headers_->Clear();
+    return Status::OK();
+  }
+
+  keep_alive_ = data[7] != '0';
+  bool chunked = false;
+  bool has_length = false;
+  uint64_t length = 0;
+  const char* line = static_cast<const char*>(memchr(data, '\n', size)) + 1;
+  const char* end = data + size;
+  while (line < end) {
+    const char* newline =
+        static_cast<const char*>(memchr(line, '\n', end - line));
+    const size_t line_size = newline - line;
+    Slice value;
+    if (MatchHeader(line, line_size, "content-length", &value)) {
+      char digits[24];
+      if (value.size() == 0 || value.size() >= sizeof(digits)) {
+        return Malformed("malformed Content-Length");
+      }
+      memcpy(digits, value.data(), value.size());
+      digits[value.size()] = '\0';
+      char* digits_end = NULL;
+      length = strtoull(digits, &digits_end, 10);
+      if (*digits_end != '\0' || digits[0] < '0' || digits[0] > '9') {
+        return Malformed("malformed Content-Length");
+      }
+      has_length = true;
+    } else if (MatchHeader(line, line_size, "transfer-encoding", &value)) {
+      chunked = HasToken(value, "chunked");
+    } else if (MatchHeader(line, line_size, "connection", &value)) {
+      if (HasToken(value, "close")) {
+        keep_alive_ = false;
+      } else if (HasToken(value, "keep-alive")) {
+        keep_alive_ = true;
+      }
+    }
+    line = newline + 1;
+  }
+
+  if (head_ || status_code_ == 204 || status_code_ == 304) {
+    state_ = DONE;
+  } else if (status_code_ == 101) {
+    // The connection now speaks another protocol, which isn't ours.
+    keep_alive_ = false;
+    state_ = DONE;
+  } else if (chunked) {
+    handler_->OnBodySize(-1);
+    state_ = CHUNK_SIZE;
+  } else if (has_length) {
+    handler_->OnBodySize(static_cast<int64_t>(length));
+    remaining_ = length;
+    state_ = length > 0 ? BODY_LENGTH : DONE;
+  } else {
+    handler_->OnBodySize(-1);
+    keep_alive_ = false;
+    state_ = BODY_UNTIL_CLOSE;
+  }
+  return Status::OK();
+}
+
+bool Http1ResponseParser::TakeLine(const char* data, size_t size,
+                                   size_t* consumed) {
+  const char* newline = static_cast<const char*>(memchr(data, '\n', size));
+  if (newline == NULL) {
+    line_.append(data, size);
+    *consumed = size;
+    return false;
+  }
+  line_.append(data, newline - data);
+  if (!line_.empty() && line_[line_.size() - 1] == '\r') {
+    line_.resize(line_.size() - 1);
+  }
+  *consumed = newline - data + 1;
+  return true;
+}
+
+Status Http1ResponseParser::Deliver(const char* data, size_t size) {
+  body_bytes_ += size;
+  if (size > 0 && !handler_->OnBody(data, size)) {
+    abandoned_ = true;
+    return Status::MakeError(kNativeHttpModule, "response abandoned");
+  }
+  return Status::OK();
+}
+
+}  // namespace enquery
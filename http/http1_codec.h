@@ -0,0 +1,372 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef HTTP_HTTP1_CODEC_H_
+#define HTTP_HTTP1_CODEC_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <string>
+#include <vector>
+#include "enquery/buffer.h"
+#include "enquery/shared.h"
+#include "enquery/status.h"
+
+namespace enquery {
+
+class HttpRequest;
+
+// The name of the native HTTP/1.1 engine, for Status messages.
+extern const char* const kNativeHttpModule;
+
+// Where an "http://" URI is served from, and what goes on its request
+// line.
+struct Http1Target {
+  Http1Target() : port(80) {}
+  std::string host;       // Name or address, without IPv6 brackets.
+  int port;
+  std::string authority;  // As in the URI, for the Host header.
+  std::string path;       // Path and query; "/" if the URI has neither.
+};
+
+// Split 'uri' into 'target'. Return false unless it is an "http://" URI
+// with a host, and without spaces or control characters.
+bool ParseHttp1Target(const char* uri, Http1Target* target);
+
+// Return true if requests made with 'method' may be sent again, or sent
+// on a connection behind others, without risk (GET and HEAD.)
+bool IsHttp1Replayable(int method);
+
+// Append the header block of 'request', addressed to 'target', to 'out'
+// as HTTP/1.1: the request line and headers, but neither the headers that
+// frame the body nor the blank line after them (see AppendHttp1Framing.)
+// The header is written straight into 'out', without building a list of
+// lines first. 'out' is appended to rather than replaced, so that a
+// caller may reuse its memory. Fails, before writing anything, if a
+// header's name isn't a token or its value has control characters (other
+// than tabs) in it.
+Status AppendHttp1RequestHead(const HttpRequest& request,
+                              const Http1Target& target, std::string* out);
+
+// Append the header that frames the body of 'request' to 'out', if it
+// needs one, and the blank line that ends the header block. A body of
+// unknown size is sent chunked.
+void AppendHttp1Framing(const HttpRequest& request, std::string* out);
+
+// Http1HeadCache keeps the last header block it wrote, and hands it out
+// again for the next request if that has the same method, target and
+// headers, as the requests sent to one host often do; it is then neither
+// checked nor written again. The framing is left out of the block, so
+// that bodies of different sizes don't tell requests apart.
+class Http1HeadCache {
+ public:
+  Http1HeadCache() : method_(-1) {}
+
+  // Set 'head' to the header block of 'request', addressed to 'target'.
+  // The block is shared, and stays unchanged for as long as it is
+  // referenced. Fails as AppendHttp1RequestHead() does.
+  Status Get(const HttpRequest& request, const Http1Target& target,
+             Shared<std::string>::Ptr* head);
+
+ private:
+  Http1HeadCache(const Http1HeadCache& no_copy);
+  Http1HeadCache& operator=(const Http1HeadCache& no_assign);
+
+  // Return true if the cached block is the header block of 'request',
+  // addressed to 'target'.
+  bool Matches(const HttpRequest& request, const Http1Target& target) const;
+
+  Shared<std::string>::Ptr head_;
+  int method_;
+  std::vector<std::string> key_;  // Path, authority, content type, then
+                                  // each header's name and value.
+};
+
+// Http1RequestWriter sends a request on a socket, as much at a time as
+// the socket will take. The body is never gathered into one place: a
+// buffer or slices are sent from the request's own memory, together with
+// the header block in one system call, and a file range or a source is
+// read a piece at a time, each piece once the last has been sent. (A file
+// is read rather than given to sendfile(), which would raise SIGPIPE if
+// the server closed the connection.)
+class Http1RequestWriter {
+ public:
+  Http1RequestWriter();
+
+  // Start writing 'request', with 'head' as its header block (see
+  // Http1HeadCache.) The request isn't copied: it must stay unchanged
+  // until it has been written.
+  void Reset(const HttpRequest* request, Shared<std::string>::Ptr head);
+
+  // Start writing the request again from the beginning, e.g. on another
+  // connection. Returns false if its body comes from a source that has
+  // been read from and can't be rewound.
+  bool Rewind();
+
+  // Point up to 'max' entries of 'iov' at the next of the request, in
+  // order, first reading the next piece of a file or source body if all
+  // that was read before has been sent. Sets 'count' to the number of
+  // entries used, which is zero once all of the request has been sent,
+  // and 'complete' if they reach the end of the request. Fails if the
+  // body can't be read, or isn't the size given.
+  Status Gather(struct iovec* iov, int max, int* count, bool* complete);
+
+  // Count the first 'size' bytes of those last gathered as sent.
+  void Advance(size_t size);
+
+  // Send as much of the request on the non-blocking socket 'fd' as it
+  // will take, returning once all of it has been sent or the socket is
+  // full (see done().) Fails if the body can't be read, or as
+  // MakeHttp1SocketError() describes if the socket fails.
+  Status Send(int fd);
+
+  // Return true once all of the request has been sent.
+  bool done() const {
+    return next_ == parts_.size() && (!reading_ || body_ended_);
+  }
+
+  // Return the bytes of the request sent so far, framing included.
+  uint64_t sent() const { return sent_; }
+
+ private:
+  Http1RequestWriter(const Http1RequestWriter& no_copy);
+  Http1RequestWriter& operator=(const Http1RequestWriter& no_assign);
+
+  // Go back to the beginning of the request.
+  void Restart();
+
+  // Add 'size' bytes at 'data' to the parts ready to be sent.
+  void AddPart(const char* data, size_t size);
+
+  // Read the next piece of a file or source body into piece_, as the
+  // only part ready to be sent.
+  Status ReadPiece();
+
+  const HttpRequest* request_;
+  Shared<std::string>::Ptr head_;
+  std::string framing_;
+  std::vector<struct iovec> parts_;  // Ready to be sent...
+  size_t next_;                      // ...from this part...
+  size_t offset_;                    // ...and this far into it.
+  bool reading_;        // The body is read a piece at a time...
+  bool body_ended_;     // ...and has all been read...
+  uint64_t body_read_;  // ...or this much of it.
+  std::string piece_;   // The piece last read, with any chunk framing.
+  uint64_t sent_;
+};
+
+// The time limits on a request, as MonotonicNanos() times (zero where
+// there is no limit.) They are worked out as for curl (see
+// SetCurlTimeouts()) from the request's own limits and a client's
+// defaults; no connect limit means curl's 300 seconds.
+struct Http1Deadlines {
+  Http1Deadlines()
+      : connect(0), total(0), low_speed_bytes(0), low_speed_nanos(0) {}
+  uint64_t connect;          // Connected by then.
+  uint64_t total;            // Done by then.
+  uint64_t low_speed_bytes;  // Per second, over each...
+  uint64_t low_speed_nanos;  // ...period of this length.
+};
+
+// Return the deadlines of 'request', started at 'now', given the client's
+// default limits.
+Http1Deadlines MakeHttp1Deadlines(const HttpRequest& request, int connect_ms,
+                                  int total_ms, int low_speed_bytes,
+                                  int low_speed_seconds, uint64_t now);
+
+// Http1SpeedCheck tells when a transfer falls below its low speed limit:
+// fewer bytes than the limit allows arrive in a period.
+class Http1SpeedCheck {
+ public:
+  Http1SpeedCheck() : bytes_(0), period_(0), start_(0), count_(0) {}
+
+  // Start timing at 'now', for 'deadlines'.
+  void Start(const Http1Deadlines& deadlines, uint64_t now) {
+    bytes_ = deadlines.low_speed_bytes * deadlines.low_speed_nanos /
+             1000000000ULL;
+    period_ = deadlines.low_speed_nanos;
+    start_ = now;
+    count_ = 0;
+  }
+
+  // Count 'bytes' received.
+  void Add(uint64_t bytes) { count_ += bytes; }
+
+  // Return false if a period that had ended by 'now' fell short; after a
+  // period that didn't, the next one begins.
+  bool Check(uint64_t now) {
+    if (period_ == 0 || now < start_ + period_) {
+      return true;
+    }
+    if (count_ < bytes_) {
+      return false;
+    }
+    start_ = now;
+    count_ = 0;
+    return true;
+  }
+
+  // Return when the current period ends, or zero if there is no limit.
+  uint64_t period_end() const { return period_ ? start_ + period_ : 0; }
+
+ private:
+  uint64_t bytes_;   // Expected in each period.
+  uint64_t period_;
+  uint64_t start_;
+  uint64_t count_;
+};
+
+// An address that a target's host name resolved to.
+struct Http1Address {
+  Http1Address() : size(0) {}
+  struct sockaddr_storage address;
+  socklen_t size;
+};
+
+// Resolve the host name of 'target' into 'addresses', blocking.
+Status ResolveHttp1Target(const Http1Target& target,
+                          std::vector<Http1Address>* addresses);
+
+// Begin connecting a non-blocking TCP socket to the first of 'addresses'
+// that will take it, setting 'fd' to it. The connection may still be in
+// progress on return: once the socket is writable, call
+// FinishHttp1Connect().
+Status StartHttp1Connect(const std::vector<Http1Address>& addresses,
+                         int* fd);
+
+// As above, but resolve the host name of 'target' first, blocking.
+Status StartHttp1Connect(const Http1Target& target, int* fd);
+
+// Return the outcome of the connection attempt on 'fd'.
+Status FinishHttp1Connect(int fd);
+
+// Return a Status for the socket error 'error', with one of the codes in
+// http_client.h where one applies.
+Status MakeHttp1SocketError(int error);
+
+// Return an empty buffer for a response body or header block. Buffers
+// go back to a process-wide pool when the last reference is dropped, so
+// that clients reuse memory rather than allocating it for every response.
+Shared<Buffer>::Ptr TakePooledBuffer();
+
+// Http1ResponseParser reads an HTTP/1.1 response incrementally, from
+// pieces of whatever size arrive. The header block (status line to blank
+// line) is copied as received into a buffer, in the form CurlHttpResponse
+// takes; the body is handed to a BodyHandler straight from the caller's
+// data, without being copied. Content-Length, chunked and close-delimited
+// bodies are understood, as are interim (1xx) responses, which are
+// skipped.
+class Http1ResponseParser {
+ public:
+  // Receives the body of the response being parsed.
+  class BodyHandler {
+   public:
+    virtual ~BodyHandler() {}
+
+    // Consume the next 'size' bytes of the body. The data is valid only
+    // for the duration of the call. Return false to abandon the response.
+    virtual bool OnBody(const char* data, size_t size) = 0;
+
+    // Called once the headers are in, with the length of the body if it
+    // is known (e.g. to reserve memory for it), or -1.
+    virtual void OnBodySize(int64_t size) { (void)size; }
+  };
+
+  Http1ResponseParser();
+
+  // Start on the response to a request ('head' if it was a HEAD request,
+  // whose response has no body), copying its header block into 'headers'
+  // and passing its body to 'handler'. Neither is owned.
+  void Reset(bool head, Buffer* headers, BodyHandler* handler);
+
+  // Consume a prefix of 'data', setting 'consumed' to its length, which
+  // is less than 'size' only if the response is done: the rest belongs to
+  // the next response. Returns a failure if the response is malformed or
+  // the handler abandons it.
+  Status Parse(const char* data, size_t size, size_t* consumed);
+
+  // The connection has been closed by the server. Returns a failure
+  // unless that completes the response (whose body runs to the close.)
+  Status Finish();
+
+  // Return true once the response is complete.
+  bool done() const { return state_ == DONE; }
+
+  // Return true if any of the response has been received.
+  bool started() const { return wire_bytes_ > 0; }
+
+  // Return true if the connection may be used again once the response is
+  // complete.
+  bool keep_alive() const { return keep_alive_; }
+
+  // Return the status code, once the headers are in.
+  int status_code() const { return status_code_; }
+
+  // Return the bytes of the response received so far, framing included.
+  uint64_t wire_bytes() const { return wire_bytes_; }
+
+  // Return the bytes of the body received so far.
+  uint64_t body_bytes() const { return body_bytes_; }
+
+  // Return true if the handler abandoned the response.
+  bool abandoned() const { return abandoned_; }
+
+ private:
+  typedef enum State {
+    HEADERS,          // In the header block.
+    BODY_LENGTH,      // In a body of known length.
+    BODY_UNTIL_CLOSE, // In a body that ends with the connection.
+    CHUNK_SIZE,       // In a chunk size line.
+    CHUNK_DATA,       // In a chunk...
+    CHUNK_END,        // ...then the CRLF after it.
+    TRAILERS,         // In the trailer, after the last chunk.
+    DONE
+  } State;
+
+  Http1ResponseParser(const Http1ResponseParser& no_copy);
+  Http1ResponseParser& operator=(const Http1ResponseParser& no_assign);
+
+  // Parse 'data' while in the header block; see Parse().
+  Status ParseHeaders(const char* data, size_t size, size_t* consumed);
+
+  // Work out how the body is framed from the complete header block.
+  Status StartBody();
+
+  // Collect a line (of a chunk size or trailer) into line_. Return true
+  // once it is complete.
+  bool TakeLine(const char* data, size_t size, size_t* consumed);
+
+  // Pass body data on to the handler.
+  Status Deliver(const char* data, size_t size);
+
+  State state_;
+  bool head_;
+  Buffer* headers_;
+  BodyHandler* handler_;
+  int status_code_;
+  bool keep_alive_;
+  uint64_t remaining_;  // Of the body or the current chunk.
+  std::string line_;    // A chunk size or trailer line in progress.
+  size_t line_size_;    // The length of the header line in progress.
+  uint64_t wire_bytes_;
+  uint64_t body_bytes_;
+  bool abandoned_;
+};
+
+}  // namespace enquery
+
+#endif  // HTTP_HTTP1_CODEC_H_
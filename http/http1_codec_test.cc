@@ -0,0 +1,402 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "http/http1_codec.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include "enquery/buffer.h"
+#include "enquery/http_client.h"
+#include "enquery/http_request.h"
+#include "enquery/shared.h"
+#include "enquery/slice.h"
+#include "enquery/status.h"
+#include "enquery/testing.h"
+
+using ::enquery::Buffer;
+using ::enquery::Http1HeadCache;
+using ::enquery::Http1RequestWriter;
+using ::enquery::Http1ResponseParser;
+using ::enquery::Http1Target;
+using ::enquery::HttpBodySource;
+using ::enquery::HttpRequest;
+using ::enquery::ParseHttp1Target;
+using ::enquery::Shared;
+using ::enquery::Slice;
+using ::enquery::Status;
+
+namespace {
+
+// Collects a response body.
+class Collector : public Http1ResponseParser::BodyHandler {
+ public:
+  Collector() : size(-2) {}
+  virtual bool OnBody(const char* data, size_t length) {
+    body.append(data, length);
+    return true;
+  }
+  virtual void OnBodySize(int64_t length) { size = length; }
+  std::string body;
+  int64_t size;
+};
+
+// Parse 'input' as a response, fed to the parser 'step' bytes at a time,
+// setting 'body' to its body. Return the bytes that were left over.
+size_t ParseInSteps(const std::string& input, size_t step, bool head,
+                    std::string* body, Http1ResponseParser* parser) {
+  Buffer headers;
+  Collector collector;
+  parser->Reset(head, &headers, &collector);
+  size_t offset = 0;
+  while (offset < input.size() && !parser->done()) {
+    const size_t size = std::min(step, input.size() - offset);
+    size_t consumed = 0;
+    ASSERT_TRUE(parser->Parse(input.data() + offset, size, &consumed)
+                    .IsSuccess());
+    offset += consumed;
+  }
+  *body = collector.body;
+  return input.size() - offset;
+}
+
+// Produces the bytes of a string, claiming 'size' for their size.
+class StringSource : public HttpBodySource {
+ public:
+  StringSource(const std::string& data, int64_t size)
+      : data_(data), size_(size), offset_(0) {}
+  virtual int64_t Size() { return size_; }
+  virtual Status Read(char* data, size_t size, size_t* bytes_read) {
+    *bytes_read = std::min(size, data_.size() - offset_);
+    memcpy(data, data_.data() + offset_, *bytes_read);
+    offset_ += *bytes_read;
+    return Status::OK();
+  }
+  virtual bool Rewind() {
+    offset_ = 0;
+    return true;
+  }
+
+ private:
+  const std::string data_;
+  const int64_t size_;
+  size_t offset_;
+};
+
+// Write 'request' over a socket pair, setting 'out' to what arrives.
+Status WriteThrough(const HttpRequest& request, std::string* out) {
+  Http1Target target;
+  ASSERT_TRUE(ParseHttp1Target(request.uri(), &target));
+  Http1HeadCache heads;
+  Shared<std::string>::Ptr head;
+  ASSERT_TRUE(heads.Get(request, target, &head).IsSuccess());
+  Http1RequestWriter writer;
+  writer.Reset(&request, head);
+
+  int fds[2];
+  ASSERT_EQUALS(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+  fcntl(fds[1], F_SETFL, O_NONBLOCK);
+  out->clear();
+  Status status;
+  while (status.IsSuccess() && !writer.done()) {
+    status = writer.Send(fds[0]);
+    char data[16384];
+    ssize_t n;
+    while ((n = read(fds[1], data, sizeof(data))) > 0) {
+      out->append(data, n);
+    }
+  }
+  if (status.IsSuccess()) {
+    ASSERT_EQUALS(writer.sent(), out->size());
+  }
+  close(fds[0]);
+  close(fds[1]);
+  return status;
+}
+
+// Return the body of a request written as 'out'.
+std::string BodyOf(const std::string& out) {
+  const size_t end = out.find("\r\n\r\n");
+  ASSERT_TRUE(end != std::string::npos);
+  return out.substr(end + 4);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  // A chunked response, split at every possible point, gives the same
+  // body, and the bytes of the next response are left alone.
+  {
+    const std::string response =
+        "HTTP/1.1 200 OK\r\n"
+        "Transfer-Encoding: chunked\r\n"
+        "\r\n"
+        "5;ext=1\r\nhello\r\n"
+        "7\r\n, world\r\n"
+        "0\r\n"
+        "Trailer: x\r\n"
+        "\r\n";
+    const std::string next = "HTTP/1.1 204 No Content\r\n\r\n";
+    for (size_t step = 1; step <= response.size(); ++step) {
+      Http1ResponseParser parser;
+      std::string body;
+      ASSERT_EQUALS(ParseInSteps(response + next, step, false, &body, &parser),
+                    next.size());
+      ASSERT_TRUE(parser.done());
+      ASSERT_TRUE(parser.keep_alive());
+      ASSERT_EQUALS(parser.status_code(), 200);
+      ASSERT_TRUE(body == "hello, world");
+      ASSERT_EQUALS(parser.body_bytes(), 12u);
+      ASSERT_EQUALS(parser.wire_bytes(), response.size());
+    }
+  }
+
+  // A sized body reports its size, and interim responses are skipped.
+  {
+    const std::string response =
+        "HTTP/1.1 100 Continue\r\n\r\n"
+        "HTTP/1.1 201 Created\r\n"
+        "Content-Length: 3\r\n"
+        "\r\n"
+        "abc";
+    Http1ResponseParser parser;
+    Buffer headers;
+    Collector collector;
+    parser.Reset(false, &headers, &collector);
+    size_t consumed = 0;
+    ASSERT_TRUE(
+        parser.Parse(response.data(), response.size(), &consumed).IsSuccess());
+    ASSERT_EQUALS(consumed, response.size());
+    ASSERT_TRUE(parser.done());
+    ASSERT_EQUALS(parser.status_code(), 201);
+    ASSERT_EQUALS(collector.size, 3);
+    ASSERT_TRUE(collector.body == "abc");
+    const std::string block(headers.Data(), headers.Size());
+    ASSERT_EQUALS(block.find("HTTP/1.1 201"), 0u);
+  }
+
+  // The response to a HEAD request has no body, whatever its headers say.
+  {
+    Http1ResponseParser parser;
+    std::string body;
+    ASSERT_EQUALS(ParseInSteps("HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\n",
+                               7, true, &body, &parser),
+                  0u);
+    ASSERT_TRUE(parser.done());
+    ASSERT_TRUE(body.empty());
+  }
+
+  // A body without a length runs to the close of the connection, which
+  // can't then be reused; a sized body cut short by a close is an error.
+  {
+    Http1ResponseParser parser;
+    std::string body;
+    ParseInSteps("HTTP/1.0 200 OK\r\n\r\nuntil close", 4, false, &body,
+                 &parser);
+    ASSERT_TRUE(!parser.done());
+    ASSERT_TRUE(parser.Finish().IsSuccess());
+    ASSERT_TRUE(parser.done());
+    ASSERT_TRUE(!parser.keep_alive());
+    ASSERT_TRUE(body == "until close");
+
+    ParseInSteps("HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\nshort", 100,
+                 false, &body, &parser);
+    ASSERT_EQUALS(parser.Finish().GetCode(), enquery::kHttpConnectionLost);
+  }
+
+  // Malformed responses are rejected.
+  {
+    Http1ResponseParser parser;
+    Buffer headers;
+    Collector collector;
+    parser.Reset(false, &headers, &collector);
+    const std::string bad = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked"
+                            "\r\n\r\nzz\r\n";
+    size_t consumed = 0;
+    ASSERT_TRUE(parser.Parse(bad.data(), bad.size(), &consumed).IsFailure());
+
+    headers.Clear();
+    parser.Reset(false, &headers, &collector);
+    const std::string garbage = "SMTP ready\r\n\r\n";
+    ASSERT_TRUE(
+        parser.Parse(garbage.data(), garbage.size(), &consumed).IsFailure());
+
+    // Bytes after a chunk that aren't its CRLF fail at once, rather than
+    // being collected while waiting for a line to end.
+    headers.Clear();
+    parser.Reset(false, &headers, &collector);
+    const std::string overrun = "HTTP/1.1 200 OK\r\nTransfer-Encoding: "
+                                "chunked\r\n\r\n2\r\nokxxxx";
+    ASSERT_TRUE(
+        parser.Parse(overrun.data(), overrun.size(), &consumed).IsFailure());
+  }
+
+  // Targets are split into host, port and path.
+  {
+    Http1Target target;
+    ASSERT_TRUE(ParseHttp1Target("http://example.com:8080/a?b=c", &target));
+    ASSERT_TRUE(target.host == "example.com");
+    ASSERT_EQUALS(target.port, 8080);
+    ASSERT_TRUE(target.authority == "example.com:8080");
+    ASSERT_TRUE(target.path == "/a?b=c");
+
+    ASSERT_TRUE(ParseHttp1Target("http://[::1]", &target));
+    ASSERT_TRUE(target.host == "::1");
+    ASSERT_EQUALS(target.port, 80);
+    ASSERT_TRUE(target.path == "/");
+
+    ASSERT_TRUE(!ParseHttp1Target("https://example.com/", &target));
+    ASSERT_TRUE(!ParseHttp1Target("http:///path", &target));
+
+    // Nothing can be slipped onto the request line, or after it.
+    ASSERT_TRUE(!ParseHttp1Target("http://h/a b", &target));
+    ASSERT_TRUE(!ParseHttp1Target("http://h/a\r\nX-Evil: 1", &target));
+    ASSERT_TRUE(!ParseHttp1Target("http://h/a\tb", &target));
+    ASSERT_TRUE(!ParseHttp1Target("http://h\n/", &target));
+  }
+
+  // Requests are written with a Host header and a sized body.
+  {
+    HttpRequest request;
+    request.set_uri("http://h:81/p")
+        .set_method(HttpRequest::POST)
+        .set_body("data", 4)
+        .AddHeader("X-Test", "1");
+    std::string out;
+    ASSERT_TRUE(WriteThrough(request, &out).IsSuccess());
+    ASSERT_EQUALS(out.find("POST /p HTTP/1.1\r\n"), 0u);
+    ASSERT_TRUE(out.find("\r\nHost: h:81\r\n") != std::string::npos);
+    ASSERT_TRUE(out.find("\r\nX-Test: 1\r\n") != std::string::npos);
+    ASSERT_TRUE(out.find("\r\nContent-Length: 4\r\n") != std::string::npos);
+    ASSERT_EQUALS(out.rfind("\r\n\r\ndata"), out.size() - 8);
+  }
+
+  // Bodies in slices, files and sources, larger than the pieces they are
+  // read in, arrive whole; one of unknown size arrives chunked.
+  {
+    std::string data(200000, '\0');
+    for (size_t i = 0; i < data.size(); ++i) {
+      data[i] = static_cast<char>(i % 251);
+    }
+    std::string out;
+
+    const Slice slices[] = {Slice(data.data(), 10),
+                            Slice(data.data() + 10, data.size() - 10)};
+    HttpRequest request;
+    request.set_uri("http://h/p").set_method(HttpRequest::PUT);
+    request.set_body_slices(slices, 2);
+    ASSERT_TRUE(WriteThrough(request, &out).IsSuccess());
+    ASSERT_TRUE(out.find("\r\nContent-Length: 200000\r\n") !=
+                std::string::npos);
+    ASSERT_TRUE(BodyOf(out) == data);
+
+    FILE* file = tmpfile();
+    ASSERT_TRUE(file != NULL);
+    ASSERT_EQUALS(fwrite(data.data(), 1, data.size(), file), data.size());
+    ASSERT_EQUALS(fflush(file), 0);
+    request.set_body_file(fileno(file), 1000, 150000);
+    ASSERT_TRUE(WriteThrough(request, &out).IsSuccess());
+    ASSERT_TRUE(BodyOf(out) == data.substr(1000, 150000));
+    request.set_body_file(fileno(file), 100000, 150000);
+    ASSERT_TRUE(WriteThrough(request, &out).IsFailure());
+    fclose(file);
+
+    StringSource sized(data, data.size());
+    request.set_body_source(&sized);
+    ASSERT_TRUE(WriteThrough(request, &out).IsSuccess());
+    ASSERT_TRUE(BodyOf(out) == data);
+
+    StringSource unsized(data, HttpBodySource::kUnknownSize);
+    request.set_body_source(&unsized);
+    ASSERT_TRUE(WriteThrough(request, &out).IsSuccess());
+    ASSERT_TRUE(out.find("\r\nTransfer-Encoding: chunked\r\n") !=
+                std::string::npos);
+    Http1ResponseParser parser;
+    std::string body;
+    ASSERT_EQUALS(
+        ParseInSteps("HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n" +
+                         BodyOf(out),
+                     out.size(), false, &body, &parser),
+        0u);
+    ASSERT_TRUE(parser.done());
+    ASSERT_TRUE(body == data);
+
+    // A source that gives less, or more, than it said fails the request.
+    StringSource short_source(data, data.size() + 1);
+    request.set_body_source(&short_source);
+    ASSERT_TRUE(WriteThrough(request, &out).IsFailure());
+    StringSource long_source(data, data.size() - 1);
+    request.set_body_source(&long_source);
+    ASSERT_TRUE(WriteThrough(request, &out).IsFailure());
+  }
+
+  // A header block is reused for requests that differ only in their
+  // bodies, and written afresh for others.
+  {
+    Http1Target target;
+    ASSERT_TRUE(ParseHttp1Target("http://h/p", &target));
+    HttpRequest request;
+    request.set_uri("http://h/p")
+        .set_method(HttpRequest::POST)
+        .set_body("a", 1)
+        .AddHeader("X-Test", "1");
+    Http1HeadCache heads;
+    Shared<std::string>::Ptr first, second, third;
+    ASSERT_TRUE(heads.Get(request, target, &first).IsSuccess());
+    request.set_body("bb", 2);
+    ASSERT_TRUE(heads.Get(request, target, &second).IsSuccess());
+    ASSERT_TRUE(first.get() == second.get());
+    request.AddHeader("X-Other", "2");
+    ASSERT_TRUE(heads.Get(request, target, &third).IsSuccess());
+    ASSERT_TRUE(third.get() != first.get());
+    ASSERT_TRUE(third->find("\r\nX-Other: 2\r\n") != std::string::npos);
+    ASSERT_TRUE(first->find("X-Other") == std::string::npos);
+    ASSERT_TRUE(first->find("Content-Length") == std::string::npos);
+  }
+
+  // Headers that would end their line early, or aren't names, are
+  // refused before anything is written.
+  {
+    Http1Target target;
+    ASSERT_TRUE(ParseHttp1Target("http://h/p", &target));
+    const char* const names[] = {"X-Test", "X Test", "X-Test:", ""};
+    const char* const values[] = {"a\r\nX-Evil: 1", "a\nb", "ok", "ok"};
+    for (size_t i = 0; i < 4; ++i) {
+      HttpRequest request;
+      request.set_uri("http://h/p").AddHeader(names[i], values[i]);
+      std::string out;
+      ASSERT_TRUE(
+          enquery::AppendHttp1RequestHead(request, target, &out).IsFailure());
+      ASSERT_TRUE(out.empty());
+    }
+
+    HttpRequest request;
+    request.set_uri("http://h/p").set_content_type("text/plain\r\nX: 1");
+    std::string out;
+    ASSERT_TRUE(
+        enquery::AppendHttp1RequestHead(request, target, &out).IsFailure());
+
+    request.set_content_type("text/plain").AddHeader("X-Test", "a\tb c");
+    ASSERT_TRUE(
+        enquery::AppendHttp1RequestHead(request, target, &out).IsSuccess());
+  }
+
+  return EXIT_SUCCESS;
+}
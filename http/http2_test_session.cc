@@ -0,0 +1,677 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "http/http2_test_session.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+typedef std::pair<std::string, std::string> Field;
+
+const char kPreface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+const size_t kPrefaceSize = sizeof(kPreface) - 1;
+const size_t kFrameHeaderSize = 9;
+
+// Frame types.
+const uint8_t kData = 0x0;
+const uint8_t kHeaders = 0x1;
+const uint8_t kRstStream = 0x3;
+const uint8_t kSettings = 0x4;
+const uint8_t kPing = 0x6;
+const uint8_t kWindowUpdate = 0x8;
+const uint8_t kContinuation = 0x9;
+
+// Frame flags.
+const uint8_t kEndStream = 0x1;
+const uint8_t kAck = 0x1;
+const uint8_t kEndHeaders = 0x4;
+const uint8_t kPadded = 0x8;
+const uint8_t kPriority = 0x20;
+
+// Settings.
+const uint16_t kInitialWindowSize = 0x4;
+const uint16_t kMaxFrameSize = 0x5;
+
+// Protocol defaults.
+const int64_t kDefaultWindow = 65535;
+const size_t kDefaultMaxFrameSize = 16384;
+const size_t kDefaultTableLimit = 4096;
+
+// HPACK's static table (RFC 7541, appendix A). Index 1 is first.
+const struct {
+  const char* name;
+  const char* value;
+} kStaticTable[] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+const uint32_t kStaticTableSize =
+    sizeof(kStaticTable) / sizeof(kStaticTable[0]);
+
+// Static table indexes used in responses.
+const uint8_t kStatusIndex = 8;
+const uint8_t kContentLengthIndex = 28;
+
+// The length in bits of the HPACK Huffman code of each byte value (RFC
+// 7541, appendix B). The code is canonical, so the lengths are enough to
+// rebuild it.
+const uint8_t kHuffmanLengths[256] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+};
+const int kMaxHuffmanLength = 30;
+
+// A canonical Huffman decoder: codes of each length are consecutive,
+// starting from 'first[length]', and belong to the symbols listed, in
+// order, from 'offset[length]'.
+struct HuffmanDecoder {
+  HuffmanDecoder() {
+    uint32_t count[kMaxHuffmanLength + 1] = {0};
+    for (int symbol = 0; symbol < 256; ++symbol) {
+      ++count[kHuffmanLengths[symbol]];
+    }
+    uint32_t code = 0;
+    uint32_t index = 0;
+    for (int length = 1; length <= kMaxHuffmanLength; ++length) {
+      code = (code + count[length - 1]) << 1;
+      first[length] = code;
+      offset[length] = index;
+      this->count[length] = count[length];
+      for (int symbol = 0; symbol < 256; ++symbol) {
+        if (kHuffmanLengths[symbol] == length) {
+          symbols[index++] = static_cast<uint8_t>(symbol);
+        }
+      }
+    }
+  }
+
+  bool Decode(const char* data, size_t size, std::string* out) const {
+    uint32_t code = 0;
+    int length = 0;
+    for (size_t i = 0; i < size; ++i) {
+      for (int bit = 7; bit >= 0; --bit) {
+        code = (code << 1) | ((static_cast<uint8_t>(data[i]) >> bit) & 1);
+        if (++length > kMaxHuffmanLength) {
+          return false;
+        }
+        if (code - first[length] < count[length]) {
+          out->push_back(static_cast<char>(
+              symbols[offset[length] + code - first[length]]));
+          code = 0;
+          length = 0;
+        }
+      }
+    }
+    // Whatever is left is padding: fewer than eight 1 bits.
+    return length < 8 && code == (1u << length) - 1;
+  }
+
+  uint32_t first[kMaxHuffmanLength + 1];
+  uint32_t count[kMaxHuffmanLength + 1];
+  uint32_t offset[kMaxHuffmanLength + 1];
+  uint8_t symbols[256];
+};
+
+const HuffmanDecoder kHuffman;
+
+uint32_t ReadUint32(const char* p) {
+  const uint8_t* b = reinterpret_cast<const uint8_t*>(p);
+  return (static_cast<uint32_t>(b[0]) << 24) | (b[1] << 16) | (b[2] << 8) |
+         b[3];
+}
+
+void AppendFrame(uint8_t type, uint8_t flags, uint32_t stream_id,
+                 const char* payload, size_t length, std::string* out) {
+  const char header[kFrameHeaderSize] = {
+      static_cast<char>(length >> 16), static_cast<char>(length >> 8),
+      static_cast<char>(length), static_cast<char>(type),
+      static_cast<char>(flags), static_cast<char>(stream_id >> 24),
+      static_cast<char>(stream_id >> 16), static_cast<char>(stream_id >> 8),
+      static_cast<char>(stream_id)};
+  out->append(header, kFrameHeaderSize);
+  out->append(payload, length);
+}
+
+void AppendWindowUpdate(uint32_t stream_id, uint32_t increment,
+                        std::string* out) {
+  const char payload[4] = {
+      static_cast<char>(increment >> 24), static_cast<char>(increment >> 16),
+      static_cast<char>(increment >> 8), static_cast<char>(increment)};
+  AppendFrame(kWindowUpdate, 0, stream_id, payload, sizeof(payload), out);
+}
+
+// Append an HPACK integer whose first byte holds 'prefix_bits' bits,
+// above which are 'high_bits'.
+void AppendInteger(uint32_t value, int prefix_bits, uint8_t high_bits,
+                   std::string* out) {
+  const uint32_t mask = (1u << prefix_bits) - 1;
+  if (value < mask) {
+    out->push_back(static_cast<char>(high_bits | value));
+    return;
+  }
+  out->push_back(static_cast<char>(high_bits | mask));
+  value -= mask;
+  while (value >= 128) {
+    out->push_back(static_cast<char>(0x80 | (value & 0x7f)));
+    value >>= 7;
+  }
+  out->push_back(static_cast<char>(value));
+}
+
+// Append a header field whose name is in the static table, as a literal
+// that isn't added to the dynamic table.
+void AppendField(uint8_t name_index, const std::string& value,
+                 std::string* out) {
+  AppendInteger(name_index, 4, 0x00, out);
+  AppendInteger(value.size(), 7, 0x00, out);
+  out->append(value);
+}
+
+// Append a header field whose name isn't indexed, as a literal that isn't
+// added to the dynamic table.
+void AppendLiteralField(const std::string& name, const std::string& value,
+                        std::string* out) {
+  out->push_back(0x00);
+  AppendInteger(name.size(), 7, 0x00, out);
+  out->append(name);
+  AppendInteger(value.size(), 7, 0x00, out);
+  out->append(value);
+}
+
+bool DecodeInteger(const std::string& in, size_t* pos, int prefix_bits,
+                   uint32_t* value) {
+  if (*pos >= in.size()) {
+    return false;
+  }
+  const uint32_t mask = (1u << prefix_bits) - 1;
+  *value = static_cast<uint8_t>(in[(*pos)++]) & mask;
+  if (*value < mask) {
+    return true;
+  }
+  for (int shift = 0; shift <= 21; shift += 7) {
+    if (*pos >= in.size()) {
+      return false;
+    }
+    const uint8_t b = static_cast<uint8_t>(in[(*pos)++]);
+    *value += static_cast<uint32_t>(b & 0x7f) << shift;
+    if ((b & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool DecodeString(const std::string& in, size_t* pos, std::string* out) {
+  if (*pos >= in.size()) {
+    return false;
+  }
+  const bool huffman = (in[*pos] & 0x80) != 0;
+  uint32_t length = 0;
+  if (!DecodeInteger(in, pos, 7, &length) || in.size() - *pos < length) {
+    return false;
+  }
+  out->clear();
+  const char* data = in.data() + *pos;
+  *pos += length;
+  if (huffman) {
+    return kHuffman.Decode(data, length, out);
+  }
+  out->assign(data, length);
+  return true;
+}
+
+}  // namespace
+
+namespace enquery {
+
+Http2TestSession::Http2TestSession()
+    : preface_received_(false),
+      max_open_streams_(0),
+      connection_window_(kDefaultWindow),
+      initial_window_(kDefaultWindow),
+      max_frame_size_(kDefaultMaxFrameSize),
+      header_stream_(0),
+      header_end_stream_(false),
+      table_size_(0),
+      table_limit_(kDefaultTableLimit) {}
+
+bool Http2TestSession::IsPreface(const std::string& input) {
+  return input.compare(0, std::min(input.size(), kPrefaceSize), kPreface,
+                       std::min(input.size(), kPrefaceSize)) == 0;
+}
+
+bool Http2TestSession::FindHeader(const Request& request, const char* name,
+                                  std::string* value) {
+  for (size_t i = 0; i < request.headers.size(); ++i) {
+    if (request.headers[i].first == name) {
+      *value = request.headers[i].second;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Http2TestSession::Receive(std::string* input,
+                               std::vector<Request>* requests) {
+  size_t pos = 0;
+  if (!preface_received_) {
+    if (input->size() < kPrefaceSize) {
+      return IsPreface(*input);
+    }
+    if (input->compare(0, kPrefaceSize, kPreface) != 0) {
+      return false;
+    }
+    preface_received_ = true;
+    pos = kPrefaceSize;
+    // The server's settings: the defaults will do.
+    AppendFrame(kSettings, 0, 0, NULL, 0, &control_);
+  }
+
+  bool ok = true;
+  while (ok && input->size() - pos >= kFrameHeaderSize) {
+    const char* header = input->data() + pos;
+    const size_t length = (static_cast<uint8_t>(header[0]) << 16) |
+                          (static_cast<uint8_t>(header[1]) << 8) |
+                          static_cast<uint8_t>(header[2]);
+    if (input->size() - pos - kFrameHeaderSize < length) {
+      break;
+    }
+    ok = HandleFrame(static_cast<uint8_t>(header[3]),
+                     static_cast<uint8_t>(header[4]),
+                     ReadUint32(header + 5) & 0x7fffffff,
+                     header + kFrameHeaderSize, length, requests);
+    pos += kFrameHeaderSize + length;
+  }
+  input->erase(0, pos);
+  return ok;
+}
+
+bool Http2TestSession::HandleFrame(uint8_t type, uint8_t flags,
+                                   uint32_t stream_id, const char* payload,
+                                   size_t length,
+                                   std::vector<Request>* requests) {
+  // A header block must be finished before anything else is sent.
+  if (header_stream_ != 0 &&
+      (type != kContinuation || stream_id != header_stream_)) {
+    return false;
+  }
+
+  // Strip padding from the frames that may have it.
+  if ((type == kData || type == kHeaders) && (flags & kPadded)) {
+    if (length < 1 || static_cast<uint8_t>(payload[0]) >= length) {
+      return false;
+    }
+    length -= 1 + static_cast<uint8_t>(payload[0]);
+    ++payload;
+  }
+
+  switch (type) {
+    case kData: {
+      std::map<uint32_t, Stream>::iterator it = streams_.find(stream_id);
+      if (it == streams_.end()) {
+        return false;
+      }
+      it->second.body.append(payload, length);
+      // Let the client send as much again, straight away.
+      if (length > 0) {
+        AppendWindowUpdate(0, length, &control_);
+        if (!(flags & kEndStream)) {
+          AppendWindowUpdate(stream_id, length, &control_);
+        }
+      }
+      if (flags & kEndStream) {
+        EndRequest(stream_id, requests);
+      }
+      return true;
+    }
+
+    case kHeaders:
+      if (stream_id == 0) {
+        return false;
+      }
+      if (flags & kPriority) {
+        if (length < 5) {
+          return false;
+        }
+        payload += 5;
+        length -= 5;
+      }
+      header_stream_ = stream_id;
+      header_block_.assign(payload, length);
+      header_end_stream_ = (flags & kEndStream) != 0;
+      if (streams_.find(stream_id) == streams_.end()) {
+        streams_[stream_id].send_window = initial_window_;
+        max_open_streams_ = std::max(max_open_streams_, streams_.size());
+      }
+      break;
+
+    case kContinuation:
+      if (stream_id != header_stream_) {
+        return false;
+      }
+      header_block_.append(payload, length);
+      break;
+
+    case kRstStream:
+      streams_.erase(stream_id);
+      return true;
+
+    case kSettings:
+      if (flags & kAck) {
+        return true;
+      }
+      if (length % 6 != 0) {
+        return false;
+      }
+      for (size_t i = 0; i < length; i += 6) {
+        const uint16_t id = (static_cast<uint8_t>(payload[i]) << 8) |
+                            static_cast<uint8_t>(payload[i + 1]);
+        const uint32_t value = ReadUint32(payload + i + 2);
+        if (id == kInitialWindowSize) {
+          // Changing the initial window changes every stream's window.
+          for (std::map<uint32_t, Stream>::iterator it = streams_.begin();
+               it != streams_.end(); ++it) {
+            it->second.send_window += value - initial_window_;
+          }
+          initial_window_ = value;
+        } else if (id == kMaxFrameSize) {
+          max_frame_size_ = value;
+        }
+      }
+      AppendFrame(kSettings, kAck, 0, NULL, 0, &control_);
+      return true;
+
+    case kPing:
+      if (!(flags & kAck)) {
+        AppendFrame(kPing, kAck, 0, payload, length, &control_);
+      }
+      return true;
+
+    case kWindowUpdate: {
+      if (length != 4) {
+        return false;
+      }
+      const uint32_t increment = ReadUint32(payload) & 0x7fffffff;
+      if (stream_id == 0) {
+        connection_window_ += increment;
+      } else {
+        std::map<uint32_t, Stream>::iterator it = streams_.find(stream_id);
+        if (it != streams_.end()) {
+          it->second.send_window += increment;
+        }
+      }
+      return true;
+    }
+
+    default:
+      // PRIORITY, GOAWAY and anything unknown are ignored.
+      return true;
+  }
+
+  // A HEADERS or CONTINUATION frame: decode the block once it's whole.
+  if (!(flags & kEndHeaders)) {
+    return true;
+  }
+  const uint32_t id = header_stream_;
+  header_stream_ = 0;
+  if (!DecodeHeaders(header_block_, &streams_[id].headers)) {
+    return false;
+  }
+  if (header_end_stream_) {
+    EndRequest(id, requests);
+  }
+  return true;
+}
+
+void Http2TestSession::EndRequest(uint32_t stream_id,
+                                  std::vector<Request>* requests) {
+  Stream& stream = streams_[stream_id];
+  requests->push_back(Request());
+  Request& request = requests->back();
+  request.stream_id = stream_id;
+  request.headers.swap(stream.headers);
+  request.body.swap(stream.body);
+}
+
+void Http2TestSession::Respond(uint32_t stream_id, int code,
+                               const Headers& headers,
+                               const std::string& body) {
+  std::map<uint32_t, Stream>::iterator it = streams_.find(stream_id);
+  if (it == streams_.end()) {
+    return;  // Reset by the client.
+  }
+
+  char number[32];
+  std::string block;
+  snprintf(number, sizeof(number), "%d", code);
+  AppendField(kStatusIndex, number, &block);
+  snprintf(number, sizeof(number), "%lu",
+           static_cast<unsigned long>(body.size()));  // NOLINT
+  AppendField(kContentLengthIndex, number, &block);
+  for (size_t i = 0; i < headers.size(); ++i) {
+    AppendLiteralField(headers[i].first, headers[i].second, &block);
+  }
+  // Responses are small enough to need no CONTINUATION frames.
+  AppendFrame(kHeaders, kEndHeaders | (body.empty() ? kEndStream : 0),
+              stream_id, block.data(), block.size(), &control_);
+
+  if (body.empty()) {
+    streams_.erase(it);
+    return;
+  }
+  it->second.response = body;
+  it->second.response_offset = 0;
+  it->second.responded = true;
+}
+
+void Http2TestSession::Send(std::string* output) {
+  output->append(control_);
+  control_.clear();
+
+  // Send response bodies, oldest stream first, while the windows allow.
+  std::map<uint32_t, Stream>::iterator it = streams_.begin();
+  while (it != streams_.end() && connection_window_ > 0) {
+    Stream& stream = it->second;
+    while (stream.responded && stream.send_window > 0 &&
+           connection_window_ > 0 &&
+           stream.response_offset < stream.response.size()) {
+      const size_t n = std::min(
+          std::min(stream.response.size() - stream.response_offset,
+                   max_frame_size_),
+          static_cast<size_t>(std::min(stream.send_window,
+                                       connection_window_)));
+      const bool last = stream.response_offset + n == stream.response.size();
+      AppendFrame(kData, last ? kEndStream : 0, it->first,
+                  stream.response.data() + stream.response_offset, n, output);
+      stream.response_offset += n;
+      stream.send_window -= n;
+      connection_window_ -= n;
+    }
+    if (stream.responded &&
+        stream.response_offset == stream.response.size()) {
+      streams_.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+}
+
+bool Http2TestSession::DecodeHeaders(const std::string& block,
+                                     Headers* headers) {
+  size_t pos = 0;
+  while (pos < block.size()) {
+    if (!DecodeField(block, &pos, headers)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Http2TestSession::DecodeField(const std::string& block, size_t* pos,
+                                   Headers* headers) {
+  const uint8_t first = static_cast<uint8_t>(block[*pos]);
+  uint32_t index = 0;
+
+  // An indexed field.
+  if (first & 0x80) {
+    Field field;
+    if (!DecodeInteger(block, pos, 7, &index) || !LookUp(index, &field)) {
+      return false;
+    }
+    headers->push_back(field);
+    return true;
+  }
+
+  // A change to the size of the dynamic table.
+  if ((first & 0xe0) == 0x20) {
+    if (!DecodeInteger(block, pos, 5, &index) || index > kDefaultTableLimit) {
+      return false;
+    }
+    table_limit_ = index;
+    EvictFromTable();
+    return true;
+  }
+
+  // A literal field, with its name indexed or literal, that is added to
+  // the dynamic table or not.
+  const bool add_to_table = (first & 0xc0) == 0x40;
+  if (!DecodeInteger(block, pos, add_to_table ? 6 : 4, &index)) {
+    return false;
+  }
+  Field field;
+  if (index != 0) {
+    if (!LookUp(index, &field)) {
+      return false;
+    }
+  } else if (!DecodeString(block, pos, &field.first)) {
+    return false;
+  }
+  if (!DecodeString(block, pos, &field.second)) {
+    return false;
+  }
+  if (add_to_table) {
+    AddToTable(field);
+  }
+  headers->push_back(field);
+  return true;
+}
+
+bool Http2TestSession::LookUp(uint32_t index, Field* field) const {
+  if (index >= 1 && index <= kStaticTableSize) {
+    field->first = kStaticTable[index - 1].name;
+    field->second = kStaticTable[index - 1].value;
+    return true;
+  }
+  index -= kStaticTableSize + 1;
+  if (index >= table_.size()) {
+    return false;
+  }
+  *field = table_[index];
+  return true;
+}
+
+void Http2TestSession::AddToTable(const Field& field) {
+  table_.push_front(field);
+  table_size_ += 32 + field.first.size() + field.second.size();
+  EvictFromTable();
+}
+
+void Http2TestSession::EvictFromTable() {
+  while (table_size_ > table_limit_) {
+    const Field& oldest = table_.back();
+    table_size_ -= 32 + oldest.first.size() + oldest.second.size();
+    table_.pop_back();
+  }
+}
+
+}  // namespace enquery
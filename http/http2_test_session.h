@@ -0,0 +1,132 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef HTTP_HTTP2_TEST_SESSION_H_
+#define HTTP_HTTP2_TEST_SESSION_H_
+
+#include <stdint.h>
+#include <deque>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace enquery {
+
+// Http2TestSession is the server side of one HTTP/2 connection, for
+// HttpTestServer. It decodes requests from the bytes a client sends and
+// encodes responses, within the client's flow control windows. It covers
+// what an HTTP/2 client needs from a server, and no more: there is no
+// server push, priorities are ignored, and it trusts the client.
+class Http2TestSession {
+ public:
+  typedef std::vector<std::pair<std::string, std::string> > Headers;
+
+  // A complete request.
+  struct Request {
+    uint32_t stream_id;
+    Headers headers;
+    std::string body;
+  };
+
+  Http2TestSession();
+
+  // Return true if 'input' starts like an HTTP/2 connection (or is too
+  // short to tell.)
+  static bool IsPreface(const std::string& input);
+
+  // Set 'value' to the header 'name' (in lower case) of 'request'. Return
+  // false if there is no such header.
+  static bool FindHeader(const Request& request, const char* name,
+                         std::string* value);
+
+  // Consume the complete frames at the start of 'input', adding the
+  // requests they complete to 'requests'. Return false if the input
+  // isn't valid HTTP/2, in which case the connection should be closed.
+  bool Receive(std::string* input, std::vector<Request>* requests);
+
+  // Answer the request on 'stream_id' with status 'code', 'headers' (with
+  // names in lower case) and 'body'.
+  void Respond(uint32_t stream_id, int code, const Headers& headers,
+               const std::string& body);
+
+  // Append the frames that may be sent now to 'output'.
+  void Send(std::string* output);
+
+  // Return the most streams that have been open at once.
+  size_t max_open_streams() const { return max_open_streams_; }
+
+ private:
+  struct Stream {
+    Stream() : send_window(0), response_offset(0), responded(false) {}
+    Headers headers;
+    std::string body;
+    int64_t send_window;
+    std::string response;  // Response body yet to be sent...
+    size_t response_offset;  // ...from here.
+    bool responded;
+  };
+
+  Http2TestSession(const Http2TestSession& no_copy);
+  Http2TestSession& operator=(const Http2TestSession& no_assign);
+
+  // Handle one frame. Return false on a protocol error.
+  bool HandleFrame(uint8_t type, uint8_t flags, uint32_t stream_id,
+                   const char* payload, size_t length,
+                   std::vector<Request>* requests);
+
+  // Handle the end of a request on 'stream_id'.
+  void EndRequest(uint32_t stream_id, std::vector<Request>* requests);
+
+  // Decode an HPACK header block into 'headers'.
+  bool DecodeHeaders(const std::string& block, Headers* headers);
+
+  // Decode one HPACK header field starting at 'pos'.
+  bool DecodeField(const std::string& block, size_t* pos, Headers* headers);
+
+  // Set 'field' to the header field at HPACK 'index'. Return false if
+  // there is none.
+  bool LookUp(uint32_t index,
+              std::pair<std::string, std::string>* field) const;
+
+  // Add a field to the HPACK dynamic table, evicting older ones.
+  void AddToTable(const std::pair<std::string, std::string>& field);
+
+  // Evict fields until the dynamic table fits its size limit.
+  void EvictFromTable();
+
+  bool preface_received_;
+  std::string control_;  // Frames waiting to be sent, ahead of data.
+  std::map<uint32_t, Stream> streams_;
+  size_t max_open_streams_;
+  int64_t connection_window_;  // Data the client will accept.
+  int64_t initial_window_;     // For new streams, set by the client.
+  size_t max_frame_size_;      // Set by the client.
+
+  // A header block spread over HEADERS and CONTINUATION frames.
+  uint32_t header_stream_;  // Non-zero while the block is incomplete.
+  std::string header_block_;
+  bool header_end_stream_;
+
+  // The HPACK dynamic table, newest first, and its size as HPACK counts
+  // it.
+  std::deque<std::pair<std::string, std::string> > table_;
+  size_t table_size_;
+  size_t table_limit_;
+};
+
+}  // namespace enquery
+
+#endif  // HTTP_HTTP2_TEST_SESSION_H_
@@ -14,6 +14,7 @@
 // contributors.
 
 #include <stdlib.h>
+#include <string>
 #include "enquery/http_client.h"
 #include "enquery/http.h"
 #include "enquery/http_request.h"
@@ -22,12 +23,14 @@
 #include "enquery/status.h"
 #include "enquery/testing.h"
 #include "http/curl_http.h"
+#include "http/http_test_server.h"
 
 using ::enquery::CurlHttp;
 using ::enquery::Http;
 using ::enquery::HttpClient;
 using ::enquery::HttpRequest;
 using ::enquery::HttpResponse;
+using ::enquery::HttpTestServer;
 using ::enquery::Shared;
 using ::enquery::Status;
 
@@ -39,16 +42,16 @@ int main(int argc, char* argv[]) {
   Shared<HttpClient>::Ptr client(http->CreateClient(&status));
   ASSERT_TRUE(status.IsSuccess());
 
+  HttpTestServer server;
+  ASSERT_TRUE(server.Start().IsSuccess());
+  const std::string uri = server.Url("/1024");
   HttpRequest request;
-
-  // TODO(tdial): We can't and should not assume that we're connected to
-  // the internet, nor should we assume that a local web server is running.
-  // Should probably build a simple HTTP server to satisfy this unit test.
-
-  request.set_uri("http://www.example.com");
+  request.set_uri(uri.c_str());
 
   Shared<HttpResponse>::Ptr response(client->SendRequest(request, &status));
   ASSERT_TRUE(status.IsSuccess());
+  ASSERT_EQUALS(response->StatusCode(), 200);
+  ASSERT_EQUALS(response->BodySize(), 1024u);
 
   // Check Curl's global reference count. It should be 1, because the
   // module holds the global reference and the client holds a shared
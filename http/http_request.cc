@@ -14,10 +14,24 @@
 // contributors.
 
 #include "enquery/http_request.h"
+#include <assert.h>
+#include <strings.h>
 
 namespace enquery {
 
-HttpRequest::HttpRequest() : method_(HttpRequest::GET) {}
+const int64_t HttpBodySource::kUnknownSize;
+
+HttpRequest::HttpRequest()
+    : method_(HttpRequest::GET),
+      body_type_(HttpRequest::BUFFER),
+      body_fd_(-1),
+      body_offset_(0),
+      body_length_(0),
+      body_source_(NULL),
+      connect_timeout_ms_(0),
+      timeout_ms_(0),
+      low_speed_bytes_per_second_(0),
+      low_speed_seconds_(0) {}
 
 HttpRequest::~HttpRequest() {}
 
@@ -45,10 +59,38 @@ HttpRequest& HttpRequest::set_uri(const char* uri) {
 const char* HttpRequest::uri() const { return uri_.c_str(); }
 
 HttpRequest& HttpRequest::set_body(const char* data, size_t size) {
+  ClearBody();
   body_ = Buffer(data, size);
   return *this;
 }
 
+HttpRequest& HttpRequest::set_body_slices(const Slice* slices, size_t count) {
+  ClearBody();
+  body_type_ = HttpRequest::SLICES;
+  body_slices_.assign(slices, slices + count);
+  for (size_t i = 0; i < count; ++i) {
+    body_length_ += slices[i].size();
+  }
+  return *this;
+}
+
+HttpRequest& HttpRequest::set_body_file(int fd, int64_t offset,
+                                        int64_t length) {
+  ClearBody();
+  body_type_ = HttpRequest::FILE_RANGE;
+  body_fd_ = fd;
+  body_offset_ = offset;
+  body_length_ = length;
+  return *this;
+}
+
+HttpRequest& HttpRequest::set_body_source(HttpBodySource* source) {
+  ClearBody();
+  body_type_ = HttpRequest::SOURCE;
+  body_source_ = source;
+  return *this;
+}
+
 HttpRequest& HttpRequest::set_content_type(const char* content_type) {
   content_type_ = content_type;
   return *this;
@@ -56,8 +98,95 @@ HttpRequest& HttpRequest::set_content_type(const char* content_type) {
 
 const char* HttpRequest::content_type() const { return content_type_.c_str(); }
 
-bool HttpRequest::HasBody() const { return (body_.Size() > 0); }
+HttpRequest& HttpRequest::AddHeader(const char* name, const char* value) {
+  headers_.push_back(std::make_pair(std::string(name), std::string(value)));
+  return *this;
+}
+
+size_t HttpRequest::HeaderCount() const { return headers_.size(); }
+
+void HttpRequest::GetHeader(size_t index, Slice* name, Slice* value) const {
+  assert(index < headers_.size());
+  const std::pair<std::string, std::string>& header = headers_[index];
+  *name = Slice(header.first.data(), header.first.size());
+  *value = Slice(header.second.data(), header.second.size());
+}
+
+bool HttpRequest::FindHeader(const char* name, Slice* value) const {
+  for (size_t i = 0; i < headers_.size(); ++i) {
+    if (strcasecmp(headers_[i].first.c_str(), name) == 0) {
+      *value = Slice(headers_[i].second.data(), headers_[i].second.size());
+      return true;
+    }
+  }
+  return false;
+}
+
+HttpRequest& HttpRequest::set_connect_timeout_ms(int timeout_ms) {
+  connect_timeout_ms_ = timeout_ms;
+  return *this;
+}
+
+int HttpRequest::connect_timeout_ms() const { return connect_timeout_ms_; }
+
+HttpRequest& HttpRequest::set_timeout_ms(int timeout_ms) {
+  timeout_ms_ = timeout_ms;
+  return *this;
+}
+
+int HttpRequest::timeout_ms() const { return timeout_ms_; }
+
+HttpRequest& HttpRequest::set_low_speed_limit(int bytes_per_second,
+                                              int seconds) {
+  low_speed_bytes_per_second_ = bytes_per_second;
+  low_speed_seconds_ = seconds;
+  return *this;
+}
+
+int HttpRequest::low_speed_bytes_per_second() const {
+  return low_speed_bytes_per_second_;
+}
+
+int HttpRequest::low_speed_seconds() const { return low_speed_seconds_; }
+
+bool HttpRequest::HasBody() const {
+  return (body_type_ == HttpRequest::SOURCE) ? (body_source_ != NULL)
+                                              : (BodySize() > 0);
+}
+
+HttpRequest::BodyType HttpRequest::body_type() const { return body_type_; }
+
+int64_t HttpRequest::BodySize() const {
+  switch (body_type_) {
+    case HttpRequest::BUFFER:
+      return static_cast<int64_t>(body_.Size());
+    case HttpRequest::SOURCE:
+      return body_source_ ? body_source_->Size() : 0;
+    default:
+      return body_length_;
+  }
+}
 
 const Buffer& HttpRequest::body() const { return body_; }
 
+const std::vector<Slice>& HttpRequest::body_slices() const {
+  return body_slices_;
+}
+
+int HttpRequest::body_fd() const { return body_fd_; }
+
+int64_t HttpRequest::body_offset() const { return body_offset_; }
+
+HttpBodySource* HttpRequest::body_source() const { return body_source_; }
+
+void HttpRequest::ClearBody() {
+  body_type_ = HttpRequest::BUFFER;
+  body_ = Buffer();
+  body_slices_.clear();
+  body_fd_ = -1;
+  body_offset_ = 0;
+  body_length_ = 0;
+  body_source_ = NULL;
+}
+
 }  // namespace enquery
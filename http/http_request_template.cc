@@ -0,0 +1,137 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "enquery/http_request_template.h"
+#include <string.h>
+#include <algorithm>
+#include <string>
+
+namespace {
+
+const char kHexDigits[] = "0123456789ABCDEF";
+
+// Return true if 'c' is unreserved, and so never needs encoding.
+bool IsUnreserved(unsigned char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == '-' || c == '.' || c == '_' ||
+         c == '~';
+}
+
+// Return the length of 'in' once encoded.
+size_t EncodedSize(const enquery::Slice& in) {
+  size_t size = 0;
+  for (size_t i = 0; i < in.size(); ++i) {
+    size += IsUnreserved(static_cast<unsigned char>(in.data()[i])) ? 1 : 3;
+  }
+  return size;
+}
+
+// Encode 'in' into 'out', which must have room for EncodedSize(in) bytes.
+// Return the end of the encoding.
+char* Encode(const enquery::Slice& in, char* out) {
+  for (size_t i = 0; i < in.size(); ++i) {
+    const unsigned char c = static_cast<unsigned char>(in.data()[i]);
+    if (IsUnreserved(c)) {
+      *out++ = static_cast<char>(c);
+    } else {
+      *out++ = '%';
+      *out++ = kHexDigits[c >> 4];
+      *out++ = kHexDigits[c & 0xf];
+    }
+  }
+  return out;
+}
+
+// Return the length of the query string for 'params'.
+size_t QuerySize(const enquery::QueryParam* params, size_t count) {
+  size_t size = count > 0 ? 2 * count - 1 : 0;  // '=' and '&'.
+  for (size_t i = 0; i < count; ++i) {
+    size += EncodedSize(params[i].name) + EncodedSize(params[i].value);
+  }
+  return size;
+}
+
+// Encode the query string for 'params' into 'out', which must have room
+// for QuerySize() bytes. Return the end of the encoding.
+char* EncodeParams(const enquery::QueryParam* params, size_t count,
+                   char* out) {
+  for (size_t i = 0; i < count; ++i) {
+    if (i > 0) {
+      *out++ = '&';
+    }
+    out = Encode(params[i].name, out);
+    *out++ = '=';
+    out = Encode(params[i].value, out);
+  }
+  return out;
+}
+
+}  // namespace
+
+namespace enquery {
+
+size_t EncodeUriComponent(const Slice& in, char* out, size_t capacity) {
+  const size_t size = EncodedSize(in);
+  if (size <= capacity) {
+    Encode(in, out);
+  }
+  return size;
+}
+
+size_t EncodeQuery(const QueryParam* params, size_t count, char* out,
+                   size_t capacity) {
+  const size_t size = QuerySize(params, count);
+  if (size <= capacity) {
+    EncodeParams(params, count, out);
+  }
+  return size;
+}
+
+HttpRequestTemplate::HttpRequestTemplate(const HttpRequest& prototype)
+    : prototype_(prototype),
+      base_size_(prototype_.uri_.size()),
+      path_end_(std::min(prototype_.uri_.find('?'), base_size_)),
+      query_separator_(path_end_ == base_size_ ? '?' : '&') {}
+
+HttpRequestTemplate::~HttpRequestTemplate() {}
+
+void HttpRequestTemplate::Fill(const Slice& path, HttpRequest* request) const {
+  Fill(path, NULL, 0, request);
+}
+
+void HttpRequestTemplate::Fill(const Slice& path, const QueryParam* params,
+                               size_t count, HttpRequest* request) const {
+  // Assigning member by member lets each string and vector keep its
+  // storage when it is already large enough.
+  *request = prototype_;
+
+  const size_t path_size = EncodedSize(path);
+  const size_t query_size = count > 0 ? 1 + QuerySize(params, count) : 0;
+  std::string& uri = request->uri_;
+  uri.resize(base_size_ + path_size + query_size);
+
+  // Make room for the path ahead of the base URI's query, if it has one.
+  char* base = &uri[0];
+  memmove(base + path_end_ + path_size, base + path_end_,
+          base_size_ - path_end_);
+  Encode(path, base + path_end_);
+  char* out = base + base_size_ + path_size;
+  if (count > 0) {
+    *out++ = query_separator_;
+    EncodeParams(params, count, out);
+  }
+}
+
+}  // namespace enquery
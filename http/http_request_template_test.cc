@@ -0,0 +1,135 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include <string.h>
+#include <string>
+#include "enquery/http_request.h"
+#include "enquery/http_request_template.h"
+#include "enquery/slice.h"
+#include "enquery/testing.h"
+
+using ::enquery::EncodeQuery;
+using ::enquery::EncodeUriComponent;
+using ::enquery::HttpRequest;
+using ::enquery::HttpRequestTemplate;
+using ::enquery::QueryParam;
+using ::enquery::Slice;
+
+namespace {
+
+Slice MakeSlice(const char* str) { return Slice(str, strlen(str)); }
+
+std::string Encode(const char* str) {
+  char out[64];
+  const size_t size = EncodeUriComponent(MakeSlice(str), out, sizeof(out));
+  ASSERT_TRUE(size <= sizeof(out));
+  return std::string(out, size);
+}
+
+void TestEncodeUriComponent() {
+  ASSERT_EQUALS(Encode(""), std::string());
+  ASSERT_EQUALS(Encode("AZaz09-._~"), std::string("AZaz09-._~"));
+  ASSERT_EQUALS(Encode("a b/c?d"), std::string("a%20b%2Fc%3Fd"));
+  ASSERT_EQUALS(Encode("\xff\x01"), std::string("%FF%01"));
+
+  // Measuring writes nothing; too small a buffer is left alone.
+  ASSERT_EQUALS(EncodeUriComponent(MakeSlice("a&b"), NULL, 0), 5u);
+  char out[4] = {'x', 'x', 'x', 'x'};
+  ASSERT_EQUALS(EncodeUriComponent(MakeSlice("a&b"), out, sizeof(out)), 5u);
+  ASSERT_EQUALS(std::string(out, 4), std::string("xxxx"));
+}
+
+void TestEncodeQuery() {
+  const QueryParam params[] = {QueryParam(MakeSlice("k"), MakeSlice("v 1")),
+                               QueryParam(MakeSlice("empty"), Slice()),
+                               QueryParam(MakeSlice("a=b"), MakeSlice("&"))};
+  char out[64];
+  size_t size = EncodeQuery(params, 3, out, sizeof(out));
+  ASSERT_EQUALS(std::string(out, size),
+                std::string("k=v%201&empty=&a%3Db=%26"));
+  ASSERT_EQUALS(EncodeQuery(params, 3, NULL, 0), size);
+  ASSERT_EQUALS(EncodeQuery(params, 0, out, sizeof(out)), 0u);
+}
+
+void TestFill() {
+  HttpRequest prototype;
+  prototype.set_method(HttpRequest::PUT)
+      .set_uri("http://kv.local/v1/keys/")
+      .set_content_type("application/json")
+      .set_timeout_ms(250)
+      .AddHeader("X-Db", "7");
+  const HttpRequestTemplate lookup(prototype);
+
+  HttpRequest request;
+  request.set_uri("http://elsewhere/").AddHeader("X-Stale", "1");
+  lookup.Fill(MakeSlice("user/42"), &request);
+  ASSERT_STRING_EQUALS(request.uri(), "http://kv.local/v1/keys/user%2F42");
+  ASSERT_EQUALS(request.method(), HttpRequest::PUT);
+  ASSERT_STRING_EQUALS(request.content_type(), "application/json");
+  ASSERT_EQUALS(request.timeout_ms(), 250);
+  ASSERT_EQUALS(request.HeaderCount(), 1u);
+  Slice value;
+  ASSERT_TRUE(request.FindHeader("x-db", &value));
+  ASSERT_FALSE(request.FindHeader("X-Stale", &value));
+
+  // The template is unchanged by filling.
+  ASSERT_STRING_EQUALS(lookup.prototype().uri(), "http://kv.local/v1/keys/");
+
+  // Query parameters.
+  const QueryParam params[] = {QueryParam(MakeSlice("v"), MakeSlice("2")),
+                               QueryParam(MakeSlice("q"), MakeSlice("a b"))};
+  lookup.Fill(MakeSlice("k"), params, 2, &request);
+  ASSERT_STRING_EQUALS(request.uri(),
+                       "http://kv.local/v1/keys/k?v=2&q=a%20b");
+
+  // The path goes before the base URI's query, and parameters after it,
+  // following "&".
+  prototype.set_uri("http://kv.local/v1/keys/?db=7");
+  const HttpRequestTemplate query(prototype);
+  query.Fill(MakeSlice("x y"), &request);
+  ASSERT_STRING_EQUALS(request.uri(), "http://kv.local/v1/keys/x%20y?db=7");
+  query.Fill(MakeSlice("k"), params, 1, &request);
+  ASSERT_STRING_EQUALS(request.uri(), "http://kv.local/v1/keys/k?db=7&v=2");
+}
+
+void TestFillReusesStorage() {
+  HttpRequest prototype;
+  prototype.set_uri("http://kv.local/v1/keys/").AddHeader("X-Db", "7");
+  const HttpRequestTemplate lookup(prototype);
+
+  HttpRequest request;
+  lookup.Fill(MakeSlice("a-long-key-to-size-the-uri-storage"), &request);
+  const char* uri = request.uri();
+  Slice name, value;
+  request.GetHeader(0, &name, &value);
+  const char* header = name.data();
+
+  // Filling with a shorter key uses the same storage.
+  lookup.Fill(MakeSlice("k1"), &request);
+  ASSERT_TRUE(request.uri() == uri);
+  request.GetHeader(0, &name, &value);
+  ASSERT_TRUE(name.data() == header);
+  ASSERT_STRING_EQUALS(request.uri(), "http://kv.local/v1/keys/k1");
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  TestEncodeUriComponent();
+  TestEncodeQuery();
+  TestFill();
+  TestFillReusesStorage();
+  return EXIT_SUCCESS;
+}
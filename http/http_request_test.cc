@@ -15,13 +15,32 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <string>
 #include "enquery/http_request.h"
+#include "enquery/slice.h"
 #include "enquery/status.h"
 #include "enquery/testing.h"
 
+using ::enquery::HttpBodySource;
 using ::enquery::HttpRequest;
+using ::enquery::Slice;
 using ::enquery::Status;
 
+namespace {
+
+// A source of an empty body, of unknown size.
+class UnsizedSource : public HttpBodySource {
+ public:
+  virtual int64_t Size() { return kUnknownSize; }
+  virtual Status Read(char* data, size_t size, size_t* bytes_read) {
+    *bytes_read = 0;
+    return Status::OK();
+  }
+  virtual bool Rewind() { return true; }
+};
+
+}  // namespace
+
 int main(int argc, char* argv[]) {
   HttpRequest request;
 
@@ -46,5 +65,64 @@ int main(int argc, char* argv[]) {
   request.set_content_type(kTestContentType);
   ASSERT_EQUALS(strcmp(kTestContentType, request.content_type()), 0);
 
+  // Bodies
+  ASSERT_TRUE(!request.HasBody());
+  request.set_body("abc", 3);
+  ASSERT_EQUALS(request.body_type(), HttpRequest::BUFFER);
+  ASSERT_EQUALS(request.BodySize(), 3);
+
+  const Slice slices[] = {Slice("hello, ", 7), Slice("world", 5)};
+  request.set_body_slices(slices, 2);
+  ASSERT_EQUALS(request.body_type(), HttpRequest::SLICES);
+  ASSERT_EQUALS(request.body_slices().size(), 2u);
+  ASSERT_EQUALS(request.BodySize(), 12);
+  ASSERT_EQUALS(request.body().Size(), 0u);
+  ASSERT_TRUE(request.HasBody());
+
+  request.set_body_file(7, 100, 4096);
+  ASSERT_EQUALS(request.body_type(), HttpRequest::FILE_RANGE);
+  ASSERT_EQUALS(request.body_fd(), 7);
+  ASSERT_EQUALS(request.body_offset(), 100);
+  ASSERT_EQUALS(request.BodySize(), 4096);
+  ASSERT_TRUE(request.body_slices().empty());
+
+  UnsizedSource source;
+  request.set_body_source(&source);
+  ASSERT_EQUALS(request.body_type(), HttpRequest::SOURCE);
+  ASSERT_TRUE(request.body_source() == &source);
+  ASSERT_EQUALS(request.BodySize(), HttpBodySource::kUnknownSize);
+  ASSERT_TRUE(request.HasBody());
+
+  request.set_body("", 0);
+  ASSERT_EQUALS(request.body_type(), HttpRequest::BUFFER);
+  ASSERT_TRUE(!request.HasBody());
+
+  // Headers are kept in order and found regardless of case.
+  ASSERT_EQUALS(request.HeaderCount(), 0u);
+  request.AddHeader("Accept", "text/plain").AddHeader("X-Empty", "");
+  ASSERT_EQUALS(request.HeaderCount(), 2u);
+  Slice name, value;
+  request.GetHeader(1, &name, &value);
+  ASSERT_TRUE(std::string(name.data(), name.size()) == "X-Empty");
+  ASSERT_TRUE(value.IsEmpty());
+  ASSERT_TRUE(request.FindHeader("accept", &value));
+  ASSERT_TRUE(std::string(value.data(), value.size()) == "text/plain");
+  ASSERT_FALSE(request.FindHeader("Accept-Encoding", &value));
+
+  HttpRequest copy(request);
+  ASSERT_TRUE(copy.FindHeader("ACCEPT", &value));
+  ASSERT_TRUE(std::string(value.data(), value.size()) == "text/plain");
+
+  // Timeouts default to the client's.
+  ASSERT_EQUALS(request.connect_timeout_ms(), 0);
+  ASSERT_EQUALS(request.timeout_ms(), 0);
+  ASSERT_EQUALS(request.low_speed_bytes_per_second(), 0);
+  request.set_connect_timeout_ms(50).set_timeout_ms(-1).set_low_speed_limit(
+      100, 3);
+  ASSERT_EQUALS(request.connect_timeout_ms(), 50);
+  ASSERT_EQUALS(request.timeout_ms(), -1);
+  ASSERT_EQUALS(request.low_speed_bytes_per_second(), 100);
+  ASSERT_EQUALS(request.low_speed_seconds(), 3);
+
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,224 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "http/http_test_client.h"
+#include <errno.h>
+#include <strings.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "enquery/http_request.h"
+#include "enquery/scope_lock.h"
+#include "enquery/shared.h"
+#include "enquery/slice.h"
+#include "enquery/utility.h"
+
+namespace {
+
+const char kModule[] = "FakeAsyncHttpClient";
+
+}  // namespace
+
+namespace enquery {
+
+FakeHttpResponse::FakeHttpResponse(int code, const std::string& body)
+    : code_(code), body_(body) {}
+
+FakeHttpResponse& FakeHttpResponse::AddHeader(const std::string& name,
+                                              const std::string& value) {
+  names_.push_back(name);
+  values_.push_back(value);
+  return *this;
+}
+
+const char* FakeHttpResponse::Body() const { return body_.data(); }
+
+size_t FakeHttpResponse::BodySize() const { return body_.size(); }
+
+int FakeHttpResponse::StatusCode() const { return code_; }
+
+size_t FakeHttpResponse::HeaderCount() const { return names_.size(); }
+
+void FakeHttpResponse::GetHeader(size_t index, Slice* name,
+                                 Slice* value) const {
+  *name = Slice(names_[index].data(), names_[index].size());
+  *value = Slice(values_[index].data(), values_[index].size());
+}
+
+bool FakeHttpResponse::FindHeader(const char* name, Slice* value) const {
+  for (size_t i = 0; i < names_.size(); ++i) {
+    if (strcasecmp(names_[i].c_str(), name) == 0) {
+      *value = Slice(values_[i].data(), values_[i].size());
+      return true;
+    }
+  }
+  return false;
+}
+
+const HttpTimings& FakeHttpResponse::Timings() const { return timings_; }
+
+FakeAsyncHttpClient::FakeAsyncHttpClient()
+    : mutex_("FakeAsyncHttpClient"), cancelled_(0), fail_next_(false) {}
+
+FakeAsyncHttpClient::~FakeAsyncHttpClient() {
+  while (waiting() > 0) {
+    Fail(0, ESHUTDOWN);
+  }
+}
+
+Status FakeAsyncHttpClient::SendRequest(const HttpRequest& request,
+                                        Future<HttpResult>* future) {
+  ScopeLock lock(&mutex_);
+  if (fail_next_) {
+    fail_next_ = false;
+    return Status::MakeError(kModule, "failed to send");
+  }
+  uris_.push_back(request.uri());
+  promises_.push_back(Promise<HttpResult>());
+  sent_at_.push_back(MonotonicNanos());
+  *future = promises_.back().GetFuture();
+  return Status::OK();
+}
+
+void FakeAsyncHttpClient::Cancel(const Future<HttpResult>& future) {
+  Promise<HttpResult> promise;
+  {
+    ScopeLock lock(&mutex_);
+    size_t i = 0;
+    while (i < promises_.size() && !(promises_[i].GetFuture() == future)) {
+      ++i;
+    }
+    if (i == promises_.size()) {
+      return;
+    }
+    promise = promises_[i];
+    promises_.erase(promises_.begin() + i);
+    uris_.erase(uris_.begin() + i);
+    ++cancelled_;
+  }
+  promise.SetValue(
+      HttpResult(Status::MakeError(kModule, "request cancelled", ECANCELED),
+                 Shared<HttpResponse>::Ptr()));
+}
+
+HttpStream* FakeAsyncHttpClient::OpenStream(const HttpRequest& request,
+                                            Status* status) {
+  MaybeAssign(status, Status::MakeError(kModule, "streams unsupported"));
+  return NULL;
+}
+
+HttpByteCounts FakeAsyncHttpClient::GetByteCounts() const {
+  return HttpByteCounts();
+}
+
+size_t FakeAsyncHttpClient::waiting() {
+  ScopeLock lock(&mutex_);
+  return promises_.size();
+}
+
+std::string FakeAsyncHttpClient::uri(size_t index) {
+  ScopeLock lock(&mutex_);
+  return uris_[index];
+}
+
+void FakeAsyncHttpClient::WaitFor(size_t count) {
+  while (waiting() < count) {
+    usleep(1000);
+  }
+}
+
+void FakeAsyncHttpClient::Respond(size_t index,
+                                  Shared<HttpResponse>::Ptr response) {
+  std::string uri;
+  Take(index, &uri).SetValue(HttpResult(Status::OK(), response));
+}
+
+void FakeAsyncHttpClient::Respond(size_t index, int code) {
+  std::string uri;
+  Promise<HttpResult> promise = Take(index, &uri);
+  Shared<HttpResponse>::Ptr response(new FakeHttpResponse(code, uri));
+  promise.SetValue(HttpResult(Status::OK(), response));
+}
+
+void FakeAsyncHttpClient::RespondAll(int code) {
+  while (waiting() > 0) {
+    Respond(0, code);
+  }
+}
+
+void FakeAsyncHttpClient::Fail(size_t index, int code) {
+  std::string uri;
+  Take(index, &uri).SetValue(
+      HttpResult(Status::MakeError(kModule, "request failed", code),
+                 Shared<HttpResponse>::Ptr()));
+}
+
+void FakeAsyncHttpClient::FailNext() {
+  ScopeLock lock(&mutex_);
+  fail_next_ = true;
+}
+
+int FakeAsyncHttpClient::sent() {
+  ScopeLock lock(&mutex_);
+  return static_cast<int>(sent_at_.size());
+}
+
+int FakeAsyncHttpClient::cancelled() {
+  ScopeLock lock(&mutex_);
+  return cancelled_;
+}
+
+uint64_t FakeAsyncHttpClient::sent_at(size_t n) {
+  ScopeLock lock(&mutex_);
+  return sent_at_[n];
+}
+
+Promise<HttpResult> FakeAsyncHttpClient::Take(size_t index,
+                                              std::string* uri) {
+  ScopeLock lock(&mutex_);
+  Promise<HttpResult> promise = promises_[index];
+  *uri = uris_[index];
+  promises_.erase(promises_.begin() + index);
+  uris_.erase(uris_.begin() + index);
+  return promise;
+}
+
+Future<HttpResult> Send(AsyncHttpClient* client, const std::string& uri) {
+  return Send(client, uri, HttpRequest::GET);
+}
+
+Future<HttpResult> Send(AsyncHttpClient* client, const std::string& uri,
+                        HttpRequest::Method method) {
+  HttpRequest request;
+  request.set_uri(uri.c_str()).set_method(method);
+  Future<HttpResult> future;
+  ASSERT_TRUE(client->SendRequest(request, &future).IsSuccess());
+  return future;
+}
+
+std::string BodyOf(Future<HttpResult> future) {
+  HttpResult result = future.GetValue();
+  ASSERT_TRUE(result.status().IsSuccess());
+  return std::string(result.response()->Body(),
+                     result.response()->BodySize());
+}
+
+int CodeOf(Future<HttpResult> future) {
+  HttpResult result = future.GetValue();
+  ASSERT_TRUE(result.status().IsSuccess());
+  return result.response()->StatusCode();
+}
+
+}  // namespace enquery
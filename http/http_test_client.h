@@ -0,0 +1,163 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef HTTP_HTTP_TEST_CLIENT_H_
+#define HTTP_HTTP_TEST_CLIENT_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "enquery/async_http_client.h"
+#include "enquery/futures.h"
+#include "enquery/http_request.h"
+#include "enquery/http_response.h"
+#include "enquery/mutex.h"
+#include "enquery/status.h"
+#include "enquery/testing.h"
+
+namespace enquery {
+
+class Slice;
+
+// A response made up by a test: a status code, a body and headers.
+class FakeHttpResponse : public HttpResponse {
+ public:
+  FakeHttpResponse(int code, const std::string& body);
+
+  // Add a header to the response.
+  FakeHttpResponse& AddHeader(const std::string& name,
+                              const std::string& value);
+
+  virtual const char* Body() const;
+  virtual size_t BodySize() const;
+  virtual int StatusCode() const;
+  virtual size_t HeaderCount() const;
+  virtual void GetHeader(size_t index, Slice* name, Slice* value) const;
+  virtual bool FindHeader(const char* name, Slice* value) const;
+  virtual const HttpTimings& Timings() const;
+
+ private:
+  const int code_;
+  const std::string body_;
+  std::vector<std::string> names_;
+  std::vector<std::string> values_;
+  const HttpTimings timings_;
+};
+
+// An AsyncHttpClient for testing the clients that wrap one: requests wait
+// until the test completes them, by their index among those waiting (in
+// the order they were sent.) Cancelling a request fails it with
+// ECANCELED, and requests still waiting when the client is deleted fail
+// with ESHUTDOWN, as they would with a real client. Streams aren't
+// supported.
+class FakeAsyncHttpClient : public AsyncHttpClient {
+ public:
+  FakeAsyncHttpClient();
+  virtual ~FakeAsyncHttpClient();
+
+  virtual Status SendRequest(const HttpRequest& request,
+                             Future<HttpResult>* future);
+  virtual void Cancel(const Future<HttpResult>& future);
+  virtual HttpStream* OpenStream(const HttpRequest& request, Status* status);
+  virtual HttpByteCounts GetByteCounts() const;
+
+  // Return the number of requests waiting to complete.
+  size_t waiting();
+
+  // Return the URI of the waiting request at 'index'.
+  std::string uri(size_t index);
+
+  // Wait until at least 'count' requests are waiting.
+  void WaitFor(size_t count);
+
+  // Complete the waiting request at 'index' with 'response'.
+  void Respond(size_t index, Shared<HttpResponse>::Ptr response);
+
+  // Complete the waiting request at 'index' with a response whose status
+  // code is 'code' and whose body is the request's URI.
+  void Respond(size_t index, int code);
+
+  // Respond to every waiting request, as above.
+  void RespondAll(int code);
+
+  // Fail the waiting request at 'index' with the error code 'code'.
+  void Fail(size_t index, int code);
+
+  // Make the next call to SendRequest() fail.
+  void FailNext();
+
+  // Return the number of requests sent (waiting or not.)
+  int sent();
+
+  // Return the number of requests cancelled while waiting.
+  int cancelled();
+
+  // Return the MonotonicNanos() time at which the 'n'th request (from
+  // zero) was sent.
+  uint64_t sent_at(size_t n);
+
+ private:
+  FakeAsyncHttpClient(const FakeAsyncHttpClient& no_copy);
+  FakeAsyncHttpClient& operator=(const FakeAsyncHttpClient& no_assign);
+
+  // Remove the waiting request at 'index', returning its promise and URI.
+  Promise<HttpResult> Take(size_t index, std::string* uri);
+
+  Mutex mutex_;
+  std::vector<std::string> uris_;
+  std::vector<Promise<HttpResult> > promises_;
+  std::vector<uint64_t> sent_at_;
+  int cancelled_;
+  bool fail_next_;
+};
+
+// Helpers for the tests of clients that wrap an AsyncHttpClient. Each
+// fails the test if what it does doesn't succeed.
+
+// Create a 'Client' (e.g. a RetryingHttpClient) wrapping 'client'.
+template <typename Client>
+Client* Wrap(AsyncHttpClient* client,
+             const typename Client::Settings& settings) {
+  Status status;
+  Client* wrapper = Client::Create(client, settings, &status);
+  ASSERT_TRUE(status.IsSuccess());
+  return wrapper;
+}
+
+// Return the statistics a wrapping client has kept.
+template <typename Client>
+typename Client::Statistics StatisticsOf(const Client& client) {
+  typename Client::Statistics stats;
+  client.GetStatistics(&stats);
+  return stats;
+}
+
+// Send a GET for 'uri' through 'client'.
+Future<HttpResult> Send(AsyncHttpClient* client, const std::string& uri);
+
+// Send a request for 'uri' with 'method' through 'client'.
+Future<HttpResult> Send(AsyncHttpClient* client, const std::string& uri,
+                        HttpRequest::Method method);
+
+// Wait for a request to succeed, and return the body of its response.
+std::string BodyOf(Future<HttpResult> future);
+
+// Wait for a request to succeed, and return its response's status code.
+int CodeOf(Future<HttpResult> future);
+
+}  // namespace enquery
+
+#endif  // HTTP_HTTP_TEST_CLIENT_H_
@@ -0,0 +1,735 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "http/http_test_server.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include "enquery/portability.h"
+#include "enquery/reactor.h"
+#include "enquery/shared.h"
+
+namespace {
+
+// The most body sent in one chunk, when responses are chunked.
+const size_t kChunkSize = 16384;
+
+void SetNonBlocking(int fd) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+void AddHeader(const char* name, const std::string& value,
+               enquery::Http2TestSession::Headers* headers) {
+  headers->push_back(std::make_pair(std::string(name), value));
+}
+
+#ifdef HAVE_ZLIB
+// Compress 'input' into 'output' in gzip format.
+void Gzip(const std::string& input, std::string* output) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+               Z_DEFAULT_STRATEGY);
+  output->resize(deflateBound(&stream, input.size()));
+  stream.next_in =
+      reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+  stream.avail_in = input.size();
+  stream.next_out = reinterpret_cast<Bytef*>(&(*output)[0]);
+  stream.avail_out = output->size();
+  deflate(&stream, Z_FINISH);
+  output->resize(stream.total_out);
+  deflateEnd(&stream);
+}
+
+// Decompress the gzip data in 'input' into 'output'. Return false if it
+// isn't valid.
+bool Gunzip(const std::string& input, std::string* output) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  inflateInit2(&stream, 15 + 16);
+  stream.next_in =
+      reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+  stream.avail_in = input.size();
+  output->clear();
+  int result = Z_OK;
+  while (result == Z_OK) {
+    char buf[16384];
+    stream.next_out = reinterpret_cast<Bytef*>(buf);
+    stream.avail_out = sizeof(buf);
+    result = inflate(&stream, Z_NO_FLUSH);
+    output->append(buf, sizeof(buf) - stream.avail_out);
+  }
+  inflateEnd(&stream);
+  return result == Z_STREAM_END;
+}
+#endif
+
+}  // namespace
+
+namespace enquery {
+
+// Serves the connections accepted by one thread. Responses that are held
+// back wait in their connection's queue until they are due, so that one
+// slow response doesn't hold up the thread.
+class HttpTestServer::Worker : public Reactor::Handler {
+ public:
+  explicit Worker(HttpTestServer* server)
+      : server_(server), reactor_(NULL), started_(false), stop_(false) {}
+
+  virtual ~Worker() {
+    if (started_) {
+      __atomic_store_n(&stop_, true, __ATOMIC_RELEASE);
+      reactor_->Wakeup();
+      pthread_join(thread_, NULL);
+    }
+    for (std::map<int, Connection>::iterator it = connections_.begin();
+         it != connections_.end(); ++it) {
+      close(it->first);
+    }
+    delete reactor_;
+  }
+
+  // Start serving connections accepted from the server's listener.
+  Status Start() {
+    Status status;
+    reactor_ = Reactor::Create(Reactor::DefaultSettings(), &status);
+    if (!reactor_) {
+      return status;
+    }
+    status = reactor_->Add(server_->listener_, Reactor::READABLE, this);
+    if (status.IsFailure()) {
+      return status;
+    }
+    const int error = pthread_create(&thread_, NULL, ThreadMain, this);
+    if (error != 0) {
+      return Status::MakeFromSystemError(error);
+    }
+    started_ = true;
+    return Status::OK();
+  }
+
+  virtual void OnReady(int fd, int events) {
+    if (fd == server_->listener_) {
+      Accept();
+      return;
+    }
+    Connection& conn = connections_[fd];
+    if (events & Reactor::READABLE) {
+      char buf[65536];
+      ssize_t n;
+      while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        conn.input.append(buf, n);
+        __atomic_add_fetch(&server_->bytes_received_, n, __ATOMIC_RELAXED);
+      }
+      if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        Close(fd, false);
+        return;
+      }
+      if (!conn.h2.get() && Http2TestSession::IsPreface(conn.input)) {
+        conn.h2 = Shared<Http2TestSession>::Ptr(new Http2TestSession());
+      }
+      if (conn.h2.get()) {
+        if (!ParseHttp2Requests(&conn)) {
+          Close(fd, false);
+          return;
+        }
+      } else {
+        ParseRequests(fd, &conn);
+      }
+    }
+    Flush(fd, &conn);
+  }
+
+ private:
+  // A response held back until 'due', and what to do once it is sent.
+  struct Delayed {
+    uint64_t due;
+    std::string data;
+    Fault fault;
+  };
+
+  struct Connection {
+    Connection() : continued(false), doomed(false), closing(FAULT_NONE) {}
+    std::string input;
+    std::string output;
+    bool continued;  // Sent "100 Continue" for the current request.
+    bool doomed;     // A fault has been queued; later requests are ignored.
+    Fault closing;   // Once 'output' is sent, close the connection so.
+    std::deque<Delayed> delayed;       // Responses not yet due, in order.
+    Shared<Http2TestSession>::Ptr h2;  // Set if the client speaks HTTP/2.
+  };
+
+  Worker(const Worker& no_copy);
+  Worker& operator=(const Worker& no_assign);
+
+  static void* ThreadMain(void* arg) {
+    static_cast<Worker*>(arg)->Run();
+    return NULL;
+  }
+
+  void Run() {
+    while (!__atomic_load_n(&stop_, __ATOMIC_ACQUIRE)) {
+      int timeout_ms = 100;
+      const uint64_t now = MonotonicNanos();
+      for (std::set<int>::const_iterator it = delayed_.begin();
+           it != delayed_.end(); ++it) {
+        const uint64_t due = connections_[*it].delayed.front().due;
+        const int wait_ms =
+            due <= now ? 0 : static_cast<int>((due - now + 999999) / 1000000);
+        timeout_ms = std::min(timeout_ms, wait_ms);
+      }
+      reactor_->Poll(timeout_ms);
+      if (!delayed_.empty()) {
+        ReleaseDue(MonotonicNanos());
+      }
+    }
+  }
+
+  // Accept one connection. Taking one at a time lets the other workers,
+  // which are woken too, share a burst of connections.
+  void Accept() {
+    const int fd = accept(server_->listener_, NULL, NULL);
+    if (fd < 0) {
+      return;
+    }
+    SetNonBlocking(fd);
+    connections_[fd] = Connection();
+    reactor_->Add(fd, Reactor::READABLE, this);
+    __atomic_add_fetch(&server_->connections_accepted_, 1, __ATOMIC_RELAXED);
+  }
+
+  // Close the connection 'fd', resetting it if 'reset'.
+  void Close(int fd, bool reset) {
+    if (reset) {
+      struct linger linger = {1, 0};
+      setsockopt(fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+    }
+    reactor_->Remove(fd);
+    close(fd);
+    connections_.erase(fd);
+    delayed_.erase(fd);
+  }
+
+  // Answer each complete request in the input buffer.
+  void ParseRequests(int fd, Connection* conn) {
+    if (conn->doomed) {
+      conn->input.clear();
+      return;
+    }
+    size_t end;
+    while (!conn->doomed &&
+           (end = conn->input.find("\r\n\r\n")) != std::string::npos) {
+      const std::string head = conn->input.substr(0, end + 2);
+      std::string body;
+      size_t consumed = 0;
+      if (!ReadBody(conn->input, end + 4, head, &body, &consumed)) {
+        // The body hasn't all arrived. A client that asked first may be
+        // waiting to be told to send it.
+        if (!conn->continued && FindHeader(head, "expect", NULL)) {
+          conn->output.append("HTTP/1.1 100 Continue\r\n\r\n");
+          conn->continued = true;
+        }
+        return;
+      }
+      conn->input.erase(0, consumed);
+      conn->continued = false;
+
+      Exchange exchange;
+      const size_t path = head.find(' ') + 1;
+      exchange.path = head.substr(path, head.find(' ', path) - path);
+      FindHeader(head, "content-encoding", &exchange.content_encoding);
+      FindHeader(head, "accept-encoding", &exchange.accept_encoding);
+      FindHeader(head, "if-none-match", &exchange.if_none_match);
+      exchange.body.swap(body);
+      server_->Answer(&exchange);
+      Respond(fd, conn, &exchange);
+    }
+  }
+
+  // Queue the response to 'exchange' on 'conn', or add it straight to the
+  // output if it is due now.
+  void Respond(int fd, Connection* conn, Exchange* exchange) {
+    if (exchange->fault != FAULT_NONE) {
+      conn->doomed = true;
+      conn->input.clear();
+    }
+    if (exchange->delay_ms <= 0 && conn->delayed.empty() &&
+        exchange->fault == FAULT_NONE) {
+      Format(*exchange, &conn->output);
+      return;
+    }
+    conn->delayed.push_back(Delayed());
+    Delayed& delayed = conn->delayed.back();
+    delayed.due = MonotonicNanos() +
+                  static_cast<uint64_t>(exchange->delay_ms) * 1000000;
+    delayed.fault = exchange->fault;
+    if (delayed.fault == FAULT_NONE || delayed.fault == FAULT_TRUNCATE) {
+      Format(*exchange, &delayed.data);
+    }
+    if (delayed.fault == FAULT_TRUNCATE) {
+      delayed.data.resize(delayed.data.size() / 2);
+    }
+    delayed_.insert(fd);
+  }
+
+  // Append the HTTP/1.1 response to 'exchange' to 'out'.
+  static void Format(const Exchange& exchange, std::string* out) {
+    char header[128];
+    snprintf(header, sizeof(header), "HTTP/1.1 %d X\r\n", exchange.code);
+    out->append(header);
+    for (size_t i = 0; i < exchange.headers.size(); ++i) {
+      out->append(exchange.headers[i].first + ": " +
+                  exchange.headers[i].second + "\r\n");
+    }
+    if (!exchange.chunked || exchange.code == 204 || exchange.code == 304) {
+      snprintf(header, sizeof(header), "Content-Length: %lu\r\n\r\n",
+               static_cast<unsigned long>(exchange.body.size()));  // NOLINT
+      out->append(header);
+      out->append(exchange.body);
+      return;
+    }
+    out->append("Transfer-Encoding: chunked\r\n\r\n");
+    for (size_t offset = 0; offset < exchange.body.size();
+         offset += kChunkSize) {
+      const size_t size = std::min(kChunkSize, exchange.body.size() - offset);
+      snprintf(header, sizeof(header), "%lx\r\n",
+               static_cast<unsigned long>(size));  // NOLINT
+      out->append(header);
+      out->append(exchange.body, offset, size);
+      out->append("\r\n");
+    }
+    out->append("0\r\n\r\n");
+  }
+
+  // Move the responses that are due by 'now' to their connections'
+  // output, and send them.
+  void ReleaseDue(uint64_t now) {
+    const std::vector<int> fds(delayed_.begin(), delayed_.end());
+    for (size_t i = 0; i < fds.size(); ++i) {
+      Connection& conn = connections_[fds[i]];
+      while (!conn.delayed.empty() && conn.delayed.front().due <= now &&
+             conn.closing == FAULT_NONE) {
+        Delayed& delayed = conn.delayed.front();
+        conn.output.append(delayed.data);
+        conn.closing = delayed.fault;
+        conn.delayed.pop_front();
+      }
+      if (conn.delayed.empty() || conn.closing != FAULT_NONE) {
+        delayed_.erase(fds[i]);
+      }
+      Flush(fds[i], &conn);
+    }
+  }
+
+  // Answer each complete request received over HTTP/2. Return false if
+  // the connection should be closed.
+  bool ParseHttp2Requests(Connection* conn) {
+    std::vector<Http2TestSession::Request> requests;
+    if (!conn->h2->Receive(&conn->input, &requests)) {
+      return false;
+    }
+    for (size_t i = 0; i < requests.size(); ++i) {
+      const Http2TestSession::Request& request = requests[i];
+      Exchange exchange;
+      exchange.http2 = true;
+      Http2TestSession::FindHeader(request, ":path", &exchange.path);
+      Http2TestSession::FindHeader(request, "content-encoding",
+                                   &exchange.content_encoding);
+      Http2TestSession::FindHeader(request, "accept-encoding",
+                                   &exchange.accept_encoding);
+      Http2TestSession::FindHeader(request, "if-none-match",
+                                   &exchange.if_none_match);
+      exchange.body = request.body;
+      server_->Answer(&exchange);
+      conn->h2->Respond(request.stream_id, exchange.code, exchange.headers,
+                        exchange.body);
+    }
+    conn->h2->Send(&conn->output);
+
+    const uint64_t streams = conn->h2->max_open_streams();
+    if (streams > server_->max_concurrent_streams()) {
+      __atomic_store_n(&server_->max_concurrent_streams_, streams,
+                       __ATOMIC_RELAXED);
+    }
+    return true;
+  }
+
+  // Write as much pending output as the socket takes, waiting for it to
+  // become writable if necessary. Once a faulted response is written,
+  // the connection is closed.
+  void Flush(int fd, Connection* conn) {
+    while (!conn->output.empty()) {
+      ssize_t n = write(fd, conn->output.data(), conn->output.size());
+      if (n <= 0) {
+        break;
+      }
+      conn->output.erase(0, n);
+    }
+    if (conn->output.empty() && conn->closing != FAULT_NONE) {
+      Close(fd, conn->closing == FAULT_RESET);
+      return;
+    }
+    reactor_->Modify(fd, conn->output.empty()
+                             ? Reactor::READABLE
+                             : Reactor::READABLE | Reactor::WRITABLE);
+  }
+
+  HttpTestServer* const server_;
+  Reactor* reactor_;
+  pthread_t thread_;
+  bool started_;
+  bool stop_;
+  std::map<int, Connection> connections_;
+  std::set<int> delayed_;  // Connections with responses held back.
+};
+
+HttpTestServer::HttpTestServer()
+    : listener_(-1),
+      port_(0),
+      connections_accepted_(0),
+      requests_served_(0),
+      bytes_received_(0),
+      faults_injected_(0),
+      max_concurrent_streams_(0) {}
+
+HttpTestServer::HttpTestServer(const Settings& settings)
+    : settings_(settings),
+      listener_(-1),
+      port_(0),
+      connections_accepted_(0),
+      requests_served_(0),
+      bytes_received_(0),
+      faults_injected_(0),
+      max_concurrent_streams_(0) {}
+
+HttpTestServer::~HttpTestServer() {
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    delete workers_[i];
+  }
+  if (listener_ >= 0) {
+    close(listener_);
+  }
+}
+
+Status HttpTestServer::Start() {
+  listener_ = socket(AF_INET, SOCK_STREAM, 0);
+  if (listener_ < 0) {
+    return Status::MakeFromSystemError(errno);
+  }
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(addr);
+  if (bind(listener_, reinterpret_cast<sockaddr*>(&addr), len) != 0 ||
+      listen(listener_, 1024) != 0 ||
+      getsockname(listener_, reinterpret_cast<sockaddr*>(&addr), &len) != 0) {
+    return Status::MakeFromSystemError(errno);
+  }
+  port_ = ntohs(addr.sin_port);
+  SetNonBlocking(listener_);
+
+  const int threads = std::max(1, settings_.thread_count());
+  for (int i = 0; i < threads; ++i) {
+    workers_.push_back(new Worker(this));
+    Status status = workers_.back()->Start();
+    if (status.IsFailure()) {
+      return status;
+    }
+  }
+  return Status::OK();
+}
+
+std::string HttpTestServer::Url(const char* path) const {
+  char prefix[32];
+  snprintf(prefix, sizeof(prefix), "http://127.0.0.1:%d", port_);
+  return std::string(prefix) + path;
+}
+
+uint64_t HttpTestServer::connections_accepted() const {
+  return __atomic_load_n(&connections_accepted_, __ATOMIC_RELAXED);
+}
+
+uint64_t HttpTestServer::requests_served() const {
+  return __atomic_load_n(&requests_served_, __ATOMIC_RELAXED);
+}
+
+uint64_t HttpTestServer::bytes_received() const {
+  return __atomic_load_n(&bytes_received_, __ATOMIC_RELAXED);
+}
+
+uint64_t HttpTestServer::faults_injected() const {
+  return __atomic_load_n(&faults_injected_, __ATOMIC_RELAXED);
+}
+
+uint64_t HttpTestServer::max_concurrent_streams() const {
+  return __atomic_load_n(&max_concurrent_streams_, __ATOMIC_RELAXED);
+}
+
+// Work out the response to a request: "/echo" answers with the request
+// body; "/status/<code>" with that status and no body; "/<n>" with n
+// bytes. A query adds caching headers, or sets how the response is sent.
+void HttpTestServer::Answer(Exchange* exchange) {
+  const uint64_t served =
+      __atomic_add_fetch(&requests_served_, 1, __ATOMIC_RELAXED);
+  exchange->delay_ms = settings_.latency_ms();
+  exchange->chunked = settings_.chunked_responses();
+  if (settings_.fault_every() > 0 && served % settings_.fault_every() == 0) {
+    exchange->fault = settings_.fault();
+  }
+  const size_t query = exchange->path.find('?');
+  const std::string path = exchange->path.substr(0, query);
+  if (query != std::string::npos) {
+    ReadQuery(exchange, query + 1);
+    if (AddCacheHeaders(exchange, query + 1)) {
+      return;
+    }
+  }
+
+  // Only an error response can be sent over HTTP/2.
+  if (exchange->http2 && exchange->fault != FAULT_ERROR) {
+    exchange->fault = FAULT_NONE;
+  }
+  if (exchange->fault != FAULT_NONE) {
+    __atomic_add_fetch(&faults_injected_, 1, __ATOMIC_RELAXED);
+  }
+  if (exchange->fault == FAULT_ERROR) {
+    exchange->fault = FAULT_NONE;
+    exchange->code = 503;
+    exchange->body.clear();
+    return;
+  }
+
+#ifdef HAVE_ZLIB
+  if (exchange->content_encoding == "gzip") {
+    std::string decoded;
+    if (!Gunzip(exchange->body, &decoded)) {
+      exchange->code = 400;
+      exchange->body.clear();
+      return;
+    }
+    exchange->body.swap(decoded);
+  }
+#endif
+
+  if (path.compare(0, 5, "/echo") == 0) {
+    // The body stays as it is.
+  } else if (path.compare(0, 8, "/status/") == 0) {
+    exchange->code = atoi(path.c_str() + 8);
+    exchange->body.clear();
+  } else {
+    exchange->body.assign(strtoul(path.c_str() + 1, NULL, 10), 'x');
+  }
+
+#ifdef HAVE_ZLIB
+  // Compress the response if the client accepts gzip.
+  if (!exchange->body.empty() &&
+      exchange->accept_encoding.find("gzip") != std::string::npos) {
+    std::string compressed;
+    Gzip(exchange->body, &compressed);
+    exchange->body.swap(compressed);
+    AddHeader("content-encoding", "gzip", &exchange->headers);
+  }
+#endif
+}
+
+// Read how the response is to be sent from the query starting at 'start'
+// in the path of 'exchange'.
+void HttpTestServer::ReadQuery(Exchange* exchange, size_t start) {
+  const std::string& path = exchange->path;
+  while (start < path.size()) {
+    size_t end = path.find('&', start);
+    if (end == std::string::npos) {
+      end = path.size();
+    }
+    const std::string param = path.substr(start, end - start);
+    if (param.compare(0, 9, "delay_ms=") == 0) {
+      exchange->delay_ms = atoi(param.c_str() + 9);
+    } else if (param == "chunked") {
+      exchange->chunked = true;
+    } else if (param == "fault=reset") {
+      exchange->fault = FAULT_RESET;
+    } else if (param == "fault=close") {
+      exchange->fault = FAULT_CLOSE;
+    } else if (param == "fault=truncate") {
+      exchange->fault = FAULT_TRUNCATE;
+    } else if (param == "fault=error") {
+      exchange->fault = FAULT_ERROR;
+    }
+    start = end + 1;
+  }
+}
+
+// Add the caching headers asked for by the query starting at 'start' in
+// the path of 'exchange'. Return true if the request has been answered,
+// because its If-None-Match matches the ETag.
+bool HttpTestServer::AddCacheHeaders(Exchange* exchange, size_t start) {
+  const std::string& path = exchange->path;
+  std::string etag;
+  while (start < path.size()) {
+    size_t end = path.find('&', start);
+    if (end == std::string::npos) {
+      end = path.size();
+    }
+    const std::string param = path.substr(start, end - start);
+    if (param.compare(0, 8, "max_age=") == 0) {
+      AddHeader("cache-control", "max-age=" + param.substr(8),
+                &exchange->headers);
+    } else if (param == "no_store") {
+      AddHeader("cache-control", "no-store", &exchange->headers);
+    } else if (param.compare(0, 5, "etag=") == 0) {
+      etag = "\"" + param.substr(5) + "\"";
+      AddHeader("etag", etag, &exchange->headers);
+    }
+    start = end + 1;
+  }
+  if (etag.empty() || exchange->if_none_match != etag) {
+    return false;
+  }
+  exchange->code = 304;
+  exchange->body.clear();
+  return true;
+}
+
+// Find the header 'name' (in lower case) in 'head', setting 'value' (if
+// not NULL) to its value.
+bool HttpTestServer::FindHeader(const std::string& head, const char* name,
+                                std::string* value) {
+  const size_t length = strlen(name);
+  for (size_t line = head.find("\r\n"); line != std::string::npos;
+       line = head.find("\r\n", line + 2)) {
+    const size_t start = line + 2;
+    if (strncasecmp(head.c_str() + start, name, length) == 0 &&
+        head.compare(start + length, 1, ":") == 0) {
+      if (value) {
+        const size_t first = head.find_first_not_of(' ', start + length + 1);
+        *value = head.substr(first, head.find("\r\n", first) - first);
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+// Read the body of the request whose header, 'head', ends just before
+// 'start' in 'input'. Return false if it hasn't all arrived; otherwise
+// set 'body' to it and 'consumed' to the size of the whole request.
+bool HttpTestServer::ReadBody(const std::string& input, size_t start,
+                              const std::string& head, std::string* body,
+                              size_t* consumed) {
+  std::string value;
+  if (FindHeader(head, "content-length", &value)) {
+    const size_t length = strtoul(value.c_str(), NULL, 10);
+    if (input.size() - start < length) {
+      return false;
+    }
+    body->assign(input, start, length);
+    *consumed = start + length;
+    return true;
+  }
+
+  if (!FindHeader(head, "transfer-encoding", &value) ||
+      value != "chunked") {
+    *consumed = start;
+    return true;
+  }
+
+  // Each chunk is its size in hex, CRLF, the data and CRLF; the last has
+  // size zero and is followed by a blank line (trailers aren't expected.)
+  // Nothing is copied until the whole body has arrived.
+  std::vector<std::pair<size_t, size_t> > chunks;
+  size_t pos = start;
+  for (;;) {
+    const size_t line_end = input.find("\r\n", pos);
+    if (line_end == std::string::npos) {
+      return false;
+    }
+    const size_t size = strtoul(input.c_str() + pos, NULL, 16);
+    if (size == 0) {
+      if (input.size() < line_end + 4) {
+        return false;
+      }
+      *consumed = line_end + 4;
+      break;
+    }
+    if (input.size() < line_end + 2 + size + 2) {
+      return false;
+    }
+    chunks.push_back(std::make_pair(line_end + 2, size));
+    pos = line_end + 2 + size + 2;
+  }
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    body->append(input, chunks[i].first, chunks[i].second);
+  }
+  return true;
+}
+
+StalledTestServer::StalledTestServer() : listener_(-1), port_(0) {}
+
+StalledTestServer::~StalledTestServer() {
+  if (listener_ >= 0) {
+    close(listener_);
+  }
+}
+
+Status StalledTestServer::Start() {
+  listener_ = socket(AF_INET, SOCK_STREAM, 0);
+  if (listener_ < 0) {
+    return Status::MakeFromSystemError(errno);
+  }
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(addr);
+  if (bind(listener_, reinterpret_cast<sockaddr*>(&addr), len) != 0 ||
+      listen(listener_, 128) != 0 ||
+      getsockname(listener_, reinterpret_cast<sockaddr*>(&addr), &len) != 0) {
+    return Status::MakeFromSystemError(errno);
+  }
+  port_ = ntohs(addr.sin_port);
+  return Status::OK();
+}
+
+std::string StalledTestServer::Url(const char* scheme,
+                                   const char* path) const {
+  char prefix[48];
+  snprintf(prefix, sizeof(prefix), "%s://127.0.0.1:%d", scheme, port_);
+  return std::string(prefix) + path;
+}
+
+}  // namespace enquery
@@ -0,0 +1,223 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef HTTP_HTTP_TEST_SERVER_H_
+#define HTTP_HTTP_TEST_SERVER_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "enquery/status.h"
+#include "http/http2_test_session.h"
+
+namespace enquery {
+
+// A small keep-alive HTTP/1.1 server on the loopback interface, for tests
+// and benchmarks. It runs on threads of its own, each driving a Reactor
+// (epoll) over the connections it accepted. Every request is answered
+// with a body whose size is given by the path, e.g. "GET /4096" returns
+// 4096 bytes, except that "/echo" returns the request body and
+// "/status/<code>" returns that status code. Request bodies may be sized
+// or chunked, and requests may be pipelined. If built with zlib,
+// gzip-encoded request bodies are decoded and responses are compressed
+// for clients that accept gzip.
+//
+// For testing caches, the query "max_age=<s>" or "no_store" adds a
+// Cache-Control header to the response and "etag=<tag>" an ETag; a
+// request whose If-None-Match matches the tag is answered "304 Not
+// Modified", without a body. For testing how clients cope with slow or
+// failing servers, "delay_ms=<n>" holds the response back for n
+// milliseconds, "chunked" sends its body chunked, and "fault=<name>"
+// fails the request as Settings::set_fault() describes, where the name is
+// "reset", "close", "truncate" or "error". Queries may be combined with
+// '&'.
+//
+// Clients that start with the HTTP/2 connection preface are answered in
+// HTTP/2 ("h2c" with prior knowledge), with the same responses; delays,
+// chunking and faults apply to HTTP/1.1 only.
+class HttpTestServer {
+ public:
+  // Ways to fail a request.
+  typedef enum Fault {
+    FAULT_NONE,
+    FAULT_RESET,     // Reset the connection instead of answering.
+    FAULT_CLOSE,     // Close the connection instead of answering.
+    FAULT_TRUNCATE,  // Send half the response, then close the connection.
+    FAULT_ERROR      // Answer "503 Service Unavailable", without a body.
+  } Fault;
+
+  // Settings for all of the requests a server answers.
+  class Settings {
+   public:
+    Settings()
+        : thread_count_(1),
+          latency_ms_(0),
+          chunked_(false),
+          fault_(FAULT_NONE),
+          fault_every_(0) {}
+
+    // Set the number of threads serving connections (default 1). Each
+    // connection is served by the thread that accepted it.
+    Settings& set_thread_count(int count) {
+      thread_count_ = count;
+      return *this;
+    }
+
+    // Get the number of threads serving connections.
+    int thread_count() const { return thread_count_; }
+
+    // Hold back every response for 'latency_ms' milliseconds (default 0),
+    // as if the server took that long to work it out. Responses on one
+    // connection still go out in order.
+    Settings& set_latency_ms(int latency_ms) {
+      latency_ms_ = latency_ms;
+      return *this;
+    }
+
+    // Get the time every response is held back for.
+    int latency_ms() const { return latency_ms_; }
+
+    // Send every response body chunked, rather than with a Content-Length
+    // (default false.)
+    Settings& set_chunked_responses(bool chunked) {
+      chunked_ = chunked;
+      return *this;
+    }
+
+    // Get whether response bodies are sent chunked.
+    bool chunked_responses() const { return chunked_; }
+
+    // Fail one request in every 'every' (counted across all connections)
+    // with 'fault'. Zero (the default) fails none.
+    Settings& set_fault(Fault fault, int every) {
+      fault_ = fault;
+      fault_every_ = every;
+      return *this;
+    }
+
+    // Get the fault injected, and how often.
+    Fault fault() const { return fault_; }
+    int fault_every() const { return fault_every_; }
+
+   private:
+    int thread_count_;
+    int latency_ms_;
+    bool chunked_;
+    Fault fault_;
+    int fault_every_;
+  };
+
+  HttpTestServer();
+  explicit HttpTestServer(const Settings& settings);
+  ~HttpTestServer();
+
+  // Listen on an ephemeral port and start serving.
+  Status Start();
+
+  // Return the port being listened on.
+  int port() const { return port_; }
+
+  // Return the URL of 'path' (which should begin with '/') on the server.
+  std::string Url(const char* path) const;
+
+  // Return the number of connections accepted so far.
+  uint64_t connections_accepted() const;
+
+  // Return the number of requests answered so far, faults included.
+  uint64_t requests_served() const;
+
+  // Return the number of bytes read from clients so far.
+  uint64_t bytes_received() const;
+
+  // Return the number of requests failed on purpose so far.
+  uint64_t faults_injected() const;
+
+  // Return the most HTTP/2 streams that have been open at once on one
+  // connection.
+  uint64_t max_concurrent_streams() const;
+
+ private:
+  class Worker;
+
+  // A request, and then the response to it, whatever the protocol.
+  struct Exchange {
+    Exchange()
+        : http2(false),
+          code(200),
+          delay_ms(0),
+          chunked(false),
+          fault(FAULT_NONE) {}
+    bool http2;
+    std::string path;
+    std::string content_encoding;  // Of the request body.
+    std::string accept_encoding;
+    std::string if_none_match;
+    std::string body;  // The request body, replaced by the response's.
+    int code;
+    Http2TestSession::Headers headers;  // Of the response, but its length.
+    int delay_ms;  // Before the response is sent.
+    bool chunked;  // Whether its body is sent chunked.
+    Fault fault;
+  };
+
+  HttpTestServer(const HttpTestServer& no_copy);
+  HttpTestServer& operator=(const HttpTestServer& no_assign);
+
+  void Answer(Exchange* exchange);
+  static void ReadQuery(Exchange* exchange, size_t start);
+  static bool AddCacheHeaders(Exchange* exchange, size_t start);
+  static bool FindHeader(const std::string& head, const char* name,
+                         std::string* value);
+  static bool ReadBody(const std::string& input, size_t start,
+                       const std::string& head, std::string* body,
+                       size_t* consumed);
+
+  const Settings settings_;
+  int listener_;
+  int port_;
+  std::vector<Worker*> workers_;
+  uint64_t connections_accepted_;
+  uint64_t requests_served_;
+  uint64_t bytes_received_;
+  uint64_t faults_injected_;
+  uint64_t max_concurrent_streams_;
+};
+
+// A server that never answers, for testing timeouts. It listens on the
+// loopback interface but never accepts, so connections complete (into the
+// listen queue) and whatever is sent on them goes unread.
+class StalledTestServer {
+ public:
+  StalledTestServer();
+  ~StalledTestServer();
+
+  // Listen on an ephemeral port.
+  Status Start();
+
+  // Return the URL of 'path' on the server, with 'scheme' ("http" or
+  // "https".)
+  std::string Url(const char* scheme, const char* path) const;
+
+ private:
+  StalledTestServer(const StalledTestServer& no_copy);
+  StalledTestServer& operator=(const StalledTestServer& no_assign);
+
+  int listener_;
+  int port_;
+};
+
+}  // namespace enquery
+
+#endif  // HTTP_HTTP_TEST_SERVER_H_
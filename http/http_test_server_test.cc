@@ -0,0 +1,209 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "http/http_test_server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "enquery/async_http_client.h"
+#include "enquery/futures.h"
+#include "enquery/http.h"
+#include "enquery/http_client.h"
+#include "enquery/http_request.h"
+#include "enquery/http_response.h"
+#include "enquery/portability.h"
+#include "enquery/shared.h"
+#include "enquery/slice.h"
+#include "enquery/status.h"
+#include "enquery/testing.h"
+
+using ::enquery::AsyncHttpClient;
+using ::enquery::Future;
+using ::enquery::Http;
+using ::enquery::HttpClient;
+using ::enquery::HttpRequest;
+using ::enquery::HttpResponse;
+using ::enquery::HttpResult;
+using ::enquery::HttpTestServer;
+using ::enquery::MonotonicNanos;
+using ::enquery::Shared;
+using ::enquery::Slice;
+using ::enquery::Status;
+
+namespace {
+
+// Send a GET for 'path' on 'server' with a new client, so that no request
+// is retried on a connection left over from another.
+Shared<HttpResponse>::Ptr Get(Http* http, const HttpTestServer& server,
+                              const char* path, Status* status) {
+  Shared<HttpClient>::Ptr client(http->CreateClient(status));
+  ASSERT_TRUE(status->IsSuccess());
+  const std::string uri = server.Url(path);
+  return Shared<HttpResponse>::Ptr(
+      client->SendRequest(HttpRequest().set_uri(uri.c_str()), status));
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  Status status;
+  Shared<Http>::Ptr http(Http::Create(&status));
+  ASSERT_TRUE(status.IsSuccess());
+
+  // Responses are held back by the server's latency, or by the request's.
+  {
+    HttpTestServer server(HttpTestServer::Settings().set_latency_ms(50));
+    ASSERT_TRUE(server.Start().IsSuccess());
+    uint64_t start = MonotonicNanos();
+    Shared<HttpResponse>::Ptr response =
+        Get(http.get(), server, "/100", &status);
+    ASSERT_TRUE(status.IsSuccess());
+    ASSERT_EQUALS(response->BodySize(), 100u);
+    ASSERT_TRUE(MonotonicNanos() - start >= 50000000u);
+
+    start = MonotonicNanos();
+    response = Get(http.get(), server, "/100?delay_ms=120", &status);
+    ASSERT_TRUE(status.IsSuccess());
+    ASSERT_TRUE(MonotonicNanos() - start >= 120000000u);
+  }
+
+  // Pipelined responses go out in order, even when a later one is due
+  // first.
+  {
+    HttpTestServer server;
+    ASSERT_TRUE(server.Start().IsSuccess());
+    Shared<Http>::Ptr native(
+        Http::Create(::enquery::HTTP_ENGINE_NATIVE, &status));
+    Shared<AsyncHttpClient>::Ptr client(native->CreateAsyncClient(
+        AsyncHttpClient::Settings()
+            .set_max_connections_per_host(1)
+            .set_max_pipelined_requests(4),
+        &status));
+    ASSERT_TRUE(status.IsSuccess());
+    const char* const paths[] = {"/1?delay_ms=100", "/2", "/3?delay_ms=20",
+                                 "/4"};
+    std::vector<Future<HttpResult> > futures;
+    for (int i = 0; i < 4; ++i) {
+      const std::string uri = server.Url(paths[i]);
+      futures.push_back(Future<HttpResult>());
+      ASSERT_TRUE(client->SendRequest(HttpRequest().set_uri(uri.c_str()),
+                                      &futures.back())
+                      .IsSuccess());
+    }
+    for (int i = 0; i < 4; ++i) {
+      HttpResult result = futures[i].GetValue();
+      ASSERT_TRUE(result.status().IsSuccess());
+      ASSERT_EQUALS(result.response()->BodySize(),
+                    static_cast<size_t>(i + 1));
+    }
+    ASSERT_EQUALS(server.connections_accepted(), 1u);
+  }
+
+  // Bodies may be sent chunked, as set for the server or asked for.
+  {
+    HttpTestServer server(
+        HttpTestServer::Settings().set_chunked_responses(true));
+    ASSERT_TRUE(server.Start().IsSuccess());
+    Shared<HttpResponse>::Ptr response =
+        Get(http.get(), server, "/100000", &status);
+    ASSERT_TRUE(status.IsSuccess());
+    ASSERT_EQUALS(response->BodySize(), 100000u);
+    Slice value;
+    ASSERT_TRUE(response->FindHeader("Transfer-Encoding", &value));
+    ASSERT_TRUE(!response->FindHeader("Content-Length", &value));
+
+    response = Get(http.get(), server, "/0", &status);
+    ASSERT_TRUE(status.IsSuccess());
+    ASSERT_EQUALS(response->BodySize(), 0u);
+  }
+  {
+    HttpTestServer server;
+    ASSERT_TRUE(server.Start().IsSuccess());
+    Shared<HttpResponse>::Ptr response =
+        Get(http.get(), server, "/5000?chunked", &status);
+    ASSERT_TRUE(status.IsSuccess());
+    ASSERT_EQUALS(response->BodySize(), 5000u);
+    Slice value;
+    ASSERT_TRUE(response->FindHeader("Transfer-Encoding", &value));
+  }
+
+  // Faults fail requests, and the server carries on serving others.
+  {
+    HttpTestServer server;
+    ASSERT_TRUE(server.Start().IsSuccess());
+    Get(http.get(), server, "/10?fault=reset", &status);
+    ASSERT_TRUE(status.IsFailure());
+    Get(http.get(), server, "/10?fault=close", &status);
+    ASSERT_TRUE(status.IsFailure());
+    Get(http.get(), server, "/100000?fault=truncate", &status);
+    ASSERT_TRUE(status.IsFailure());
+    Shared<HttpResponse>::Ptr response =
+        Get(http.get(), server, "/10?fault=error", &status);
+    ASSERT_TRUE(status.IsSuccess());
+    ASSERT_EQUALS(response->StatusCode(), 503);
+    ASSERT_EQUALS(server.faults_injected(), 4u);
+
+    response = Get(http.get(), server, "/10", &status);
+    ASSERT_TRUE(status.IsSuccess());
+    ASSERT_EQUALS(response->StatusCode(), 200);
+  }
+  {
+    HttpTestServer server(HttpTestServer::Settings().set_fault(
+        HttpTestServer::FAULT_ERROR, 3));
+    ASSERT_TRUE(server.Start().IsSuccess());
+    Shared<HttpClient>::Ptr client(http->CreateClient(&status));
+    const std::string uri = server.Url("/10");
+    int errors = 0;
+    for (int i = 0; i < 9; ++i) {
+      Shared<HttpResponse>::Ptr response(
+          client->SendRequest(HttpRequest().set_uri(uri.c_str()), &status));
+      ASSERT_TRUE(status.IsSuccess());
+      if (response->StatusCode() == 503) {
+        ++errors;
+      }
+    }
+    ASSERT_EQUALS(errors, 3);
+    ASSERT_EQUALS(server.faults_injected(), 3u);
+  }
+
+  // Several threads share many connections (eight from each of the
+  // client's I/O threads.)
+  {
+    HttpTestServer server(HttpTestServer::Settings().set_thread_count(4));
+    ASSERT_TRUE(server.Start().IsSuccess());
+    Shared<AsyncHttpClient>::Ptr client(http->CreateAsyncClient(
+        AsyncHttpClient::Settings().set_io_thread_count(2)
+            .set_max_connections_per_host(8),
+        &status));
+    ASSERT_TRUE(status.IsSuccess());
+    const std::string uri = server.Url("/1000");
+    std::vector<Future<HttpResult> > futures(400);
+    for (size_t i = 0; i < futures.size(); ++i) {
+      ASSERT_TRUE(client->SendRequest(HttpRequest().set_uri(uri.c_str()),
+                                      &futures[i])
+                      .IsSuccess());
+    }
+    for (size_t i = 0; i < futures.size(); ++i) {
+      HttpResult result = futures[i].GetValue();
+      ASSERT_TRUE(result.status().IsSuccess());
+      ASSERT_EQUALS(result.response()->BodySize(), 1000u);
+    }
+    ASSERT_EQUALS(server.requests_served(), 400u);
+    ASSERT_TRUE(server.connections_accepted() <= 16);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -13,4 +13,17 @@
 // limitations under the License. See the AUTHORS file for names of
 // contributors.
 
-int main(int argc, char* argv[]) { return 0; }
+#include "http/http_util.h"
+#include <string.h>
+#include <string>
+
+namespace enquery {
+
+std::string HostFromUri(const char* uri) {
+  const char* start = strstr(uri, "://");
+  start = start ? start + 3 : uri;
+  const size_t length = strcspn(start, "/?#");
+  return std::string(uri, start - uri + length);
+}
+
+}  // namespace enquery
@@ -0,0 +1,49 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef HTTP_HTTP_UTIL_H_
+#define HTTP_HTTP_UTIL_H_
+
+#include <stdint.h>
+#include <string>
+
+namespace enquery {
+
+// Return the part of 'uri' that identifies the server: the scheme, host
+// and port, e.g. "https://example.com:8443".
+std::string HostFromUri(const char* uri);
+
+// A fast, small random number generator (xorshift64*), good enough for
+// spreading load and retries out. Not thread-safe.
+class XorShiftRandom {
+ public:
+  // Start the sequence from 'seed', which mustn't be zero.
+  explicit XorShiftRandom(uint64_t seed) : state_(seed) {}
+
+  // Return the next number in the sequence.
+  uint64_t Next() {
+    state_ ^= state_ >> 12;
+    state_ ^= state_ << 25;
+    state_ ^= state_ >> 27;
+    return state_ * 2685821657736338717ull;
+  }
+
+ private:
+  uint64_t state_;
+};
+
+}  // namespace enquery
+
+#endif  // HTTP_HTTP_UTIL_H_
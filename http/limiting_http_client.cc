@@ -0,0 +1,424 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "enquery/limiting_http_client.h"
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "enquery/futures.h"
+#include "enquery/http_client.h"
+#include "enquery/http_request.h"
+#include "enquery/http_response.h"
+#include "enquery/mutex.h"
+#include "enquery/portability.h"
+#include "enquery/scope_lock.h"
+#include "enquery/scope_pointer.h"
+#include "enquery/shared.h"
+#include "enquery/status.h"
+#include "enquery/utility.h"
+#include "http/http_util.h"
+
+namespace enquery {
+
+namespace {
+
+const char kModule[] = "LimitingHttpClient";
+
+// Round trips after which the shortest is forgotten, in favour of the
+// shortest since, so that it follows a host whose latency changes.
+const uint64_t kRttWindow = 500;
+
+// Stands for a round trip time not yet seen.
+const uint64_t kNoRtt = ~0ULL;
+
+// The weight of each new limit chosen by the GRADIENT algorithm, against
+// the limit before it.
+const double kGradientSmoothing = 0.2;
+
+// Return true if 'result' suggests that the host is overloaded.
+bool IsOverload(const HttpResult& result) {
+  if (result.status().IsFailure()) {
+    const errno_t code = result.status().GetCode();
+    return code == kHttpConnectTimeout || code == kHttpDeadlineExceeded ||
+           code == kHttpTooSlow;
+  }
+  const int status_code = result.response()->StatusCode();
+  return status_code == 429 || status_code == 503;
+}
+
+}  // namespace
+
+class LimitingHttpClient::Rep {
+ public:
+  Rep(AsyncHttpClient* client, const Settings& settings)
+      : client_(client),
+        settings_(settings),
+        mutex_("LimitingHttpClient"),
+        stopping_(false),
+        requests_(0),
+        queued_(0),
+        rejected_(0),
+        overloads_(0) {}
+
+  ~Rep() {
+    // The wrapped client completes the requests in flight, which mustn't
+    // start the ones waiting; those then fail.
+    {
+      ScopeLock lock(&mutex_);
+      stopping_ = true;
+    }
+    delete client_;
+
+    const HttpResult shut_down(Status::MakeError(kModule, "client shut down"),
+                               Shared<HttpResponse>::Ptr());
+    for (std::map<std::string, Host>::iterator it = hosts_.begin();
+         it != hosts_.end(); ++it) {
+      for (size_t i = 0; i < it->second.queue.size(); ++i) {
+        it->second.queue[i]->promise.SetValue(shut_down);
+      }
+    }
+  }
+
+  Status Init() const {
+    if (client_ == NULL) {
+      return Status::MakeError(kModule, "client was null");
+    }
+    if (settings_.min_limit() < 1 ||
+        settings_.initial_limit() < settings_.min_limit() ||
+        settings_.max_limit() < settings_.initial_limit()) {
+      return Status::MakeError(kModule,
+                               "limits must be positive and ordered");
+    }
+    if (settings_.backoff_ratio() <= 0 || settings_.backoff_ratio() > 1) {
+      return Status::MakeError(kModule, "backoff ratio must be in (0, 1]");
+    }
+    if (settings_.rtt_tolerance() < 1) {
+      return Status::MakeError(kModule, "RTT tolerance must be at least 1");
+    }
+    if (settings_.max_queued_per_host() < 0) {
+      return Status::MakeError(kModule, "queue size must not be negative");
+    }
+    return Status::OK();
+  }
+
+  Status SendRequest(const HttpRequest& request, Future<HttpResult>* future) {
+    assert(future != NULL);
+    Shared<Call>::Ptr call(new Call(request, HostFromUri(request.uri())));
+    bool send = false;
+    {
+      ScopeLock lock(&mutex_);
+      Host& host = FindHost(call->host);
+      if (host.in_flight < Capacity(host)) {
+        ++host.in_flight;
+        active_.insert(call.get());
+        send = true;
+      } else if (host.queue.size() <
+                 static_cast<size_t>(settings_.max_queued_per_host())) {
+        host.queue.push_back(call);
+        ++queued_;
+      } else {
+        ++rejected_;
+        return Status::MakeError(kModule, "too many requests to host", EBUSY);
+      }
+      ++requests_;
+    }
+    *future = call->promise.GetFuture();
+    if (send) {
+      Send(call);
+    }
+    return Status::OK();
+  }
+
+  void Cancel(const Future<HttpResult>& future) {
+    Shared<Call>::Ptr waiting;
+    Future<HttpResult> attempt;
+    bool sent = false;
+    {
+      ScopeLock lock(&mutex_);
+      for (std::map<std::string, Host>::iterator it = hosts_.begin();
+           it != hosts_.end() && waiting.get() == NULL; ++it) {
+        std::deque<Shared<Call>::Ptr>& queue = it->second.queue;
+        for (size_t i = 0; i < queue.size(); ++i) {
+          if (queue[i]->promise.GetFuture() == future) {
+            waiting = queue[i];
+            queue.erase(queue.begin() + i);
+            break;
+          }
+        }
+      }
+      if (waiting.get() == NULL) {
+        for (std::set<Call*>::iterator it = active_.begin();
+             it != active_.end(); ++it) {
+          Call* call = *it;
+          if (call->promise.GetFuture() == future) {
+            call->cancelled = true;
+            attempt = call->attempt;
+            sent = call->sent;
+            break;
+          }
+        }
+      }
+    }
+    if (waiting.get() != NULL) {
+      waiting->promise.SetValue(HttpResult(
+          Status::MakeError(kModule, "request cancelled", ECANCELED),
+          Shared<HttpResponse>::Ptr()));
+    } else if (sent) {
+      client_->Cancel(attempt);
+    }
+  }
+
+  HttpStream* OpenStream(const HttpRequest& request, Status* status) {
+    return client_->OpenStream(request, status);
+  }
+
+  HttpByteCounts GetByteCounts() const { return client_->GetByteCounts(); }
+
+  double GetLimit(const char* uri) const {
+    ScopeLock lock(&mutex_);
+    std::map<std::string, Host>::const_iterator it =
+        hosts_.find(HostFromUri(uri));
+    return it == hosts_.end() ? settings_.initial_limit() : it->second.limit;
+  }
+
+  void GetStatistics(LimitingHttpClient::Statistics* stats) const {
+    assert(stats != NULL);
+    ScopeLock lock(&mutex_);
+    stats->set_requests(requests_)
+        .set_queued(queued_)
+        .set_rejected(rejected_)
+        .set_overloads(overloads_);
+  }
+
+ private:
+  // A request, from when it is accepted until its result is delivered.
+  struct Call {
+    Call(const HttpRequest& r, const std::string& h)
+        : request(r), host(h), sent_at(0), sent(false), cancelled(false) {}
+    const HttpRequest request;
+    const std::string host;
+    Promise<HttpResult> promise;
+
+    // Guarded by the client's mutex.
+    uint64_t sent_at;
+    Future<HttpResult> attempt;  // Set once 'sent'.
+    bool sent;
+    bool cancelled;
+  };
+
+  // The state of one host.
+  struct Host {
+    Host()
+        : limit(0),
+          in_flight(0),
+          min_rtt(kNoRtt),
+          window_min_rtt(kNoRtt),
+          samples(0) {}
+    double limit;
+    int in_flight;
+    std::deque<Shared<Call>::Ptr> queue;  // Waiting for the limit.
+    uint64_t min_rtt;         // The shortest round trip recently.
+    uint64_t window_min_rtt;  // The shortest in the current window.
+    uint64_t samples;
+  };
+
+  // Return the state of 'name', adding it if it is new. The caller holds
+  // the lock.
+  Host& FindHost(const std::string& name) {
+    std::map<std::string, Host>::iterator it = hosts_.find(name);
+    if (it == hosts_.end()) {
+      it = hosts_.insert(std::make_pair(name, Host())).first;
+      it->second.limit = settings_.initial_limit();
+    }
+    return it->second;
+  }
+
+  // Return the number of requests that may be in flight to 'host'.
+  static int Capacity(const Host& host) {
+    return std::max(1, static_cast<int>(host.limit));
+  }
+
+  // Send 'call', which has been counted as in flight.
+  void Send(Shared<Call>::Ptr call) {
+    const uint64_t sent_at = MonotonicNanos();
+    Future<HttpResult> attempt;
+    const Status status = client_->SendRequest(call->request, &attempt);
+    if (status.IsFailure()) {
+      Complete(call, HttpResult(status, Shared<HttpResponse>::Ptr()), false);
+      return;
+    }
+    bool cancelled = false;
+    {
+      ScopeLock lock(&mutex_);
+      call->sent_at = sent_at;
+      call->attempt = attempt;
+      call->sent = true;
+      cancelled = call->cancelled;
+    }
+    if (cancelled) {
+      client_->Cancel(attempt);
+    }
+    attempt.Notify(OnDone, this, call);
+  }
+
+  static void OnDone(Rep* rep, Shared<Call>::Ptr call) {
+    rep->Complete(call, call->attempt.GetValue(), true);
+  }
+
+  // Deliver 'result' for 'call', which frees its place for a waiting
+  // request; 'sampled' says whether the result tells of the host's load.
+  void Complete(Shared<Call>::Ptr call, const HttpResult& result,
+                bool sampled) {
+    std::vector<Shared<Call>::Ptr> ready;
+    {
+      ScopeLock lock(&mutex_);
+      active_.erase(call.get());
+      Host& host = hosts_[call->host];
+      if (sampled) {
+        Adapt(result, MonotonicNanos() - call->sent_at, &host);
+      }
+      --host.in_flight;
+      while (!stopping_ && !host.queue.empty() &&
+             host.in_flight < Capacity(host)) {
+        ready.push_back(host.queue.front());
+        host.queue.pop_front();
+        ++host.in_flight;
+        active_.insert(ready.back().get());
+      }
+    }
+    call->promise.SetValue(result);
+    for (size_t i = 0; i < ready.size(); ++i) {
+      Send(ready[i]);
+    }
+  }
+
+  // Adjust the limit of 'host' for a request that had 'result' after
+  // 'rtt' nanoseconds, and was still counted in flight. The caller holds
+  // the lock.
+  void Adapt(const HttpResult& result, uint64_t rtt, Host* host) {
+    double limit = host->limit;
+    if (IsOverload(result)) {
+      ++overloads_;
+      limit *= settings_.backoff_ratio();
+    } else if (result.status().IsFailure()) {
+      return;  // Says nothing about load.
+    } else {
+      host->min_rtt = std::min(host->min_rtt, rtt);
+      host->window_min_rtt = std::min(host->window_min_rtt, rtt);
+      if (++host->samples % kRttWindow == 0) {
+        host->min_rtt = host->window_min_rtt;
+        host->window_min_rtt = kNoRtt;
+      }
+
+      switch (settings_.algorithm()) {
+        case AIMD:
+          if (host->in_flight >= Capacity(*host)) {
+            limit += 1 / limit;
+          }
+          break;
+        case GRADIENT: {
+          const double gradient = std::max(
+              0.5, std::min(1.0, settings_.rtt_tolerance() * host->min_rtt /
+                                     std::max<uint64_t>(rtt, 1)));
+          double target = limit * gradient + sqrt(limit);
+          // A host that isn't using half its limit shows nothing about
+          // whether it could take more.
+          if (target > limit && host->in_flight * 2 < limit) {
+            target = limit;
+          }
+          limit += (target - limit) * kGradientSmoothing;
+          break;
+        }
+      }
+    }
+    host->limit = std::max<double>(settings_.min_limit(),
+                                   std::min<double>(settings_.max_limit(),
+                                                    limit));
+  }
+
+  Rep(const Rep& no_copy);
+  Rep& operator=(const Rep& no_assign);
+
+  AsyncHttpClient* const client_;
+  const Settings settings_;
+
+  // Guards the members below.
+  mutable Mutex mutex_;
+  bool stopping_;  // The client is being deleted.
+  std::map<std::string, Host> hosts_;
+  std::set<Call*> active_;  // Calls counted in flight.
+  uint64_t requests_;
+  uint64_t queued_;
+  uint64_t rejected_;
+  uint64_t overloads_;
+};
+
+LimitingHttpClient::LimitingHttpClient(Rep* rep) : rep_(rep) {
+  assert(rep != NULL);
+}
+
+LimitingHttpClient::~LimitingHttpClient() { delete rep_; }
+
+LimitingHttpClient* LimitingHttpClient::Create(AsyncHttpClient* client,
+                                               const Settings& settings,
+                                               Status* status_out) {
+  ScopePointer<Rep> rep(new Rep(client, settings));
+  Status status = rep->Init();
+  if (status.IsFailure()) {
+    MaybeAssign(status_out, status);
+    return NULL;
+  }
+
+  LimitingHttpClient* limiting_client = new LimitingHttpClient(rep.Get());
+  rep.ReleaseOwnership();
+
+  return limiting_client;
+}
+
+Status LimitingHttpClient::SendRequest(const HttpRequest& request,
+                                       Future<HttpResult>* future) {
+  return rep_->SendRequest(request, future);
+}
+
+void LimitingHttpClient::Cancel(const Future<HttpResult>& future) {
+  rep_->Cancel(future);
+}
+
+HttpStream* LimitingHttpClient::OpenStream(const HttpRequest& request,
+                                           Status* status) {
+  return rep_->OpenStream(request, status);
+}
+
+HttpByteCounts LimitingHttpClient::GetByteCounts() const {
+  return rep_->GetByteCounts();
+}
+
+double LimitingHttpClient::GetLimit(const char* uri) const {
+  return rep_->GetLimit(uri);
+}
+
+void LimitingHttpClient::GetStatistics(Statistics* stats) const {
+  rep_->GetStatistics(stats);
+}
+
+}  // namespace enquery
@@ -0,0 +1,178 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "enquery/async_http_client.h"
+#include "enquery/futures.h"
+#include "enquery/http_client.h"
+#include "enquery/http_request.h"
+#include "enquery/http_response.h"
+#include "enquery/limiting_http_client.h"
+#include "enquery/shared.h"
+#include "enquery/status.h"
+#include "enquery/testing.h"
+#include "http/http_test_client.h"
+
+using ::enquery::AsyncHttpClient;
+using ::enquery::FakeAsyncHttpClient;
+using ::enquery::Future;
+using ::enquery::HttpRequest;
+using ::enquery::HttpResult;
+using ::enquery::LimitingHttpClient;
+using ::enquery::Send;
+using ::enquery::Shared;
+using ::enquery::StatisticsOf;
+using ::enquery::Status;
+using ::enquery::Wrap;
+
+namespace {
+
+// Send a GET for 'uri', returning whether the client took the request.
+Status TrySend(AsyncHttpClient* client, const char* uri,
+               Future<HttpResult>* future) {
+  HttpRequest request;
+  request.set_uri(uri);
+  return client->SendRequest(request, future);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  // Requests over a host's limit wait, and once the queue is full are
+  // rejected. Each host has its own limit.
+  {
+    FakeAsyncHttpClient* fake = new FakeAsyncHttpClient();
+    Shared<LimitingHttpClient>::Ptr client(Wrap<LimitingHttpClient>(
+        fake, LimitingHttpClient::Settings()
+                  .set_initial_limit(2)
+                  .set_max_queued_per_host(1)));
+    Send(client.get(), "http://a/1");
+    Send(client.get(), "http://a/2");
+    Future<HttpResult> third = Send(client.get(), "http://a/3");
+    Future<HttpResult> fourth;
+    Status status = TrySend(client.get(), "http://a/4", &fourth);
+    ASSERT_EQUALS(status.GetCode(), EBUSY);
+    Send(client.get(), "http://b/1");
+    ASSERT_EQUALS(fake->waiting(), 3u);
+
+    fake->Respond(0, 200);
+    ASSERT_EQUALS(fake->waiting(), 3u);
+    ASSERT_EQUALS(fake->uri(2), "http://a/3");
+    fake->Respond(2, 200);
+    ASSERT_EQUALS(third.GetValue().response()->StatusCode(), 200);
+
+    LimitingHttpClient::Statistics stats = StatisticsOf(*client.get());
+    ASSERT_EQUALS(stats.requests(), 4u);
+    ASSERT_EQUALS(stats.queued(), 1u);
+    ASSERT_EQUALS(stats.rejected(), 1u);
+  }
+
+  // AIMD: successes at the limit raise it a little; overload cuts it,
+  // while other failures leave it be.
+  {
+    FakeAsyncHttpClient* fake = new FakeAsyncHttpClient();
+    Shared<LimitingHttpClient>::Ptr client(Wrap<LimitingHttpClient>(
+        fake, LimitingHttpClient::Settings().set_initial_limit(2)));
+    Send(client.get(), "http://a/");
+    Send(client.get(), "http://a/");
+    fake->Respond(0, 200);
+    ASSERT_EQUALS(client->GetLimit("http://a/"), 2.5);
+    fake->Respond(0, 200);  // Below the limit.
+    ASSERT_EQUALS(client->GetLimit("http://a/"), 2.5);
+    Send(client.get(), "http://a/");
+    fake->Fail(0, EIO);
+    ASSERT_EQUALS(client->GetLimit("http://a/"), 2.5);
+    Send(client.get(), "http://a/");
+    fake->Respond(0, 503);
+    ASSERT_EQUALS(client->GetLimit("http://a/"), 2.25);
+    Send(client.get(), "http://a/");
+    fake->Fail(0, enquery::kHttpDeadlineExceeded);
+    ASSERT_TRUE(client->GetLimit("http://a/") < 2.25);
+    ASSERT_EQUALS(StatisticsOf(*client.get()).overloads(), 2u);
+  }
+
+  // GRADIENT: a busy host's limit grows while round trips stay short, but
+  // not an idle one's ...
+  {
+    FakeAsyncHttpClient* fake = new FakeAsyncHttpClient();
+    Shared<LimitingHttpClient>::Ptr client(Wrap<LimitingHttpClient>(
+        fake, LimitingHttpClient::Settings()
+                  .set_algorithm(LimitingHttpClient::GRADIENT)
+                  .set_initial_limit(10)
+                  .set_rtt_tolerance(1e9)));
+    Send(client.get(), "http://a/");
+    fake->Respond(0, 200);
+    ASSERT_EQUALS(client->GetLimit("http://a/"), 10.0);
+    for (int i = 0; i < 10; ++i) {
+      Send(client.get(), "http://a/");
+    }
+    fake->Respond(0, 200);
+    ASSERT_TRUE(client->GetLimit("http://a/") > 10.0);
+  }
+
+  // ... and shrinks once they lengthen.
+  {
+    FakeAsyncHttpClient* fake = new FakeAsyncHttpClient();
+    Shared<LimitingHttpClient>::Ptr client(Wrap<LimitingHttpClient>(
+        fake, LimitingHttpClient::Settings()
+                  .set_algorithm(LimitingHttpClient::GRADIENT)
+                  .set_initial_limit(10)));
+    for (int i = 0; i < 10; ++i) {
+      Send(client.get(), "http://a/");
+    }
+    fake->Respond(0, 200);
+    Send(client.get(), "http://a/");
+    const double limit = client->GetLimit("http://a/");
+    for (int i = 0; i < 3; ++i) {
+      usleep(50000);
+      fake->Respond(0, 200);
+      Send(client.get(), "http://a/");
+    }
+    ASSERT_TRUE(client->GetLimit("http://a/") < limit);
+  }
+
+  // Requests may be cancelled while waiting or in flight.
+  {
+    FakeAsyncHttpClient* fake = new FakeAsyncHttpClient();
+    Shared<LimitingHttpClient>::Ptr client(Wrap<LimitingHttpClient>(
+        fake, LimitingHttpClient::Settings().set_initial_limit(1)));
+    Future<HttpResult> first = Send(client.get(), "http://a/1");
+    Future<HttpResult> second = Send(client.get(), "http://a/2");
+    client->Cancel(second);
+    ASSERT_EQUALS(second.GetValue().status().GetCode(), ECANCELED);
+    client->Cancel(first);
+    ASSERT_EQUALS(first.GetValue().status().GetCode(), ECANCELED);
+    ASSERT_EQUALS(fake->waiting(), 0u);
+  }
+
+  // Deleting the client fails the requests still waiting.
+  {
+    FakeAsyncHttpClient* fake = new FakeAsyncHttpClient();
+    LimitingHttpClient* client = Wrap<LimitingHttpClient>(
+        fake, LimitingHttpClient::Settings().set_initial_limit(1));
+    Future<HttpResult> first = Send(client, "http://a/1");
+    Future<HttpResult> second = Send(client, "http://a/2");
+    fake->Respond(0, 200);
+    delete client;
+    ASSERT_TRUE(first.GetValue().status().IsSuccess());
+    ASSERT_TRUE(second.GetValue().status().IsFailure());
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,1451 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "http/native_async_http_client.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "http/curl_http_response.h"
+#include "http/curl_request.h"
+#include "http/http1_codec.h"
+#include "enquery/buffer.h"
+#include "enquery/futures.h"
+#include "enquery/http_request.h"
+#include "enquery/mutex.h"
+#include "enquery/portability.h"
+#include "enquery/reactor.h"
+#include "enquery/scope_lock.h"
+#include "enquery/scope_pointer.h"
+#include "enquery/shared.h"
+#include "enquery/slice.h"
+#include "enquery/thread.h"
+#include "enquery/utility.h"
+
+namespace {
+
+const char* const kModule = "NativeAsyncHttpClient";
+
+const uint64_t kNanosPerMilli = 1000000;
+
+// Bytes read from a connection at a time.
+const size_t kReadSize = 64 * 1024;
+
+// The most receives the reactor makes at once for an I/O thread, each
+// into a buffer of kReadSize. Connections beyond them read for themselves
+// when the reactor says they are ready.
+const int kReceiveBuffers = 32;
+
+// The most parts of requests (header blocks, and the pieces of their
+// bodies) written by one system call.
+const int kMaxWriteParts = 64;
+
+// A request is sent at most this many times, when the connections it is
+// sent on close before answering it.
+const int kMaxAttempts = 2;
+
+// The most memory reserved up front for a body of known length.
+const int64_t kMaxReserve = 16 << 20;
+
+// How long a host's resolved addresses are used for, as in curl's DNS
+// cache.
+const uint64_t kResolvedNanos = 60 * 1000 * kNanosPerMilli;
+
+}  // namespace
+
+namespace enquery {
+
+namespace {
+
+struct Exchange;
+
+// Implemented by the I/O thread that runs an exchange.
+class ExchangeRunner {
+ public:
+  // Ask for 'exchange' to be resumed if it is paused, or abandoned if its
+  // stream has been deleted. May be called from any thread.
+  virtual void Poke(Exchange* exchange) = 0;
+
+ protected:
+  virtual ~ExchangeRunner() {}
+};
+
+// The state shared by a streaming exchange and its HttpStream, as for
+// CurlAsyncHttpClient.
+struct StreamState {
+  explicit StreamState(size_t limit_bytes)
+      : mutex("NativeHttpStream"),
+        limit(limit_bytes),
+        buffered(0),
+        paused(false),
+        done(false),
+        abandoned(false),
+        runner(NULL),
+        exchange(NULL) {}
+  Mutex mutex;
+  CondVar cond;
+  std::deque<std::string> chunks;
+  const size_t limit;
+  size_t buffered;         // Total size of 'chunks'.
+  bool paused;             // Reading waits for buffer space.
+  bool done;               // The exchange has ended...
+  Status status;           // ...with this status.
+  bool abandoned;          // The stream has been deleted.
+  ExchangeRunner* runner;  // NULL once the exchange has ended.
+  Exchange* exchange;
+  Shared<HttpResponse>::Ptr head;  // Set before the first of the body.
+};
+
+struct Connection;
+
+// A request, from submission until its outcome is delivered. Owned by the
+// I/O thread once submitted. The response body goes to 'body' or, for a
+// streaming request, to 'stream'.
+struct Exchange : public Http1ResponseParser::BodyHandler {
+  Exchange()
+      : head(false),
+        replayable(false),
+        request_body_bytes(0),
+        started_at(0),
+        attempts(0),
+        delivered(false),
+        connection(NULL),
+        parser(NULL) {}
+
+  virtual bool OnBody(const char* data, size_t size);
+  virtual void OnBodySize(int64_t size);
+
+  HttpRequest request;         // Its body is sent from here...
+  Http1RequestWriter writer;  // ...by this.
+  Http1Target target;
+  bool head;
+  bool replayable;
+  uint64_t request_body_bytes;
+  Http1Deadlines deadlines;
+  uint64_t started_at;
+  int attempts;
+  bool delivered;          // Ended early (e.g. cancelled); see Deliver().
+  Connection* connection;  // Carrying the request, or NULL while it waits.
+  const Http1ResponseParser* parser;  // Reading the response, once begun.
+  Shared<Buffer>::Ptr body;
+  Shared<Buffer>::Ptr headers;
+  Shared<StreamState>::Ptr stream;
+  Promise<HttpResult> promise;
+  HttpTimings timings;
+};
+
+// Give the stream of 'exchange' the head of its response, from the status
+// code and header block the parser has read, unless that has been done
+// already. Called with the stream's mutex held.
+void SetStreamHead(Exchange* exchange) {
+  StreamState* state = exchange->stream.get();
+  if (state->head.get() != NULL) {
+    return;
+  }
+  state->head = Shared<HttpResponse>::Ptr(new CurlHttpResponse(
+      TakePooledBuffer(), exchange->headers, exchange->parser->status_code(),
+      exchange->timings));
+  state->cond.Broadcast();
+}
+
+bool Exchange::OnBody(const char* data, size_t size) {
+  if (delivered) {
+    return true;  // Nobody wants it, but the connection may be reused.
+  }
+  if (StreamState* state = stream.get()) {
+    // Data is queued for the reader even past the limit; once over it,
+    // the connection stops reading until the reader catches up.
+    ScopeLock lock(&state->mutex);
+    if (state->abandoned) {
+      return false;
+    }
+    SetStreamHead(this);
+    state->chunks.push_back(std::string(data, size));
+    state->buffered += size;
+    if (state->buffered >= state->limit) {
+      state->paused = true;
+    }
+    state->cond.Signal();
+    return true;
+  }
+  body->Append(data, size);
+  return true;
+}
+
+void Exchange::OnBodySize(int64_t size) {
+  if (size > 0 && body.get()) {
+    body->Reserve(static_cast<size_t>(std::min(size, kMaxReserve)));
+  }
+}
+
+// Deliver the outcome of 'exchange', unless that has been done already.
+// An exchange that ends early (cancelled, or out of time behind others on
+// its connection) is delivered at once, and its response, if one comes,
+// is discarded.
+void Deliver(Exchange* exchange, const Status& status,
+             Shared<HttpResponse>::Ptr response) {
+  if (exchange->delivered) {
+    return;
+  }
+  exchange->delivered = true;
+  if (StreamState* stream = exchange->stream.get()) {
+    ScopeLock lock(&stream->mutex);
+    stream->done = true;
+    stream->status = status;
+    stream->runner = NULL;
+    stream->exchange = NULL;
+    stream->cond.Broadcast();
+    return;
+  }
+  exchange->promise.SetValue(HttpResult(
+      status, status.IsSuccess() ? response : Shared<HttpResponse>::Ptr()));
+}
+
+class NativeHttpStream : public HttpStream {
+ public:
+  explicit NativeHttpStream(Shared<StreamState>::Ptr state) : state_(state) {}
+
+  virtual ~NativeHttpStream() {
+    ScopeLock lock(&state_->mutex);
+    state_->abandoned = true;
+    state_->chunks.clear();
+    state_->buffered = 0;
+    if (state_->runner) {
+      state_->runner->Poke(state_->exchange);
+    }
+  }
+
+  virtual const HttpResponse* Head() {
+    ScopeLock lock(&state_->mutex);
+    while (state_->head.get() == NULL && !state_->done) {
+      state_->cond.Wait(&state_->mutex);
+    }
+    return state_->head.get();
+  }
+
+  virtual Status Next(Slice* chunk) {
+    assert(chunk != NULL);
+    current_.clear();
+    ScopeLock lock(&state_->mutex);
+    while (state_->chunks.empty() && !state_->done) {
+      state_->cond.Wait(&state_->mutex);
+    }
+    if (state_->chunks.empty()) {
+      *chunk = Slice();
+      return state_->status;
+    }
+
+    current_.swap(state_->chunks.front());
+    state_->chunks.pop_front();
+    state_->buffered -= current_.size();
+    *chunk = Slice(current_.data(), current_.size());
+
+    // Resume at half full, as CurlHttpStream does.
+    if (state_->paused && state_->buffered <= state_->limit / 2) {
+      state_->paused = false;
+      if (state_->runner) {
+        state_->runner->Poke(state_->exchange);
+      }
+    }
+    return Status::OK();
+  }
+
+ private:
+  NativeHttpStream(const NativeHttpStream& no_copy);
+  NativeHttpStream& operator=(const NativeHttpStream& no_assign);
+
+  Shared<StreamState>::Ptr state_;
+  std::string current_;
+};
+
+struct Host;
+
+// A connection to a host, and the exchanges it carries, in the order
+// their requests were sent. The first is the one being answered.
+struct Connection {
+  Connection(int socket, Host* to)
+      : fd(socket),
+        host(to),
+        connecting(true),
+        reused(false),
+        paused(false),
+        receiving(false),
+        events(0),
+        written(0),
+        idle_since(0),
+        connect_deadline(0) {}
+  const int fd;
+  Host* const host;
+  bool connecting;
+  bool reused;  // Has answered a request.
+  bool paused;     // Not reading, while a stream's reader catches up.
+  bool receiving;  // The reactor is receiving for it.
+  int events;      // Watched for.
+  std::deque<Exchange*> exchanges;
+  size_t written;  // Exchanges whose requests have been written.
+  Http1ResponseParser parser;  // For the first exchange.
+  Http1SpeedCheck speed;       // Likewise.
+  uint64_t idle_since;
+  uint64_t connect_deadline;
+};
+
+// The requests waiting for a connection to a host, its connections, and
+// the addresses its name resolved to.
+struct Host {
+  Host() : resolved_at(0), resolving(false) {}
+  Http1HeadCache heads;  // Of the requests sent to the host.
+  std::deque<Exchange*> waiting;
+  std::vector<Connection*> connections;
+  std::vector<Http1Address> addresses;
+  uint64_t resolved_at;  // When 'addresses' were found, or zero.
+  bool resolving;
+};
+
+// The outcome of resolving a host's name, off the I/O thread.
+struct Resolution {
+  std::string authority;  // Of the host.
+  Status status;
+  std::vector<Http1Address> addresses;
+};
+
+Status Cancelled() {
+  return Status::MakeError(kModule, "request cancelled", ECANCELED);
+}
+
+Status ConnectionLost() {
+  return Status::MakeError(kModule, "connection closed by server",
+                           kHttpConnectionLost);
+}
+
+Status DeadlineExceeded() {
+  return Status::MakeError(kModule, "request deadline exceeded",
+                           kHttpDeadlineExceeded);
+}
+
+// Return the earlier of two deadlines, where zero means none.
+uint64_t Earliest(uint64_t a, uint64_t b) {
+  if (a == 0 || b == 0) {
+    return a + b;
+  }
+  return std::min(a, b);
+}
+
+// Make an exchange for a copy of 'request'. The caller owns it.
+Status MakeExchange(const HttpRequest& request,
+                    const AsyncHttpClient::Settings& settings,
+                    Exchange** exchange_out) {
+  ScopePointer<Exchange> exchange(new Exchange());
+  if (!ParseHttp1Target(request.uri(), &exchange->target)) {
+    return Status::MakeError(kModule,
+                             "only valid http:// URIs are supported",
+                             EPROTONOSUPPORT);
+  }
+  exchange->request = request;
+  exchange->head = request.method() == HttpRequest::HEAD;
+  exchange->replayable = IsHttp1Replayable(request.method());
+  if (request.HasBody()) {
+    exchange->request_body_bytes =
+        std::max(request.BodySize(), static_cast<int64_t>(0));
+  }
+  exchange->started_at = MonotonicNanos();
+  exchange->deadlines = MakeHttp1Deadlines(
+      request, settings.connect_timeout_ms(), settings.timeout_ms(),
+      settings.low_speed_bytes_per_second(), settings.low_speed_seconds(),
+      exchange->started_at);
+  exchange->headers = TakePooledBuffer();
+  *exchange_out = exchange.ReleaseOwnership();
+  return Status::OK();
+}
+
+}  // namespace
+
+class NativeAsyncHttpClient::IoThread : public Reactor::Handler,
+                                        public Reactor::Completion,
+                                        public ExchangeRunner {
+ public:
+  IoThread(const AsyncHttpClient::Settings& settings,
+           HttpByteCounts* byte_counts)
+      : settings_(settings),
+        idle_timeout_nanos_(settings.idle_timeout_ms() * kNanosPerMilli),
+        max_pipelined_(std::max(1, settings.max_pipelined_requests())),
+        byte_counts_(byte_counts),
+        mutex_("NativeAsyncHttpClient::IoThread"),
+        stopping_(false),
+        reactor_(NULL),
+        thread_(NULL),
+        resolver_(NULL),
+        total_connections_(0),
+        next_check_(0),
+        hosts_emptied_(false),
+        read_buffer_(kReadSize) {}
+
+  virtual ~IoThread() {
+    {
+      ScopeLock lock(&mutex_);
+      stopping_ = true;
+      resolve_cond_.Signal();
+    }
+    if (thread_) {
+      reactor_->Wakeup();
+      delete thread_;  // Joins.
+    }
+    delete resolver_;  // Joins, once any lookup under way is done.
+
+    // The thread has exited; fail whatever it left behind.
+    const Status shut_down = Status::MakeError(kModule, "client shut down");
+    for (size_t i = 0; i < pending_.size(); ++i) {
+      Complete(pending_[i], shut_down);
+    }
+    for (std::map<int, Connection*>::iterator it = connections_.begin();
+         it != connections_.end(); ++it) {
+      Connection* connection = it->second;
+      close(connection->fd);
+      for (size_t i = 0; i < connection->exchanges.size(); ++i) {
+        Complete(connection->exchanges[i], shut_down);
+      }
+      delete connection;
+    }
+    for (std::map<std::string, Host*>::iterator it = hosts_.begin();
+         it != hosts_.end(); ++it) {
+      for (size_t i = 0; i < it->second->waiting.size(); ++i) {
+        Complete(it->second->waiting[i], shut_down);
+      }
+      delete it->second;
+    }
+    delete reactor_;
+  }
+
+  Status Init() {
+    Status status;
+    reactor_ = Reactor::Create(
+        Reactor::DefaultSettings()
+            .set_backend(settings_.reactor_backend())
+            .set_buffers(kReceiveBuffers, kReadSize),
+        &status);
+    if (!reactor_) {
+      return status;
+    }
+    resolver_ = Thread::Create(ResolverMain, this, &status);
+    if (!resolver_) {
+      return status;
+    }
+    thread_ = Thread::Create(ThreadMain, this, &status);
+    return status;
+  }
+
+  // Hand an exchange to the I/O thread. Fails only if shutting down.
+  Status Submit(Exchange* exchange) {
+    bool was_empty = false;
+    {
+      ScopeLock lock(&mutex_);
+      if (stopping_) {
+        return Status::MakeError(kModule, "client shut down");
+      }
+      was_empty = pending_.empty();
+      pending_.push_back(exchange);
+    }
+
+    // The thread takes every pending exchange at once, so only the first
+    // needs to wake it.
+    if (was_empty) {
+      reactor_->Wakeup();
+    }
+    return Status::OK();
+  }
+
+  virtual void Poke(Exchange* exchange) {
+    {
+      ScopeLock lock(&mutex_);
+      poked_.push_back(exchange);
+    }
+    reactor_->Wakeup();
+  }
+
+  // Ask for the exchange whose result 'future' is to receive to be
+  // abandoned, if this thread is running it.
+  void Cancel(const Future<HttpResult>& future) {
+    {
+      ScopeLock lock(&mutex_);
+      cancelled_.push_back(future);
+    }
+    reactor_->Wakeup();
+  }
+
+  virtual void OnReady(int fd, int events) {
+    std::map<int, Connection*>::iterator it = connections_.find(fd);
+    if (it == connections_.end()) {
+      return;
+    }
+    Connection* connection = it->second;
+    if (connection->connecting) {
+      Status status = FinishHttp1Connect(fd);
+      if (status.IsFailure()) {
+        CloseConnection(connection, status, false, false);
+        return;
+      }
+      connection->connecting = false;
+      const uint64_t now = MonotonicNanos();
+      for (size_t i = 0; i < connection->exchanges.size(); ++i) {
+        Exchange* exchange = connection->exchanges[i];
+        exchange->timings.connect_nanos = now - exchange->started_at;
+      }
+      Flush(connection);
+      return;
+    }
+    if ((events & Reactor::WRITABLE) && !Flush(connection)) {
+      return;
+    }
+    if (events & Reactor::READABLE) {
+      Read(connection);
+    }
+  }
+
+  // A receive made by the reactor is done. Its connection can't have been
+  // closed meanwhile, as that would have cancelled it.
+  virtual void OnComplete(int fd, int result, char* buffer) {
+    std::map<int, Connection*>::iterator it = connections_.find(fd);
+    if (it != connections_.end()) {
+      Connection* connection = it->second;
+      bool open = false;
+      if (result > 0) {
+        open = Consume(connection, buffer, result);
+      } else if (result == 0) {
+        HandleEof(connection);
+      } else {
+        CloseConnection(connection, MakeHttp1SocketError(-result), true,
+                        true);
+      }
+      if (open) {
+        connection->receiving = false;
+        UpdateEvents(connection);
+      }
+    }
+    reactor_->ReleaseBuffer(buffer);
+  }
+
+ private:
+  IoThread(const IoThread& no_copy);
+  IoThread& operator=(const IoThread& no_assign);
+
+  static void* ThreadMain(void* arg) {
+    static_cast<IoThread*>(arg)->Run();
+    return NULL;
+  }
+
+  static void* ResolverMain(void* arg) {
+    static_cast<IoThread*>(arg)->RunResolver();
+    return NULL;
+  }
+
+  // Resolve host names for the I/O thread, which mustn't block on them.
+  void RunResolver() {
+    ScopeLock lock(&mutex_);
+    for (;;) {
+      while (to_resolve_.empty() && !stopping_) {
+        resolve_cond_.Wait(&mutex_);
+      }
+      if (stopping_) {
+        return;
+      }
+      const Http1Target target = to_resolve_.front();
+      to_resolve_.pop_front();
+      Resolution resolution;
+      resolution.authority = target.authority;
+      mutex_.Unlock();
+      resolution.status = ResolveHttp1Target(target, &resolution.addresses);
+      mutex_.Lock();
+      resolved_.push_back(resolution);
+      reactor_->Wakeup();
+    }
+  }
+
+  void Run() {
+    for (;;) {
+      std::vector<Exchange*> pending;
+      std::vector<Exchange*> poked;
+      std::vector<Future<HttpResult> > cancelled;
+      std::vector<Resolution> resolved;
+      {
+        ScopeLock lock(&mutex_);
+        if (stopping_) {
+          break;
+        }
+        pending.swap(pending_);
+        poked.swap(poked_);
+        cancelled.swap(cancelled_);
+        resolved.swap(resolved_);
+      }
+      for (size_t i = 0; i < resolved.size(); ++i) {
+        HandleResolution(resolved[i]);
+      }
+      for (size_t i = 0; i < pending.size(); ++i) {
+        Start(pending[i]);
+      }
+      for (size_t i = 0; i < poked.size(); ++i) {
+        HandlePoke(poked[i]);
+      }
+      for (size_t i = 0; i < cancelled.size(); ++i) {
+        HandleCancel(cancelled[i]);
+      }
+      FlushAssigned();
+
+      int timeout_ms = -1;
+      if (next_check_ != 0) {
+        const uint64_t now = MonotonicNanos();
+        timeout_ms = (next_check_ <= now)
+                         ? 0
+                         : static_cast<int>((next_check_ - now +
+                                             kNanosPerMilli - 1) /
+                                            kNanosPerMilli);
+      }
+      reactor_->Poll(timeout_ms);
+      CheckTimeouts(MonotonicNanos());
+      FlushAssigned();
+      EvictHosts();
+    }
+  }
+
+  // Forget the hosts with no connections and nothing waiting, so that a
+  // client that talks to many hosts over its life doesn't keep them all.
+  // A host used again has its name looked up again.
+  void EvictHosts() {
+    if (!hosts_emptied_) {
+      return;
+    }
+    hosts_emptied_ = false;
+    std::map<std::string, Host*>::iterator it = hosts_.begin();
+    while (it != hosts_.end()) {
+      Host* host = it->second;
+      if (host->connections.empty() && host->waiting.empty() &&
+          !host->resolving) {
+        delete host;
+        hosts_.erase(it++);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  // Complete 'exchange' with 'status' (unless its outcome was delivered
+  // early) and delete it.
+  void Complete(Exchange* exchange, const Status& status) {
+    Deliver(exchange, status, Shared<HttpResponse>::Ptr());
+    if (exchange->stream.get()) {
+      streams_.erase(exchange);
+    }
+    delete exchange;
+  }
+
+  // Arrange to be woken by 'deadline' (zero for none.)
+  void Watch(uint64_t deadline) {
+    if (deadline != 0 && (next_check_ == 0 || deadline < next_check_)) {
+      next_check_ = deadline;
+    }
+  }
+
+  void Start(Exchange* exchange) {
+    if (exchange->stream.get()) {
+      streams_.insert(exchange);
+    }
+    Host*& host = hosts_[exchange->target.authority];
+    if (host == NULL) {
+      host = new Host();
+    }
+    Shared<std::string>::Ptr head;
+    Status status =
+        host->heads.Get(exchange->request, exchange->target, &head);
+    if (status.IsFailure()) {
+      hosts_emptied_ = true;
+      Complete(exchange, status);
+      return;
+    }
+    exchange->writer.Reset(&exchange->request, head);
+    host->waiting.push_back(exchange);
+    Watch(Earliest(exchange->deadlines.connect, exchange->deadlines.total));
+    Dispatch(host);
+  }
+
+  // Give the requests waiting for 'host' to connections: idle ones first,
+  // then new ones while the limits allow, and then, for requests that may
+  // be pipelined, busy ones. Requests are taken in order, so one that has
+  // to wait holds up those behind it.
+  void Dispatch(Host* host) {
+    while (!host->waiting.empty()) {
+      Exchange* exchange = host->waiting.front();
+      Connection* connection = FindIdle(host);
+      if (connection == NULL && MayOpen(host)) {
+        if (host->resolved_at == 0 ||
+            MonotonicNanos() - host->resolved_at >= kResolvedNanos) {
+          Resolve(host, exchange->target);
+        } else {
+          Status status;
+          connection = Open(host, exchange, &status);
+          if (connection == NULL) {
+            host->waiting.pop_front();
+            hosts_emptied_ = true;
+            Complete(exchange, status);
+            continue;
+          }
+        }
+      }
+      if (connection == NULL) {
+        connection = FindPipeline(host, *exchange);
+      }
+      if (connection == NULL) {
+        break;
+      }
+      host->waiting.pop_front();
+      Assign(connection, exchange);
+    }
+  }
+
+  Connection* FindIdle(Host* host) {
+    for (size_t i = 0; i < host->connections.size(); ++i) {
+      if (host->connections[i]->exchanges.empty()) {
+        return host->connections[i];
+      }
+    }
+    return NULL;
+  }
+
+  // Return the connection with the shortest pipeline that 'exchange' may
+  // join, if there is one.
+  Connection* FindPipeline(Host* host, const Exchange& exchange) {
+    if (!exchange.replayable || max_pipelined_ < 2) {
+      return NULL;
+    }
+    Connection* best = NULL;
+    for (size_t i = 0; i < host->connections.size(); ++i) {
+      Connection* connection = host->connections[i];
+      const size_t length = connection->exchanges.size();
+      if (length < max_pipelined_ && !connection->paused &&
+          connection->exchanges.front()->replayable &&
+          (best == NULL || length < best->exchanges.size())) {
+        best = connection;
+      }
+    }
+    return best;
+  }
+
+  // Have the name of 'host' resolved, unless that is under way; it is
+  // dispatched to again once it has been.
+  void Resolve(Host* host, const Http1Target& target) {
+    if (host->resolving) {
+      return;
+    }
+    host->resolving = true;
+    ScopeLock lock(&mutex_);
+    to_resolve_.push_back(target);
+    resolve_cond_.Signal();
+  }
+
+  void HandleResolution(const Resolution& resolution) {
+    Host* host = hosts_[resolution.authority];
+    host->resolving = false;
+    if (resolution.status.IsFailure()) {
+      hosts_emptied_ = true;
+      // Every request waiting would fail the same way.
+      while (!host->waiting.empty()) {
+        Exchange* exchange = host->waiting.front();
+        host->waiting.pop_front();
+        Complete(exchange, resolution.status);
+      }
+      return;
+    }
+    host->addresses = resolution.addresses;
+    host->resolved_at = MonotonicNanos();
+    for (size_t i = 0; i < host->waiting.size(); ++i) {
+      Exchange* exchange = host->waiting[i];
+      exchange->timings.dns_nanos = host->resolved_at - exchange->started_at;
+    }
+    Dispatch(host);
+  }
+
+  bool MayOpen(const Host* host) const {
+    const int per_host = settings_.max_connections_per_host();
+    const int total = settings_.max_total_connections();
+    return (per_host <= 0 ||
+            host->connections.size() < static_cast<size_t>(per_host)) &&
+           (total <= 0 || total_connections_ < static_cast<size_t>(total));
+  }
+
+  // Start a connection to 'host' for 'exchange'.
+  Connection* Open(Host* host, Exchange* exchange, Status* status) {
+    int fd = -1;
+    *status = StartHttp1Connect(host->addresses, &fd);
+    if (status->IsFailure()) {
+      return NULL;
+    }
+    *status = reactor_->Add(fd, Reactor::WRITABLE, this);
+    if (status->IsFailure()) {
+      close(fd);
+      return NULL;
+    }
+    Connection* connection = new Connection(fd, host);
+    connection->events = Reactor::WRITABLE;
+    connection->connect_deadline =
+        Earliest(exchange->deadlines.connect, exchange->deadlines.total);
+    connections_[fd] = connection;
+    host->connections.push_back(connection);
+    ++total_connections_;
+    Watch(connection->connect_deadline);
+    return connection;
+  }
+
+  void Assign(Connection* connection, Exchange* exchange) {
+    exchange->connection = connection;
+    ++exchange->attempts;
+    connection->exchanges.push_back(exchange);
+    if (connection->exchanges.size() == 1) {
+      StartResponse(connection);
+    }
+    if (!connection->connecting) {
+      assigned_.push_back(connection->fd);
+    }
+  }
+
+  // Get ready to read the response to the first exchange.
+  void StartResponse(Connection* connection) {
+    Exchange* exchange = connection->exchanges.front();
+    connection->parser.Reset(exchange->head, exchange->headers.get(),
+                             exchange);
+    exchange->parser = &connection->parser;
+    connection->speed.Start(exchange->deadlines, MonotonicNanos());
+    Watch(connection->speed.period_end());
+  }
+
+  // Write the requests given to connections since they were last
+  // flushed. Writing them together, rather than each as it is assigned,
+  // lets one system call carry several.
+  void FlushAssigned() {
+    std::vector<int> assigned;
+    assigned.swap(assigned_);
+    for (size_t i = 0; i < assigned.size(); ++i) {
+      std::map<int, Connection*>::iterator it = connections_.find(assigned[i]);
+      if (it != connections_.end() && !it->second->connecting) {
+        Flush(it->second);
+      }
+    }
+  }
+
+  // Write as much of the requests as the socket will take. Requests are
+  // gathered into one system call until one that isn't all ready, such as
+  // one whose body is read a piece at a time. Return false if the
+  // connection failed and was closed.
+  bool Flush(Connection* connection) {
+    while (connection->written < connection->exchanges.size()) {
+      struct iovec iov[kMaxWriteParts];
+      size_t sizes[kMaxWriteParts];  // Gathered from each exchange in turn.
+      int count = 0;
+      size_t gathered = 0;
+      for (size_t i = connection->written;
+           i < connection->exchanges.size() && count < kMaxWriteParts &&
+           gathered < static_cast<size_t>(kMaxWriteParts);
+           ++i) {
+        int used = 0;
+        bool complete = false;
+        Status status = connection->exchanges[i]->writer.Gather(
+            iov + count, kMaxWriteParts - count, &used, &complete);
+        if (status.IsFailure()) {
+          FailBody(connection, i, status);
+          return false;
+        }
+        sizes[gathered] = 0;
+        for (int j = count; j < count + used; ++j) {
+          sizes[gathered] += iov[j].iov_len;
+        }
+        ++gathered;
+        count += used;
+        if (!complete) {
+          break;
+        }
+      }
+
+      ssize_t n = 0;
+      if (count > 0) {
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = iov;
+        message.msg_iovlen = count;
+        n = sendmsg(connection->fd, &message, MSG_NOSIGNAL);
+      }
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+          break;
+        }
+        CloseConnection(connection, MakeHttp1SocketError(errno), true, true);
+        return false;
+      }
+
+      size_t left = static_cast<size_t>(n);
+      for (size_t i = 0; i < gathered; ++i) {
+        Http1RequestWriter& writer =
+            connection->exchanges[connection->written]->writer;
+        const size_t sent = std::min(left, sizes[i]);
+        writer.Advance(sent);
+        left -= sent;
+        if (!writer.done()) {
+          break;
+        }
+        ++connection->written;
+      }
+    }
+    UpdateEvents(connection);
+    return true;
+  }
+
+  // Fail the exchange at 'index' on 'connection', whose body couldn't be
+  // read, with 'status'. Part of its request may have been sent, so the
+  // connection is closed; the others on it are sent again if they may be.
+  void FailBody(Connection* connection, size_t index, const Status& status) {
+    Exchange* exchange = connection->exchanges[index];
+    connection->exchanges.erase(connection->exchanges.begin() + index);
+    exchange->connection = NULL;
+    Complete(exchange, status);
+    CloseConnection(connection, ConnectionLost(), true, true);
+  }
+
+  void Read(Connection* connection) {
+    for (;;) {
+      const ssize_t n =
+          recv(connection->fd, &read_buffer_[0], read_buffer_.size(), 0);
+      if (n > 0) {
+        if (!Consume(connection, &read_buffer_[0], n)) {
+          return;
+        }
+        // A short read means the socket is drained, which saves asking.
+        if (connection->paused || static_cast<size_t>(n) < kReadSize) {
+          return;
+        }
+        continue;
+      }
+      if (n == 0) {
+        HandleEof(connection);
+        return;
+      }
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        CloseConnection(connection, MakeHttp1SocketError(errno), true, true);
+      }
+      return;
+    }
+  }
+
+  // Parse data received on 'connection', finishing exchanges as their
+  // responses complete. Return false if the connection was closed.
+  bool Consume(Connection* connection, const char* data, size_t size) {
+    const uint64_t now = MonotonicNanos();
+    while (size > 0) {
+      if (connection->exchanges.empty()) {
+        CloseConnection(connection,
+                        Status::MakeError(kModule, "unexpected data", EPROTO),
+                        false, false);
+        return false;
+      }
+      Exchange* exchange = connection->exchanges.front();
+      if (exchange->timings.first_byte_nanos == 0) {
+        exchange->timings.first_byte_nanos = now - exchange->started_at;
+      }
+      size_t used = 0;
+      Status status = connection->parser.Parse(data, size, &used);
+      connection->speed.Add(used);
+      if (status.IsFailure()) {
+        CloseConnection(connection, status, false, true);
+        return false;
+      }
+      data += used;
+      size -= used;
+      if (connection->parser.done() && !FinishExchange(connection)) {
+        return false;
+      }
+    }
+
+    // A stream whose reader has fallen behind holds up the connection.
+    if (!connection->exchanges.empty()) {
+      if (StreamState* stream = connection->exchanges.front()->stream.get()) {
+        ScopeLock lock(&stream->mutex);
+        connection->paused = stream->paused && !stream->abandoned;
+      }
+      UpdateEvents(connection);
+    }
+    return true;
+  }
+
+  // The response to the first exchange on 'connection' is complete.
+  // Return false if the connection was closed.
+  bool FinishExchange(Connection* connection) {
+    Exchange* exchange = connection->exchanges.front();
+    connection->exchanges.pop_front();
+    const bool written = connection->written > 0;
+    if (written) {
+      --connection->written;
+    }
+    connection->reused = true;
+    connection->paused = false;
+    exchange->connection = NULL;
+
+    const uint64_t now = MonotonicNanos();
+    AddByteCounts(*exchange, connection->parser);
+    Shared<HttpResponse>::Ptr response;
+    if (exchange->delivered) {
+      // Nobody wants the response.
+    } else if (StreamState* state = exchange->stream.get()) {
+      // A response without a body still has a head.
+      ScopeLock lock(&state->mutex);
+      SetStreamHead(exchange);
+    } else {
+      exchange->timings.total_nanos = now - exchange->started_at;
+      response = Shared<HttpResponse>::Ptr(new CurlHttpResponse(
+          exchange->body, exchange->headers, connection->parser.status_code(),
+          exchange->timings));
+    }
+    Deliver(exchange, Status::OK(), response);
+    Complete(exchange, Status::OK());
+
+    // A server may answer before it has read the whole request, but then
+    // the rest of it can't be sent on the same connection.
+    if (!connection->parser.keep_alive() || !written) {
+      CloseConnection(connection, ConnectionLost(), true, true);
+      return false;
+    }
+    if (!connection->exchanges.empty()) {
+      StartResponse(connection);
+    } else {
+      connection->idle_since = now;
+      Watch(now + idle_timeout_nanos_);
+    }
+    Dispatch(connection->host);
+    return true;
+  }
+
+  void HandleEof(Connection* connection) {
+    Http1ResponseParser& parser = connection->parser;
+    if (!connection->exchanges.empty() && parser.started() &&
+        !parser.done()) {
+      Status status = parser.Finish();
+      if (status.IsSuccess()) {
+        FinishExchange(connection);  // Closes the connection.
+      } else {
+        CloseConnection(connection, status, false, true);
+      }
+      return;
+    }
+    CloseConnection(connection, ConnectionLost(), true, true);
+  }
+
+  // Close 'connection'. The first exchange completes with 'status', unless
+  // 'retry_first' and it may be sent again; the rest are sent again if
+  // 'retry_rest', or also complete. Requests are sent again only if the
+  // connection had answered none of them, and no more than kMaxAttempts
+  // times; a request that isn't replayable only if the connection was
+  // reused, since then the server most likely closed it as it was idle.
+  void CloseConnection(Connection* connection, const Status& status,
+                       bool retry_first, bool retry_rest) {
+    reactor_->Remove(connection->fd);
+    close(connection->fd);
+    connections_.erase(connection->fd);
+    --total_connections_;
+    Host* host = connection->host;
+    host->connections.erase(std::find(host->connections.begin(),
+                                      host->connections.end(), connection));
+    hosts_emptied_ = true;
+    std::deque<Exchange*> exchanges;
+    exchanges.swap(connection->exchanges);
+    const bool answering =
+        connection->parser.started() && !connection->parser.done();
+    const bool reused = connection->reused;
+    delete connection;
+
+    std::vector<Exchange*> again;
+    for (size_t i = 0; i < exchanges.size(); ++i) {
+      Exchange* exchange = exchanges[i];
+      exchange->connection = NULL;
+      bool retry = false;
+      if (i == 0) {
+        retry = retry_first && !answering && (exchange->replayable || reused);
+      } else {
+        retry = retry_rest;
+      }
+      if (retry && !exchange->delivered &&
+          exchange->attempts < kMaxAttempts && exchange->writer.Rewind()) {
+        again.push_back(exchange);
+      } else {
+        Complete(exchange, (i == 0 || !retry_rest) ? status : ConnectionLost());
+      }
+    }
+    for (size_t i = again.size(); i > 0; --i) {
+      host->waiting.push_front(again[i - 1]);
+    }
+    Dispatch(host);
+  }
+
+  // Watch 'connection' for what it is waiting to do. Responses are
+  // received by the reactor, or read here once the connection is ready if
+  // the reactor has no buffer to spare.
+  void UpdateEvents(Connection* connection) {
+    int events = 0;
+    if (connection->connecting ||
+        connection->written < connection->exchanges.size()) {
+      events |= Reactor::WRITABLE;
+    }
+    if (!connection->connecting && !connection->paused &&
+        !connection->receiving) {
+      char* buffer = reactor_->AcquireBuffer();
+      if (buffer != NULL &&
+          reactor_->Receive(connection->fd, buffer, reactor_->buffer_size(),
+                            this)
+              .IsSuccess()) {
+        connection->receiving = true;
+      } else {
+        if (buffer != NULL) {
+          reactor_->ReleaseBuffer(buffer);
+        }
+        events |= Reactor::READABLE;
+      }
+    }
+    if (events != connection->events) {
+      reactor_->Modify(connection->fd, events);
+      connection->events = events;
+    }
+  }
+
+  // Resume or abandon a streaming exchange, if it hasn't already ended.
+  void HandlePoke(Exchange* exchange) {
+    if (streams_.find(exchange) == streams_.end()) {
+      return;
+    }
+    bool abandoned = false;
+    {
+      ScopeLock lock(&exchange->stream->mutex);
+      abandoned = exchange->stream->abandoned;
+    }
+    Connection* connection = exchange->connection;
+    if (!abandoned) {
+      if (connection && connection->paused) {
+        connection->paused = false;
+        UpdateEvents(connection);
+      }
+      return;
+    }
+
+    const Status status = Status::MakeError(kModule, "stream abandoned");
+    if (connection == NULL) {
+      std::deque<Exchange*>& waiting =
+          hosts_[exchange->target.authority]->waiting;
+      waiting.erase(std::find(waiting.begin(), waiting.end(), exchange));
+      hosts_emptied_ = true;
+      Complete(exchange, status);
+    } else if (connection->exchanges.front() == exchange) {
+      CloseConnection(connection, status, false, true);
+    } else {
+      Deliver(exchange, status, Shared<HttpResponse>::Ptr());
+    }
+  }
+
+  // Abandon the exchange whose result 'future' is to receive, if this
+  // thread has it. Exchanges are searched one by one, as in
+  // CurlAsyncHttpClient. One that is being answered takes its connection
+  // with it; one behind it in a pipeline ends at once, and its response is
+  // discarded when it comes.
+  void HandleCancel(const Future<HttpResult>& future) {
+    for (std::map<std::string, Host*>::iterator it = hosts_.begin();
+         it != hosts_.end(); ++it) {
+      std::deque<Exchange*>& waiting = it->second->waiting;
+      for (size_t i = 0; i < waiting.size(); ++i) {
+        Exchange* exchange = waiting[i];
+        if (exchange->stream.get() == NULL &&
+            exchange->promise.GetFuture() == future) {
+          waiting.erase(waiting.begin() + i);
+          hosts_emptied_ = true;
+          Complete(exchange, Cancelled());
+          return;
+        }
+      }
+    }
+    for (std::map<int, Connection*>::iterator it = connections_.begin();
+         it != connections_.end(); ++it) {
+      Connection* connection = it->second;
+      for (size_t i = 0; i < connection->exchanges.size(); ++i) {
+        Exchange* exchange = connection->exchanges[i];
+        if (exchange->stream.get() == NULL && !exchange->delivered &&
+            exchange->promise.GetFuture() == future) {
+          if (i == 0) {
+            CloseConnection(connection, Cancelled(), false, true);
+          } else {
+            Deliver(exchange, Cancelled(), Shared<HttpResponse>::Ptr());
+          }
+          return;
+        }
+      }
+    }
+  }
+
+  // Fail exchanges and close connections whose time is up, and work out
+  // when to look again.
+  void CheckTimeouts(uint64_t now) {
+    if (next_check_ == 0 || now < next_check_) {
+      return;
+    }
+    next_check_ = 0;
+
+    // While a host's name is resolved, its requests are connecting.
+    for (std::map<std::string, Host*>::iterator it = hosts_.begin();
+         it != hosts_.end(); ++it) {
+      std::deque<Exchange*>& waiting = it->second->waiting;
+      const bool resolving = it->second->resolving;
+      for (size_t i = 0; i < waiting.size();) {
+        Exchange* exchange = waiting[i];
+        const uint64_t total = exchange->deadlines.total;
+        const uint64_t connect = resolving ? exchange->deadlines.connect : 0;
+        if (total != 0 && now >= total) {
+          waiting.erase(waiting.begin() + i);
+          hosts_emptied_ = true;
+          Complete(exchange, DeadlineExceeded());
+        } else if (connect != 0 && now >= connect) {
+          waiting.erase(waiting.begin() + i);
+          hosts_emptied_ = true;
+          Complete(exchange, MakeHttp1SocketError(ETIMEDOUT));
+        } else {
+          Watch(Earliest(connect, total));
+          ++i;
+        }
+      }
+    }
+
+    // Closing a connection may open others, so the connections are
+    // looked up again one by one.
+    std::vector<int> fds;
+    for (std::map<int, Connection*>::iterator it = connections_.begin();
+         it != connections_.end(); ++it) {
+      fds.push_back(it->first);
+    }
+    for (size_t i = 0; i < fds.size(); ++i) {
+      std::map<int, Connection*>::iterator it = connections_.find(fds[i]);
+      if (it != connections_.end()) {
+        CheckConnection(it->second, now);
+      }
+    }
+  }
+
+  void CheckConnection(Connection* connection, uint64_t now) {
+    if (connection->connecting) {
+      if (now < connection->connect_deadline) {
+        Watch(connection->connect_deadline);
+        return;
+      }
+      const uint64_t total = connection->exchanges.front()->deadlines.total;
+      CloseConnection(connection,
+                      total != 0 && total <= connection->connect_deadline
+                          ? DeadlineExceeded()
+                          : MakeHttp1SocketError(ETIMEDOUT),
+                      false, false);
+      return;
+    }
+    if (connection->exchanges.empty()) {
+      if (now - connection->idle_since >= idle_timeout_nanos_) {
+        CloseConnection(connection, Status::OK(), false, false);
+      } else {
+        Watch(connection->idle_since + idle_timeout_nanos_);
+      }
+      return;
+    }
+
+    // Exchanges behind the first can only end early.
+    for (size_t i = 1; i < connection->exchanges.size(); ++i) {
+      Exchange* exchange = connection->exchanges[i];
+      const uint64_t deadline = exchange->deadlines.total;
+      if (exchange->delivered || deadline == 0) {
+        continue;
+      }
+      if (now >= deadline) {
+        Deliver(exchange, DeadlineExceeded(), Shared<HttpResponse>::Ptr());
+      } else {
+        Watch(deadline);
+      }
+    }
+    Exchange* first = connection->exchanges.front();
+    const uint64_t deadline = first->delivered ? 0 : first->deadlines.total;
+    if (deadline != 0 && now >= deadline) {
+      CloseConnection(connection, DeadlineExceeded(), false, true);
+      return;
+    }
+    if (!connection->paused && !connection->speed.Check(now)) {
+      CloseConnection(connection,
+                      Status::MakeError(kModule, "transfer too slow",
+                                        kHttpTooSlow),
+                      false, true);
+      return;
+    }
+    Watch(deadline);
+    if (!connection->paused) {
+      Watch(connection->speed.period_end());
+    }
+  }
+
+  void AddByteCounts(const Exchange& exchange,
+                     const Http1ResponseParser& parser) {
+    __atomic_add_fetch(&byte_counts_->request_body_bytes,
+                       exchange.request_body_bytes, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&byte_counts_->request_wire_bytes,
+                       exchange.writer.sent(), __ATOMIC_RELAXED);
+    __atomic_add_fetch(&byte_counts_->response_wire_bytes,
+                       parser.wire_bytes(), __ATOMIC_RELAXED);
+    __atomic_add_fetch(&byte_counts_->response_body_bytes,
+                       parser.body_bytes(), __ATOMIC_RELAXED);
+  }
+
+  const AsyncHttpClient::Settings settings_;
+  const uint64_t idle_timeout_nanos_;
+  const size_t max_pipelined_;
+  HttpByteCounts* const byte_counts_;  // Owned by the client.
+
+  // Guards the members below, which are shared with submitting threads.
+  Mutex mutex_;
+  std::vector<Exchange*> pending_;
+  std::vector<Exchange*> poked_;
+  std::vector<Future<HttpResult> > cancelled_;
+  std::deque<Http1Target> to_resolve_;
+  std::vector<Resolution> resolved_;
+  CondVar resolve_cond_;  // Signalled when 'to_resolve_' grows.
+  bool stopping_;
+
+  // Used only by the I/O thread, once started.
+  Reactor* reactor_;
+  Thread* thread_;
+  Thread* resolver_;
+  std::map<std::string, Host*> hosts_;
+  std::map<int, Connection*> connections_;
+  size_t total_connections_;
+  std::set<Exchange*> streams_;  // Streaming exchanges not yet deleted.
+  std::vector<int> assigned_;    // Connections given requests to write.
+  uint64_t next_check_;          // When to check for timeouts, if ever.
+  bool hosts_emptied_;           // Some host may now be unused.
+  std::vector<char> read_buffer_;
+};
+
+NativeAsyncHttpClient::NativeAsyncHttpClient(
+    const AsyncHttpClient::Settings& settings)
+    : settings_(settings), next_thread_(0) {}
+
+NativeAsyncHttpClient::~NativeAsyncHttpClient() {
+  for (size_t i = 0; i < threads_.size(); ++i) {
+    delete threads_[i];
+  }
+}
+
+AsyncHttpClient* NativeAsyncHttpClient::Create(
+    const AsyncHttpClient::Settings& settings, Status* status_out) {
+  ScopePointer<NativeAsyncHttpClient> client(
+      new NativeAsyncHttpClient(settings));
+  Status status = client->Init();
+  MaybeAssign(status_out, status);
+  if (status.IsFailure()) {
+    return NULL;
+  }
+  return client.ReleaseOwnership();
+}
+
+Status NativeAsyncHttpClient::Init() {
+  if (settings_.io_thread_count() < 1) {
+    return Status::MakeError(kModule, "I/O thread count must be positive");
+  }
+  for (int i = 0; i < settings_.io_thread_count(); ++i) {
+    IoThread* thread = new IoThread(settings_, &byte_counts_);
+    threads_.push_back(thread);
+    Status status = thread->Init();
+    if (status.IsFailure()) {
+      return status;
+    }
+  }
+  return Status::OK();
+}
+
+HttpByteCounts NativeAsyncHttpClient::GetByteCounts() const {
+  return LoadByteCounts(byte_counts_);
+}
+
+NativeAsyncHttpClient::IoThread* NativeAsyncHttpClient::NextThread() {
+  const unsigned int index = __sync_fetch_and_add(&next_thread_, 1);
+  return threads_[index % threads_.size()];
+}
+
+Status NativeAsyncHttpClient::SendRequest(const HttpRequest& request,
+                                          Future<HttpResult>* future) {
+  assert(future != NULL);
+  Exchange* exchange = NULL;
+  Status status = MakeExchange(request, settings_, &exchange);
+  if (status.IsFailure()) {
+    return status;
+  }
+  exchange->body = TakePooledBuffer();
+  Future<HttpResult> result = exchange->promise.GetFuture();
+  status = NextThread()->Submit(exchange);
+  if (status.IsFailure()) {
+    delete exchange;
+    return status;
+  }
+  *future = result;
+  return Status::OK();
+}
+
+void NativeAsyncHttpClient::Cancel(const Future<HttpResult>& future) {
+  // The future doesn't say which thread has the exchange, so every
+  // thread looks for it.
+  for (size_t i = 0; i < threads_.size(); ++i) {
+    threads_[i]->Cancel(future);
+  }
+}
+
+HttpStream* NativeAsyncHttpClient::OpenStream(const HttpRequest& request,
+                                              Status* status_out) {
+  Exchange* exchange = NULL;
+  Status status = MakeExchange(request, settings_, &exchange);
+  if (status.IsFailure()) {
+    MaybeAssign(status_out, status);
+    return NULL;
+  }
+  IoThread* thread = NextThread();
+  exchange->stream = Shared<StreamState>::Ptr(new StreamState(
+      std::max(static_cast<size_t>(1), settings_.stream_buffer_size())));
+  exchange->stream->runner = thread;
+  exchange->stream->exchange = exchange;
+  ScopePointer<HttpStream> stream(new NativeHttpStream(exchange->stream));
+
+  status = thread->Submit(exchange);
+  MaybeAssign(status_out, status);
+  if (status.IsFailure()) {
+    exchange->stream->runner = NULL;
+    delete exchange;
+    return NULL;
+  }
+  return stream.ReleaseOwnership();
+}
+
+}  // namespace enquery
@@ -0,0 +1,77 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef HTTP_NATIVE_ASYNC_HTTP_CLIENT_H_
+#define HTTP_NATIVE_ASYNC_HTTP_CLIENT_H_
+
+#include <vector>
+#include "enquery/async_http_client.h"
+#include "enquery/status.h"
+
+namespace enquery {
+
+class HttpRequest;
+
+// An AsyncHttpClient that speaks HTTP/1.1 over plain TCP itself, without
+// curl. Each I/O thread drives its own connections with a Reactor:
+// requests are written with as few system calls as the socket allows,
+// header blocks from a cache kept for each host and bodies from the copy
+// of the request, as the socket takes them, and responses are parsed as
+// they are read, straight into pooled buffers. Connections
+// are kept open between requests and, with max_pipelined_requests, carry
+// several GET or HEAD requests at once; requests that a connection was
+// closed under before they were answered are sent again on another.
+// Host names are resolved by a thread beside each I/O thread, so that a
+// slow lookup holds up only the requests to that host, and the addresses
+// found are used for a minute before they are looked up again.
+class NativeAsyncHttpClient : public AsyncHttpClient {
+ public:
+  virtual ~NativeAsyncHttpClient();
+
+  // Create a client and start its I/O threads. Returns NULL on failure
+  // and populates the caller's (optional) Status.
+  static AsyncHttpClient* Create(const AsyncHttpClient::Settings& settings,
+                                 Status* status);
+
+  virtual Status SendRequest(const HttpRequest& request,
+                             Future<HttpResult>* future);
+
+  virtual void Cancel(const Future<HttpResult>& future);
+
+  virtual HttpStream* OpenStream(const HttpRequest& request, Status* status);
+
+  virtual HttpByteCounts GetByteCounts() const;
+
+ private:
+  class IoThread;
+
+  explicit NativeAsyncHttpClient(const AsyncHttpClient::Settings& settings);
+  NativeAsyncHttpClient(const NativeAsyncHttpClient& no_copy);
+  NativeAsyncHttpClient& operator=(const NativeAsyncHttpClient& no_assign);
+
+  Status Init();
+
+  // Return the I/O thread for the next request, round-robin.
+  IoThread* NextThread();
+
+  const AsyncHttpClient::Settings settings_;
+  std::vector<IoThread*> threads_;
+  unsigned int next_thread_;
+  HttpByteCounts byte_counts_;
+};
+
+}  // namespace enquery
+
+#endif  // HTTP_NATIVE_ASYNC_HTTP_CLIENT_H_
@@ -0,0 +1,81 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "http/native_http.h"
+#include <errno.h>
+#include <stdlib.h>
+#include "http/http1_codec.h"
+#include "http/native_async_http_client.h"
+#include "http/native_http_client.h"
+#include "enquery/status.h"
+#include "enquery/utility.h"
+
+namespace {
+
+using ::enquery::HttpVersion;
+using ::enquery::Status;
+
+// Return an error if the native engine can't honour these settings.
+Status CheckSettings(bool accept_encoding, size_t compress_requests_above,
+                     HttpVersion version) {
+  if (accept_encoding || compress_requests_above > 0) {
+    return Status::MakeError(enquery::kNativeHttpModule,
+                             "compression is not supported", ENOTSUP);
+  }
+  if (version == enquery::HTTP_VERSION_2_PRIOR_KNOWLEDGE) {
+    return Status::MakeError(enquery::kNativeHttpModule,
+                             "HTTP/2 is not supported", ENOTSUP);
+  }
+  return Status::OK();
+}
+
+}  // namespace
+
+namespace enquery {
+
+NativeHttp::NativeHttp() {}
+
+NativeHttp::~NativeHttp() {}
+
+Http* NativeHttp::Create(Status* status) {
+  MaybeAssign(status, Status::OK());
+  return new NativeHttp();
+}
+
+HttpClient* NativeHttp::CreateClient(const HttpClient::Settings& settings,
+                                     Status* status_out) {
+  Status status = CheckSettings(settings.accept_encoding(),
+                                settings.compress_requests_above(),
+                                settings.http_version());
+  MaybeAssign(status_out, status);
+  if (status.IsFailure()) {
+    return NULL;
+  }
+  return new NativeHttpClient(settings);
+}
+
+AsyncHttpClient* NativeHttp::CreateAsyncClient(
+    const AsyncHttpClient::Settings& settings, Status* status_out) {
+  Status status = CheckSettings(settings.accept_encoding(),
+                                settings.compress_requests_above(),
+                                settings.http_version());
+  if (status.IsFailure()) {
+    MaybeAssign(status_out, status);
+    return NULL;
+  }
+  return NativeAsyncHttpClient::Create(settings, status_out);
+}
+
+}  // namespace enquery
@@ -0,0 +1,53 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef HTTP_NATIVE_HTTP_H_
+#define HTTP_NATIVE_HTTP_H_
+
+#include "enquery/http.h"
+#include "enquery/status.h"
+
+namespace enquery {
+
+// NativeHttp creates clients that speak HTTP/1.1 themselves rather than
+// through curl. They handle plain http:// only, and neither compress
+// requests nor ask for compressed responses; settings that need either
+// are refused.
+class NativeHttp : public Http {
+ public:
+  virtual ~NativeHttp();
+
+  // Create an instance of the http library.
+  static Http* Create(Status* status);
+
+  using Http::CreateClient;
+
+  // Create an instance of an http client.
+  virtual HttpClient* CreateClient(const HttpClient::Settings& settings,
+                                   Status* status);
+
+  // Create an asynchronous http client.
+  virtual AsyncHttpClient* CreateAsyncClient(
+      const AsyncHttpClient::Settings& settings, Status* status);
+
+ private:
+  NativeHttp();
+  NativeHttp(const NativeHttp& copy_from);
+  NativeHttp& operator=(const NativeHttp& assign_from);
+};
+
+}  // namespace enquery
+
+#endif  // HTTP_NATIVE_HTTP_H_
@@ -0,0 +1,477 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "http/native_http_client.h"
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "http/curl_http_response.h"
+#include "http/curl_request.h"
+#include "http/http1_codec.h"
+#include "enquery/buffer.h"
+#include "enquery/http_request.h"
+#include "enquery/http_response.h"
+#include "enquery/portability.h"
+#include "enquery/scope_lock.h"
+#include "enquery/shared.h"
+#include "enquery/slice.h"
+#include "enquery/trace.h"
+#include "enquery/utility.h"
+
+namespace {
+
+const uint64_t kNanosPerMilli = 1000000;
+
+// Bytes read from a connection at a time.
+const size_t kReadSize = 16 * 1024;
+
+// The most memory reserved up front for a body of known length; longer
+// bodies grow as they arrive.
+const int64_t kMaxReserve = 16 << 20;
+
+// Collects a response body into a buffer.
+class BufferHandler : public enquery::Http1ResponseParser::BodyHandler {
+ public:
+  explicit BufferHandler(enquery::Buffer* buffer) : buffer_(buffer) {}
+
+  virtual bool OnBody(const char* data, size_t size) {
+    buffer_->Append(data, size);
+    return true;
+  }
+
+  virtual void OnBodySize(int64_t size) {
+    if (size > 0) {
+      buffer_->Reserve(static_cast<size_t>(std::min(size, kMaxReserve)));
+    }
+  }
+
+ private:
+  enquery::Buffer* buffer_;
+};
+
+// Passes a response on to a sink: the head, from the status code and
+// header block the parser has read, then the body.
+class SinkHandler : public enquery::Http1ResponseParser::BodyHandler {
+ public:
+  SinkHandler(enquery::HttpSink* sink,
+              const enquery::Http1ResponseParser* parser,
+              enquery::Shared<enquery::Buffer>::Ptr headers,
+              const enquery::HttpTimings* timings)
+      : sink_(sink), parser_(parser), headers_(headers), timings_(timings),
+        started_(false) {}
+
+  // Pass the head on, unless that has been done already.
+  bool Start() {
+    if (started_) {
+      return true;
+    }
+    started_ = true;
+    const enquery::CurlHttpResponse head(enquery::TakePooledBuffer(),
+                                         headers_, parser_->status_code(),
+                                         *timings_);
+    return sink_->OnResponse(head);
+  }
+
+  virtual bool OnBody(const char* data, size_t size) {
+    return Start() && sink_->OnData(enquery::Slice(data, size));
+  }
+
+ private:
+  enquery::HttpSink* sink_;
+  const enquery::Http1ResponseParser* parser_;
+  enquery::Shared<enquery::Buffer>::Ptr headers_;
+  const enquery::HttpTimings* timings_;
+  bool started_;
+};
+
+// Wait for 'events' on 'fd' until 'deadline' (a MonotonicNanos() time, or
+// zero for no limit.) Return zero once ready, ETIMEDOUT if the deadline
+// passes first, or another error.
+int WaitFor(int fd, short events, uint64_t deadline) {  // NOLINT
+  for (;;) {
+    int timeout_ms = -1;
+    if (deadline != 0) {
+      const uint64_t now = enquery::MonotonicNanos();
+      if (now >= deadline) {
+        return ETIMEDOUT;
+      }
+      timeout_ms = static_cast<int>((deadline - now + kNanosPerMilli - 1) /
+                                    kNanosPerMilli);
+    }
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = events;
+    pfd.revents = 0;
+    const int result = poll(&pfd, 1, timeout_ms);
+    if (result > 0) {
+      return 0;
+    }
+    if (result < 0 && errno != EINTR) {
+      return errno;
+    }
+  }
+}
+
+// Return the earlier of two deadlines, where zero means none.
+uint64_t Earliest(uint64_t a, uint64_t b) {
+  if (a == 0 || b == 0) {
+    return a + b;
+  }
+  return std::min(a, b);
+}
+
+// Return true if the server has closed 'fd' (or it has failed) while it
+// was idle.
+bool IsClosed(int fd) {
+  char byte;
+  const ssize_t n = recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+  return n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+}
+
+enquery::Status DeadlineExceeded() {
+  return enquery::Status::MakeError(enquery::kNativeHttpModule,
+                                    "request deadline exceeded",
+                                    enquery::kHttpDeadlineExceeded);
+}
+
+// Connect to 'target' within 'deadlines', setting 'fd' to the socket.
+enquery::Status Connect(const enquery::Http1Target& target,
+                        const enquery::Http1Deadlines& deadlines, int* fd) {
+  enquery::Status status = enquery::StartHttp1Connect(target, fd);
+  if (status.IsFailure()) {
+    return status;
+  }
+  const int error =
+      WaitFor(*fd, POLLOUT, Earliest(deadlines.connect, deadlines.total));
+  if (error == 0) {
+    status = enquery::FinishHttp1Connect(*fd);
+  } else if (error != ETIMEDOUT) {
+    status = enquery::MakeHttp1SocketError(error);
+  } else if (deadlines.total != 0 && deadlines.total <= deadlines.connect) {
+    status = DeadlineExceeded();
+  } else {
+    status = enquery::MakeHttp1SocketError(ETIMEDOUT);
+  }
+  if (status.IsFailure()) {
+    close(*fd);
+    *fd = -1;
+  }
+  return status;
+}
+
+}  // namespace
+
+namespace enquery {
+
+NativeHttpClient::NativeHttpClient(const HttpClient::Settings& settings)
+    : settings_(settings),
+      idle_timeout_nanos_(settings.idle_timeout_ms() * kNanosPerMilli),
+      pool_mutex_("NativeHttpClient::pool"),
+      next_eviction_(0) {}
+
+NativeHttpClient::~NativeHttpClient() {
+  for (std::map<std::string, IdleList>::iterator it = idle_.begin();
+       it != idle_.end(); ++it) {
+    CloseConnections(std::vector<Connection*>(it->second.begin(),
+                                              it->second.end()));
+  }
+}
+
+NativeHttpClient::Connection* NativeHttpClient::AcquireConnection(
+    const std::string& host) {
+  std::vector<Connection*> expired;
+  Connection* connection = NULL;
+  {
+    ScopeLock lock(&pool_mutex_);
+    const uint64_t now = MonotonicNanos();
+    EvictExpired(now, &expired);
+    std::map<std::string, IdleList>::iterator it = idle_.find(host);
+    if (it != idle_.end()) {
+      // Take the most recently used connection: it is the least likely
+      // to have been closed by the server.
+      IdleList& list = it->second;
+      while (!list.empty() && connection == NULL) {
+        Connection* newest = list.back();
+        list.pop_back();
+        if (now - newest->idle_since <= idle_timeout_nanos_ &&
+            !IsClosed(newest->fd)) {
+          connection = newest;
+        } else {
+          expired.push_back(newest);
+        }
+      }
+    }
+  }
+  CloseConnections(expired);
+  return connection;
+}
+
+void NativeHttpClient::ReleaseConnection(const std::string& host,
+                                         Connection* connection) {
+  std::vector<Connection*> expired;
+  if (settings_.max_idle_per_host() <= 0) {
+    expired.push_back(connection);
+  } else {
+    ScopeLock lock(&pool_mutex_);
+    const uint64_t now = MonotonicNanos();
+    connection->idle_since = now;
+    IdleList& list = idle_[host];
+    list.push_back(connection);
+    while (list.size() > static_cast<size_t>(settings_.max_idle_per_host())) {
+      expired.push_back(list.front());
+      list.pop_front();
+    }
+    EvictExpired(now, &expired);
+  }
+  CloseConnections(expired);
+}
+
+void NativeHttpClient::CloseConnections(
+    const std::vector<Connection*>& connections) {
+  for (size_t i = 0; i < connections.size(); ++i) {
+    close(connections[i]->fd);
+    delete connections[i];
+  }
+}
+
+void NativeHttpClient::EvictExpired(uint64_t now,
+                                    std::vector<Connection*>* expired) {
+  // As in CurlHttpClient, sweep at most twice per timeout.
+  if (now < next_eviction_) {
+    return;
+  }
+  next_eviction_ = now + idle_timeout_nanos_ / 2;
+
+  std::map<std::string, IdleList>::iterator it = idle_.begin();
+  while (it != idle_.end()) {
+    IdleList& list = it->second;
+    while (!list.empty() &&
+           now - list.front()->idle_since > idle_timeout_nanos_) {
+      expired->push_back(list.front());
+      list.pop_front();
+    }
+    if (list.empty()) {
+      idle_.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+}
+
+HttpByteCounts NativeHttpClient::GetByteCounts() const {
+  return LoadByteCounts(byte_counts_);
+}
+
+HttpResponse* NativeHttpClient::SendRequest(const HttpRequest& request,
+                                            Status* status_out) {
+  HttpResponse* response = NULL;
+  Status status = Perform(request, NULL, &response);
+  MaybeAssign(status_out, status);
+  return response;
+}
+
+Status NativeHttpClient::StreamRequest(const HttpRequest& request,
+                                       HttpSink* sink) {
+  assert(sink != NULL);
+  return Perform(request, sink, NULL);
+}
+
+Status NativeHttpClient::Perform(const HttpRequest& request, HttpSink* sink,
+                                 HttpResponse** response) {
+  TraceScope trace("http", "http.request");
+  Http1Target target;
+  if (!ParseHttp1Target(request.uri(), &target)) {
+    return Status::MakeError(kNativeHttpModule,
+                             "only valid http:// URIs are supported",
+                             EPROTONOSUPPORT);
+  }
+  const uint64_t started_at = MonotonicNanos();
+  const Http1Deadlines deadlines = MakeHttp1Deadlines(
+      request, settings_.connect_timeout_ms(), settings_.timeout_ms(),
+      settings_.low_speed_bytes_per_second(), settings_.low_speed_seconds(),
+      started_at);
+
+  // The header block is written by the connection, which keeps it for
+  // the next request, when there is one to reuse; the body is sent from
+  // wherever the request keeps it.
+  Connection* connection = AcquireConnection(target.authority);
+  bool reused = connection != NULL;
+  if (connection == NULL) {
+    connection = new Connection();
+  }
+  Shared<std::string>::Ptr head;
+  Status status = connection->heads.Get(request, target, &head);
+  if (status.IsFailure()) {
+    if (reused) {
+      ReleaseConnection(target.authority, connection);
+    } else {
+      delete connection;
+    }
+    return status;
+  }
+  connection->writer.Reset(&request, head);
+
+  // Unless streaming, the response body goes into a buffer that the
+  // response will share.
+  HttpTimings timings;
+  Http1ResponseParser parser;
+  Shared<Buffer>::Ptr body;
+  Shared<Buffer>::Ptr headers(TakePooledBuffer());
+  BufferHandler buffer_handler(NULL);
+  SinkHandler sink_handler(sink, &parser, headers, &timings);
+  Http1ResponseParser::BodyHandler* handler = &sink_handler;
+  if (!sink) {
+    body = TakePooledBuffer();
+    buffer_handler = BufferHandler(body.get());
+    handler = &buffer_handler;
+  }
+  for (;;) {
+    if (connection->fd < 0) {
+      status = Connect(target, deadlines, &connection->fd);
+      if (status.IsFailure()) {
+        delete connection;
+        return status;
+      }
+      timings.connect_nanos = MonotonicNanos() - started_at;
+    }
+    parser.Reset(request.method() == HttpRequest::HEAD, headers.get(),
+                 handler);
+    status = Exchange(connection, deadlines, &parser);
+    if (status.IsSuccess() || !reused || parser.started() ||
+        status.GetCode() != kHttpConnectionLost ||
+        !connection->writer.Rewind()) {
+      break;
+    }
+
+    // The server closed the connection as the request was sent; it never
+    // saw the request, so it is safe to send it again (unless its body
+    // can't be produced again, as checked above.)
+    close(connection->fd);
+    connection->fd = -1;
+    reused = false;
+    headers->Clear();
+  }
+  const uint64_t request_bytes = connection->writer.sent();
+
+  if (status.IsFailure() || !parser.keep_alive()) {
+    CloseConnections(std::vector<Connection*>(1, connection));
+  } else {
+    ReleaseConnection(target.authority, connection);
+  }
+  if (status.IsFailure()) {
+    if (sink && parser.abandoned()) {
+      return Status::MakeError(kNativeHttpModule,
+                               "response abandoned by sink");
+    }
+    return status;
+  }
+
+  // A response without a body still has a head to pass on.
+  if (sink && !sink_handler.Start()) {
+    return Status::MakeError(kNativeHttpModule, "response abandoned by sink");
+  }
+
+  __atomic_add_fetch(&byte_counts_.request_body_bytes,
+                     request.HasBody() ? std::max(request.BodySize(),
+                                                  static_cast<int64_t>(0))
+                                       : 0,
+                     __ATOMIC_RELAXED);
+  __atomic_add_fetch(&byte_counts_.request_wire_bytes, request_bytes,
+                     __ATOMIC_RELAXED);
+  __atomic_add_fetch(&byte_counts_.response_wire_bytes, parser.wire_bytes(),
+                     __ATOMIC_RELAXED);
+  __atomic_add_fetch(&byte_counts_.response_body_bytes, parser.body_bytes(),
+                     __ATOMIC_RELAXED);
+  if (response) {
+    timings.total_nanos = MonotonicNanos() - started_at;
+    *response = new CurlHttpResponse(body, headers, parser.status_code(),
+                                     timings);
+  }
+  return Status::OK();
+}
+
+Status NativeHttpClient::Exchange(Connection* connection,
+                                  const Http1Deadlines& deadlines,
+                                  Http1ResponseParser* parser) {
+  const int fd = connection->fd;
+  for (;;) {
+    Status status = connection->writer.Send(fd);
+    if (status.IsFailure()) {
+      return status;
+    }
+    if (connection->writer.done()) {
+      break;
+    }
+    const int error = WaitFor(fd, POLLOUT, deadlines.total);
+    if (error == ETIMEDOUT) {
+      return DeadlineExceeded();
+    }
+    if (error != 0) {
+      return MakeHttp1SocketError(error);
+    }
+  }
+
+  Http1SpeedCheck speed;
+  speed.Start(deadlines, MonotonicNanos());
+  char data[kReadSize];
+  while (!parser->done()) {
+    const ssize_t n = recv(fd, data, sizeof(data), 0);
+    if (n > 0) {
+      speed.Add(n);
+      size_t consumed = 0;
+      Status status = parser->Parse(data, n, &consumed);
+      if (status.IsFailure()) {
+        return status;
+      }
+      if (consumed < static_cast<size_t>(n)) {
+        return Status::MakeError(kNativeHttpModule,
+                                 "data after the response", EPROTO);
+      }
+      continue;
+    }
+    if (n == 0) {
+      return parser->Finish();
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      return MakeHttp1SocketError(errno);
+    }
+    const int error =
+        WaitFor(fd, POLLIN, Earliest(deadlines.total, speed.period_end()));
+    if (error != 0 && error != ETIMEDOUT) {
+      return MakeHttp1SocketError(error);
+    }
+    const uint64_t now = MonotonicNanos();
+    if (deadlines.total != 0 && now >= deadlines.total) {
+      return DeadlineExceeded();
+    }
+    if (!speed.Check(now)) {
+      return Status::MakeError(kNativeHttpModule, "transfer too slow",
+                               kHttpTooSlow);
+    }
+  }
+  return Status::OK();
+}
+
+}  // namespace enquery
@@ -0,0 +1,108 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef HTTP_NATIVE_HTTP_CLIENT_H_
+#define HTTP_NATIVE_HTTP_CLIENT_H_
+
+#include <stdint.h>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+#include "enquery/http_client.h"
+#include "enquery/mutex.h"
+#include "enquery/status.h"
+#include "http/http1_codec.h"
+
+namespace enquery {
+
+class HttpRequest;
+class HttpResponse;
+class HttpSink;
+
+// NativeHttpClient speaks HTTP/1.1 over plain TCP itself, without curl.
+// Each request is written to its connection as the socket takes it, the
+// body straight from wherever the request keeps it, and the response is
+// parsed as it is read, with the body collected into a pooled buffer or
+// passed straight to the caller's sink.
+// Connections are kept open for reuse, up to max_idle_per_host for each
+// host; a request that finds its reused connection closed by the server
+// before any response arrives is sent again on a new one.
+class NativeHttpClient : public HttpClient {
+ public:
+  explicit NativeHttpClient(const HttpClient::Settings& settings);
+  virtual ~NativeHttpClient();
+
+  virtual HttpResponse* SendRequest(const HttpRequest& request, Status* status);
+
+  virtual Status StreamRequest(const HttpRequest& request, HttpSink* sink);
+
+  virtual HttpByteCounts GetByteCounts() const;
+
+ private:
+  // A connection, open unless 'fd' is negative. The header block last
+  // written on it is kept, so that a connection that is reused for the
+  // same request doesn't write it again.
+  struct Connection {
+    Connection() : fd(-1), idle_since(0) {}
+    int fd;
+    Http1HeadCache heads;
+    Http1RequestWriter writer;
+    uint64_t idle_since;
+  };
+
+  // Idle connections to one host, least recently used first.
+  typedef std::deque<Connection*> IdleList;
+
+  NativeHttpClient(const NativeHttpClient& no_copy);
+  NativeHttpClient& operator=(const NativeHttpClient& no_assign);
+
+  // Take an idle connection to 'host' from the pool. Returns NULL if there
+  // is none.
+  Connection* AcquireConnection(const std::string& host);
+
+  // Return a connection to the pool for 'host', closing it instead if the
+  // host already has enough idle connections.
+  void ReleaseConnection(const std::string& host, Connection* connection);
+
+  // Close and delete 'connections'.
+  static void CloseConnections(const std::vector<Connection*>& connections);
+
+  // Move connections idle for longer than the timeout to 'expired'.
+  // Requires pool_mutex_ to be held.
+  void EvictExpired(uint64_t now, std::vector<Connection*>* expired);
+
+  // Send 'request', delivering the response body to 'sink' or, if it is
+  // NULL, setting 'response' to a new, complete response.
+  Status Perform(const HttpRequest& request, HttpSink* sink,
+                 HttpResponse** response);
+
+  // Write the request 'connection->writer' was given and read the
+  // response into 'parser'.
+  static Status Exchange(Connection* connection,
+                         const Http1Deadlines& deadlines,
+                         Http1ResponseParser* parser);
+
+  const HttpClient::Settings settings_;
+  const uint64_t idle_timeout_nanos_;
+  Mutex pool_mutex_;
+  std::map<std::string, IdleList> idle_;
+  uint64_t next_eviction_;
+  HttpByteCounts byte_counts_;
+};
+
+}  // namespace enquery
+
+#endif  // HTTP_NATIVE_HTTP_CLIENT_H_
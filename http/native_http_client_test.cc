@@ -0,0 +1,433 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "enquery/async_http_client.h"
+#include "enquery/futures.h"
+#include "enquery/http.h"
+#include "enquery/http_client.h"
+#include "enquery/http_request.h"
+#include "enquery/http_response.h"
+#include "enquery/shared.h"
+#include "enquery/slice.h"
+#include "enquery/status.h"
+#include "enquery/testing.h"
+#include "http/http_test_server.h"
+
+using ::enquery::AsyncHttpClient;
+using ::enquery::Future;
+using ::enquery::Http;
+using ::enquery::HttpBodySource;
+using ::enquery::HttpByteCounts;
+using ::enquery::HttpClient;
+using ::enquery::HttpRequest;
+using ::enquery::HttpResponse;
+using ::enquery::HttpResult;
+using ::enquery::HttpSink;
+using ::enquery::HttpStream;
+using ::enquery::HttpTestServer;
+using ::enquery::Reactor;
+using ::enquery::Shared;
+using ::enquery::Slice;
+using ::enquery::StalledTestServer;
+using ::enquery::Status;
+
+namespace {
+
+const int kRequests = 200;
+
+// Send a GET for 'uri' and return the future result.
+Future<HttpResult> Get(AsyncHttpClient* client, const std::string& uri) {
+  HttpRequest request;
+  request.set_uri(uri.c_str());
+  Future<HttpResult> future;
+  ASSERT_TRUE(client->SendRequest(request, &future).IsSuccess());
+  return future;
+}
+
+// Counts the body it is given, after noting the status code of the head
+// that comes first; abandons the body past 'limit' bytes.
+class CountingSink : public HttpSink {
+ public:
+  explicit CountingSink(size_t limit)
+      : status_code(0), bytes(0), limit_(limit) {}
+  virtual bool OnResponse(const HttpResponse& head) {
+    ASSERT_EQUALS(status_code, 0);
+    ASSERT_EQUALS(bytes, 0u);
+    status_code = head.StatusCode();
+    return true;
+  }
+  virtual bool OnData(const Slice& data) {
+    ASSERT_TRUE(status_code != 0);
+    bytes += data.size();
+    return bytes <= limit_;
+  }
+  int status_code;
+  size_t bytes;
+
+ private:
+  size_t limit_;
+};
+
+// Produces 'size' bytes, noting how much more the server had received by
+// the time the last of them was read than when the source was made. Were
+// the body read in full before any of it was sent, that would be nothing.
+class WatchedSource : public HttpBodySource {
+ public:
+  WatchedSource(const HttpTestServer* server, int64_t size)
+      : received_at_end(0),
+        server_(server),
+        received_at_start_(server->bytes_received()),
+        size_(size),
+        offset_(0) {}
+  virtual int64_t Size() { return size_; }
+  virtual Status Read(char* data, size_t size, size_t* bytes_read) {
+    const size_t count =
+        std::min(size, static_cast<size_t>(size_ - offset_));
+    memset(data, 's', count);
+    offset_ += count;
+    if (count > 0 && offset_ == size_) {
+      received_at_end = server_->bytes_received() - received_at_start_;
+    }
+    *bytes_read = count;
+    return Status::OK();
+  }
+  virtual bool Rewind() {
+    offset_ = 0;
+    return true;
+  }
+  uint64_t received_at_end;
+
+ private:
+  const HttpTestServer* server_;
+  const uint64_t received_at_start_;
+  const int64_t size_;
+  int64_t offset_;
+};
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  Status status;
+  Shared<Http>::Ptr http(Http::Create(::enquery::HTTP_ENGINE_NATIVE, &status));
+  ASSERT_TRUE(status.IsSuccess());
+
+  // The synchronous client reuses its connection, and echoes bodies.
+  {
+    HttpTestServer server;
+    ASSERT_TRUE(server.Start().IsSuccess());
+    Shared<HttpClient>::Ptr client(http->CreateClient(&status));
+    ASSERT_TRUE(status.IsSuccess());
+    for (int i = 0; i < 20; ++i) {
+      char path[32];
+      snprintf(path, sizeof(path), "/%d", i * 1000);
+      const std::string uri = server.Url(path);
+      Shared<HttpResponse>::Ptr response(
+          client->SendRequest(HttpRequest().set_uri(uri.c_str()), &status));
+      ASSERT_TRUE(status.IsSuccess());
+      ASSERT_EQUALS(response->StatusCode(), 200);
+      ASSERT_EQUALS(response->BodySize(), static_cast<size_t>(i * 1000));
+    }
+    ASSERT_EQUALS(server.connections_accepted(), 1u);
+
+    const std::string data(1000000, 'e');
+    const std::string uri = server.Url("/echo");
+    Shared<HttpResponse>::Ptr response(client->SendRequest(
+        HttpRequest()
+            .set_uri(uri.c_str())
+            .set_method(HttpRequest::POST)
+            .set_body(data.data(), data.size()),
+        &status));
+    ASSERT_TRUE(status.IsSuccess());
+    ASSERT_TRUE(std::string(response->Body(), response->BodySize()) == data);
+    Slice length;
+    ASSERT_TRUE(response->FindHeader("Content-Length", &length));
+
+    const std::string status_uri = server.Url("/status/404");
+    response = Shared<HttpResponse>::Ptr(client->SendRequest(
+        HttpRequest().set_uri(status_uri.c_str()), &status));
+    ASSERT_TRUE(status.IsSuccess());
+    ASSERT_EQUALS(response->StatusCode(), 404);
+
+    // A sink sees the whole body, or may abandon it.
+    const std::string big_uri = server.Url("/1000000");
+    CountingSink sink(2000000);
+    ASSERT_TRUE(client->StreamRequest(HttpRequest().set_uri(big_uri.c_str()),
+                                      &sink)
+                    .IsSuccess());
+    ASSERT_EQUALS(sink.status_code, 200);
+    ASSERT_EQUALS(sink.bytes, 1000000u);
+    CountingSink missing(0);
+    ASSERT_TRUE(
+        client->StreamRequest(HttpRequest().set_uri(status_uri.c_str()),
+                              &missing)
+            .IsSuccess());
+    ASSERT_EQUALS(missing.status_code, 404);
+    CountingSink quitter(1000);
+    ASSERT_TRUE(client
+                    ->StreamRequest(HttpRequest().set_uri(big_uri.c_str()),
+                                    &quitter)
+                    .IsFailure());
+
+    const HttpByteCounts counts = client->GetByteCounts();
+    ASSERT_EQUALS(counts.request_body_bytes, 1000000u);
+    ASSERT_TRUE(counts.response_wire_bytes > counts.response_body_bytes);
+  }
+
+  // A body larger than the socket buffers is sent as it is read, rather
+  // than gathered first: by the time the last of it is read, most of it
+  // has reached the server.
+  {
+    const int64_t kBodySize = 64 << 20;
+    HttpTestServer server;
+    ASSERT_TRUE(server.Start().IsSuccess());
+    const std::string uri = server.Url("/status/204");
+    Shared<HttpClient>::Ptr client(http->CreateClient(&status));
+    ASSERT_TRUE(status.IsSuccess());
+    WatchedSource source(&server, kBodySize);
+    Shared<HttpResponse>::Ptr response(
+        client->SendRequest(HttpRequest()
+                                .set_uri(uri.c_str())
+                                .set_method(HttpRequest::PUT)
+                                .set_body_source(&source),
+                            &status));
+    ASSERT_TRUE(status.IsSuccess());
+    ASSERT_EQUALS(response->StatusCode(), 204);
+    ASSERT_TRUE(source.received_at_end > kBodySize / 4);
+
+    Shared<AsyncHttpClient>::Ptr async_client(
+        http->CreateAsyncClient(AsyncHttpClient::Settings(), &status));
+    ASSERT_TRUE(status.IsSuccess());
+    WatchedSource async_source(&server, kBodySize);
+    Future<HttpResult> future;
+    ASSERT_TRUE(async_client
+                    ->SendRequest(HttpRequest()
+                                      .set_uri(uri.c_str())
+                                      .set_method(HttpRequest::PUT)
+                                      .set_body_source(&async_source),
+                                  &future)
+                    .IsSuccess());
+    HttpResult result = future.GetValue();
+    ASSERT_TRUE(result.status().IsSuccess());
+    ASSERT_EQUALS(result.response()->StatusCode(), 204);
+    ASSERT_TRUE(async_source.received_at_end > kBodySize / 4);
+  }
+
+  // Only plain HTTP/1.1 without compression is on offer.
+  {
+    ASSERT_TRUE(http->CreateClient(
+                    HttpClient::Settings().set_accept_encoding(true),
+                    &status) == NULL);
+    ASSERT_TRUE(status.IsFailure());
+    Shared<HttpClient>::Ptr client(http->CreateClient(&status));
+    Shared<HttpResponse>::Ptr response(client->SendRequest(
+        HttpRequest().set_uri("https://127.0.0.1:1/"), &status));
+    ASSERT_TRUE(response.get() == NULL);
+    ASSERT_TRUE(status.IsFailure());
+  }
+
+  // Many requests in flight at once across two I/O threads, on each
+  // reactor backend (io_uring falls back to epoll where unavailable.)
+  const Reactor::Backend backends[] = {Reactor::EPOLL, Reactor::IO_URING};
+  for (size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); ++b) {
+    HttpTestServer server;
+    ASSERT_TRUE(server.Start().IsSuccess());
+    Shared<AsyncHttpClient>::Ptr client(http->CreateAsyncClient(
+        AsyncHttpClient::Settings()
+            .set_io_thread_count(2)
+            .set_reactor_backend(backends[b]),
+        &status));
+    ASSERT_TRUE(status.IsSuccess());
+
+    std::vector<Future<HttpResult> > futures;
+    std::vector<size_t> sizes;
+    for (int i = 0; i < kRequests; ++i) {
+      const size_t size = 1 + (i * 997) % 20000;
+      char path[32];
+      snprintf(path, sizeof(path), "/%lu",
+               static_cast<unsigned long>(size));  // NOLINT
+      futures.push_back(Get(client.get(), server.Url(path)));
+      sizes.push_back(size);
+    }
+    for (int i = 0; i < kRequests; ++i) {
+      HttpResult result = futures[i].GetValue();
+      ASSERT_TRUE(result.status().IsSuccess());
+      ASSERT_EQUALS(result.response()->BodySize(), sizes[i]);
+      ASSERT_EQUALS(result.response()->StatusCode(), 200);
+    }
+    ASSERT_EQUALS(server.requests_served(), static_cast<uint64_t>(kRequests));
+  }
+
+  // With pipelining, requests share one connection in order.
+  {
+    HttpTestServer server;
+    ASSERT_TRUE(server.Start().IsSuccess());
+    Shared<AsyncHttpClient>::Ptr client(http->CreateAsyncClient(
+        AsyncHttpClient::Settings()
+            .set_max_connections_per_host(1)
+            .set_max_pipelined_requests(8),
+        &status));
+    ASSERT_TRUE(status.IsSuccess());
+    std::vector<Future<HttpResult> > futures;
+    for (int i = 0; i < kRequests; ++i) {
+      char path[32];
+      snprintf(path, sizeof(path), "/%d", i);
+      futures.push_back(Get(client.get(), server.Url(path)));
+    }
+    for (int i = 0; i < kRequests; ++i) {
+      HttpResult result = futures[i].GetValue();
+      ASSERT_TRUE(result.status().IsSuccess());
+      ASSERT_EQUALS(result.response()->BodySize(), static_cast<size_t>(i));
+    }
+    ASSERT_EQUALS(server.connections_accepted(), 1u);
+
+    // A POST isn't pipelined, but still goes through.
+    const std::string uri = server.Url("/echo");
+    Future<HttpResult> future;
+    ASSERT_TRUE(client
+                    ->SendRequest(HttpRequest()
+                                      .set_uri(uri.c_str())
+                                      .set_method(HttpRequest::POST)
+                                      .set_body("ping", 4),
+                                  &future)
+                    .IsSuccess());
+    HttpResult result = future.GetValue();
+    ASSERT_TRUE(result.status().IsSuccess());
+    ASSERT_TRUE(std::string(result.response()->Body(),
+                            result.response()->BodySize()) == "ping");
+  }
+
+  // A stream delivers the whole body to a slow reader, and deleting a
+  // stream part way abandons it.
+  {
+    HttpTestServer server;
+    ASSERT_TRUE(server.Start().IsSuccess());
+    Shared<AsyncHttpClient>::Ptr client(http->CreateAsyncClient(
+        AsyncHttpClient::Settings().set_stream_buffer_size(32768), &status));
+    ASSERT_TRUE(status.IsSuccess());
+    const std::string uri = server.Url("/4000000");
+    HttpRequest request;
+    request.set_uri(uri.c_str());
+
+    HttpStream* stream = client->OpenStream(request, &status);
+    ASSERT_TRUE(status.IsSuccess());
+    size_t total = 0;
+    int chunks = 0;
+    Slice chunk;
+    while ((status = stream->Next(&chunk)).IsSuccess() && !chunk.IsEmpty()) {
+      total += chunk.size();
+      if (++chunks % 16 == 0) {
+        usleep(1000);
+      }
+    }
+    ASSERT_TRUE(status.IsSuccess());
+    ASSERT_EQUALS(total, 4000000u);
+    delete stream;
+
+    stream = client->OpenStream(request, &status);
+    ASSERT_TRUE(stream->Next(&chunk).IsSuccess());
+    ASSERT_TRUE(!chunk.IsEmpty());
+    delete stream;
+
+    // The head comes before the body, and comes even without one.
+    const std::string tagged_uri = server.Url("/10?etag=x");
+    stream = client->OpenStream(HttpRequest().set_uri(tagged_uri.c_str()),
+                                &status);
+    ASSERT_TRUE(status.IsSuccess());
+    const HttpResponse* head = stream->Head();
+    ASSERT_TRUE(head != NULL);
+    ASSERT_EQUALS(head->StatusCode(), 200);
+    ASSERT_EQUALS(head->BodySize(), 0u);
+    Slice etag;
+    ASSERT_TRUE(head->FindHeader("etag", &etag));
+    ASSERT_EQUALS(std::string(etag.data(), etag.size()), std::string("\"x\""));
+    ASSERT_TRUE(stream->Next(&chunk).IsSuccess());
+    ASSERT_EQUALS(chunk.size(), 10u);
+    ASSERT_TRUE(stream->Head() == head);
+    delete stream;
+
+    const std::string error_uri = server.Url("/status/500");
+    stream = client->OpenStream(HttpRequest().set_uri(error_uri.c_str()),
+                                &status);
+    ASSERT_TRUE(status.IsSuccess());
+    head = stream->Head();
+    ASSERT_TRUE(head != NULL);
+    ASSERT_EQUALS(head->StatusCode(), 500);
+    ASSERT_TRUE(stream->Next(&chunk).IsSuccess());
+    ASSERT_TRUE(chunk.IsEmpty());
+    delete stream;
+
+    HttpResult result = Get(client.get(), server.Url("/10")).GetValue();
+    ASSERT_TRUE(result.status().IsSuccess());
+  }
+
+  // Failures are reported through the result's status.
+  {
+    Shared<AsyncHttpClient>::Ptr client(
+        http->CreateAsyncClient(AsyncHttpClient::Settings(), &status));
+    ASSERT_TRUE(status.IsSuccess());
+    HttpResult result = Get(client.get(), "http://127.0.0.1:1/").GetValue();
+    ASSERT_EQUALS(result.status().GetCode(), enquery::kHttpConnectFailed);
+    ASSERT_TRUE(result.response() == NULL);
+
+    // Names are resolved off the I/O thread, and every request waiting
+    // for one learns that it didn't resolve.
+    Future<HttpResult> first = Get(client.get(), "http://unknown.invalid/1");
+    Future<HttpResult> second = Get(client.get(), "http://unknown.invalid/2");
+    ASSERT_EQUALS(first.GetValue().status().GetCode(),
+                  enquery::kHttpConnectFailed);
+    ASSERT_EQUALS(second.GetValue().status().GetCode(),
+                  enquery::kHttpConnectFailed);
+  }
+
+  // A request to a server that doesn't answer times out, or is too slow,
+  // or may be cancelled.
+  {
+    StalledTestServer server;
+    ASSERT_TRUE(server.Start().IsSuccess());
+    Shared<AsyncHttpClient>::Ptr client(http->CreateAsyncClient(
+        AsyncHttpClient::Settings().set_timeout_ms(100), &status));
+    ASSERT_TRUE(status.IsSuccess());
+    const std::string uri = server.Url("http", "/");
+    HttpResult result = Get(client.get(), uri).GetValue();
+    ASSERT_EQUALS(result.status().GetCode(), enquery::kHttpDeadlineExceeded);
+
+    HttpRequest request;
+    request.set_uri(uri.c_str()).set_timeout_ms(-1).set_low_speed_limit(1, 1);
+    Future<HttpResult> future;
+    ASSERT_TRUE(client->SendRequest(request, &future).IsSuccess());
+    ASSERT_EQUALS(future.GetValue().status().GetCode(), enquery::kHttpTooSlow);
+
+    request.set_low_speed_limit(0, 0);
+    ASSERT_TRUE(client->SendRequest(request, &future).IsSuccess());
+    client->Cancel(future);
+    ASSERT_EQUALS(future.GetValue().status().GetCode(), ECANCELED);
+
+    Shared<HttpClient>::Ptr sync_client(http->CreateClient(
+        HttpClient::Settings().set_timeout_ms(100), &status));
+    Shared<HttpResponse>::Ptr response(
+        sync_client->SendRequest(HttpRequest().set_uri(uri.c_str()), &status));
+    ASSERT_EQUALS(status.GetCode(), enquery::kHttpDeadlineExceeded);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,457 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "enquery/retrying_http_client.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <algorithm>
+#include <set>
+#include <string>
+#include <vector>
+#include "enquery/futures.h"
+#include "enquery/http_client.h"
+#include "enquery/http_request.h"
+#include "enquery/http_response.h"
+#include "enquery/mutex.h"
+#include "enquery/portability.h"
+#include "enquery/scope_lock.h"
+#include "enquery/scope_pointer.h"
+#include "enquery/shared.h"
+#include "enquery/slice.h"
+#include "enquery/status.h"
+#include "enquery/timer_queue.h"
+#include "enquery/utility.h"
+#include "http/http_util.h"
+
+namespace enquery {
+
+namespace {
+
+const char kModule[] = "RetryingHttpClient";
+
+const uint64_t kNanosPerMilli = 1000000;
+const uint64_t kNanosPerSecond = 1000000000;
+
+// Parse a Retry-After of delta-seconds into 'nanos'. (The HTTP-date form
+// is rare from servers under load, and isn't understood.)
+bool ParseRetryAfter(const Slice& value, uint64_t* nanos) {
+  if (value.IsEmpty() || value.size() > 9) {
+    return false;
+  }
+  uint64_t seconds = 0;
+  for (size_t i = 0; i < value.size(); ++i) {
+    const char c = value.data()[i];
+    if (c < '0' || c > '9') {
+      return false;
+    }
+    seconds = seconds * 10 + (c - '0');
+  }
+  *nanos = seconds * kNanosPerSecond;
+  return true;
+}
+
+}  // namespace
+
+class RetryingHttpClient::Rep {
+ public:
+  Rep(AsyncHttpClient* client, const Settings& settings)
+      : client_(client),
+        settings_(settings),
+        timers_(NULL),
+        mutex_("RetryingHttpClient"),
+        stopping_(false),
+        random_(MonotonicNanos() | 1),
+        budget_(settings.max_retry_tokens()),
+        requests_(0),
+        retries_(0),
+        retries_denied_(0),
+        exhausted_(0) {}
+
+  ~Rep() {
+    // Stop retrying, and stop the timers, deleting the retries they held.
+    {
+      ScopeLock lock(&mutex_);
+      stopping_ = true;
+    }
+    delete timers_;
+
+    // Requests that were waiting to retry get no further.
+    std::vector<Shared<Call>::Ptr> waiting;
+    {
+      ScopeLock lock(&mutex_);
+      for (std::set<Call*>::iterator it = active_.begin();
+           it != active_.end(); ++it) {
+        ScopeLock call_lock(&(*it)->mutex);
+        if ((*it)->waiting) {
+          (*it)->waiting = false;
+          waiting.push_back((*it)->self);
+          (*it)->self = Shared<Call>::Ptr();
+        }
+      }
+    }
+    const HttpResult shut_down(Status::MakeError(kModule, "client shut down"),
+                               Shared<HttpResponse>::Ptr());
+    for (size_t i = 0; i < waiting.size(); ++i) {
+      Finish(waiting[i], shut_down);
+    }
+
+    // The wrapped client completes the attempts still in flight, whose
+    // results are delivered as they are.
+    delete client_;
+  }
+
+  Status Init() {
+    if (client_ == NULL) {
+      return Status::MakeError(kModule, "client was null");
+    }
+    if (settings_.max_attempts() < 1) {
+      return Status::MakeError(kModule, "max attempts must be positive");
+    }
+    if (settings_.base_backoff_ms() < 0 ||
+        settings_.max_backoff_ms() < settings_.base_backoff_ms()) {
+      return Status::MakeError(kModule,
+                               "backoffs must be non-negative and ordered");
+    }
+    if (settings_.retry_budget_percent() < 0 ||
+        settings_.max_retry_tokens() < 0) {
+      return Status::MakeError(kModule, "budget must not be negative");
+    }
+    Status status;
+    timers_ = TimerQueue::Create(&status);
+    return status;
+  }
+
+  Status SendRequest(const HttpRequest& request, Future<HttpResult>* future) {
+    assert(future != NULL);
+    Shared<Call>::Ptr call(
+        new Call(request, settings_.base_backoff_ms() * kNanosPerMilli));
+    Status status = client_->SendRequest(request, &call->attempt);
+    if (status.IsFailure()) {
+      return status;
+    }
+    {
+      ScopeLock lock(&mutex_);
+      ++requests_;
+      budget_ = std::min(settings_.max_retry_tokens(),
+                         budget_ + settings_.retry_budget_percent() / 100);
+      active_.insert(call.get());
+    }
+    *future = call->promise.GetFuture();
+    call->attempt.Notify(OnAttemptDone, this, call);
+    return Status::OK();
+  }
+
+  void Cancel(const Future<HttpResult>& future) {
+    Shared<Call>::Ptr waiting;
+    Future<HttpResult> attempt;
+    bool found = false;
+    TimerQueue::TimerId timer = 0;
+    {
+      ScopeLock lock(&mutex_);
+      std::set<Call*>::iterator it = active_.begin();
+      while (it != active_.end() && !((*it)->promise.GetFuture() == future)) {
+        ++it;
+      }
+      if (it != active_.end()) {
+        Call* call = *it;
+        ScopeLock call_lock(&call->mutex);
+        call->cancelled = true;
+        if (call->waiting) {
+          // Taken from the timer, which will find nothing to do.
+          call->waiting = false;
+          timer = call->timer;
+          waiting = call->self;
+          call->self = Shared<Call>::Ptr();
+        } else {
+          attempt = call->attempt;
+        }
+        found = true;
+      }
+    }
+    if (!found) {
+      return;
+    }
+    if (waiting.get() != NULL) {
+      timers_->Cancel(timer);
+      const Status cancelled =
+          Status::MakeError(kModule, "request cancelled", ECANCELED);
+      Finish(waiting, HttpResult(cancelled, Shared<HttpResponse>::Ptr()));
+    } else {
+      // The attempt completes with ECANCELED, which isn't retried.
+      client_->Cancel(attempt);
+    }
+  }
+
+  HttpStream* OpenStream(const HttpRequest& request, Status* status) {
+    return client_->OpenStream(request, status);
+  }
+
+  HttpByteCounts GetByteCounts() const { return client_->GetByteCounts(); }
+
+  void GetStatistics(RetryingHttpClient::Statistics* stats) const {
+    assert(stats != NULL);
+    ScopeLock lock(&mutex_);
+    stats->set_requests(requests_)
+        .set_retries(retries_)
+        .set_retries_denied(retries_denied_)
+        .set_exhausted(exhausted_);
+  }
+
+ private:
+  // A request, from when it is sent until the result of its last attempt
+  // is delivered. Shared by the callbacks of its attempts and timers.
+  struct Call {
+    Call(const HttpRequest& r, uint64_t backoff)
+        : request(r),
+          mutex("RetryingHttpClient::Call"),
+          attempts(1),
+          backoff_nanos(backoff),
+          timer(0),
+          waiting(false),
+          cancelled(false) {}
+    const HttpRequest request;
+    Promise<HttpResult> promise;
+
+    // Guards the members below.
+    Mutex mutex;
+    Future<HttpResult> attempt;  // The latest attempt.
+    int attempts;
+    uint64_t backoff_nanos;      // The previous backoff.
+    TimerQueue::TimerId timer;   // Set while 'waiting'.
+    Shared<Call>::Ptr self;      // Set while 'waiting', for Cancel().
+    bool waiting;                // Between attempts.
+    bool cancelled;              // The caller cancelled the request.
+  };
+
+  typedef void (*CallFunction)(Rep*, Shared<Call>::Ptr);
+  typedef Callback_2<CallFunction, Rep*, Shared<Call>::Ptr> CallCallback;
+
+  static bool IsIdempotent(const HttpRequest& request) {
+    switch (request.method()) {
+      case HttpRequest::GET:
+      case HttpRequest::HEAD:
+      case HttpRequest::PUT:
+      case HttpRequest::DELETE:
+      case HttpRequest::TRACE:
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  // Return true if the settings allow 'result' of an attempt at 'request'
+  // to be retried, setting 'min_delay' to the least backoff that the
+  // server asked for.
+  bool IsRetryable(const HttpRequest& request, const HttpResult& result,
+                   uint64_t* min_delay) const {
+    *min_delay = 0;
+    const int errors = settings_.retryable_errors();
+    if (result.status().IsFailure()) {
+      switch (result.status().GetCode()) {
+        case kHttpConnectFailed:
+        case kHttpConnectTimeout:
+          return (errors & CONNECT_FAILURES) != 0;
+        case kHttpConnectionLost:
+          return (errors & CONNECTION_RESETS) != 0 && IsIdempotent(request);
+        case kHttpDeadlineExceeded:
+        case kHttpTooSlow:
+          return (errors & TIMEOUTS) != 0 && IsIdempotent(request);
+        default:
+          return false;
+      }
+    }
+
+    const HttpResponse* response = result.response();
+    const std::vector<int>& statuses = settings_.retryable_statuses();
+    if (!IsIdempotent(request) ||
+        std::find(statuses.begin(), statuses.end(), response->StatusCode()) ==
+            statuses.end()) {
+      return false;
+    }
+    Slice retry_after;
+    if (response->FindHeader("Retry-After", &retry_after) &&
+        ParseRetryAfter(retry_after, min_delay)) {
+      return *min_delay <= settings_.max_backoff_ms() * kNanosPerMilli;
+    }
+    return true;
+  }
+
+  // Return the next backoff after 'previous': a random time between the
+  // base backoff and three times 'previous', within the maximum. The
+  // caller holds the lock.
+  uint64_t NextBackoff(uint64_t previous) {
+    const uint64_t base = settings_.base_backoff_ms() * kNanosPerMilli;
+    const uint64_t cap = settings_.max_backoff_ms() * kNanosPerMilli;
+    const uint64_t high = std::max(base, previous * 3);
+
+    return std::min(cap, base + random_.Next() % (high - base + 1));
+  }
+
+  // Retry 'call', or deliver the result of its latest attempt.
+  static void OnAttemptDone(Rep* rep, Shared<Call>::Ptr call) {
+    const HttpResult result = call->attempt.GetValue();
+    if (!rep->ScheduleRetry(call, result)) {
+      rep->Finish(call, result);
+    }
+  }
+
+  // Schedule the next attempt for 'call', whose latest attempt had
+  // 'result'. Return false if there is to be none.
+  bool ScheduleRetry(Shared<Call>::Ptr call, const HttpResult& result) {
+    Call* c = call.get();
+    uint64_t min_delay = 0;
+    if (!IsRetryable(c->request, result, &min_delay)) {
+      return false;
+    }
+    HttpBodySource* source = c->request.body_source();
+    if (c->request.body_type() == HttpRequest::SOURCE && source != NULL &&
+        !source->Rewind()) {
+      return false;
+    }
+
+    // The timer is scheduled under the call's lock, so that Cancel() sees
+    // it, and under the client's, so that the timers aren't being stopped.
+    ScopeLock lock(&mutex_);
+    ScopeLock call_lock(&c->mutex);
+    if (stopping_ || c->cancelled) {
+      return false;
+    }
+    if (c->attempts >= settings_.max_attempts()) {
+      ++exhausted_;
+      return false;
+    }
+    if (budget_ < 1) {
+      ++retries_denied_;
+      return false;
+    }
+    budget_ -= 1;
+    ++retries_;
+    const uint64_t backoff =
+        std::max(NextBackoff(c->backoff_nanos), min_delay);
+    ++c->attempts;
+    c->backoff_nanos = backoff;
+    c->waiting = true;
+    c->self = call;
+    c->timer =
+        timers_->Schedule(backoff, new CallCallback(OnBackoffDone, this, call));
+    return true;
+  }
+
+  // Send the next attempt for 'call'. Run by the timer queue once the
+  // backoff has passed.
+  static void OnBackoffDone(Rep* rep, Shared<Call>::Ptr call) {
+    Call* c = call.get();
+    {
+      ScopeLock lock(&c->mutex);
+      if (!c->waiting) {
+        return;  // Cancelled.
+      }
+      c->waiting = false;
+      c->self = Shared<Call>::Ptr();
+    }
+
+    Future<HttpResult> attempt;
+    Status status = rep->client_->SendRequest(c->request, &attempt);
+    if (status.IsFailure()) {
+      rep->Finish(call, HttpResult(status, Shared<HttpResponse>::Ptr()));
+      return;
+    }
+    bool cancelled = false;
+    {
+      ScopeLock lock(&c->mutex);
+      c->attempt = attempt;
+      cancelled = c->cancelled;
+    }
+    if (cancelled) {
+      // Cancelled while this was sent.
+      rep->client_->Cancel(attempt);
+    }
+    attempt.Notify(OnAttemptDone, rep, call);
+  }
+
+  // Deliver 'result' as the outcome of 'call'.
+  void Finish(Shared<Call>::Ptr call, const HttpResult& result) {
+    {
+      ScopeLock lock(&mutex_);
+      active_.erase(call.get());
+    }
+    call->promise.SetValue(result);
+  }
+
+  Rep(const Rep& no_copy);
+  Rep& operator=(const Rep& no_assign);
+
+  AsyncHttpClient* const client_;
+  const Settings settings_;
+  TimerQueue* timers_;
+
+  // Guards the members below.
+  mutable Mutex mutex_;
+  bool stopping_;           // The client is being deleted.
+  std::set<Call*> active_;  // Calls whose result hasn't been delivered.
+  XorShiftRandom random_;   // For NextBackoff().
+  double budget_;           // Retries that may be sent now.
+  uint64_t requests_;
+  uint64_t retries_;
+  uint64_t retries_denied_;
+  uint64_t exhausted_;
+};
+
+RetryingHttpClient::RetryingHttpClient(Rep* rep) : rep_(rep) {
+  assert(rep != NULL);
+}
+
+RetryingHttpClient::~RetryingHttpClient() { delete rep_; }
+
+RetryingHttpClient* RetryingHttpClient::Create(AsyncHttpClient* client,
+                                               const Settings& settings,
+                                               Status* status_out) {
+  ScopePointer<Rep> rep(new Rep(client, settings));
+  Status status = rep->Init();
+  if (status.IsFailure()) {
+    MaybeAssign(status_out, status);
+    return NULL;
+  }
+
+  RetryingHttpClient* retrying_client = new RetryingHttpClient(rep.Get());
+  rep.ReleaseOwnership();
+
+  return retrying_client;
+}
+
+Status RetryingHttpClient::SendRequest(const HttpRequest& request,
+                                       Future<HttpResult>* future) {
+  return rep_->SendRequest(request, future);
+}
+
+void RetryingHttpClient::Cancel(const Future<HttpResult>& future) {
+  rep_->Cancel(future);
+}
+
+HttpStream* RetryingHttpClient::OpenStream(const HttpRequest& request,
+                                           Status* status) {
+  return rep_->OpenStream(request, status);
+}
+
+HttpByteCounts RetryingHttpClient::GetByteCounts() const {
+  return rep_->GetByteCounts();
+}
+
+void RetryingHttpClient::GetStatistics(Statistics* stats) const {
+  rep_->GetStatistics(stats);
+}
+
+}  // namespace enquery
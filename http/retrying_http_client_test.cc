@@ -0,0 +1,265 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "enquery/async_http_client.h"
+#include "enquery/futures.h"
+#include "enquery/http.h"
+#include "enquery/http_client.h"
+#include "enquery/http_request.h"
+#include "enquery/http_response.h"
+#include "enquery/portability.h"
+#include "enquery/retrying_http_client.h"
+#include "enquery/shared.h"
+#include "enquery/status.h"
+#include "enquery/testing.h"
+#include "http/http_test_client.h"
+#include "http/http_test_server.h"
+
+using ::enquery::AsyncHttpClient;
+using ::enquery::CodeOf;
+using ::enquery::FakeAsyncHttpClient;
+using ::enquery::FakeHttpResponse;
+using ::enquery::Future;
+using ::enquery::Http;
+using ::enquery::HttpRequest;
+using ::enquery::HttpResponse;
+using ::enquery::HttpResult;
+using ::enquery::HttpTestServer;
+using ::enquery::MonotonicNanos;
+using ::enquery::RetryingHttpClient;
+using ::enquery::Send;
+using ::enquery::Shared;
+using ::enquery::StatisticsOf;
+using ::enquery::Status;
+using ::enquery::Wrap;
+
+namespace {
+
+// Wait for a request, and answer it with 'code' and, unless it is NULL,
+// a Retry-After header.
+void Respond(FakeAsyncHttpClient* fake, int code, const char* retry_after) {
+  FakeHttpResponse* response = new FakeHttpResponse(code, "");
+  if (retry_after != NULL) {
+    response->AddHeader("Retry-After", retry_after);
+  }
+  fake->WaitFor(1);
+  fake->Respond(0, Shared<HttpResponse>::Ptr(response));
+}
+
+// Wait for a request, and fail it with 'code'.
+void Fail(FakeAsyncHttpClient* fake, int code) {
+  fake->WaitFor(1);
+  fake->Fail(0, code);
+}
+
+// Return the time between the sending of request 'index' and the one
+// before it.
+uint64_t Gap(FakeAsyncHttpClient* fake, size_t index) {
+  return fake->sent_at(index) - fake->sent_at(index - 1);
+}
+
+RetryingHttpClient::Settings FastSettings() {
+  return RetryingHttpClient::Settings().set_base_backoff_ms(1)
+      .set_max_backoff_ms(20);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  // A 503 is retried, after a backoff.
+  {
+    FakeAsyncHttpClient* fake = new FakeAsyncHttpClient();
+    Shared<RetryingHttpClient>::Ptr client(Wrap<RetryingHttpClient>(
+        fake, RetryingHttpClient::Settings().set_base_backoff_ms(20)));
+    Future<HttpResult> future = Send(client.get(), "http://a/");
+    Respond(fake, 503, NULL);
+    Respond(fake, 200, NULL);
+    ASSERT_EQUALS(CodeOf(future), 200);
+    ASSERT_EQUALS(fake->sent(), 2);
+    ASSERT_TRUE(Gap(fake, 1) >= 20000000u);
+    ASSERT_EQUALS(StatisticsOf(*client.get()).retries(), 1u);
+  }
+
+  // Once the attempts run out, the last result is delivered.
+  {
+    FakeAsyncHttpClient* fake = new FakeAsyncHttpClient();
+    Shared<RetryingHttpClient>::Ptr client(
+        Wrap<RetryingHttpClient>(fake, FastSettings()));
+    Future<HttpResult> future = Send(client.get(), "http://a/");
+    Respond(fake, 503, NULL);
+    Fail(fake, enquery::kHttpConnectionLost);
+    Respond(fake, 502, NULL);
+    ASSERT_EQUALS(CodeOf(future), 502);
+    ASSERT_EQUALS(fake->sent(), 3);
+    ASSERT_EQUALS(StatisticsOf(*client.get()).exhausted(), 1u);
+  }
+
+  // Other statuses and failures aren't retried; neither are timeouts,
+  // unless asked for.
+  {
+    FakeAsyncHttpClient* fake = new FakeAsyncHttpClient();
+    Shared<RetryingHttpClient>::Ptr client(
+        Wrap<RetryingHttpClient>(fake, FastSettings()));
+    Future<HttpResult> future = Send(client.get(), "http://a/");
+    Respond(fake, 500, NULL);
+    ASSERT_EQUALS(CodeOf(future), 500);
+    future = Send(client.get(), "http://a/");
+    Fail(fake, EIO);
+    ASSERT_EQUALS(future.GetValue().status().GetCode(), EIO);
+    future = Send(client.get(), "http://a/");
+    Fail(fake, enquery::kHttpDeadlineExceeded);
+    ASSERT_EQUALS(future.GetValue().status().GetCode(),
+                  enquery::kHttpDeadlineExceeded);
+    ASSERT_EQUALS(fake->sent(), 3);
+  }
+  {
+    FakeAsyncHttpClient* fake = new FakeAsyncHttpClient();
+    Shared<RetryingHttpClient>::Ptr client(Wrap<RetryingHttpClient>(
+        fake, FastSettings()
+                  .clear_retryable_statuses()
+                  .add_retryable_status(500)
+                  .set_retryable_errors(RetryingHttpClient::TIMEOUTS)));
+    Future<HttpResult> future = Send(client.get(), "http://a/");
+    Fail(fake, enquery::kHttpTooSlow);
+    Respond(fake, 503, NULL);
+    ASSERT_EQUALS(CodeOf(future), 503);
+    future = Send(client.get(), "http://a/");
+    Respond(fake, 500, NULL);
+    Respond(fake, 200, NULL);
+    ASSERT_EQUALS(CodeOf(future), 200);
+  }
+
+  // A POST is retried only if it never reached the server.
+  {
+    FakeAsyncHttpClient* fake = new FakeAsyncHttpClient();
+    Shared<RetryingHttpClient>::Ptr client(
+        Wrap<RetryingHttpClient>(fake, FastSettings()));
+    Future<HttpResult> future =
+        Send(client.get(), "http://a/", HttpRequest::POST);
+    Respond(fake, 503, NULL);
+    ASSERT_EQUALS(CodeOf(future), 503);
+    future = Send(client.get(), "http://a/", HttpRequest::POST);
+    Fail(fake, enquery::kHttpConnectionLost);
+    ASSERT_EQUALS(future.GetValue().status().GetCode(),
+                  enquery::kHttpConnectionLost);
+    future = Send(client.get(), "http://a/", HttpRequest::POST);
+    Fail(fake, enquery::kHttpConnectFailed);
+    Respond(fake, 200, NULL);
+    ASSERT_EQUALS(CodeOf(future), 200);
+    ASSERT_EQUALS(fake->sent(), 4);
+  }
+
+  // A Retry-After within the maximum backoff is waited for; a longer one
+  // isn't retried.
+  {
+    FakeAsyncHttpClient* fake = new FakeAsyncHttpClient();
+    Shared<RetryingHttpClient>::Ptr client(Wrap<RetryingHttpClient>(
+        fake, FastSettings().set_max_backoff_ms(1000)));
+    Future<HttpResult> future = Send(client.get(), "http://a/");
+    Respond(fake, 503, "1");
+    Respond(fake, 200, NULL);
+    ASSERT_EQUALS(CodeOf(future), 200);
+    ASSERT_TRUE(Gap(fake, 1) >= 1000000000u);
+    future = Send(client.get(), "http://a/");
+    Respond(fake, 503, "2");
+    ASSERT_EQUALS(CodeOf(future), 503);
+  }
+
+  // Retries are limited by the budget, which requests top up.
+  {
+    FakeAsyncHttpClient* fake = new FakeAsyncHttpClient();
+    Shared<RetryingHttpClient>::Ptr client(Wrap<RetryingHttpClient>(
+        fake, FastSettings().set_max_retry_tokens(1).set_retry_budget_percent(
+                  50)));
+    Future<HttpResult> future = Send(client.get(), "http://a/");
+    Respond(fake, 503, NULL);
+    Respond(fake, 200, NULL);
+    ASSERT_EQUALS(CodeOf(future), 200);
+    future = Send(client.get(), "http://a/");
+    Respond(fake, 503, NULL);
+    ASSERT_EQUALS(CodeOf(future), 503);
+    ASSERT_EQUALS(StatisticsOf(*client.get()).retries_denied(), 1u);
+    future = Send(client.get(), "http://a/");
+    Respond(fake, 503, NULL);
+    Respond(fake, 200, NULL);
+    ASSERT_EQUALS(CodeOf(future), 200);
+  }
+
+  // A request may be cancelled while it waits to retry, or while an
+  // attempt is in flight.
+  {
+    FakeAsyncHttpClient* fake = new FakeAsyncHttpClient();
+    Shared<RetryingHttpClient>::Ptr client(Wrap<RetryingHttpClient>(
+        fake, RetryingHttpClient::Settings().set_base_backoff_ms(10000)
+                  .set_max_backoff_ms(10000)));
+    Future<HttpResult> future = Send(client.get(), "http://a/");
+    Respond(fake, 503, NULL);
+    while (StatisticsOf(*client.get()).retries() == 0) {
+      usleep(1000);
+    }
+    client->Cancel(future);
+    ASSERT_EQUALS(future.GetValue().status().GetCode(), ECANCELED);
+    future = Send(client.get(), "http://a/");
+    while (fake->sent() < 2) {
+      usleep(1000);
+    }
+    client->Cancel(future);
+    ASSERT_EQUALS(future.GetValue().status().GetCode(), ECANCELED);
+    ASSERT_EQUALS(fake->sent(), 2);
+  }
+
+  // Deleting the client completes requests waiting to retry.
+  {
+    FakeAsyncHttpClient* fake = new FakeAsyncHttpClient();
+    RetryingHttpClient* client = Wrap<RetryingHttpClient>(
+        fake, RetryingHttpClient::Settings().set_base_backoff_ms(10000)
+                  .set_max_backoff_ms(10000));
+    Future<HttpResult> future = Send(client, "http://a/");
+    Respond(fake, 503, NULL);
+    while (StatisticsOf(*client).retries() == 0) {
+      usleep(1000);
+    }
+    delete client;
+    ASSERT_TRUE(future.GetValue().status().IsFailure());
+  }
+
+  // Against a real server, every attempt is made.
+  {
+    Status status;
+    Shared<Http>::Ptr http(Http::Create(&status));
+    ASSERT_TRUE(status.IsSuccess());
+    HttpTestServer server;
+    ASSERT_TRUE(server.Start().IsSuccess());
+    Shared<RetryingHttpClient>::Ptr client(
+        Wrap<RetryingHttpClient>(
+            http->CreateAsyncClient(AsyncHttpClient::Settings(), &status),
+            FastSettings()));
+    const std::string uri = server.Url("/status/503");
+    HttpRequest request;
+    request.set_uri(uri.c_str());
+    Future<HttpResult> future;
+    ASSERT_TRUE(client->SendRequest(request, &future).IsSuccess());
+    ASSERT_EQUALS(CodeOf(future), 503);
+    ASSERT_EQUALS(server.requests_served(), 3u);
+  }
+
+  return EXIT_SUCCESS;
+}
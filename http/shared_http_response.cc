@@ -0,0 +1,49 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "http/shared_http_response.h"
+#include "enquery/slice.h"
+
+namespace enquery {
+
+SharedHttpResponse::SharedHttpResponse(Shared<HttpResponse>::Ptr response)
+    : response_(response) {}
+
+SharedHttpResponse::~SharedHttpResponse() {}
+
+const char* SharedHttpResponse::Body() const { return response_->Body(); }
+
+size_t SharedHttpResponse::BodySize() const { return response_->BodySize(); }
+
+int SharedHttpResponse::StatusCode() const { return response_->StatusCode(); }
+
+size_t SharedHttpResponse::HeaderCount() const {
+  return response_->HeaderCount();
+}
+
+void SharedHttpResponse::GetHeader(size_t index, Slice* name,
+                                   Slice* value) const {
+  response_->GetHeader(index, name, value);
+}
+
+bool SharedHttpResponse::FindHeader(const char* name, Slice* value) const {
+  return response_->FindHeader(name, value);
+}
+
+const HttpTimings& SharedHttpResponse::Timings() const {
+  return response_->Timings();
+}
+
+}  // namespace enquery
@@ -0,0 +1,52 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef HTTP_SHARED_HTTP_RESPONSE_H_
+#define HTTP_SHARED_HTTP_RESPONSE_H_
+
+#include <stdlib.h>
+#include "enquery/http_response.h"
+#include "enquery/shared.h"
+
+namespace enquery {
+
+class Slice;
+
+// Hands a response that others also hold (e.g. a cache, or callers of a
+// coalesced request) to one caller, who owns only this handle: the
+// response, and its body, stay until every holder is done with them.
+class SharedHttpResponse : public HttpResponse {
+ public:
+  explicit SharedHttpResponse(Shared<HttpResponse>::Ptr response);
+  virtual ~SharedHttpResponse();
+
+  virtual const char* Body() const;
+  virtual size_t BodySize() const;
+  virtual int StatusCode() const;
+  virtual size_t HeaderCount() const;
+  virtual void GetHeader(size_t index, Slice* name, Slice* value) const;
+  virtual bool FindHeader(const char* name, Slice* value) const;
+  virtual const HttpTimings& Timings() const;
+
+ private:
+  SharedHttpResponse(const SharedHttpResponse& no_copy);
+  SharedHttpResponse& operator=(const SharedHttpResponse& no_assign);
+
+  const Shared<HttpResponse>::Ptr response_;
+};
+
+}  // namespace enquery
+
+#endif  // HTTP_SHARED_HTTP_RESPONSE_H_
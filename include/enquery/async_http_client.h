@@ -0,0 +1,305 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef INCLUDE_ENQUERY_ASYNC_HTTP_CLIENT_H_
+#define INCLUDE_ENQUERY_ASYNC_HTTP_CLIENT_H_
+
+#include "enquery/futures.h"
+#include "enquery/http_client.h"
+#include "enquery/http_response.h"
+#include "enquery/reactor.h"
+#include "enquery/shared.h"
+#include "enquery/slice.h"
+#include "enquery/status.h"
+
+namespace enquery {
+
+class HttpRequest;
+
+// The outcome of an asynchronous request: a status and, if the request
+// succeeded, the response.
+class HttpResult {
+ public:
+  HttpResult() {}
+
+  HttpResult(const Status& status, Shared<HttpResponse>::Ptr response)
+      : status_(status), response_(response) {}
+
+  // Default copy, assignment, and destructor are O.K.
+
+  // Return the status of the request.
+  const Status& status() const { return status_; }
+
+  // Return the response, or NULL if the request failed.
+  HttpResponse* response() const { return response_.get(); }
+
+  // Return a shared reference to the response.
+  Shared<HttpResponse>::Ptr shared_response() const { return response_; }
+
+ private:
+  Status status_;
+  Shared<HttpResponse>::Ptr response_;
+};
+
+// HttpStream delivers a response body in pieces as it arrives. Data that
+// the reader hasn't yet taken is buffered; once the buffer is full the
+// transfer is paused until the reader catches up, so a slow reader costs
+// a bounded amount of memory. Deleting the stream abandons the transfer.
+class HttpStream {
+ public:
+  virtual ~HttpStream() {}
+
+  // Wait for the response's status code and headers, which come before
+  // any of the body, and return them as a response with an empty body;
+  // e.g. to check the status code before reading on. Returns NULL if the
+  // request failed first, in which case Next() returns the failure. The
+  // head remains valid as long as the stream.
+  virtual const HttpResponse* Head() = 0;
+
+  // Wait for the next piece of the body and point 'chunk' at it. The data
+  // remains valid until the next call. At the end of the body, 'chunk' is
+  // set empty and the status of the request as a whole is returned.
+  virtual Status Next(Slice* chunk) = 0;
+};
+
+// An HTTP client that doesn't block the caller: requests are handed to a
+// small number of I/O threads, each of which multiplexes many transfers,
+// and each request's result is delivered through a Future. Futures are
+// completed (and their Notify() callbacks run) on an I/O thread, so
+// callbacks should be brief.
+class AsyncHttpClient {
+ public:
+  // The Settings class is used to configure an AsyncHttpClient.
+  class Settings {
+   public:
+    Settings()
+        : io_thread_count_(1),
+          max_connections_per_host_(0),
+          max_total_connections_(0),
+          idle_timeout_ms_(60000),
+          stream_buffer_size_(1 << 20),
+          accept_encoding_(false),
+          compress_requests_above_(0),
+          http_version_(HTTP_VERSION_1_1),
+          max_concurrent_streams_(100),
+          connect_timeout_ms_(0),
+          timeout_ms_(0),
+          low_speed_bytes_per_second_(0),
+          low_speed_seconds_(0),
+          max_pipelined_requests_(1),
+          reactor_backend_(Reactor::DEFAULT) {}
+
+    // Set the number of I/O threads. Requests are spread across them.
+    Settings& set_io_thread_count(int count) {
+      io_thread_count_ = count;
+      return *this;
+    }
+
+    // Get the number of I/O threads.
+    int io_thread_count() const { return io_thread_count_; }
+
+    // Set the most connections each I/O thread opens to one host; further
+    // requests wait for a connection. Zero means no limit.
+    Settings& set_max_connections_per_host(int max_connections) {
+      max_connections_per_host_ = max_connections;
+      return *this;
+    }
+
+    // Get the most connections each I/O thread opens to one host.
+    int max_connections_per_host() const { return max_connections_per_host_; }
+
+    // Set the most connections each I/O thread opens in total. Zero means
+    // no limit.
+    Settings& set_max_total_connections(int max_connections) {
+      max_total_connections_ = max_connections;
+      return *this;
+    }
+
+    // Get the most connections each I/O thread opens in total.
+    int max_total_connections() const { return max_total_connections_; }
+
+    // Set how long a connection may stay idle before it is closed.
+    Settings& set_idle_timeout_ms(int timeout_ms) {
+      idle_timeout_ms_ = timeout_ms;
+      return *this;
+    }
+
+    // Get how long a connection may stay idle before it is closed.
+    int idle_timeout_ms() const { return idle_timeout_ms_; }
+
+    // Set the most response data buffered for each HttpStream before its
+    // transfer is paused.
+    Settings& set_stream_buffer_size(size_t size) {
+      stream_buffer_size_ = size;
+      return *this;
+    }
+
+    // Get the most response data buffered for each HttpStream.
+    size_t stream_buffer_size() const { return stream_buffer_size_; }
+
+    // Set whether to ask for compressed responses, as for HttpClient.
+    Settings& set_accept_encoding(bool accept_encoding) {
+      accept_encoding_ = accept_encoding;
+      return *this;
+    }
+
+    // Get whether to ask for compressed responses.
+    bool accept_encoding() const { return accept_encoding_; }
+
+    // Set the size from which request bodies are sent gzip-compressed, as
+    // for HttpClient. Zero never compresses.
+    Settings& set_compress_requests_above(size_t size) {
+      compress_requests_above_ = size;
+      return *this;
+    }
+
+    // Get the size from which request bodies are compressed.
+    size_t compress_requests_above() const { return compress_requests_above_; }
+
+    // Set the version of HTTP to use (by default, HTTP/1.1.) Over HTTP/2,
+    // concurrent requests to a host are multiplexed over one connection
+    // (per I/O thread), and a request waits for that connection rather
+    // than opening another.
+    Settings& set_http_version(HttpVersion version) {
+      http_version_ = version;
+      return *this;
+    }
+
+    // Get the version of HTTP to use.
+    HttpVersion http_version() const { return http_version_; }
+
+    // Set the most requests multiplexed over one HTTP/2 connection. More
+    // connections are opened for further requests, within the connection
+    // limits. Servers may lower it.
+    Settings& set_max_concurrent_streams(int max_streams) {
+      max_concurrent_streams_ = max_streams;
+      return *this;
+    }
+
+    // Get the most requests multiplexed over one HTTP/2 connection.
+    int max_concurrent_streams() const { return max_concurrent_streams_; }
+
+    // Set the default connect timeout for requests, which may override it
+    // (see HttpRequest::set_connect_timeout_ms().) Zero, the default, uses
+    // curl's own limit (300 seconds.)
+    Settings& set_connect_timeout_ms(int timeout_ms) {
+      connect_timeout_ms_ = timeout_ms;
+      return *this;
+    }
+
+    // Get the default connect timeout.
+    int connect_timeout_ms() const { return connect_timeout_ms_; }
+
+    // Set the default total timeout for requests, which may override it
+    // (see HttpRequest::set_timeout_ms().) For a stream, the time includes
+    // any spent paused because the reader fell behind. Zero, the default,
+    // means no limit.
+    Settings& set_timeout_ms(int timeout_ms) {
+      timeout_ms_ = timeout_ms;
+      return *this;
+    }
+
+    // Get the default total timeout.
+    int timeout_ms() const { return timeout_ms_; }
+
+    // Set the default low speed limit for requests, which may override it
+    // (see HttpRequest::set_low_speed_limit().) Zero, the default, means
+    // no limit.
+    Settings& set_low_speed_limit(int bytes_per_second, int seconds) {
+      low_speed_bytes_per_second_ = bytes_per_second;
+      low_speed_seconds_ = seconds;
+      return *this;
+    }
+
+    // Get the default low speed limit.
+    int low_speed_bytes_per_second() const {
+      return low_speed_bytes_per_second_;
+    }
+    int low_speed_seconds() const { return low_speed_seconds_; }
+
+    // Set the most HTTP/1.1 requests sent on one connection ahead of
+    // their responses. Only GET and HEAD requests are pipelined, and only
+    // once every connection the host may have is busy. One, the default,
+    // sends a request only on an idle connection. Only the native engine
+    // (HTTP_ENGINE_NATIVE) pipelines; curl no longer can.
+    Settings& set_max_pipelined_requests(int max_requests) {
+      max_pipelined_requests_ = max_requests;
+      return *this;
+    }
+
+    // Get the most HTTP/1.1 requests sent on one connection at once.
+    int max_pipelined_requests() const { return max_pipelined_requests_; }
+
+    // Set the reactor backend each I/O thread runs on (see Reactor.) The
+    // native engine (HTTP_ENGINE_NATIVE) also has the reactor receive its
+    // responses; curl only waits on it for readiness.
+    Settings& set_reactor_backend(Reactor::Backend backend) {
+      reactor_backend_ = backend;
+      return *this;
+    }
+
+    // Get the reactor backend each I/O thread runs on.
+    Reactor::Backend reactor_backend() const { return reactor_backend_; }
+
+   private:
+    int io_thread_count_;
+    int max_connections_per_host_;
+    int max_total_connections_;
+    int idle_timeout_ms_;
+    size_t stream_buffer_size_;
+    bool accept_encoding_;
+    size_t compress_requests_above_;
+    HttpVersion http_version_;
+    int max_concurrent_streams_;
+    int connect_timeout_ms_;
+    int timeout_ms_;
+    int low_speed_bytes_per_second_;
+    int low_speed_seconds_;
+    int max_pipelined_requests_;
+    Reactor::Backend reactor_backend_;
+  };
+
+  // Requests still in progress when the client is destroyed complete
+  // with an error.
+  virtual ~AsyncHttpClient() {}
+
+  // Start sending 'request', which is copied. On success, 'future' will
+  // receive the result. If a failed Status is returned, the request was
+  // not sent and 'future' is unchanged. May be called from any thread,
+  // including from a Notify() callback.
+  virtual Status SendRequest(const HttpRequest& request,
+                             Future<HttpResult>* future) = 0;
+
+  // Abandon the request whose result 'future' (as set by SendRequest())
+  // is to receive, if it is still in progress; it then completes with an
+  // error whose code is ECANCELED. Cancelling a request that has already
+  // completed has no effect. May be called from any thread, including
+  // from a Notify() callback.
+  virtual void Cancel(const Future<HttpResult>& future) = 0;
+
+  // Start sending 'request', which is copied, and return a stream from
+  // which to read the response body. Returns NULL on failure and
+  // populates the caller's (optional) Status. The caller owns the stream.
+  // If the client is deleted first, the stream ends with an error.
+  virtual HttpStream* OpenStream(const HttpRequest& request,
+                                 Status* status) = 0;
+
+  // Return the bytes transferred by completed requests so far.
+  virtual HttpByteCounts GetByteCounts() const = 0;
+};
+
+}  // namespace enquery
+
+#endif  // INCLUDE_ENQUERY_ASYNC_HTTP_CLIENT_H_
@@ -0,0 +1,218 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef INCLUDE_ENQUERY_BALANCING_HTTP_CLIENT_H_
+#define INCLUDE_ENQUERY_BALANCING_HTTP_CLIENT_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "enquery/async_http_client.h"
+#include "enquery/futures.h"
+#include "enquery/status.h"
+
+namespace enquery {
+
+class HttpRequest;
+
+// BalancingHttpClient spreads requests over the replicas (endpoints) of
+// a service, in front of another AsyncHttpClient. A request's URI is a
+// path, such as "/index/_search", which is appended to the endpoint
+// chosen for it; URIs that aren't paths are sent as they are.
+//
+// Each request picks two endpoints at random and goes to the one with
+// the lower cost: its moving average (EWMA) latency times one more than
+// the requests it has outstanding. An endpoint that hasn't answered yet
+// is assumed to have the mean latency of those that have. This "power of
+// two choices" steers load away from slow or busy replicas without the
+// herding that always picking the best one causes. An endpoint that fails
+// several times in a row is ejected for a cool-down, after which one more
+// failure ejects it again. If every endpoint is ejected, they are all
+// used regardless.
+//
+// A failure is an error other than cancellation, or a 5xx response.
+class BalancingHttpClient : public AsyncHttpClient {
+ public:
+  class Settings {
+   public:
+    Settings()
+        : ewma_weight_(0.3), max_failures_(5), ejection_ms_(10000) {}
+
+    // Add an endpoint (a URL prefix, such as "http://replica-2:8080".)
+    Settings& add_endpoint(const char* endpoint) {
+      endpoints_.push_back(endpoint);
+      return *this;
+    }
+
+    // Get the endpoints.
+    const std::vector<std::string>& endpoints() const { return endpoints_; }
+
+    // Set the weight (between 0 and 1) of each latency in the moving
+    // average. Higher weights follow changes sooner but are noisier.
+    Settings& set_ewma_weight(double weight) {
+      ewma_weight_ = weight;
+      return *this;
+    }
+
+    // Get the weight of each latency in the moving average.
+    double ewma_weight() const { return ewma_weight_; }
+
+    // Set the failures in a row that eject an endpoint.
+    Settings& set_max_failures(int failures) {
+      max_failures_ = failures;
+      return *this;
+    }
+
+    // Get the failures in a row that eject an endpoint.
+    int max_failures() const { return max_failures_; }
+
+    // Set how long an endpoint stays ejected.
+    Settings& set_ejection_ms(int ejection_ms) {
+      ejection_ms_ = ejection_ms;
+      return *this;
+    }
+
+    // Get how long an endpoint stays ejected.
+    int ejection_ms() const { return ejection_ms_; }
+
+   private:
+    std::vector<std::string> endpoints_;
+    double ewma_weight_;
+    int max_failures_;
+    int ejection_ms_;
+  };
+
+  // A point-in-time snapshot of one endpoint, as returned by
+  // GetStatistics().
+  class EndpointStatistics {
+   public:
+    EndpointStatistics()
+        : requests_(0),
+          failures_(0),
+          outstanding_(0),
+          ewma_latency_nanos_(0),
+          ejections_(0),
+          ejected_(false) {}
+
+    // Set the endpoint.
+    EndpointStatistics& set_endpoint(const std::string& endpoint) {
+      endpoint_ = endpoint;
+      return *this;
+    }
+
+    // Get the endpoint.
+    const std::string& endpoint() const { return endpoint_; }
+
+    // Set the number of requests sent to the endpoint.
+    EndpointStatistics& set_requests(uint64_t requests) {
+      requests_ = requests;
+      return *this;
+    }
+
+    // Get the number of requests sent to the endpoint.
+    uint64_t requests() const { return requests_; }
+
+    // Set the number of requests that failed.
+    EndpointStatistics& set_failures(uint64_t failures) {
+      failures_ = failures;
+      return *this;
+    }
+
+    // Get the number of requests that failed.
+    uint64_t failures() const { return failures_; }
+
+    // Set the number of requests outstanding.
+    EndpointStatistics& set_outstanding(uint64_t outstanding) {
+      outstanding_ = outstanding;
+      return *this;
+    }
+
+    // Get the number of requests outstanding.
+    uint64_t outstanding() const { return outstanding_; }
+
+    // Set the moving average latency.
+    EndpointStatistics& set_ewma_latency_nanos(uint64_t nanos) {
+      ewma_latency_nanos_ = nanos;
+      return *this;
+    }
+
+    // Get the moving average latency.
+    uint64_t ewma_latency_nanos() const { return ewma_latency_nanos_; }
+
+    // Set the number of times the endpoint has been ejected.
+    EndpointStatistics& set_ejections(uint64_t ejections) {
+      ejections_ = ejections;
+      return *this;
+    }
+
+    // Get the number of times the endpoint has been ejected.
+    uint64_t ejections() const { return ejections_; }
+
+    // Set whether the endpoint is ejected now.
+    EndpointStatistics& set_ejected(bool ejected) {
+      ejected_ = ejected;
+      return *this;
+    }
+
+    // Get whether the endpoint is ejected now.
+    bool ejected() const { return ejected_; }
+
+   private:
+    std::string endpoint_;
+    uint64_t requests_;
+    uint64_t failures_;
+    uint64_t outstanding_;
+    uint64_t ewma_latency_nanos_;
+    uint64_t ejections_;
+    bool ejected_;
+  };
+
+  virtual ~BalancingHttpClient();
+
+  // Create a balancing client in front of 'client', which it takes
+  // ownership of (even on failure.) Returns NULL in the event of an
+  // error and populates the caller's (optional) Status variable with
+  // error information.
+  static BalancingHttpClient* Create(AsyncHttpClient* client,
+                                     const Settings& settings, Status* status);
+
+  virtual Status SendRequest(const HttpRequest& request,
+                             Future<HttpResult>* future);
+
+  virtual void Cancel(const Future<HttpResult>& future);
+
+  // Open a stream to an endpoint chosen as for a request. Streams aren't
+  // counted in the endpoint's statistics.
+  virtual HttpStream* OpenStream(const HttpRequest& request, Status* status);
+
+  virtual HttpByteCounts GetByteCounts() const;
+
+  // Populate 'stats' with a snapshot of each endpoint, in the order they
+  // were added.
+  void GetStatistics(std::vector<EndpointStatistics>* stats) const;
+
+ private:
+  BalancingHttpClient(const BalancingHttpClient& no_copy);
+  BalancingHttpClient& operator=(const BalancingHttpClient& no_assign);
+
+  class Rep;
+  explicit BalancingHttpClient(Rep* rep);
+
+  Rep* rep_;
+};
+
+}  // namespace enquery
+
+#endif  // INCLUDE_ENQUERY_BALANCING_HTTP_CLIENT_H_
@@ -0,0 +1,197 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef INCLUDE_ENQUERY_BATCHING_HTTP_CLIENT_H_
+#define INCLUDE_ENQUERY_BATCHING_HTTP_CLIENT_H_
+
+#include <stdint.h>
+#include <vector>
+#include "enquery/async_http_client.h"
+#include "enquery/futures.h"
+#include "enquery/slice.h"
+#include "enquery/status.h"
+
+namespace enquery {
+
+class HttpRequest;
+class HttpResponse;
+
+// One request's share of the response to a batch, as found by
+// HttpBatchEncoder::Decode().
+struct HttpBatchPart {
+  HttpBatchPart() : status_code(0) {}
+  int status_code;  // Zero if the batch has no answer for the request.
+  Slice body;       // Must lie within the body of the batch response.
+};
+
+// HttpBatchEncoder lets a BatchingHttpClient combine small requests into
+// one call to a bulk endpoint (e.g. a multi-get) that the server offers,
+// and split the response to that call among them. Its methods may be
+// called from several threads at once.
+class HttpBatchEncoder {
+ public:
+  virtual ~HttpBatchEncoder() {}
+
+  // Return true if 'request' may be sent as part of a batch.
+  virtual bool IsBatchable(const HttpRequest& request) = 0;
+
+  // Set 'batch' to one request that asks for what all of 'requests' do.
+  // There are at least two requests, all to the same host. A failure
+  // fails every request with the same Status.
+  virtual Status Encode(const std::vector<const HttpRequest*>& requests,
+                        HttpRequest* batch) = 0;
+
+  // Split 'response', the successful response to a batch of 'count'
+  // requests, into one part for each, in the order they were encoded.
+  // 'parts' holds 'count' empty parts on entry. A failure fails every
+  // request with the same Status.
+  virtual Status Decode(const HttpResponse& response, size_t count,
+                        std::vector<HttpBatchPart>* parts) = 0;
+};
+
+// BatchingHttpClient cuts round trips for many small requests to the same
+// host, in front of another AsyncHttpClient. The first request for a host
+// opens a batch, which collects further requests for that host until a
+// short window has passed, or it is full. The batch is then sent all at
+// once, in one of two ways:
+//
+// - Without an encoder, the requests are handed to the wrapped client
+//   back to back. Given a native client (HTTP_ENGINE_NATIVE) that may
+//   pipeline (see AsyncHttpClient::Settings::set_max_pipelined_requests())
+//   and a small limit on connections per host, they are written on one
+//   connection ahead of their responses, with a single system call. Only
+//   GET and HEAD requests without a body are batched this way, since only
+//   they are safe to pipeline.
+//
+// - With an HttpBatchEncoder, requests that it accepts are combined into
+//   one request, and the response is split among them. A batch of one is
+//   sent as it is.
+//
+// Either way each caller's future completes on its own, with its own
+// response (a part shares the batch response, rather than copying it) or
+// failure. Other requests, and all calls to OpenStream(), go straight to
+// the wrapped client.
+class BatchingHttpClient : public AsyncHttpClient {
+ public:
+  class Settings {
+   public:
+    Settings() : window_us_(200), max_batch_size_(32), encoder_(NULL) {}
+
+    // Set how long a batch collects requests, from its first, before it
+    // is sent. This is the most a request is delayed. Zero sends every
+    // request at once, without batching.
+    Settings& set_window_us(int window_us) {
+      window_us_ = window_us;
+      return *this;
+    }
+
+    // Get how long a batch collects requests.
+    int window_us() const { return window_us_; }
+
+    // Set the most requests in a batch. A full batch is sent at once.
+    Settings& set_max_batch_size(int max_batch_size) {
+      max_batch_size_ = max_batch_size;
+      return *this;
+    }
+
+    // Get the most requests in a batch.
+    int max_batch_size() const { return max_batch_size_; }
+
+    // Set the encoder that combines a batch into one request, or NULL
+    // (the default) to pipeline the batch instead. The encoder is not
+    // owned, and must outlive the client.
+    Settings& set_encoder(HttpBatchEncoder* encoder) {
+      encoder_ = encoder;
+      return *this;
+    }
+
+    // Get the encoder, if any.
+    HttpBatchEncoder* encoder() const { return encoder_; }
+
+   private:
+    int window_us_;
+    int max_batch_size_;
+    HttpBatchEncoder* encoder_;
+  };
+
+  // A point-in-time snapshot of batching activity, as returned by
+  // GetStatistics().
+  class Statistics {
+   public:
+    Statistics() : requests_(0), batches_(0) {}
+
+    // Set the number of requests that were batched.
+    Statistics& set_requests(uint64_t requests) {
+      requests_ = requests;
+      return *this;
+    }
+
+    // Get the number of requests that were batched.
+    uint64_t requests() const { return requests_; }
+
+    // Set the number of batches sent. Their average size is requests()
+    // over batches().
+    Statistics& set_batches(uint64_t batches) {
+      batches_ = batches;
+      return *this;
+    }
+
+    // Get the number of batches sent.
+    uint64_t batches() const { return batches_; }
+
+   private:
+    uint64_t requests_;
+    uint64_t batches_;
+  };
+
+  // Requests still waiting in a batch complete with an error.
+  virtual ~BatchingHttpClient();
+
+  // Create a batching client in front of 'client', which it takes
+  // ownership of (even on failure.) Returns NULL in the event of an
+  // error and populates the caller's (optional) Status variable with
+  // error information.
+  static BatchingHttpClient* Create(AsyncHttpClient* client,
+                                    const Settings& settings, Status* status);
+
+  virtual Status SendRequest(const HttpRequest& request,
+                             Future<HttpResult>* future);
+
+  // Cancel a request. One still waiting in its batch is dropped from it.
+  // One sent in a combined batch completes at once, but the batch is
+  // still sent, for the sake of the others.
+  virtual void Cancel(const Future<HttpResult>& future);
+
+  virtual HttpStream* OpenStream(const HttpRequest& request, Status* status);
+
+  // Return the bytes transferred by the wrapped client.
+  virtual HttpByteCounts GetByteCounts() const;
+
+  // Populate 'stats' with a snapshot of the client's counters.
+  void GetStatistics(Statistics* stats) const;
+
+ private:
+  BatchingHttpClient(const BatchingHttpClient& no_copy);
+  BatchingHttpClient& operator=(const BatchingHttpClient& no_assign);
+
+  class Rep;
+  explicit BatchingHttpClient(Rep* rep);
+
+  Rep* rep_;
+};
+
+}  // namespace enquery
+
+#endif  // INCLUDE_ENQUERY_BATCHING_HTTP_CLIENT_H_
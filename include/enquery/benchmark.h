@@ -0,0 +1,385 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef INCLUDE_ENQUERY_BENCHMARK_H_
+#define INCLUDE_ENQUERY_BENCHMARK_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "enquery/mutex.h"
+#include "enquery/portability.h"
+
+// A minimal micro-benchmark framework, in the spirit of testing.h. Each
+// *_bench.cc file registers functions with ENQUERY_BENCHMARK() and ends
+// with ENQUERY_BENCHMARK_MAIN(). For example:
+//
+//   void BM_Append(BenchmarkState* state) {
+//     Buffer buffer;
+//     for (uint64_t i = 0; i < state->iterations(); ++i) {
+//       buffer.Append("x", 1);
+//     }
+//   }
+//   ENQUERY_BENCHMARK(BM_Append);
+//
+//   ENQUERY_BENCHMARK_MAIN()
+//
+// Each benchmark is first calibrated: it is run with a growing number of
+// iterations until one run (a "sample") takes a target time, which also
+// warms caches, the allocator and any thread pools. It is then run for a
+// fixed number of samples. The reported ns/op is the total time over the
+// total iterations; percentiles are of the per-sample ns/op.
+//
+// Flags accepted by the generated main():
+//   --filter=SUBSTRING  only run benchmarks whose name contains SUBSTRING
+//   --format=FORMAT     text (default), csv, or json
+//   --min_time=SECONDS  time to spend measuring each benchmark (default 1)
+//   --samples=N         number of samples per benchmark (default 50)
+//
+// In lock profiling builds, the hottest locks are reported at the end.
+
+namespace enquery {
+
+// Prevent the compiler from optimizing away a value computed in a
+// benchmark loop.
+template <typename T>
+inline void DoNotOptimize(const T& value) {
+#if defined(__GNUC__)
+  __asm__ __volatile__("" : : "r"(&value) : "memory");
+#else
+  static volatile const void* sink;
+  sink = &value;
+#endif
+}
+
+// Passed to each benchmark function, which must perform the operation
+// under test iterations() times. Setup and teardown that should not be
+// measured may be bracketed by StopTiming() and StartTiming().
+class BenchmarkState {
+ public:
+  explicit BenchmarkState(uint64_t iterations)
+      : iterations_(iterations), elapsed_(0), started_at_(0), running_(false) {
+    StartTiming();
+  }
+
+  // Return the number of times to perform the operation.
+  uint64_t iterations() const { return iterations_; }
+
+  // Resume timing.
+  void StartTiming() {
+    if (!running_) {
+      running_ = true;
+      started_at_ = MonotonicNanos();
+    }
+  }
+
+  // Pause timing.
+  void StopTiming() {
+    if (running_) {
+      elapsed_ += MonotonicNanos() - started_at_;
+      running_ = false;
+    }
+  }
+
+  // Return the time measured so far, in nanoseconds.
+  uint64_t elapsed_nanos() const { return elapsed_; }
+
+ private:
+  BenchmarkState(const BenchmarkState& no_copy);
+  BenchmarkState& operator=(const BenchmarkState& no_assign);
+
+  uint64_t iterations_;
+  uint64_t elapsed_;
+  uint64_t started_at_;
+  bool running_;
+};
+
+typedef void (*BenchmarkFunction)(BenchmarkState* state);
+
+class Benchmark {
+ public:
+  typedef enum Format { TEXT = 0, CSV = 1, JSON = 2 } Format;
+
+  // The Settings class controls how benchmarks are run and reported.
+  class Settings {
+   public:
+    Settings()
+        : min_time_seconds_(1.0), samples_(50), format_(TEXT), filter_("") {}
+
+    // Set the time to spend measuring each benchmark.
+    Settings& set_min_time_seconds(double seconds) {
+      min_time_seconds_ = seconds;
+      return *this;
+    }
+
+    // Get the time to spend measuring each benchmark.
+    double min_time_seconds() const { return min_time_seconds_; }
+
+    // Set the number of samples taken for each benchmark.
+    Settings& set_samples(int samples) {
+      samples_ = samples;
+      return *this;
+    }
+
+    // Get the number of samples taken for each benchmark.
+    int samples() const { return samples_; }
+
+    // Set the output format.
+    Settings& set_format(Format format) {
+      format_ = format;
+      return *this;
+    }
+
+    // Get the output format.
+    Format format() const { return format_; }
+
+    // Only run benchmarks whose name contains 'filter'.
+    Settings& set_filter(const char* filter) {
+      filter_ = filter;
+      return *this;
+    }
+
+    // Get the benchmark name filter.
+    const char* filter() const { return filter_.c_str(); }
+
+   private:
+    double min_time_seconds_;
+    int samples_;
+    Format format_;
+    std::string filter_;
+  };
+
+  // The measurements for a single benchmark.
+  struct Result {
+    std::string name;
+    uint64_t iterations;
+    double ns_per_op;
+    double min_ns;
+    double p50_ns;
+    double p90_ns;
+    double p99_ns;
+    double max_ns;
+  };
+
+  // Add a benchmark to the set run by RunAll(). Returns true so that it
+  // may be used in a static initializer.
+  static bool Register(const char* name, BenchmarkFunction function) {
+    Entry entry = {name, function};
+    Registry()->push_back(entry);
+    return true;
+  }
+
+  // Measure a single function.
+  static Result Run(const char* name, BenchmarkFunction function,
+                    const Settings& settings) {
+    const int samples = settings.samples() > 0 ? settings.samples() : 1;
+    const uint64_t target =
+        static_cast<uint64_t>(settings.min_time_seconds() * 1e9 / samples);
+
+    // Calibrate, growing the iteration count until a sample takes the
+    // target time. Growth is bounded so that a noisy first run can't
+    // overshoot by much.
+    uint64_t iterations = 1;
+    for (;;) {
+      const uint64_t elapsed = RunOnce(function, iterations);
+      if (elapsed >= target || iterations >= kMaxIterations) {
+        break;
+      }
+      uint64_t next = iterations * 10;
+      if (elapsed > 0) {
+        const double scaled = 1.2 * iterations * target / elapsed;
+        if (scaled < next) {
+          next = static_cast<uint64_t>(scaled);
+        }
+      }
+      if (next <= iterations) {
+        next = iterations + 1;
+      }
+      iterations = (next < kMaxIterations) ? next : kMaxIterations;
+    }
+
+    // Measure.
+    std::vector<double> per_op;
+    uint64_t total = 0;
+    for (int i = 0; i < samples; ++i) {
+      const uint64_t elapsed = RunOnce(function, iterations);
+      total += elapsed;
+      per_op.push_back(static_cast<double>(elapsed) / iterations);
+    }
+    std::sort(per_op.begin(), per_op.end());
+
+    Result result;
+    result.name = name;
+    result.iterations = iterations * samples;
+    result.ns_per_op = static_cast<double>(total) / result.iterations;
+    result.min_ns = per_op.front();
+    result.p50_ns = Percentile(per_op, 50.0);
+    result.p90_ns = Percentile(per_op, 90.0);
+    result.p99_ns = Percentile(per_op, 99.0);
+    result.max_ns = per_op.back();
+    return result;
+  }
+
+  // Run all registered benchmarks that match the filter, writing results
+  // to stdout as each completes. Returns the number run.
+  static int RunAll(const Settings& settings) {
+    const std::vector<Entry>& registry = *Registry();
+    int count = 0;
+    PrintHeader(settings.format());
+    for (size_t i = 0; i < registry.size(); ++i) {
+      if (strstr(registry[i].name, settings.filter()) == NULL) {
+        continue;
+      }
+      Result result = Run(registry[i].name, registry[i].function, settings);
+      PrintResult(settings.format(), result, count == 0);
+      ++count;
+    }
+    PrintFooter(settings.format());
+    return count;
+  }
+
+  // Parse command line flags and run all registered benchmarks.
+  static int Main(int argc, char* argv[]) {
+    Settings settings;
+    for (int i = 1; i < argc; ++i) {
+      const char* arg = argv[i];
+      if (strncmp(arg, "--filter=", 9) == 0) {
+        settings.set_filter(arg + 9);
+      } else if (strcmp(arg, "--format=text") == 0) {
+        settings.set_format(TEXT);
+      } else if (strcmp(arg, "--format=csv") == 0) {
+        settings.set_format(CSV);
+      } else if (strcmp(arg, "--format=json") == 0) {
+        settings.set_format(JSON);
+      } else if (strncmp(arg, "--min_time=", 11) == 0) {
+        settings.set_min_time_seconds(atof(arg + 11));
+      } else if (strncmp(arg, "--samples=", 10) == 0) {
+        settings.set_samples(atoi(arg + 10));
+      } else {
+        fprintf(stderr,
+                "usage: %s [--filter=SUBSTRING] [--format=text|csv|json] "
+                "[--min_time=SECONDS] [--samples=N]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+      }
+    }
+    RunAll(settings);
+    if (LockProfiler::IsEnabled()) {
+      LockProfiler::PrintReport(kLockReportEntries);
+    }
+    return EXIT_SUCCESS;
+  }
+
+ private:
+  static const uint64_t kMaxIterations = 1000000000ULL;
+  static const size_t kLockReportEntries = 10;
+
+  struct Entry {
+    const char* name;
+    BenchmarkFunction function;
+  };
+
+  static std::vector<Entry>* Registry() {
+    static std::vector<Entry> registry;
+    return &registry;
+  }
+
+  static uint64_t RunOnce(BenchmarkFunction function, uint64_t iterations) {
+    BenchmarkState state(iterations);
+    function(&state);
+    state.StopTiming();
+    return state.elapsed_nanos();
+  }
+
+  // Nearest-rank percentile of sorted 'values'.
+  static double Percentile(const std::vector<double>& values, double pct) {
+    size_t rank = static_cast<size_t>(pct / 100.0 * values.size() + 0.5);
+    if (rank < 1) {
+      rank = 1;
+    }
+    if (rank > values.size()) {
+      rank = values.size();
+    }
+    return values[rank - 1];
+  }
+
+  static void PrintHeader(Format format) {
+    switch (format) {
+      case TEXT:
+        printf("%-40s %12s %10s %10s %10s %10s %10s\n", "benchmark",
+               "iterations", "ns/op", "p50", "p90", "p99", "max");
+        break;
+      case CSV:
+        printf("name,iterations,ns_per_op,min_ns,p50_ns,p90_ns,p99_ns,"
+               "max_ns\n");
+        break;
+      case JSON:
+        printf("{\"benchmarks\":[");
+        break;
+    }
+    fflush(stdout);
+  }
+
+  static void PrintResult(Format format, const Result& r, bool first) {
+    const char* name = r.name.c_str();
+    const unsigned long long iterations = r.iterations;  // NOLINT
+    switch (format) {
+      case TEXT:
+        printf("%-40s %12llu %10.1f %10.1f %10.1f %10.1f %10.1f\n", name,
+               iterations, r.ns_per_op, r.p50_ns, r.p90_ns, r.p99_ns,
+               r.max_ns);
+        break;
+      case CSV:
+        printf("%s,%llu,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n", name, iterations,
+               r.ns_per_op, r.min_ns, r.p50_ns, r.p90_ns, r.p99_ns,
+               r.max_ns);
+        break;
+      case JSON:
+        printf("%s\n  {\"name\":\"%s\",\"iterations\":%llu,"
+               "\"ns_per_op\":%.3f,\"min_ns\":%.3f,\"p50_ns\":%.3f,"
+               "\"p90_ns\":%.3f,\"p99_ns\":%.3f,\"max_ns\":%.3f}",
+               first ? "" : ",", name, iterations, r.ns_per_op, r.min_ns,
+               r.p50_ns, r.p90_ns, r.p99_ns, r.max_ns);
+        break;
+    }
+    fflush(stdout);
+  }
+
+  static void PrintFooter(Format format) {
+    if (format == JSON) {
+      printf("\n]}\n");
+    }
+  }
+};
+
+}  // namespace enquery
+
+// Register a benchmark function, which must have the signature
+// void (BenchmarkState*).
+#define ENQUERY_BENCHMARK(function)                        \
+  static const bool enquery_benchmark_##function =         \
+      ::enquery::Benchmark::Register(#function, function)
+
+// Define main() to run all benchmarks registered in the executable.
+#define ENQUERY_BENCHMARK_MAIN()                           \
+  int main(int argc, char* argv[]) {                       \
+    return ::enquery::Benchmark::Main(argc, argv);         \
+  }
+
+#endif  // INCLUDE_ENQUERY_BENCHMARK_H_
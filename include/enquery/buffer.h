@@ -56,6 +56,16 @@ class Buffer {
   // Returns reference to self so that calls may be chained.
   Buffer& Append(const char* data, size_t size);
 
+  // Remove the contents, keeping the memory allocated for reuse.
+  void Clear();
+
+  // Allocate memory for at least 'size' bytes in all, so that appending
+  // up to that size doesn't reallocate.
+  void Reserve(size_t size);
+
+  // Return the number of bytes allocated.
+  size_t Capacity() const;
+
   // Canonical swap support
   void swap(Buffer& other);
 
@@ -0,0 +1,170 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef INCLUDE_ENQUERY_CACHING_HTTP_CLIENT_H_
+#define INCLUDE_ENQUERY_CACHING_HTTP_CLIENT_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "enquery/http_client.h"
+#include "enquery/status.h"
+
+namespace enquery {
+
+// CachingHttpClient keeps responses to GET and HEAD requests in memory
+// and answers repeated requests from them, in front of another client.
+// Freshness follows the response's Cache-Control (max-age, no-cache and
+// no-store) and Expires headers. Once a response is stale, or if the
+// request says "Cache-Control: no-cache", the cache asks the server
+// whether it has changed with If-None-Match and If-Modified-Since; a
+// "304 Not Modified" reply costs no body, and the stored response is
+// returned again. Stored responses are shared with the callers they are
+// returned to, not copied. It is a private cache: responses marked
+// "private" are stored.
+//
+// Requests that the cache can't answer (other methods, conditional
+// requests, and requests with "Cache-Control: no-store") go straight to
+// the wrapped client, as do all calls to StreamRequest().
+class CachingHttpClient : public HttpClient {
+ public:
+  class Settings {
+   public:
+    Settings() : max_bytes_(64 << 20) {}
+
+    // Set the most bytes of responses (bodies and headers) to hold. The
+    // least recently used responses are evicted to stay within it; a
+    // response larger than this is never stored.
+    Settings& set_max_bytes(size_t max_bytes) {
+      max_bytes_ = max_bytes;
+      return *this;
+    }
+
+    // Get the most bytes of responses to hold.
+    size_t max_bytes() const { return max_bytes_; }
+
+    // Add a request header whose value is part of the key that responses
+    // are stored under, for servers whose responses depend on it (e.g.
+    // "Accept-Language".) Requests always differ by method and URI.
+    Settings& add_key_header(const char* name) {
+      key_headers_.push_back(name);
+      return *this;
+    }
+
+    // Get the request headers that are part of the key.
+    const std::vector<std::string>& key_headers() const {
+      return key_headers_;
+    }
+
+   private:
+    size_t max_bytes_;
+    std::vector<std::string> key_headers_;
+  };
+
+  // A point-in-time snapshot of cache activity, as returned by
+  // GetStatistics().
+  class Statistics {
+   public:
+    Statistics()
+        : hits_(0), revalidations_(0), misses_(0), evictions_(0), bytes_(0) {}
+
+    // Set the number of requests answered without asking the server.
+    Statistics& set_hits(uint64_t hits) {
+      hits_ = hits;
+      return *this;
+    }
+
+    // Get the number of requests answered without asking the server.
+    uint64_t hits() const { return hits_; }
+
+    // Set the number of requests answered from the cache after the server
+    // said that the stored response was still good.
+    Statistics& set_revalidations(uint64_t revalidations) {
+      revalidations_ = revalidations;
+      return *this;
+    }
+
+    // Get the number of requests answered after revalidation.
+    uint64_t revalidations() const { return revalidations_; }
+
+    // Set the number of cacheable requests that needed a full response.
+    Statistics& set_misses(uint64_t misses) {
+      misses_ = misses;
+      return *this;
+    }
+
+    // Get the number of cacheable requests that needed a full response.
+    uint64_t misses() const { return misses_; }
+
+    // Set the number of responses evicted to make room for others.
+    Statistics& set_evictions(uint64_t evictions) {
+      evictions_ = evictions;
+      return *this;
+    }
+
+    // Get the number of responses evicted to make room for others.
+    uint64_t evictions() const { return evictions_; }
+
+    // Set the number of bytes held.
+    Statistics& set_bytes(uint64_t bytes) {
+      bytes_ = bytes;
+      return *this;
+    }
+
+    // Get the number of bytes held.
+    uint64_t bytes() const { return bytes_; }
+
+   private:
+    uint64_t hits_;
+    uint64_t revalidations_;
+    uint64_t misses_;
+    uint64_t evictions_;
+    uint64_t bytes_;
+  };
+
+  virtual ~CachingHttpClient();
+
+  // Create a cache in front of 'client', which it takes ownership of
+  // (even on failure.) Returns NULL in the event of an error and
+  // populates the caller's (optional) Status variable with error
+  // information.
+  static CachingHttpClient* Create(HttpClient* client,
+                                   const Settings& settings, Status* status);
+
+  virtual HttpResponse* SendRequest(const HttpRequest& request, Status* status);
+
+  virtual Status StreamRequest(const HttpRequest& request, HttpSink* sink);
+
+  // Return the bytes transferred by the wrapped client, which exclude
+  // responses answered from the cache.
+  virtual HttpByteCounts GetByteCounts() const;
+
+  // Populate 'stats' with a snapshot of the cache's counters.
+  void GetStatistics(Statistics* stats) const;
+
+ private:
+  CachingHttpClient(const CachingHttpClient& no_copy);
+  CachingHttpClient& operator=(const CachingHttpClient& no_assign);
+
+  class Rep;
+  explicit CachingHttpClient(Rep* rep);
+
+  Rep* rep_;
+};
+
+}  // namespace enquery
+
+#endif  // INCLUDE_ENQUERY_CACHING_HTTP_CLIENT_H_
@@ -0,0 +1,98 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef INCLUDE_ENQUERY_COALESCING_HTTP_CLIENT_H_
+#define INCLUDE_ENQUERY_COALESCING_HTTP_CLIENT_H_
+
+#include <stdint.h>
+#include "enquery/http_client.h"
+#include "enquery/status.h"
+
+namespace enquery {
+
+// CoalescingHttpClient sends each set of identical GET and HEAD requests
+// that are in flight at the same time to the server once, in front of
+// another client. The first request of a set goes to the wrapped client;
+// those that arrive before it completes wait for it, and every one of
+// them gets the same response (or failure.) The response is shared, not
+// copied. Requests are identical if they have the same method, URI,
+// headers and time limits, so that none waits on another longer than its
+// own limits allow.
+//
+// This protects a server from a burst of requests for the same thing,
+// e.g. when a popular document expires from callers' caches at once.
+// Other requests, and all calls to StreamRequest(), go straight to the
+// wrapped client.
+class CoalescingHttpClient : public HttpClient {
+ public:
+  // A point-in-time snapshot of coalescing activity, as returned by
+  // GetStatistics().
+  class Statistics {
+   public:
+    Statistics() : sent_(0), collapsed_(0) {}
+
+    // Set the number of requests that were sent to the wrapped client.
+    Statistics& set_sent(uint64_t sent) {
+      sent_ = sent;
+      return *this;
+    }
+
+    // Get the number of requests that were sent to the wrapped client.
+    uint64_t sent() const { return sent_; }
+
+    // Set the number of requests answered with another's response.
+    Statistics& set_collapsed(uint64_t collapsed) {
+      collapsed_ = collapsed;
+      return *this;
+    }
+
+    // Get the number of requests answered with another's response.
+    uint64_t collapsed() const { return collapsed_; }
+
+   private:
+    uint64_t sent_;
+    uint64_t collapsed_;
+  };
+
+  virtual ~CoalescingHttpClient();
+
+  // Create a coalescing client in front of 'client', which it takes
+  // ownership of (even on failure.) Returns NULL in the event of an
+  // error and populates the caller's (optional) Status variable with
+  // error information.
+  static CoalescingHttpClient* Create(HttpClient* client, Status* status);
+
+  virtual HttpResponse* SendRequest(const HttpRequest& request, Status* status);
+
+  virtual Status StreamRequest(const HttpRequest& request, HttpSink* sink);
+
+  virtual HttpByteCounts GetByteCounts() const;
+
+  // Populate 'stats' with a snapshot of the client's counters.
+  void GetStatistics(Statistics* stats) const;
+
+ private:
+  CoalescingHttpClient(const CoalescingHttpClient& no_copy);
+  CoalescingHttpClient& operator=(const CoalescingHttpClient& no_assign);
+
+  class Rep;
+  explicit CoalescingHttpClient(Rep* rep);
+
+  Rep* rep_;
+};
+
+}  // namespace enquery
+
+#endif  // INCLUDE_ENQUERY_COALESCING_HTTP_CLIENT_H_
@@ -19,8 +19,11 @@
 #include <inttypes.h>
 #include <pthread.h>
 #include <algorithm>
+#include <stdint.h>
 #include <deque>
+#include "enquery/mutex.h"
 #include "enquery/shared.h"
+#include "enquery/trace.h"
 
 namespace enquery {
 
@@ -102,19 +105,15 @@ class Callback_2 : public Callback {
 template <typename T>
 class SharedValue {
  public:
-  SharedValue() : ready_(false), value_(T()) {
-    pthread_mutex_init(&mutex_, NULL);
-    pthread_cond_init(&cond_, NULL);
-  }
-
-  ~SharedValue() {
-    pthread_cond_destroy(&cond_);
-    pthread_mutex_destroy(&mutex_);
-  }
+  SharedValue() : mutex_("SharedValue"), ready_(false), value_(T()) {}
 
   // TODO(tdial): Should we allow multiple calls to Set()?
   void Set(const T& value) {
-    pthread_mutex_lock(&mutex_);
+    // The flow starts before the value is published, so that a waiter
+    // can't end it first.
+    ENQUERY_TRACE(Tracer::FLOW_START, "future", "future",
+                  reinterpret_cast<uintptr_t>(this));
+    mutex_.Lock();
     value_ = value;
     ready_ = true;
 
@@ -123,17 +122,23 @@ class SharedValue {
     // Get() on a future without causing deadlock.
     CallbackQueue calls;
     callbacks_.swap(calls);
-    pthread_cond_broadcast(&cond_);
-    pthread_mutex_unlock(&mutex_);
+    cond_.Broadcast();
+    mutex_.Unlock();
     calls.Execute();
   }
 
   T Get() {
-    pthread_mutex_lock(&mutex_);
-    while (!ready_) {
-      pthread_cond_wait(&cond_, &mutex_);
+    mutex_.Lock();
+    if (!ready_) {
+      // Only waits are traced; they end with the flow from the Set().
+      TraceScope trace("future", "future.wait");
+      while (!ready_) {
+        cond_.Wait(&mutex_);
+      }
+      ENQUERY_TRACE(Tracer::FLOW_END, "future", "future",
+                    reinterpret_cast<uintptr_t>(this));
     }
-    pthread_mutex_unlock(&mutex_);
+    mutex_.Unlock();
     return value_;
   }
 
@@ -141,22 +146,22 @@ class SharedValue {
     // If the the SharedValue has already been set, execute the callback
     // immediately on the current thread. Otherwise, queue the callback
     // for later execution, which occurs on the thread that calls Set().
-    pthread_mutex_lock(&mutex_);
+    mutex_.Lock();
     Callback* tmp = NULL;
     if (ready_) {
       tmp = callback;
     } else {
       callbacks_.Add(callback);
     }
-    pthread_mutex_unlock(&mutex_);
+    mutex_.Unlock();
     if (tmp) {
       tmp->Execute();
       delete tmp;
     }
   }
 
-  pthread_mutex_t mutex_;
-  pthread_cond_t cond_;
+  Mutex mutex_;
+  CondVar cond_;
   bool ready_;
   T value_;
   CallbackQueue callbacks_;
@@ -180,6 +185,11 @@ class Future {
 
   bool Valid() const { return (value_.get() != NULL); }
 
+  // Return true if both futures will receive the same value.
+  bool operator==(const Future<T>& other) const {
+    return value_ == other.value_;
+  }
+
   T GetValue() { return value_->Get(); }
 
   template <typename F>
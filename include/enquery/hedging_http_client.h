@@ -0,0 +1,200 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef INCLUDE_ENQUERY_HEDGING_HTTP_CLIENT_H_
+#define INCLUDE_ENQUERY_HEDGING_HTTP_CLIENT_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "enquery/async_http_client.h"
+#include "enquery/futures.h"
+#include "enquery/status.h"
+
+namespace enquery {
+
+class HttpRequest;
+
+// HedgingHttpClient cuts the tail latency of idempotent requests, in
+// front of another AsyncHttpClient. If a request hasn't completed after
+// a delay (by default, the 95th percentile of recent latencies), a copy
+// of it (a "hedge") is sent, to another endpoint if there is one. The
+// first of the two to succeed is the result, and the other is cancelled.
+// A request whose hedge won counts, for the delay, as having taken as
+// long as the hedge let it.
+// A budget limits hedges to a share of requests, so that a slow server
+// doesn't get twice the load just when it can least afford it.
+//
+// Requests are hedged if their method is idempotent (GET, HEAD, PUT,
+// DELETE or TRACE) and their body, if any, can be sent twice at once
+// (i.e. isn't produced by an HttpBodySource.) Other requests, and all
+// calls to OpenStream(), go straight to the wrapped client.
+class HedgingHttpClient : public AsyncHttpClient {
+ public:
+  class Settings {
+   public:
+    Settings()
+        : delay_percentile_(95.0),
+          initial_delay_ms_(10),
+          min_delay_ms_(1),
+          max_hedge_percent_(5.0) {}
+
+    // Add an endpoint (a URL prefix, such as "http://replica-2:8080") to
+    // send hedges to. A hedge for a request whose URI starts with one
+    // endpoint goes to the next one added (after the last, the first),
+    // with the rest of the URI unchanged. Without endpoints, or if the
+    // URI doesn't start with one, hedges go to the same URI.
+    Settings& add_endpoint(const char* endpoint) {
+      endpoints_.push_back(endpoint);
+      return *this;
+    }
+
+    // Get the endpoints that hedges may go to.
+    const std::vector<std::string>& endpoints() const { return endpoints_; }
+
+    // Set the percentile (0-100) of the latency of recent requests after
+    // which a request is hedged.
+    Settings& set_delay_percentile(double percentile) {
+      delay_percentile_ = percentile;
+      return *this;
+    }
+
+    // Get the percentile of latency after which a request is hedged.
+    double delay_percentile() const { return delay_percentile_; }
+
+    // Set the delay before hedging used until enough latencies have been
+    // seen to take a percentile of.
+    Settings& set_initial_delay_ms(int delay_ms) {
+      initial_delay_ms_ = delay_ms;
+      return *this;
+    }
+
+    // Get the delay before hedging used at first.
+    int initial_delay_ms() const { return initial_delay_ms_; }
+
+    // Set the shortest delay before hedging, however fast requests are.
+    Settings& set_min_delay_ms(int delay_ms) {
+      min_delay_ms_ = delay_ms;
+      return *this;
+    }
+
+    // Get the shortest delay before hedging.
+    int min_delay_ms() const { return min_delay_ms_; }
+
+    // Set the most hedges to send, as a percentage of requests. Unused
+    // allowance accumulates a little, so that a short burst of slow
+    // requests can all be hedged.
+    Settings& set_max_hedge_percent(double percent) {
+      max_hedge_percent_ = percent;
+      return *this;
+    }
+
+    // Get the most hedges to send, as a percentage of requests.
+    double max_hedge_percent() const { return max_hedge_percent_; }
+
+   private:
+    std::vector<std::string> endpoints_;
+    double delay_percentile_;
+    int initial_delay_ms_;
+    int min_delay_ms_;
+    double max_hedge_percent_;
+  };
+
+  // A point-in-time snapshot of hedging activity, as returned by
+  // GetStatistics().
+  class Statistics {
+   public:
+    Statistics()
+        : requests_(0), hedges_sent_(0), hedges_won_(0), hedges_denied_(0) {}
+
+    // Set the number of requests that could be hedged.
+    Statistics& set_requests(uint64_t requests) {
+      requests_ = requests;
+      return *this;
+    }
+
+    // Get the number of requests that could be hedged.
+    uint64_t requests() const { return requests_; }
+
+    // Set the number of hedges sent.
+    Statistics& set_hedges_sent(uint64_t hedges_sent) {
+      hedges_sent_ = hedges_sent;
+      return *this;
+    }
+
+    // Get the number of hedges sent.
+    uint64_t hedges_sent() const { return hedges_sent_; }
+
+    // Set the number of hedges whose response was the result.
+    Statistics& set_hedges_won(uint64_t hedges_won) {
+      hedges_won_ = hedges_won;
+      return *this;
+    }
+
+    // Get the number of hedges whose response was the result.
+    uint64_t hedges_won() const { return hedges_won_; }
+
+    // Set the number of hedges not sent because the budget was spent.
+    Statistics& set_hedges_denied(uint64_t hedges_denied) {
+      hedges_denied_ = hedges_denied;
+      return *this;
+    }
+
+    // Get the number of hedges not sent because the budget was spent.
+    uint64_t hedges_denied() const { return hedges_denied_; }
+
+   private:
+    uint64_t requests_;
+    uint64_t hedges_sent_;
+    uint64_t hedges_won_;
+    uint64_t hedges_denied_;
+  };
+
+  virtual ~HedgingHttpClient();
+
+  // Create a hedging client in front of 'client', which it takes
+  // ownership of (even on failure.) Returns NULL in the event of an
+  // error and populates the caller's (optional) Status variable with
+  // error information.
+  static HedgingHttpClient* Create(AsyncHttpClient* client,
+                                   const Settings& settings, Status* status);
+
+  virtual Status SendRequest(const HttpRequest& request,
+                             Future<HttpResult>* future);
+
+  // Cancel a request, and its hedge if one was sent.
+  virtual void Cancel(const Future<HttpResult>& future);
+
+  virtual HttpStream* OpenStream(const HttpRequest& request, Status* status);
+
+  // Return the bytes transferred by the wrapped client, hedges included.
+  virtual HttpByteCounts GetByteCounts() const;
+
+  // Populate 'stats' with a snapshot of the client's counters.
+  void GetStatistics(Statistics* stats) const;
+
+ private:
+  HedgingHttpClient(const HedgingHttpClient& no_copy);
+  HedgingHttpClient& operator=(const HedgingHttpClient& no_assign);
+
+  class Rep;
+  explicit HedgingHttpClient(Rep* rep);
+
+  Rep* rep_;
+};
+
+}  // namespace enquery
+
+#endif  // INCLUDE_ENQUERY_HEDGING_HTTP_CLIENT_H_
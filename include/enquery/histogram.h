@@ -0,0 +1,82 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef INCLUDE_ENQUERY_HISTOGRAM_H_
+#define INCLUDE_ENQUERY_HISTOGRAM_H_
+
+#include <stdint.h>
+
+namespace enquery {
+
+// Histogram records unsigned 64-bit values (typically latencies in
+// nanoseconds) into log-linear buckets, in the manner of HdrHistogram:
+// each power of two is split into 32 linear sub-buckets, so any value is
+// reported to within about 3% over the full 64-bit range, in constant
+// space and with O(1) recording.
+//
+// Record() is intended for a single writer. It may run concurrently with
+// readers such as Merge() or Percentile(), which then observe a snapshot
+// that may lag the writer by a few values; this makes per-thread
+// histograms cheap to aggregate without locking the recording path.
+class Histogram {
+ public:
+  Histogram();
+
+  // Default copy, assignment, and destructor are O.K.
+
+  // Record a single value.
+  void Record(uint64_t value);
+
+  // Add all values recorded in 'other' to this histogram.
+  void Merge(const Histogram& other);
+
+  // Discard all recorded values.
+  void Clear();
+
+  // Return the number of values recorded.
+  uint64_t Count() const;
+
+  // Return the smallest value recorded, or zero if empty.
+  uint64_t Min() const;
+
+  // Return the largest value recorded, or zero if empty.
+  uint64_t Max() const;
+
+  // Return the arithmetic mean of recorded values, or zero if empty.
+  double Mean() const;
+
+  // Return the value at or below which 'percentile' percent (0-100) of
+  // recorded values fall, rounded up to the bucket boundary. Returns zero
+  // if empty.
+  uint64_t Percentile(double percentile) const;
+
+ private:
+  static const int kSubBucketBits = 5;
+  static const int kSubBucketCount = 1 << kSubBucketBits;
+  static const int kBucketCount = (64 - kSubBucketBits + 1) * kSubBucketCount;
+
+  static int BucketIndex(uint64_t value);
+  static uint64_t BucketHighestValue(int index);
+
+  uint64_t buckets_[kBucketCount];
+  uint64_t count_;
+  uint64_t sum_;
+  uint64_t min_;
+  uint64_t max_;
+};
+
+}  // namespace enquery
+
+#endif  // INCLUDE_ENQUERY_HISTOGRAM_H_
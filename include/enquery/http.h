@@ -16,22 +16,44 @@
 #ifndef INCLUDE_ENQUERY_HTTP_H_
 #define INCLUDE_ENQUERY_HTTP_H_
 
+#include "enquery/async_http_client.h"
+#include "enquery/http_client.h"
 #include "enquery/shared.h"
 #include "enquery/status.h"
 
 namespace enquery {
 
-class HttpClient;
+// The implementations of HTTP that the library offers.
+typedef enum HttpEngine {
+  // Clients built on libcurl. They support HTTPS, HTTP/2 and compression.
+  HTTP_ENGINE_CURL,
+
+  // Clients that speak HTTP/1.1 over plain TCP themselves. They do less
+  // work per request than curl, and the asynchronous client can pipeline
+  // requests, but they handle http:// only and don't compress.
+  HTTP_ENGINE_NATIVE
+} HttpEngine;
 
 class Http {
  public:
   virtual ~Http();
 
-  // Create an instance of the library.
+  // Create an instance of the library, using curl.
   static Http* Create(Status* status);
 
-  // Create an HTTP client
-  virtual HttpClient* CreateClient(Status* status) = 0;
+  // Create an instance of the library, using 'engine'.
+  static Http* Create(HttpEngine engine, Status* status);
+
+  // Create an HTTP client with default settings.
+  HttpClient* CreateClient(Status* status);
+
+  // Create an HTTP client.
+  virtual HttpClient* CreateClient(const HttpClient::Settings& settings,
+                                   Status* status) = 0;
+
+  // Create an asynchronous HTTP client.
+  virtual AsyncHttpClient* CreateAsyncClient(
+      const AsyncHttpClient::Settings& settings, Status* status) = 0;
 
  protected:
   Http();
@@ -16,6 +16,10 @@
 #ifndef INCLUDE_ENQUERY_HTTP_CLIENT_H_
 #define INCLUDE_ENQUERY_HTTP_CLIENT_H_
 
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "enquery/slice.h"
 #include "enquery/status.h"
 
 namespace enquery {
@@ -23,12 +27,203 @@ namespace enquery {
 class HttpRequest;
 class HttpResponse;
 
+// HttpSink receives a response body in pieces, as it arrives, so that the
+// caller can consume the first bytes before the last are received and
+// never has to hold the whole body.
+class HttpSink {
+ public:
+  virtual ~HttpSink() {}
+
+  // Called once, before any of the body, with the response's status code
+  // and headers; 'head' has an empty body and is valid only for the
+  // duration of the call. Return false to abandon the request, e.g. if
+  // the status code shows the body isn't wanted. By default, accepts.
+  virtual bool OnResponse(const HttpResponse& head) {
+    (void)head;
+    return true;
+  }
+
+  // Consume the next piece of the body. The data is valid only for the
+  // duration of the call. Return false to abandon the request.
+  //
+  // The transfer waits while this runs, so a sink that falls behind slows
+  // the sender down rather than letting data pile up in memory.
+  virtual bool OnData(const Slice& data) = 0;
+};
+
+// The versions of HTTP a client may use.
+typedef enum HttpVersion {
+  // HTTP/1.1 only. The default; other versions are opted into.
+  HTTP_VERSION_1_1,
+  // HTTP/2 where a TLS server offers it (through ALPN), otherwise
+  // HTTP/1.1. Cleartext requests use HTTP/1.1.
+  HTTP_VERSION_2,
+  // HTTP/2 without negotiation, over TLS or cleartext ("h2c"), for
+  // servers known to support it.
+  HTTP_VERSION_2_PRIOR_KNOWLEDGE
+} HttpVersion;
+
+// The codes (Status::GetCode()) of the errors from requests that fail on
+// the way to or from the server, so that callers can tell them apart: a
+// request that couldn't connect may be worth sending elsewhere at once,
+// while one that missed its deadline may be better shed. Other failures
+// have other codes (often zero.)
+const errno_t kHttpConnectFailed = ECONNREFUSED;  // Refused or unresolved.
+const errno_t kHttpConnectTimeout = ETIMEDOUT;    // Couldn't connect in time.
+const errno_t kHttpConnectionLost = ECONNRESET;   // Lost during the request.
+const errno_t kHttpDeadlineExceeded = ETIME;      // Took too long overall.
+const errno_t kHttpTooSlow = ENODATA;             // Data stopped flowing.
+
+// Bytes transferred by a client, counted over every request it has
+// completed. When bodies are compressed, the "wire" counts are of the
+// bytes sent and received and the "body" counts are of the bytes the
+// caller supplied and received.
+struct HttpByteCounts {
+  HttpByteCounts()
+      : request_body_bytes(0),
+        request_wire_bytes(0),
+        response_wire_bytes(0),
+        response_body_bytes(0) {}
+  uint64_t request_body_bytes;
+  uint64_t request_wire_bytes;
+  uint64_t response_wire_bytes;
+  uint64_t response_body_bytes;
+};
+
 class HttpClient {
  public:
+  // The Settings class is used to configure an HttpClient. Clients keep
+  // connections open after a request completes so that later requests to
+  // the same host (scheme, host and port) can skip connection setup.
+  class Settings {
+   public:
+    Settings()
+        : max_idle_per_host_(8),
+          idle_timeout_ms_(60000),
+          accept_encoding_(false),
+          compress_requests_above_(0),
+          http_version_(HTTP_VERSION_1_1),
+          connect_timeout_ms_(0),
+          timeout_ms_(0),
+          low_speed_bytes_per_second_(0),
+          low_speed_seconds_(0) {}
+
+    // Set the number of idle connections kept open to each host. Zero
+    // disables reuse: every request makes a new connection.
+    Settings& set_max_idle_per_host(int max_idle) {
+      max_idle_per_host_ = max_idle;
+      return *this;
+    }
+
+    // Get the number of idle connections kept open to each host.
+    int max_idle_per_host() const { return max_idle_per_host_; }
+
+    // Set how long a connection may stay idle before it is closed.
+    Settings& set_idle_timeout_ms(int timeout_ms) {
+      idle_timeout_ms_ = timeout_ms;
+      return *this;
+    }
+
+    // Get how long a connection may stay idle before it is closed.
+    int idle_timeout_ms() const { return idle_timeout_ms_; }
+
+    // Set whether to ask for compressed responses, with every encoding
+    // curl can decode (gzip and deflate, and zstd or br if curl was built
+    // with them.) Bodies are decoded before they reach the caller.
+    Settings& set_accept_encoding(bool accept_encoding) {
+      accept_encoding_ = accept_encoding;
+      return *this;
+    }
+
+    // Get whether to ask for compressed responses.
+    bool accept_encoding() const { return accept_encoding_; }
+
+    // Set the size from which request bodies are sent gzip-compressed
+    // (bodies of unknown size count as large.) The server must accept
+    // "Content-Encoding: gzip". Zero, the default, never compresses; so
+    // does a build without zlib.
+    Settings& set_compress_requests_above(size_t size) {
+      compress_requests_above_ = size;
+      return *this;
+    }
+
+    // Get the size from which request bodies are compressed.
+    size_t compress_requests_above() const { return compress_requests_above_; }
+
+    // Set the version of HTTP to use (by default, HTTP/1.1.) Each request
+    // made by an HttpClient has a connection to itself, so HTTP/2 saves
+    // connections only between requests; use an AsyncHttpClient to
+    // multiplex them.
+    Settings& set_http_version(HttpVersion version) {
+      http_version_ = version;
+      return *this;
+    }
+
+    // Get the version of HTTP to use.
+    HttpVersion http_version() const { return http_version_; }
+
+    // Set the default connect timeout for requests, which may override it
+    // (see HttpRequest::set_connect_timeout_ms().) Zero, the default, uses
+    // curl's own limit (300 seconds.)
+    Settings& set_connect_timeout_ms(int timeout_ms) {
+      connect_timeout_ms_ = timeout_ms;
+      return *this;
+    }
+
+    // Get the default connect timeout.
+    int connect_timeout_ms() const { return connect_timeout_ms_; }
+
+    // Set the default total timeout for requests, which may override it
+    // (see HttpRequest::set_timeout_ms().) Zero, the default, means no
+    // limit.
+    Settings& set_timeout_ms(int timeout_ms) {
+      timeout_ms_ = timeout_ms;
+      return *this;
+    }
+
+    // Get the default total timeout.
+    int timeout_ms() const { return timeout_ms_; }
+
+    // Set the default low speed limit for requests, which may override it
+    // (see HttpRequest::set_low_speed_limit().) Zero, the default, means
+    // no limit.
+    Settings& set_low_speed_limit(int bytes_per_second, int seconds) {
+      low_speed_bytes_per_second_ = bytes_per_second;
+      low_speed_seconds_ = seconds;
+      return *this;
+    }
+
+    // Get the default low speed limit.
+    int low_speed_bytes_per_second() const {
+      return low_speed_bytes_per_second_;
+    }
+    int low_speed_seconds() const { return low_speed_seconds_; }
+
+   private:
+    int max_idle_per_host_;
+    int idle_timeout_ms_;
+    bool accept_encoding_;
+    size_t compress_requests_above_;
+    HttpVersion http_version_;
+    int connect_timeout_ms_;
+    int timeout_ms_;
+    int low_speed_bytes_per_second_;
+    int low_speed_seconds_;
+  };
+
   virtual ~HttpClient() {}
 
   virtual HttpResponse* SendRequest(const HttpRequest& request,
                                     Status* status) = 0;
+
+  // Send 'request', passing the response's status code and headers, then
+  // its body as it arrives, to 'sink' instead of buffering them. Returns
+  // once the body has been delivered; a sink that returns false fails the
+  // request.
+  virtual Status StreamRequest(const HttpRequest& request, HttpSink* sink) = 0;
+
+  // Return the bytes transferred by completed requests so far.
+  virtual HttpByteCounts GetByteCounts() const = 0;
 };
 
 }  // namespace enquery
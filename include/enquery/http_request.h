@@ -16,11 +16,40 @@
 #ifndef INCLUDE_ENQUERY_HTTP_REQUEST_H_
 #define INCLUDE_ENQUERY_HTTP_REQUEST_H_
 
+#include <stdint.h>
 #include <string>
+#include <utility>
+#include <vector>
 #include "enquery/buffer.h"
+#include "enquery/slice.h"
+#include "enquery/status.h"
 
 namespace enquery {
 
+// HttpBodySource produces a request body on demand, for bodies that are
+// generated as they are sent rather than held in memory. A source holds
+// its own read position, so it may be used by only one request at a time.
+class HttpBodySource {
+ public:
+  // Returned by Size() if the size isn't known in advance; the body is
+  // then sent with chunked transfer encoding.
+  static const int64_t kUnknownSize = -1;
+
+  virtual ~HttpBodySource() {}
+
+  // Return the size of the body in bytes, or kUnknownSize.
+  virtual int64_t Size() = 0;
+
+  // Copy up to 'size' bytes of the body into 'data' and set 'bytes_read'
+  // to the number copied, which is zero only at the end of the body. A
+  // failure abandons the request, which fails with the same Status.
+  virtual Status Read(char* data, size_t size, size_t* bytes_read) = 0;
+
+  // Start again from the beginning of the body, so that it can be sent
+  // again (e.g. after a redirect.) Return false if that isn't possible.
+  virtual bool Rewind() = 0;
+};
+
 class HttpRequest {
  public:
   typedef enum Method {
@@ -32,6 +61,14 @@ class HttpRequest {
     TRACE = 5
   } Method;
 
+  // The ways in which a body may be supplied.
+  typedef enum BodyType {
+    BUFFER = 0,      // Copied into the request by set_body().
+    SLICES = 1,      // Borrowed memory, possibly in several pieces.
+    FILE_RANGE = 2,  // A range of an open file.
+    SOURCE = 3       // Produced by an HttpBodySource.
+  } BodyType;
+
   HttpRequest();
   ~HttpRequest();
 
@@ -52,22 +89,116 @@ class HttpRequest {
   // Set body data (typically POST data)
   HttpRequest& set_body(const char* data, size_t size);
 
+  // Set the body to the concatenation of 'count' slices. The data is not
+  // copied: it must remain valid, and unchanged, until the request has
+  // completed (including any copies of the request.)
+  HttpRequest& set_body_slices(const Slice* slices, size_t count);
+
+  // Set the body to 'length' bytes of the file open as 'fd', starting at
+  // 'offset'. The descriptor is not owned, and must remain open until the
+  // request has completed. It is read with pread(), so its file position
+  // is neither used nor changed, and several requests may share it.
+  HttpRequest& set_body_file(int fd, int64_t offset, int64_t length);
+
+  // Set the body to be produced by 'source', which is not owned and must
+  // outlive the request.
+  HttpRequest& set_body_source(HttpBodySource* source);
+
   // Set the content type.
   HttpRequest& set_content_type(const char* content_type);
 
   // Get the content type.
   const char* content_type() const;
 
+  // Add a header to send with the request. A header that the HTTP client
+  // would send anyway (e.g. "Accept") replaces the client's; an empty
+  // value sends the header with no value.
+  HttpRequest& AddHeader(const char* name, const char* value);
+
+  // Return the number of headers added.
+  size_t HeaderCount() const;
+
+  // Set 'name' and 'value' to the header at 'index', which must be less
+  // than HeaderCount(). The slices are valid until the request changes.
+  void GetHeader(size_t index, Slice* name, Slice* value) const;
+
+  // Set 'value' to the first header added called 'name' (in any case).
+  // Return false if there is none.
+  bool FindHeader(const char* name, Slice* value) const;
+
+  // Set how long to wait for a connection to the server, including name
+  // resolution and the TLS handshake, before failing with
+  // kHttpConnectTimeout. Zero, the default, uses the client's setting; a
+  // negative value uses curl's own limit (300 seconds.)
+  HttpRequest& set_connect_timeout_ms(int timeout_ms);
+
+  // Get the connect timeout.
+  int connect_timeout_ms() const;
+
+  // Set how long the whole request may take, from the start of connecting
+  // to the end of the response body, before it fails with
+  // kHttpDeadlineExceeded. Zero uses the client's setting; a negative value
+  // removes the limit.
+  HttpRequest& set_timeout_ms(int timeout_ms);
+
+  // Get the total timeout.
+  int timeout_ms() const;
+
+  // Fail the request with kHttpTooSlow if fewer than 'bytes_per_second'
+  // bytes a second are transferred, on average, for 'seconds' seconds.
+  // This catches a server that stalls part way without limiting how long
+  // a healthy transfer may take. Zero uses the client's setting; a
+  // negative value removes the limit.
+  HttpRequest& set_low_speed_limit(int bytes_per_second, int seconds);
+
+  // Get the low speed limit.
+  int low_speed_bytes_per_second() const;
+  int low_speed_seconds() const;
+
   bool HasBody() const;
 
-  // Get body data
+  // Return how the body is supplied.
+  BodyType body_type() const;
+
+  // Return the size of the body, or HttpBodySource::kUnknownSize if it is
+  // produced by a source that doesn't know.
+  int64_t BodySize() const;
+
+  // Get body data, if set by set_body().
   const Buffer& body() const;
 
+  // Get the slices set by set_body_slices().
+  const std::vector<Slice>& body_slices() const;
+
+  // Get the file range set by set_body_file().
+  int body_fd() const;
+  int64_t body_offset() const;
+
+  // Get the source set by set_body_source().
+  HttpBodySource* body_source() const;
+
  private:
+  // Fills requests by writing straight into uri_.
+  friend class HttpRequestTemplate;
+
+  // Forget any body, leaving an empty BUFFER.
+  void ClearBody();
+
   Method method_;
   std::string uri_;
+  BodyType body_type_;
   Buffer body_;
+  std::vector<Slice> body_slices_;
+  int body_fd_;
+  int64_t body_offset_;
+  int64_t body_length_;  // Size of the slices or the file range.
+  HttpBodySource* body_source_;
   std::string content_type_;
+  std::vector<std::pair<std::string, std::string> > headers_;
+  int connect_timeout_ms_;
+  int timeout_ms_;
+  int low_speed_bytes_per_second_;
+  int low_speed_seconds_;
 };
 
 }  // namespace enquery
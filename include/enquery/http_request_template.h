@@ -0,0 +1,99 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef INCLUDE_ENQUERY_HTTP_REQUEST_TEMPLATE_H_
+#define INCLUDE_ENQUERY_HTTP_REQUEST_TEMPLATE_H_
+
+#include <stddef.h>
+#include "enquery/http_request.h"
+#include "enquery/slice.h"
+
+namespace enquery {
+
+// One name=value pair of a query string.
+struct QueryParam {
+  QueryParam() {}
+  QueryParam(const Slice& n, const Slice& v) : name(n), value(v) {}
+  Slice name;
+  Slice value;
+};
+
+// Percent-encode 'in' as a URI component into 'out', which has room for
+// 'capacity' bytes. Every byte but the unreserved characters of RFC 3986
+// (letters, digits and "-._~") is encoded, so the result is safe in a path
+// segment or a query. Return the length of the encoding, which is written
+// only if it fits; nothing is allocated, and 'out' is not terminated.
+// Calling with a capacity of zero measures the encoding.
+size_t EncodeUriComponent(const Slice& in, char* out, size_t capacity);
+
+// As EncodeUriComponent(), but encode 'count' parameters as a query string
+// ("a=1&b=2", without the leading "?").
+size_t EncodeQuery(const QueryParam* params, size_t count, char* out,
+                   size_t capacity);
+
+// HttpRequestTemplate builds requests that differ only at the end of the
+// URI, as a client of a key-value store sends with only the key changing.
+// The parts that don't change (method, base URI, content type, headers
+// and timeouts) are taken once from a prototype request. Fill() then makes
+// a request from the template, encoding the per-call part straight into
+// the request's URI: a request that is filled over and over reuses the
+// storage it already has, so once it has held the largest URI and headers
+// it will need, filling it allocates nothing.
+//
+// A template is immutable once made, so any number of threads may fill
+// requests from it at once.
+//
+//   HttpRequest prototype;
+//   prototype.set_uri("http://kv.local/v1/keys/").AddHeader("X-Db", "7");
+//   HttpRequestTemplate lookup(prototype);
+//   HttpRequest request;
+//   for (...) {
+//     lookup.Fill(Slice(key), &request);
+//     client->SendRequest(request, &response);
+//   }
+class HttpRequestTemplate {
+ public:
+  // Use 'prototype' for everything but the end of the URI's path and the
+  // per-call query parameters. Its URI is the base: Fill() appends to its
+  // path, and keeps any query it has (e.g. "http://kv/keys/?db=7") as the
+  // start of the query. A body set on the prototype is shared (not
+  // copied) by every request filled from the template.
+  explicit HttpRequestTemplate(const HttpRequest& prototype);
+  ~HttpRequestTemplate();
+
+  // Copy Constructor, Assignment O.K.
+
+  // Set 'request' to the prototype, with 'path' percent-encoded and
+  // appended to the path of the base URI (before any query.)
+  void Fill(const Slice& path, HttpRequest* request) const;
+
+  // As above, then append 'count' query parameters (if any), after "?",
+  // or after "&" if the base URI has a query.
+  void Fill(const Slice& path, const QueryParam* params, size_t count,
+            HttpRequest* request) const;
+
+  // Return the prototype.
+  const HttpRequest& prototype() const { return prototype_; }
+
+ private:
+  HttpRequest prototype_;
+  size_t base_size_;      // Length of the base URI.
+  size_t path_end_;       // Where its query (if any) starts.
+  char query_separator_;  // Put before the parameters.
+};
+
+}  // namespace enquery
+
+#endif  // INCLUDE_ENQUERY_HTTP_REQUEST_TEMPLATE_H_
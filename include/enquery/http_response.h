@@ -16,10 +16,30 @@
 #ifndef INCLUDE_ENQUERY_HTTP_RESPONSE_H_
 #define INCLUDE_ENQUERY_HTTP_RESPONSE_H_
 
+#include <stdint.h>
 #include <stdlib.h>
+#include "enquery/slice.h"
 
 namespace enquery {
 
+// How long a request took to reach each point, in nanoseconds from its
+// start, as measured by the transport. Points that weren't reached (e.g.
+// the name lookup, when a connection was reused, or the TLS handshake,
+// without TLS) are zero.
+struct HttpTimings {
+  HttpTimings()
+      : dns_nanos(0),
+        connect_nanos(0),
+        tls_nanos(0),
+        first_byte_nanos(0),
+        total_nanos(0) {}
+  uint64_t dns_nanos;         // The host name was resolved.
+  uint64_t connect_nanos;     // The TCP connection was made.
+  uint64_t tls_nanos;         // The TLS handshake was done.
+  uint64_t first_byte_nanos;  // The first byte of the response arrived.
+  uint64_t total_nanos;       // The response was complete.
+};
+
 class HttpResponse {
  public:
   HttpResponse();
@@ -27,6 +47,24 @@ class HttpResponse {
 
   virtual const char* Body() const = 0;
   virtual size_t BodySize() const = 0;
+
+  // Return the HTTP status code, e.g. 200.
+  virtual int StatusCode() const = 0;
+
+  // Return the number of headers in the response.
+  virtual size_t HeaderCount() const = 0;
+
+  // Set 'name' and 'value' to the header at 'index', which must be less
+  // than HeaderCount(). Headers are in the order received. The slices are
+  // valid for the life of the response.
+  virtual void GetHeader(size_t index, Slice* name, Slice* value) const = 0;
+
+  // Find the first header called 'name' (ignoring case) and set 'value' to
+  // its value. Return false if there is none.
+  virtual bool FindHeader(const char* name, Slice* value) const = 0;
+
+  // Return how long each part of the request took.
+  virtual const HttpTimings& Timings() const = 0;
 };
 
 }  // namespace enquery
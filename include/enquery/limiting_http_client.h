@@ -0,0 +1,228 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef INCLUDE_ENQUERY_LIMITING_HTTP_CLIENT_H_
+#define INCLUDE_ENQUERY_LIMITING_HTTP_CLIENT_H_
+
+#include <stdint.h>
+#include "enquery/async_http_client.h"
+#include "enquery/futures.h"
+#include "enquery/status.h"
+
+namespace enquery {
+
+class HttpRequest;
+
+// LimitingHttpClient keeps the number of requests in flight to each host
+// (scheme, host and port) near what the host can handle, in front of
+// another AsyncHttpClient. Each host has a limit, which adapts to how the
+// host responds. Requests over the limit wait in a queue for one to
+// complete; once the queue is full, SendRequest() fails with EBUSY, so
+// that excess load is shed at once rather than piling up.
+//
+// A request that times out (kHttpConnectTimeout, kHttpDeadlineExceeded
+// or kHttpTooSlow), or is answered 429 or 503, is a sign of overload and
+// cuts the limit by the backoff ratio. Otherwise the limit changes as the
+// algorithm chooses (see Algorithm.) Streams aren't limited.
+class LimitingHttpClient : public AsyncHttpClient {
+ public:
+  // How the limit changes while requests succeed.
+  typedef enum Algorithm {
+    // Additive increase: while the host is using its whole limit, each
+    // success adds 1/limit, so the limit grows by about one a round
+    // trip. Only overload reduces it.
+    AIMD = 0,
+    // Gradient: each success moves the limit towards limit * gradient +
+    // sqrt(limit), where the gradient is the host's shortest recent
+    // round trip time (times the tolerance) over this one's, between 0.5
+    // and 1. The limit therefore shrinks as queueing delays responses,
+    // before the host starts failing, and otherwise grows slowly.
+    GRADIENT = 1
+  } Algorithm;
+
+  class Settings {
+   public:
+    Settings()
+        : algorithm_(AIMD),
+          initial_limit_(20),
+          min_limit_(1),
+          max_limit_(1000),
+          backoff_ratio_(0.9),
+          rtt_tolerance_(1.5),
+          max_queued_per_host_(100) {}
+
+    // Set the algorithm by which the limit grows.
+    Settings& set_algorithm(Algorithm algorithm) {
+      algorithm_ = algorithm;
+      return *this;
+    }
+
+    // Get the algorithm by which the limit grows.
+    Algorithm algorithm() const { return algorithm_; }
+
+    // Set the limit for a host that hasn't been seen before.
+    Settings& set_initial_limit(int limit) {
+      initial_limit_ = limit;
+      return *this;
+    }
+
+    // Get the limit for a host that hasn't been seen before.
+    int initial_limit() const { return initial_limit_; }
+
+    // Set the lowest the limit may go.
+    Settings& set_min_limit(int limit) {
+      min_limit_ = limit;
+      return *this;
+    }
+
+    // Get the lowest the limit may go.
+    int min_limit() const { return min_limit_; }
+
+    // Set the highest the limit may go.
+    Settings& set_max_limit(int limit) {
+      max_limit_ = limit;
+      return *this;
+    }
+
+    // Get the highest the limit may go.
+    int max_limit() const { return max_limit_; }
+
+    // Set the factor (between 0 and 1) that overload multiplies the limit
+    // by.
+    Settings& set_backoff_ratio(double ratio) {
+      backoff_ratio_ = ratio;
+      return *this;
+    }
+
+    // Get the factor that overload multiplies the limit by.
+    double backoff_ratio() const { return backoff_ratio_; }
+
+    // Set how much longer than the shortest recent round trip one may be
+    // before the GRADIENT algorithm takes it as a sign of queueing.
+    Settings& set_rtt_tolerance(double tolerance) {
+      rtt_tolerance_ = tolerance;
+      return *this;
+    }
+
+    // Get the round trip time tolerance of the GRADIENT algorithm.
+    double rtt_tolerance() const { return rtt_tolerance_; }
+
+    // Set the most requests that may wait for each host. Zero rejects
+    // every request over the limit.
+    Settings& set_max_queued_per_host(int max_queued) {
+      max_queued_per_host_ = max_queued;
+      return *this;
+    }
+
+    // Get the most requests that may wait for each host.
+    int max_queued_per_host() const { return max_queued_per_host_; }
+
+   private:
+    Algorithm algorithm_;
+    int initial_limit_;
+    int min_limit_;
+    int max_limit_;
+    double backoff_ratio_;
+    double rtt_tolerance_;
+    int max_queued_per_host_;
+  };
+
+  // A point-in-time snapshot of limiting activity, as returned by
+  // GetStatistics().
+  class Statistics {
+   public:
+    Statistics() : requests_(0), queued_(0), rejected_(0), overloads_(0) {}
+
+    // Set the number of requests accepted.
+    Statistics& set_requests(uint64_t requests) {
+      requests_ = requests;
+      return *this;
+    }
+
+    // Get the number of requests accepted.
+    uint64_t requests() const { return requests_; }
+
+    // Set the number of requests that had to wait.
+    Statistics& set_queued(uint64_t queued) {
+      queued_ = queued;
+      return *this;
+    }
+
+    // Get the number of requests that had to wait.
+    uint64_t queued() const { return queued_; }
+
+    // Set the number of requests rejected because the queue was full.
+    Statistics& set_rejected(uint64_t rejected) {
+      rejected_ = rejected;
+      return *this;
+    }
+
+    // Get the number of requests rejected because the queue was full.
+    uint64_t rejected() const { return rejected_; }
+
+    // Set the number of responses that signalled overload.
+    Statistics& set_overloads(uint64_t overloads) {
+      overloads_ = overloads;
+      return *this;
+    }
+
+    // Get the number of responses that signalled overload.
+    uint64_t overloads() const { return overloads_; }
+
+   private:
+    uint64_t requests_;
+    uint64_t queued_;
+    uint64_t rejected_;
+    uint64_t overloads_;
+  };
+
+  virtual ~LimitingHttpClient();
+
+  // Create a limiting client in front of 'client', which it takes
+  // ownership of (even on failure.) Returns NULL in the event of an
+  // error and populates the caller's (optional) Status variable with
+  // error information.
+  static LimitingHttpClient* Create(AsyncHttpClient* client,
+                                    const Settings& settings, Status* status);
+
+  virtual Status SendRequest(const HttpRequest& request,
+                             Future<HttpResult>* future);
+
+  // Cancel a request, whether it is waiting or in flight.
+  virtual void Cancel(const Future<HttpResult>& future);
+
+  virtual HttpStream* OpenStream(const HttpRequest& request, Status* status);
+
+  virtual HttpByteCounts GetByteCounts() const;
+
+  // Return the current limit for the host of 'uri'.
+  double GetLimit(const char* uri) const;
+
+  // Populate 'stats' with a snapshot of the client's counters.
+  void GetStatistics(Statistics* stats) const;
+
+ private:
+  LimitingHttpClient(const LimitingHttpClient& no_copy);
+  LimitingHttpClient& operator=(const LimitingHttpClient& no_assign);
+
+  class Rep;
+  explicit LimitingHttpClient(Rep* rep);
+
+  Rep* rep_;
+};
+
+}  // namespace enquery
+
+#endif  // INCLUDE_ENQUERY_LIMITING_HTTP_CLIENT_H_
@@ -0,0 +1,125 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef INCLUDE_ENQUERY_MUTEX_H_
+#define INCLUDE_ENQUERY_MUTEX_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <vector>
+
+namespace enquery {
+
+struct LockSite;
+
+// Mutex is the lock used inside enquery. Each mutex names the site that
+// uses it (e.g. "ThreadPoolExecution"); all mutexes that share a name are
+// reported together.
+//
+// When built with ENQUERY_LOCK_PROFILING defined, Lock() first tries to
+// take the mutex without blocking. Only if that fails is the wait timed
+// and charged to the site, so uncontended locking costs no more than
+// usual. Without the define, Lock() is a plain pthread_mutex_lock(). The
+// define must be the same for every file in a build, since it changes
+// inline code.
+class Mutex {
+ public:
+  // Construct a mutex, attributing contention to 'site', which must be a
+  // string literal (or otherwise outlive the mutex.)
+  explicit Mutex(const char* site);
+  ~Mutex();
+
+  void Lock() {
+#ifdef ENQUERY_LOCK_PROFILING
+    if (pthread_mutex_trylock(&mutex_) != 0) {
+      LockSlow();
+    }
+#else
+    pthread_mutex_lock(&mutex_);
+#endif
+  }
+
+  void Unlock() { pthread_mutex_unlock(&mutex_); }
+
+ private:
+  friend class CondVar;
+
+  Mutex(const Mutex& no_copy);
+  Mutex& operator=(const Mutex& no_assign);
+
+  // Block for the mutex, recording the time spent waiting.
+  void LockSlow();
+
+  pthread_mutex_t mutex_;
+  const char* site_;
+  LockSite* profile_;  // Looked up on first contention.
+};
+
+// A condition variable for use with Mutex. Time spent in Wait() is not
+// counted as contention.
+class CondVar {
+ public:
+  CondVar();
+  ~CondVar();
+
+  // Atomically release 'mutex' and wait to be signalled; 'mutex' is held
+  // again on return.
+  void Wait(Mutex* mutex) { pthread_cond_wait(&cond_, &mutex->mutex_); }
+
+  // As Wait(), but give up once MonotonicNanos() reaches 'deadline'.
+  // Return false if the deadline passed.
+  bool WaitUntil(Mutex* mutex, uint64_t deadline);
+
+  // Wake one waiter.
+  void Signal() { pthread_cond_signal(&cond_); }
+
+  // Wake all waiters.
+  void Broadcast() { pthread_cond_broadcast(&cond_); }
+
+ private:
+  CondVar(const CondVar& no_copy);
+  CondVar& operator=(const CondVar& no_assign);
+
+  pthread_cond_t cond_;
+};
+
+// LockProfiler reports contention recorded by Mutex.
+class LockProfiler {
+ public:
+  // Contention recorded for one lock site.
+  struct Entry {
+    const char* site;
+    uint64_t contentions;     // Lock() calls that had to wait.
+    uint64_t wait_nanos;      // Total time spent waiting.
+    uint64_t max_wait_nanos;  // Longest single wait.
+  };
+
+  // Return true iff lock profiling was compiled in.
+  static bool IsEnabled();
+
+  // Fill 'entries' with every site that has been contended, hottest
+  // (greatest total wait) first. Always empty if profiling is disabled.
+  static void GetReport(std::vector<Entry>* entries);
+
+  // Print the report to stderr, at most 'max_entries' sites.
+  static void PrintReport(size_t max_entries);
+
+  // Reset all counters to zero.
+  static void Reset();
+};
+
+}  // namespace enquery
+
+#endif  // INCLUDE_ENQUERY_MUTEX_H_
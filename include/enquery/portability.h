@@ -21,6 +21,7 @@
 #include <tchar.h>
 #endif  // _WIN32
 
+#include <stdint.h>
 #include <string>
 
 namespace enquery {
@@ -35,6 +36,10 @@ typedef int errno_t;
 // Make a human-readable string from a system error number.
 std::string SystemErrorToString(errno_t error_number);
 
+// Return the value of a monotonic clock in nanoseconds. The epoch is
+// arbitrary; only differences between two readings are meaningful.
+uint64_t MonotonicNanos();
+
 }  // namespace enquery
 
 #endif  // INCLUDE_ENQUERY_PORTABILITY_H_
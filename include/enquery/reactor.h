@@ -0,0 +1,220 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef INCLUDE_ENQUERY_REACTOR_H_
+#define INCLUDE_ENQUERY_REACTOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "enquery/status.h"
+
+namespace enquery {
+
+// Reactor is a single-threaded event loop that watches file descriptors
+// for readiness and dispatches to a Handler when they become readable or
+// writable. Interest is persistent and level-triggered: a handler is
+// called on every Poll() for as long as the descriptor remains ready and
+// registered. Handlers must tolerate spurious wakeups (use non-blocking
+// descriptors and expect EAGAIN.)
+//
+// A reactor also performs transfers for its callers: Send(), Receive()
+// and Read() start one, and a Completion is told when it is done. A
+// descriptor may be used both ways at once.
+//
+// Everything except Wakeup() must only be called from the thread that
+// drives the loop; Wakeup() may be called from any thread.
+class Reactor {
+ public:
+  // Readiness events, which may be OR'd together.
+  typedef enum Event { READABLE = 1, WRITABLE = 2 } Event;
+
+  // Implementations available to the reactor. DEFAULT selects epoll.
+  // IO_URING submits interest changes and transfers in batches alongside
+  // the wait (one system call per loop iteration), and falls back to
+  // EPOLL when the kernel does not support it. With epoll, transfers are
+  // made with ordinary system calls once their descriptors are ready.
+  typedef enum Backend { DEFAULT = 0, EPOLL = 1, IO_URING = 2 } Backend;
+
+  // Interface implemented by users of the reactor to receive events.
+  class Handler {
+   public:
+    virtual ~Handler() {}
+
+    // Called on the polling thread when 'fd' is ready for 'events'.
+    virtual void OnReady(int fd, int events) = 0;
+  };
+
+  // Interface implemented by users of the reactor to learn of finished
+  // transfers.
+  class Completion {
+   public:
+    virtual ~Completion() {}
+
+    // Called on the polling thread when a transfer on 'fd' is done.
+    // 'result' is the number of bytes moved (zero at the end of a stream
+    // or file) or a negated errno value. 'buffer' is the one the transfer
+    // was given, which belongs to the caller again.
+    virtual void OnComplete(int fd, int result, char* buffer) = 0;
+  };
+
+  // Settings used to control creation of a Reactor.
+  class Settings {
+   public:
+    // Create with reasonable defaults (epoll, 256 events per wait.)
+    Settings()
+        : backend_(DEFAULT),
+          queue_depth_(256),
+          buffer_count_(0),
+          buffer_size_(0) {}
+
+    // Set the backend to use.
+    Settings& set_backend(Backend backend) {
+      backend_ = backend;
+      return *this;
+    }
+
+    // Get the backend to use.
+    Backend backend() const { return backend_; }
+
+    // Set the maximum number of events harvested per wait. For io_uring
+    // this is also the size of the submission queue.
+    Settings& set_queue_depth(int queue_depth) {
+      queue_depth_ = queue_depth;
+      return *this;
+    }
+
+    // Get the maximum number of events harvested per wait.
+    int queue_depth() const { return queue_depth_; }
+
+    // Set the number and size of the buffers the reactor lends out for
+    // transfers (see AcquireBuffer().) io_uring registers them with the
+    // kernel, which then needn't map their pages for every transfer.
+    // Sizes are rounded up to whole pages. Zero, the default, lends none.
+    Settings& set_buffers(int count, size_t size) {
+      buffer_count_ = count;
+      buffer_size_ = size;
+      return *this;
+    }
+
+    // Get the number of buffers lent out.
+    int buffer_count() const { return buffer_count_; }
+
+    // Get the size of each buffer lent out.
+    size_t buffer_size() const { return buffer_size_; }
+
+   private:
+    Backend backend_;
+    int queue_depth_;
+    int buffer_count_;
+    size_t buffer_size_;
+  };
+
+  virtual ~Reactor();
+
+  // Create a reactor with the specified settings. Returns NULL in the
+  // event of an error and populates the caller's (optional) Status.
+  static Reactor* Create(const Settings& settings, Status* status);
+
+  // Return an instance of settings that uses reasonable defaults.
+  static Settings DefaultSettings();
+
+  // Return the name of a backend, e.g. "epoll".
+  static const char* BackendName(Backend backend);
+
+  // Return the backend actually in use (after any fallback.)
+  virtual Backend backend() const = 0;
+
+  // Begin watching 'fd' for 'events', dispatching to 'handler'.
+  virtual Status Add(int fd, int events, Handler* handler) = 0;
+
+  // Change the events watched for a registered descriptor. Passing zero
+  // keeps the registration but suspends delivery.
+  virtual Status Modify(int fd, int events) = 0;
+
+  // Stop watching 'fd' and cancel its transfers, whose completions are
+  // not delivered. Must be called before a descriptor that was added or
+  // given a transfer is closed. A cancelled transfer's buffer goes back
+  // to the reactor if it was lent out by AcquireBuffer(); any other must
+  // stay valid until the reactor is destroyed, as the kernel may still
+  // be using it.
+  virtual Status Remove(int fd) = 0;
+
+  // Send 'size' bytes at 'data' on the socket 'fd'. At most one send may
+  // be in progress on a descriptor, and 'data' must stay valid until it
+  // completes. A broken connection completes with -EPIPE rather than
+  // raising SIGPIPE.
+  virtual Status Send(int fd, char* data, size_t size,
+                      Completion* completion) = 0;
+
+  // Receive up to 'size' bytes into 'data' from the socket (or pipe)
+  // 'fd', completing once some have arrived. At most one receive or read
+  // may be in progress on a descriptor.
+  virtual Status Receive(int fd, char* data, size_t size,
+                         Completion* completion) = 0;
+
+  // Read up to 'size' bytes at 'offset' in the file 'fd' into 'data'. At
+  // most one receive or read may be in progress on a descriptor.
+  virtual Status Read(int fd, char* data, size_t size, int64_t offset,
+                      Completion* completion) = 0;
+
+  // Lend out one of the buffers described by the settings, or return NULL
+  // if they are all in use. Transfers from or into these cost less with
+  // io_uring, and they are reclaimed by Remove() when it cancels one.
+  char* AcquireBuffer();
+
+  // Give back a buffer from AcquireBuffer().
+  void ReleaseBuffer(char* buffer);
+
+  // Return the size of the buffers lent out by AcquireBuffer().
+  size_t buffer_size() const { return buffer_size_; }
+
+  // Wait up to 'timeout_ms' milliseconds (-1 waits indefinitely) for
+  // events and dispatch them. Returns after one batch has been handled,
+  // the timeout expires, or Wakeup() is called.
+  virtual Status Poll(int timeout_ms) = 0;
+
+  // Cause a concurrent or subsequent Poll() to return promptly.
+  virtual void Wakeup() = 0;
+
+ protected:
+  Reactor();
+
+  // Allocate the buffers described by 'settings'.
+  Status InitBuffers(const Settings& settings);
+
+  // Return the index of the buffer that 'data' is within, or -1 if it is
+  // not within one.
+  int BufferIndex(const char* data) const;
+
+  // Return the buffer at 'index'.
+  char* buffer(int index) const { return buffers_ + index * buffer_size_; }
+
+  // Return the number of buffers.
+  int buffer_count() const { return buffer_count_; }
+
+ private:
+  char* buffers_;      // All of them, one after another.
+  size_t buffer_size_;
+  int buffer_count_;
+  int* free_buffers_;  // Indexes of those not lent out...
+  int free_count_;     // ...of which there are this many.
+
+  Reactor(const Reactor& no_copy);
+  Reactor& operator=(const Reactor& no_assign);
+};
+
+}  // namespace enquery
+
+#endif  // INCLUDE_ENQUERY_REACTOR_H_
@@ -0,0 +1,246 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef INCLUDE_ENQUERY_RETRYING_HTTP_CLIENT_H_
+#define INCLUDE_ENQUERY_RETRYING_HTTP_CLIENT_H_
+
+#include <stdint.h>
+#include <vector>
+#include "enquery/async_http_client.h"
+#include "enquery/futures.h"
+#include "enquery/status.h"
+
+namespace enquery {
+
+class HttpRequest;
+
+// RetryingHttpClient retries requests that fail transiently, in front of
+// another AsyncHttpClient. A failed attempt is retried after a backoff
+// with "decorrelated jitter": a random delay between the base backoff and
+// three times the previous one, up to a maximum, so that clients that
+// failed together don't retry together. Backoffs wait on a timer, not on
+// a thread. A budget limits retries to a share of requests, so that
+// retries can't multiply the load on a server that is already failing.
+//
+// Responses are retried if their status code is retryable (by default
+// 502, 503 and 504), unless they carry a Retry-After longer than the
+// maximum backoff; a shorter Retry-After is waited for. Failures are
+// retried according to their class (see ErrorClass.) Since a request may
+// have been processed even though it failed, only requests that never
+// reached the server are retried unless the method is idempotent (GET,
+// HEAD, PUT, DELETE or TRACE.) Bodies produced by an HttpBodySource are
+// rewound to be sent again; one that can't be isn't retried.
+//
+// The result of a request is that of its last attempt. Calls to
+// OpenStream() go straight to the wrapped client.
+class RetryingHttpClient : public AsyncHttpClient {
+ public:
+  // Classes of failure that may be retried.
+  typedef enum ErrorClass {
+    // The server couldn't be reached (kHttpConnectFailed or
+    // kHttpConnectTimeout), so the request was never sent.
+    CONNECT_FAILURES = 1,
+    // The connection was lost during the request (kHttpConnectionLost.)
+    CONNECTION_RESETS = 2,
+    // The request took too long (kHttpDeadlineExceeded or kHttpTooSlow.)
+    TIMEOUTS = 4
+  } ErrorClass;
+
+  class Settings {
+   public:
+    Settings()
+        : max_attempts_(3),
+          base_backoff_ms_(10),
+          max_backoff_ms_(1000),
+          retryable_errors_(CONNECT_FAILURES | CONNECTION_RESETS),
+          retry_budget_percent_(10.0),
+          max_retry_tokens_(10.0) {
+      retryable_statuses_.push_back(502);
+      retryable_statuses_.push_back(503);
+      retryable_statuses_.push_back(504);
+    }
+
+    // Set the most attempts to make at each request, the first included.
+    Settings& set_max_attempts(int attempts) {
+      max_attempts_ = attempts;
+      return *this;
+    }
+
+    // Get the most attempts to make at each request.
+    int max_attempts() const { return max_attempts_; }
+
+    // Set the shortest backoff before a retry.
+    Settings& set_base_backoff_ms(int backoff_ms) {
+      base_backoff_ms_ = backoff_ms;
+      return *this;
+    }
+
+    // Get the shortest backoff before a retry.
+    int base_backoff_ms() const { return base_backoff_ms_; }
+
+    // Set the longest backoff before a retry.
+    Settings& set_max_backoff_ms(int backoff_ms) {
+      max_backoff_ms_ = backoff_ms;
+      return *this;
+    }
+
+    // Get the longest backoff before a retry.
+    int max_backoff_ms() const { return max_backoff_ms_; }
+
+    // Forget the retryable status codes, including the defaults.
+    Settings& clear_retryable_statuses() {
+      retryable_statuses_.clear();
+      return *this;
+    }
+
+    // Add a status code to retry responses with.
+    Settings& add_retryable_status(int status_code) {
+      retryable_statuses_.push_back(status_code);
+      return *this;
+    }
+
+    // Get the status codes to retry responses with.
+    const std::vector<int>& retryable_statuses() const {
+      return retryable_statuses_;
+    }
+
+    // Set the classes of failure to retry, as ErrorClass values or'd
+    // together (by default, CONNECT_FAILURES | CONNECTION_RESETS.)
+    Settings& set_retryable_errors(int error_classes) {
+      retryable_errors_ = error_classes;
+      return *this;
+    }
+
+    // Get the classes of failure to retry.
+    int retryable_errors() const { return retryable_errors_; }
+
+    // Set the most retries to make, as a percentage of requests. Each
+    // request adds this share of a token to the budget, and each retry
+    // takes a whole one.
+    Settings& set_retry_budget_percent(double percent) {
+      retry_budget_percent_ = percent;
+      return *this;
+    }
+
+    // Get the most retries to make, as a percentage of requests.
+    double retry_budget_percent() const { return retry_budget_percent_; }
+
+    // Set the most tokens the budget holds, which it starts with. This
+    // bounds the retries in a burst of failures.
+    Settings& set_max_retry_tokens(double tokens) {
+      max_retry_tokens_ = tokens;
+      return *this;
+    }
+
+    // Get the most tokens the budget holds.
+    double max_retry_tokens() const { return max_retry_tokens_; }
+
+   private:
+    int max_attempts_;
+    int base_backoff_ms_;
+    int max_backoff_ms_;
+    std::vector<int> retryable_statuses_;
+    int retryable_errors_;
+    double retry_budget_percent_;
+    double max_retry_tokens_;
+  };
+
+  // A point-in-time snapshot of retry activity, as returned by
+  // GetStatistics().
+  class Statistics {
+   public:
+    Statistics()
+        : requests_(0), retries_(0), retries_denied_(0), exhausted_(0) {}
+
+    // Set the number of requests sent.
+    Statistics& set_requests(uint64_t requests) {
+      requests_ = requests;
+      return *this;
+    }
+
+    // Get the number of requests sent.
+    uint64_t requests() const { return requests_; }
+
+    // Set the number of retries sent.
+    Statistics& set_retries(uint64_t retries) {
+      retries_ = retries;
+      return *this;
+    }
+
+    // Get the number of retries sent.
+    uint64_t retries() const { return retries_; }
+
+    // Set the number of retries not sent because the budget was spent.
+    Statistics& set_retries_denied(uint64_t retries_denied) {
+      retries_denied_ = retries_denied;
+      return *this;
+    }
+
+    // Get the number of retries not sent because the budget was spent.
+    uint64_t retries_denied() const { return retries_denied_; }
+
+    // Set the number of requests that failed on every attempt.
+    Statistics& set_exhausted(uint64_t exhausted) {
+      exhausted_ = exhausted;
+      return *this;
+    }
+
+    // Get the number of requests that failed on every attempt.
+    uint64_t exhausted() const { return exhausted_; }
+
+   private:
+    uint64_t requests_;
+    uint64_t retries_;
+    uint64_t retries_denied_;
+    uint64_t exhausted_;
+  };
+
+  virtual ~RetryingHttpClient();
+
+  // Create a retrying client in front of 'client', which it takes
+  // ownership of (even on failure.) Returns NULL in the event of an
+  // error and populates the caller's (optional) Status variable with
+  // error information.
+  static RetryingHttpClient* Create(AsyncHttpClient* client,
+                                    const Settings& settings, Status* status);
+
+  virtual Status SendRequest(const HttpRequest& request,
+                             Future<HttpResult>* future);
+
+  // Cancel a request, whether an attempt is in flight or it is waiting to
+  // retry.
+  virtual void Cancel(const Future<HttpResult>& future);
+
+  virtual HttpStream* OpenStream(const HttpRequest& request, Status* status);
+
+  // Return the bytes transferred by the wrapped client, retries included.
+  virtual HttpByteCounts GetByteCounts() const;
+
+  // Populate 'stats' with a snapshot of the client's counters.
+  void GetStatistics(Statistics* stats) const;
+
+ private:
+  RetryingHttpClient(const RetryingHttpClient& no_copy);
+  RetryingHttpClient& operator=(const RetryingHttpClient& no_assign);
+
+  class Rep;
+  explicit RetryingHttpClient(Rep* rep);
+
+  Rep* rep_;
+};
+
+}  // namespace enquery
+
+#endif  // INCLUDE_ENQUERY_RETRYING_HTTP_CLIENT_H_
@@ -22,17 +22,21 @@
 
 namespace enquery {
 
-// Acquire and hold a pthread_mutex for the lifetime of the object.
+class Mutex;
+
+// Acquire and hold a mutex for the lifetime of the object.
 class ScopeLock {
  public:
   explicit ScopeLock(pthread_mutex_t* mutex);
+  explicit ScopeLock(Mutex* mutex);
   ~ScopeLock();
 
  private:
   ScopeLock(const ScopeLock& no_copy);
   ScopeLock& operator=(const ScopeLock& no_assign);
 
-  pthread_mutex_t* mutex_;
+  pthread_mutex_t* raw_mutex_;
+  Mutex* mutex_;
 };
 
 }  // namespace enquery
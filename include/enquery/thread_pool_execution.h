@@ -16,7 +16,9 @@
 #ifndef INCLUDE_ENQUERY_THREAD_POOL_EXECUTION_H_
 #define INCLUDE_ENQUERY_THREAD_POOL_EXECUTION_H_
 
+#include <stdint.h>
 #include "enquery/execution.h"
+#include "enquery/histogram.h"
 #include "enquery/shared.h"
 #include "enquery/status.h"
 #include "enquery/task.h"
@@ -44,6 +46,65 @@ class ThreadPoolExecution : public Execution {
     int thread_count_;
   };
 
+  // A point-in-time snapshot of pool activity, as returned by
+  // GetStatistics(). Times are in nanoseconds.
+  class Statistics {
+   public:
+    Statistics() : submitted_(0), completed_(0), rejected_(0), queued_(0) {}
+
+    // Set the number of tasks accepted by Execute().
+    Statistics& set_submitted(uint64_t submitted) {
+      submitted_ = submitted;
+      return *this;
+    }
+
+    // Get the number of tasks accepted by Execute().
+    uint64_t submitted() const { return submitted_; }
+
+    // Set the number of tasks that have finished running.
+    Statistics& set_completed(uint64_t completed) {
+      completed_ = completed;
+      return *this;
+    }
+
+    // Get the number of tasks that have finished running.
+    uint64_t completed() const { return completed_; }
+
+    // Set the number of tasks refused by Execute().
+    Statistics& set_rejected(uint64_t rejected) {
+      rejected_ = rejected;
+      return *this;
+    }
+
+    // Get the number of tasks refused by Execute().
+    uint64_t rejected() const { return rejected_; }
+
+    // Set the number of tasks waiting for a thread.
+    Statistics& set_queued(uint64_t queued) {
+      queued_ = queued;
+      return *this;
+    }
+
+    // Get the number of tasks waiting for a thread.
+    uint64_t queued() const { return queued_; }
+
+    // Distribution of time tasks spent queued before a thread took them.
+    Histogram& queue_wait() { return queue_wait_; }
+    const Histogram& queue_wait() const { return queue_wait_; }
+
+    // Distribution of time spent in Task::Run().
+    Histogram& run_time() { return run_time_; }
+    const Histogram& run_time() const { return run_time_; }
+
+   private:
+    uint64_t submitted_;
+    uint64_t completed_;
+    uint64_t rejected_;
+    uint64_t queued_;
+    Histogram queue_wait_;
+    Histogram run_time_;
+  };
+
   virtual ~ThreadPoolExecution();
 
   // Create a thread pool with the specified settings.
@@ -70,6 +131,13 @@ class ThreadPoolExecution : public Execution {
   // than one time, although subsequent invocations have no effect.
   void Shutdown();
 
+  // Populate 'stats' with a snapshot of the pool's counters and timing
+  // distributions. Each worker thread records into its own shard, so
+  // collecting statistics adds no contention to running tasks; a
+  // snapshot taken while tasks are running may be slightly inconsistent
+  // (e.g. completed may trail the histogram counts by a task or two.)
+  void GetStatistics(Statistics* stats) const;
+
  private:
   ThreadPoolExecution(const ThreadPoolExecution& no_copy);
   ThreadPoolExecution& operator=(const ThreadPoolExecution& no_assign);
@@ -0,0 +1,64 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef INCLUDE_ENQUERY_TIMER_QUEUE_H_
+#define INCLUDE_ENQUERY_TIMER_QUEUE_H_
+
+#include <stdint.h>
+#include "enquery/status.h"
+
+namespace enquery {
+
+class Callback;
+
+// TimerQueue runs callbacks at given times, on a thread of its own, so
+// that work can be delayed without holding up the thread that asks for
+// it. Callbacks run one at a time, in deadline order, and should be
+// brief: a slow callback delays the ones after it.
+class TimerQueue {
+ public:
+  // Identifies a scheduled callback. Never zero.
+  typedef uint64_t TimerId;
+
+  // Stop the thread. Callbacks that haven't run are deleted unrun.
+  ~TimerQueue();
+
+  // Create a timer queue and start its thread. Returns NULL in the event
+  // of an error and populates the caller's (optional) Status variable
+  // with error information.
+  static TimerQueue* Create(Status* status);
+
+  // Run 'callback' once 'delay_nanos' have passed, and then delete it.
+  // Returns an id with which to cancel it. May be called from any
+  // thread, including from a callback.
+  TimerId Schedule(uint64_t delay_nanos, Callback* callback);
+
+  // Delete the callback scheduled as 'id' without running it. Return
+  // false if it has already run (or is running.)
+  bool Cancel(TimerId id);
+
+ private:
+  TimerQueue(const TimerQueue& no_copy);
+  TimerQueue& operator=(const TimerQueue& no_assign);
+
+  class Rep;
+  explicit TimerQueue(Rep* rep);
+
+  Rep* rep_;
+};
+
+}  // namespace enquery
+
+#endif  // INCLUDE_ENQUERY_TIMER_QUEUE_H_
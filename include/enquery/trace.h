@@ -0,0 +1,121 @@
+// Copyright 2015 The Enquery Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef INCLUDE_ENQUERY_TRACE_H_
+#define INCLUDE_ENQUERY_TRACE_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include "enquery/status.h"
+
+namespace enquery {
+
+// Tracer records a timeline of events (task execution, future hand-offs,
+// HTTP request phases) that can be written out in the Chrome trace event
+// format and loaded into chrome://tracing or Perfetto.
+//
+// Tracing is off by default. While off, each instrumentation point costs
+// a single, well-predicted branch on a global flag. While on, events are
+// written to a ring buffer owned by the recording thread, so recording
+// takes no locks; when a ring is full the oldest events are overwritten.
+//
+// Event names and categories are stored by pointer and must be string
+// literals (or otherwise outlive the tracer.)
+class Tracer {
+ public:
+  // Event phases, as defined by the trace event format.
+  typedef enum Phase {
+    BEGIN = 'B',
+    END = 'E',
+    INSTANT = 'i',
+    FLOW_START = 's',
+    FLOW_END = 'f'
+  } Phase;
+
+  // Start recording. Threads that record for the first time get a ring
+  // of 'events_per_thread' events (rounded up to a power of two.)
+  static void Enable(size_t events_per_thread);
+
+  // Stop recording. Events recorded so far are kept.
+  static void Disable();
+
+  // Return true iff events are being recorded.
+  static bool IsEnabled() {
+    return __builtin_expect(__atomic_load_n(&enabled_, __ATOMIC_RELAXED), 0);
+  }
+
+  // Record an event on the current thread. 'id' ties together the two
+  // ends of a flow (e.g. a task's enqueue and start); pass zero otherwise.
+  static void Record(Phase phase, const char* category, const char* name,
+                     uint64_t id);
+
+  // Record an event of known duration that has already happened, with
+  // times from MonotonicNanos().
+  static void RecordComplete(const char* category, const char* name,
+                             uint64_t start_nanos, uint64_t duration_nanos);
+
+  // Discard all recorded events.
+  static void Clear();
+
+  // Write recorded events, in trace event JSON, to 'out'. May be called
+  // while tracing is enabled; events being overwritten at that moment
+  // are skipped. Of a full ring, the oldest event is always skipped,
+  // since the writer may be overwriting it.
+  static void WriteJson(std::string* out);
+
+  // Write recorded events, in trace event JSON, to the file at 'path'.
+  static Status WriteJsonFile(const char* path);
+
+ private:
+  static bool enabled_;
+};
+
+// Records BEGIN on construction and END on destruction.
+class TraceScope {
+ public:
+  TraceScope(const char* category, const char* name)
+      : category_(category), name_(name), enabled_(Tracer::IsEnabled()) {
+    if (enabled_) {
+      Tracer::Record(Tracer::BEGIN, category_, name_, 0);
+    }
+  }
+
+  ~TraceScope() {
+    if (enabled_) {
+      Tracer::Record(Tracer::END, category_, name_, 0);
+    }
+  }
+
+ private:
+  TraceScope(const TraceScope& no_copy);
+  TraceScope& operator=(const TraceScope& no_assign);
+
+  const char* category_;
+  const char* name_;
+  bool enabled_;
+};
+
+}  // namespace enquery
+
+// Record an event if tracing is enabled.
+#define ENQUERY_TRACE(phase, category, name, id)                        \
+  do {                                                                  \
+    if (::enquery::Tracer::IsEnabled()) {                               \
+      ::enquery::Tracer::Record((phase), (category), (name), (id));     \
+    }                                                                   \
+  } while (0)
+
+#endif  // INCLUDE_ENQUERY_TRACE_H_